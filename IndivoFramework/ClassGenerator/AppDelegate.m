@@ -63,10 +63,12 @@
 			[self addLog:@"Cancelled"];
 		}
 		else {
-			NSString *doneString = [NSString stringWithFormat:@"Done. %d schemas parsed, %d classes generated, %d classes not overwritten",
+			NSString *doneString = [NSString stringWithFormat:@"Done. %d schemas parsed, %d classes generated, %d classes not overwritten in %.3f seconds, %.1f ms of which rendering templates",
 									generator.numSchemasParsed,
 									generator.numClassesGenerated,
-									generator.numClassesNotOverwritten];
+									generator.numClassesNotOverwritten,
+									generator.generationTime,
+									generator.renderingTime * 1000.0];
 			[self addLog:doneString];
 		}
 		if ([sender respondsToSelector:@selector(setEnabled:)]) {
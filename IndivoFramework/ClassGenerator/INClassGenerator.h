@@ -32,6 +32,8 @@ void runOnMainQueue(dispatch_block_t block);
 @property (nonatomic, assign) NSUInteger numSchemasParsed;
 @property (nonatomic, assign) NSUInteger numClassesGenerated;
 @property (nonatomic, assign) NSUInteger numClassesNotOverwritten;
+@property (nonatomic, assign) NSTimeInterval generationTime;					///< Seconds the last run took from the first schema to the last class
+@property (nonatomic, assign) NSTimeInterval renderingTime;						///< Seconds of "generationTime" spent rendering class templates
 
 - (void)runFrom:(NSString *)inputPath into:(NSString *)outDirectory callback:(INCancelErrorBlock)aCallback;
 
@@ -11,6 +11,9 @@
 
 #import "INXSDParser.h"
 #import "INSDMLParser.h"
+#import "INClassTemplate.h"
+#import "INXMLNode.h"
+#import <mach/mach_time.h>
 
 
 NSString *const INClassGeneratorDidProduceLogNotification = @"INClassGeneratorDidProduceLog";
@@ -18,6 +21,35 @@ NSString *const INClassGeneratorLogStringKey = @"INClassGeneratorLogString";
 NSString *const INClassGeneratorBaseClass = @"IndivoDocument";
 
 
+/**
+ *	Converts a mach_absolute_time() difference to seconds
+ */
+static NSTimeInterval secondsFromMachTime(uint64_t machTime)
+{
+	static mach_timebase_info_data_t timebase;
+	if (0 == timebase.denom) {
+		mach_timebase_info(&timebase);
+	}
+	return (NSTimeInterval)machTime * timebase.numer / timebase.denom / 1000000000.0;
+}
+
+
+/**
+ *	Appends the path to "ordered" after all the paths it (indirectly) includes, every path only once
+ */
+static void appendIncludesFirst(NSString *path, NSDictionary *includes, NSMutableSet *visited, NSMutableArray *ordered)
+{
+	if ([visited containsObject:path]) {
+		return;
+	}
+	[visited addObject:path];
+	for (NSString *include in [includes objectForKey:path]) {
+		appendIncludesFirst(include, includes, visited, ordered);
+	}
+	[ordered addObject:path];
+}
+
+
 void runOnMainQueue(dispatch_block_t block)
 {
 	if ([NSThread isMainThread]) {
@@ -29,20 +61,35 @@ void runOnMainQueue(dispatch_block_t block)
 }
 
 
-@interface INClassGenerator ()
+@interface INClassGenerator () {
+	dispatch_group_t emissionGroup;										///< Class files are written on a concurrent queue in this group
+	dispatch_queue_t emissionResultQueue;								///< Serial queue guarding emission counters and messages
+}
 
 @property (nonatomic, copy) NSString *writeToDir;						///< Path to the directory to put the class files into.
 @property (nonatomic, strong) NSMutableDictionary *mapping;				///< Type to class name mapping
 @property (nonatomic, copy) NSString *currentInputPath;					///< Used mainly for logging
 
+@property (nonatomic, strong) NSMutableArray *emissionMessages;			///< One log message per emitted class, in the order the classes were parsed
+
+- (NSDictionary *)parseSchemasAtPaths:(NSArray *)paths includes:(NSDictionary **)includes;
+- (void)emitClass:(NSString *)className
+		 withName:(NSString *)bareName
+	   superclass:(NSString *)superclass
+		  forType:(NSString *)forType
+	   properties:(NSArray *)properties;
 - (short)createClass:(NSString *)className
 			withName:(NSString *)bareName
 		  superclass:(NSString *)superclass
 			 forType:(NSString *)forType
 		  properties:(NSArray *)properties
+		   inputPath:(NSString *)inputPath
+	   renderingTime:(NSTimeInterval *)renderTime
 			   error:(NSError **)error;
 
 - (void)sendLog:(NSString *)aString;
+- (void)sendLog:(NSString *)aString forInputPath:(NSString *)inputPath;
++ (INClassTemplate *)bundledTemplateOfType:(NSString *)extension;
 
 @end
 
@@ -50,8 +97,8 @@ void runOnMainQueue(dispatch_block_t block)
 @implementation INClassGenerator
 
 @synthesize mayOverwriteExisting;
-@synthesize numSchemasParsed, numClassesGenerated, numClassesNotOverwritten;
-@synthesize writeToDir, mapping, currentInputPath;
+@synthesize numSchemasParsed, numClassesGenerated, numClassesNotOverwritten, generationTime, renderingTime;
+@synthesize writeToDir, mapping, currentInputPath, emissionMessages;
 
 
 /**
@@ -112,17 +159,32 @@ void runOnMainQueue(dispatch_block_t block)
 		NSUInteger i = 0;
 		self.numClassesGenerated = 0;
 		self.numClassesNotOverwritten = 0;
+		self.renderingTime = 0.0;
+		self.emissionMessages = [NSMutableArray array];
+		emissionGroup = dispatch_group_create();
+		emissionResultQueue = dispatch_queue_create("org.chip.indivo.classgenerator.emissionqueue", NULL);
+		uint64_t startTime = mach_absolute_time();
+		
+		// parse all XSDs and everything they include, every file exactly once
+		NSDictionary *includes = nil;
+		NSDictionary *schemas = [self parseSchemasAtPaths:xsd includes:&includes];
+		
+		// run the schemas in a stable order, included schemas before those including them
+		NSMutableArray *ordered = [NSMutableArray arrayWithCapacity:[schemas count]];
+		NSMutableSet *visited = [NSMutableSet setWithCapacity:[schemas count]];
+		for (NSString *path in [xsd sortedArrayUsingSelector:@selector(compare:)]) {
+			appendIncludesFirst([path stringByStandardizingPath], includes, visited, ordered);
+		}
 		
-		// loop all XSDs
 		INXSDParser *xsdParser = [INXSDParser newWithDelegate:self];
-		for (NSString *path in xsd) {
-			if (![fm fileExistsAtPath:path]) {
-				NSString *logStr = [NSString stringWithFormat:@"Schema file does not exist at %@", path];
-				[self sendLog:logStr];
+		for (NSString *path in ordered) {
+			INXMLNode *schema = [schemas objectForKey:path];
+			if (!schema) {
+				continue;							// failed to parse, already logged
 			}
 			
-			// ** run the file
-			else if (![xsdParser runFileAtPath:path error:&error]) {
+			// ** run the schema
+			if (![xsdParser runSchema:schema atPath:path error:&error]) {
 				[self sendLog:[error localizedDescription]];
 			}
 			else {
@@ -132,7 +194,7 @@ void runOnMainQueue(dispatch_block_t block)
 		
 		// loop all SDMLs
 		INSDMLParser *sdmlParser = [INSDMLParser newWithDelegate:self];
-		for (NSString *path in sdml) {
+		for (NSString *path in [sdml sortedArrayUsingSelector:@selector(compare:)]) {
 			if (![fm fileExistsAtPath:path]) {
 				NSString *logStr = [NSString stringWithFormat:@"SDML file does not exist at %@", path];
 				[self sendLog:logStr];
@@ -147,8 +209,20 @@ void runOnMainQueue(dispatch_block_t block)
 			}
 		}
 		
+		// wait for all class files to be written, then log in the order the classes were parsed
+		dispatch_group_wait(emissionGroup, DISPATCH_TIME_FOREVER);
+		dispatch_release(emissionGroup);
+		emissionGroup = NULL;
+		dispatch_release(emissionResultQueue);
+		emissionResultQueue = NULL;
+		for (NSString *message in emissionMessages) {
+			[self sendLog:message forInputPath:nil];
+		}
+		self.emissionMessages = nil;
+		
 		// done
 		self.numSchemasParsed = i;
+		self.generationTime = secondsFromMachTime(mach_absolute_time() - startTime);
 		if (aCallback) {
 			runOnMainQueue(^{
 				aCallback(NO, nil);
@@ -158,6 +232,80 @@ void runOnMainQueue(dispatch_block_t block)
 }
 
 
+/**
+ *	Reads and parses the schema files at the given paths and all the files they include. Every file is parsed once, the files of each include level
+ *	are parsed concurrently.
+ *	@param paths The schema files to start with
+ *	@param includes Will hold a dictionary that maps a standardized path to an array of the standardized paths of the files it includes
+ *	@return A dictionary mapping standardized paths to the parsed INXMLNode of the schema, files that failed to parse are missing
+ */
+- (NSDictionary *)parseSchemasAtPaths:(NSArray *)paths includes:(NSDictionary **)includes
+{
+	NSMutableDictionary *schemas = [NSMutableDictionary dictionaryWithCapacity:[paths count]];
+	NSMutableDictionary *includeMap = [NSMutableDictionary dictionaryWithCapacity:[paths count]];
+	NSMutableSet *seen = [NSMutableSet setWithCapacity:[paths count]];
+	NSMutableArray *level = [NSMutableArray arrayWithCapacity:[paths count]];
+	for (NSString *path in paths) {
+		NSString *standardized = [path stringByStandardizingPath];
+		if (![seen containsObject:standardized]) {
+			[seen addObject:standardized];
+			[level addObject:standardized];
+		}
+	}
+	
+	dispatch_queue_t aQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	while ([level count] > 0) {
+		NSUInteger count = [level count];
+		
+		// every file writes the schema or the error to its own slot, so we need no locking
+		__strong id *slots = (__strong id *)calloc(count, sizeof(id));
+		if (!slots) {
+			break;
+		}
+		dispatch_apply(count, aQueue, ^(size_t idx) {
+			@autoreleasepool {
+				NSError *error = nil;
+				INXMLNode *schema = [INXSDParser schemaAtPath:[level objectAtIndex:idx] error:&error];
+				slots[idx] = schema ? schema : (error ? error : [NSNull null]);
+			}
+		});
+		
+		// collect the schemas and find the next level of includes
+		NSMutableArray *nextLevel = [NSMutableArray array];
+		for (NSUInteger idx = 0; idx < count; idx++) {
+			NSString *path = [level objectAtIndex:idx];
+			id result = slots[idx];
+			slots[idx] = nil;
+			
+			if ([result isKindOfClass:[INXMLNode class]]) {
+				[schemas setObject:result forKey:path];
+				NSArray *myIncludes = [INXSDParser includePathsOfSchema:result atPath:path];
+				if ([myIncludes count] > 0) {
+					[includeMap setObject:myIncludes forKey:path];
+					for (NSString *include in myIncludes) {
+						if (![seen containsObject:include]) {
+							[seen addObject:include];
+							[nextLevel addObject:include];
+						}
+					}
+				}
+			}
+			else {
+				NSString *reason = [result isKindOfClass:[NSError class]] ? [result localizedDescription] : @"Failed to parse schema";
+				[self sendLog:[NSString stringWithFormat:@"%@  (%@)", reason, path]];
+			}
+		}
+		free(slots);
+		level = nextLevel;
+	}
+	
+	if (NULL != includes) {
+		*includes = includeMap;
+	}
+	return schemas;
+}
+
+
 
 #pragma mark - Schema Parser Delegate
 /**
@@ -242,19 +390,7 @@ void runOnMainQueue(dispatch_block_t block)
 	
 	// we create the class if it's not yet known
 	if ([className length] > 0 && [type length] > 0 && ![mapping objectForKey:type]) {
-		NSError *error = nil;
-		NSString *message = nil;
-		short status = [self createClass:className withName:name superclass:superclass forType:type properties:properties error:&error];
-		if (status > 1) {
-			message = [NSString stringWithFormat:@"Created class \"%@\" for \"%@\"", className, name];
-		}
-		else if (1 == status) {
-			message = [NSString stringWithFormat:@"Class \"%@\" for \"%@\" already exists", className, name];
-		}
-		else {
-			message = [NSString stringWithFormat:@"Failed to create class \"%@\": %@", name, [error localizedDescription]];
-		}
-		[self sendLog:message];
+		[self emitClass:className withName:name superclass:superclass forType:type properties:properties];
 	}
 }
 
@@ -272,14 +408,87 @@ void runOnMainQueue(dispatch_block_t block)
 
 
 #pragma mark - Class Creation
+/**
+ *	Remembers the class for the type right away, so the schemas parsed next can refer to it, and writes the class files on a concurrent queue.
+ *	The log message for the class is collected in order and sent once all classes have been written.
+ */
+- (void)emitClass:(NSString *)className
+		 withName:(NSString *)bareName
+	   superclass:(NSString *)superclass
+		  forType:(NSString *)forType
+	   properties:(NSArray *)properties
+{
+	if ([className length] > 0) {
+		[mapping setObject:className forKey:forType];
+	}
+	
+	NSString *inputPath = currentInputPath;
+	NSUInteger slot = [emissionMessages count];
+	[emissionMessages addObject:[NSNull null]];
+	
+	dispatch_block_t emit = ^{
+		@autoreleasepool {
+			NSError *error = nil;
+			NSTimeInterval renderTime = 0.0;
+			short status = [self createClass:className withName:bareName superclass:superclass forType:forType properties:properties inputPath:inputPath renderingTime:&renderTime error:&error];
+			NSString *message = nil;
+			if (status > 1) {
+				message = [NSString stringWithFormat:@"Created class \"%@\" for \"%@\"", className, bareName];
+			}
+			else if (1 == status) {
+				message = [NSString stringWithFormat:@"Class \"%@\" for \"%@\" already exists", className, bareName];
+			}
+			else {
+				message = [NSString stringWithFormat:@"Failed to create class \"%@\": %@", bareName, [error localizedDescription]];
+			}
+			if (inputPath) {
+				message = [message stringByAppendingFormat:@"  (%@)", inputPath];
+			}
+			
+			dispatch_block_t record = ^{
+				if (status > 1) {
+					numClassesGenerated++;
+				}
+				else if (1 == status) {
+					numClassesNotOverwritten++;
+				}
+				renderingTime += renderTime;
+				if (emissionMessages) {
+					[emissionMessages replaceObjectAtIndex:slot withObject:message];
+				}
+				else {
+					[self sendLog:message forInputPath:nil];
+				}
+			};
+			if (emissionResultQueue) {
+				dispatch_sync(emissionResultQueue, record);
+			}
+			else {
+				record();
+			}
+		}
+	};
+	
+	// write on a concurrent queue while a run is going on, right away otherwise
+	if (emissionGroup) {
+		dispatch_group_async(emissionGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), emit);
+	}
+	else {
+		emit();
+	}
+}
+
 /**
  *	Creates a class from the given property array. It uses the class file templates and writes to the "writeToDir" path.
+ *	Does not touch any shared state, so any number of classes can be created concurrently.
  */
 - (short)createClass:(NSString *)className
 			withName:(NSString *)bareName
 		  superclass:(NSString *)superclass
 			 forType:(NSString *)forType
 		  properties:(NSArray *)properties
+		   inputPath:(NSString *)inputPath
+	   renderingTime:(NSTimeInterval *)renderTime
 			   error:(NSError **)error
 {
 	NSLog(@"Create \"%@\" with %@, child of %@", className, bareName, superclass);
@@ -291,9 +500,6 @@ void runOnMainQueue(dispatch_block_t block)
 		return 0;
 	}
 	
-	// remember it
-	[mapping setObject:className forKey:forType];
-	
 	// already there?
 	NSString *headerPath = [writeToDir stringByAppendingFormat:@"/%@.h", className];
 	NSString *bodyPath = [writeToDir stringByAppendingFormat:@"/%@.m", className];
@@ -306,7 +512,6 @@ void runOnMainQueue(dispatch_block_t block)
 			bodyPath = nil;
 		}
 		if (!headerPath && !bodyPath) {
-			numClassesNotOverwritten++;
 			return 1;
 		}
 	}
@@ -353,7 +558,7 @@ void runOnMainQueue(dispatch_block_t block)
 						className = [className substringFromIndex:endPos + 1];
 					}
 					else {
-						[self sendLog:[NSString stringWithFormat:@"Error: Cannot interpret class for property: %@", propDict]];
+						[self sendLog:[NSString stringWithFormat:@"Error: Cannot interpret class for property: %@", propDict] forInputPath:inputPath];
 					}
 				}
 				
@@ -366,7 +571,7 @@ void runOnMainQueue(dispatch_block_t block)
 				[synthNames addObject:name];
 			}
 			else {
-				[self sendLog:[NSString stringWithFormat:@"Missing name or class for property: %@", propDict]];
+				[self sendLog:[NSString stringWithFormat:@"Missing name or class for property: %@", propDict] forInputPath:inputPath];
 			}
 			
 			// collect forward class declarations and -mappings
@@ -386,7 +591,7 @@ void runOnMainQueue(dispatch_block_t block)
 	}
 	NSMutableString *templatePath = [NSMutableString new];
 	BOOL start = NO;
-	for (NSString *path in [currentInputPath pathComponents]) {
+	for (NSString *path in [inputPath pathComponents]) {
 		if (start) {
 			[templatePath appendFormat:@"/%@", path];
 		}
@@ -423,12 +628,16 @@ void runOnMainQueue(dispatch_block_t block)
 	
 	// create header
 	if (headerPath) {
+		uint64_t renderStart = mach_absolute_time();
 		NSString *header = [[self class] applyToHeaderTemplate:substitutions];
+		if (renderTime) {
+			*renderTime += secondsFromMachTime(mach_absolute_time() - renderStart);
+		}
 		if (header) {
 			NSURL *headerURL = [NSURL fileURLWithPath:headerPath];
 			
 			if (![header writeToURL:headerURL atomically:YES encoding:NSUTF8StringEncoding error:error]) {
-				[self sendLog:[NSString stringWithFormat:@"ERROR writing to %@: %@", headerPath, [*error localizedDescription]]];
+				[self sendLog:[NSString stringWithFormat:@"ERROR writing to %@: %@", headerPath, [*error localizedDescription]] forInputPath:inputPath];
 				return 0;
 			}
 		}
@@ -436,18 +645,21 @@ void runOnMainQueue(dispatch_block_t block)
 	
 	// create body (i.e. implementation)
 	if (bodyPath) {
+		uint64_t renderStart = mach_absolute_time();
 		NSString *body = [[self class] applyToBodyTemplate:substitutions];
+		if (renderTime) {
+			*renderTime += secondsFromMachTime(mach_absolute_time() - renderStart);
+		}
 		if (body) {
 			NSURL *bodyURL = [NSURL fileURLWithPath:bodyPath];
 			
 			if (![body writeToURL:bodyURL atomically:YES encoding:NSUTF8StringEncoding error:error]) {
-				[self sendLog:[NSString stringWithFormat:@"ERROR writing to %@: %@", bodyPath, [*error localizedDescription]]];
+				[self sendLog:[NSString stringWithFormat:@"ERROR writing to %@: %@", bodyPath, [*error localizedDescription]] forInputPath:inputPath];
 				return 0;
 			}
 		}
 	}
 	
-	numClassesGenerated++;
 	return 2;
 }
 
@@ -477,9 +689,17 @@ void runOnMainQueue(dispatch_block_t block)
 
 #pragma mark - Logging
 - (void)sendLog:(NSString *)aString
+{
+	[self sendLog:aString forInputPath:currentInputPath];
+}
+
+/**
+ *	Posts the log string, appending the input path if one is given
+ */
+- (void)sendLog:(NSString *)aString forInputPath:(NSString *)inputPath
 {
 	runOnMainQueue(^{
-		NSString *errString = currentInputPath ? [aString stringByAppendingFormat:@"  (%@)", currentInputPath] : aString;
+		NSString *errString = inputPath ? [aString stringByAppendingFormat:@"  (%@)", inputPath] : aString;
 		NSDictionary *userInfo = [NSDictionary dictionaryWithObject:errString forKey:INClassGeneratorLogStringKey];
 		[[NSNotificationCenter defaultCenter] postNotificationName:INClassGeneratorDidProduceLogNotification object:nil userInfo:userInfo];
 	});
@@ -488,15 +708,9 @@ void runOnMainQueue(dispatch_block_t block)
 
 
 #pragma mark - Template
-
-
-static NSString *classGeneratorHeaderTemplate = nil;
-static NSString *classGeneratorBodyTemplate = nil;
-
-
 /**
- *	This method applies substitutions found in a dictionary to a template. It currently is very cheaply implemented using RegExes and only recognizes
- *	{% if VAR_NAME %} and {{ VAR_NAME }} and does *not* allow nesting.
+ *	Renders the given substitutions into a template, parsing the template first.
+ *	If you render the same template more than once, use an INClassTemplate instance directly so the template is only parsed once.
  */
 + (NSString *)applySubstitutions:(NSDictionary *)substitutions toTemplate:(NSString *)aTemplate
 {
@@ -507,95 +721,52 @@ static NSString *classGeneratorBodyTemplate = nil;
 		return aTemplate;
 	}
 	
-	NSMutableString *applied = [aTemplate mutableCopy];
-	
-	// replace if-blocks via RegEx - that means NO NESTING
-	NSRegularExpression *ifRegEx = [NSRegularExpression regularExpressionWithPattern:@"((\\{%\\s*if\\s+([^\\}\\s]+)\\s*%\\})(.*?)(\\{%\\s*endif\\s*%\\}))"
-																			 options:NSRegularExpressionCaseInsensitive | NSRegularExpressionDotMatchesLineSeparators
-																			   error:nil];
-	NSArray *ifMatches = [ifRegEx matchesInString:applied options:0 range:NSMakeRange(0, [applied length])];
-	if ([ifMatches count] > 0) {
-		for (NSTextCheckingResult *match in [ifMatches reverseObjectEnumerator]) {
-			NSRange fullRange = [match rangeAtIndex:1];
-			NSRange openRange = [match rangeAtIndex:2];
-			NSRange keyRange = [match rangeAtIndex:3];
-			NSRange closeRange = [match rangeAtIndex:5];
-			
-			NSString *key = [applied substringWithRange:keyRange];
-			NSString *replacement = [substitutions objectForKey:key];
-			if (replacement) {
-				[applied replaceCharactersInRange:closeRange withString:@""];
-				[applied replaceCharactersInRange:openRange withString:@""];
-			}
-			else {
-				[applied replaceCharactersInRange:fullRange withString:@""];
-			}
-		}
+	return [[INClassTemplate templateWithString:aTemplate] renderWithSubstitutions:substitutions];
+}
+
+
+/**
+ *	Returns the compiled template loaded from the bundle resource "GeneratorTemplate" with the given extension, nil if it can't be read
+ */
++ (INClassTemplate *)bundledTemplateOfType:(NSString *)extension
+{
+	NSString *path = [[NSBundle bundleForClass:self] pathForResource:@"GeneratorTemplate" ofType:extension];
+	if (!path) {
+		DLog(@"The %@ template was not found!", extension);
+		return nil;
 	}
 	
-	// replace placeholders via RegEx
-	NSRegularExpression *regex = [NSRegularExpression regularExpressionWithPattern:@"(\\{\\{\\s*([^\\}\\s]+)\\s*\\}\\})"
-																		   options:NSRegularExpressionCaseInsensitive
-																			 error:nil];
-	NSArray *matches = [regex matchesInString:applied options:0 range:NSMakeRange(0, [applied length])];
-	if ([matches count] > 0) {
-		for (NSTextCheckingResult *match in [matches reverseObjectEnumerator]) {
-			NSRange fullRange = [match rangeAtIndex:1];
-			NSRange keyRange = [match rangeAtIndex:2];
-			NSString *key = [applied substringWithRange:keyRange];
-			NSString *replacement = [substitutions objectForKey:key];
-			if (replacement) {
-				[applied replaceCharactersInRange:fullRange withString:replacement];
-			}
-			else {
-				DLog(@"No replacement for %@ found", key);
-			}
-		}
+	NSError *error = nil;
+	NSString *string = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:&error];
+	if (!string) {
+		DLog(@"Error reading the %@ template: %@", extension, [error localizedDescription]);
+		return nil;
 	}
-	return applied;
+	return [INClassTemplate templateWithString:string];
 }
 
 
 + (NSString *)applyToHeaderTemplate:(NSDictionary *)substitutions
 {
-	if (!classGeneratorHeaderTemplate) {
-		NSString *headerPath = [[NSBundle bundleForClass:self] pathForResource:@"GeneratorTemplate" ofType:@"h"];
-		if (!headerPath) {
-			DLog(@"The header template was not found!");
-			return nil;
-		}
-		
-		NSError *error = nil;
-		classGeneratorHeaderTemplate = [NSString stringWithContentsOfFile:headerPath encoding:NSUTF8StringEncoding error:&error];
-		if (!classGeneratorHeaderTemplate) {
-			DLog(@"Error reading the header template: %@", [error localizedDescription]);
-			return nil;
-		}
-	}
+	static INClassTemplate *headerTemplate = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		headerTemplate = [self bundledTemplateOfType:@"h"];
+	});
 	
-	return [self applySubstitutions:substitutions toTemplate:classGeneratorHeaderTemplate];
+	return [headerTemplate renderWithSubstitutions:substitutions];
 }
 
 
 + (NSString *)applyToBodyTemplate:(NSDictionary *)substitutions
 {
-	// load template if needed
-	if (!classGeneratorBodyTemplate) {
-		NSString *bodyPath = [[NSBundle bundleForClass:self] pathForResource:@"GeneratorTemplate" ofType:@"m"];
-		if (!bodyPath) {
-			DLog(@"The body template was not found!");
-			return nil;
-		}
-		
-		NSError *error = nil;
-		classGeneratorBodyTemplate = [NSString stringWithContentsOfFile:bodyPath encoding:NSUTF8StringEncoding error:&error];
-		if (!classGeneratorBodyTemplate) {
-			DLog(@"Error reading the body template: %@", [error localizedDescription]);
-			return nil;
-		}
-	}
+	static INClassTemplate *bodyTemplate = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		bodyTemplate = [self bundledTemplateOfType:@"m"];
+	});
 	
-	return [self applySubstitutions:substitutions toTemplate:classGeneratorBodyTemplate];
+	return [bodyTemplate renderWithSubstitutions:substitutions];
 }
 
 
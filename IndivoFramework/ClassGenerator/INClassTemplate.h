@@ -0,0 +1,23 @@
+//
+//  INClassTemplate.h
+//  IndivoFramework
+//
+//  Copyright (c) 2012 Harvard Medical School. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *	A template that is parsed once into a tree of segments and can then be rendered any number of times.
+ *	Recognizes {{ VAR_NAME }} placeholders and {% if VAR_NAME %} ... {% endif %} blocks, which may be nested. An if-block is rendered if the
+ *	substitutions contain VAR_NAME, placeholders without substitution are left untouched.
+ */
+@interface INClassTemplate : NSObject
+
++ (id)templateWithString:(NSString *)aString;
+- (id)initWithString:(NSString *)aString;
+
+- (NSString *)renderWithSubstitutions:(NSDictionary *)substitutions;
+
+@end
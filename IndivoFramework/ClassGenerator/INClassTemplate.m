@@ -0,0 +1,226 @@
+//
+//  INClassTemplate.m
+//  IndivoFramework
+//
+//  Copyright (c) 2012 Harvard Medical School. All rights reserved.
+//
+
+#import "INClassTemplate.h"
+#import "Indivo.h"
+
+
+typedef enum {
+	INTemplateSegmentLiteral = 0,			///< Text that is copied as is
+	INTemplateSegmentPlaceholder,			///< A {{ KEY }} placeholder
+	INTemplateSegmentCondition				///< An {% if KEY %} block
+} INTemplateSegmentType;
+
+
+/**
+ *	One piece of a compiled template
+ */
+@interface INTemplateSegment : NSObject
+
+@property (nonatomic, assign) INTemplateSegmentType type;
+@property (nonatomic, copy) NSString *text;								///< The literal text or, for placeholders and conditions, the original tag
+@property (nonatomic, copy) NSString *key;								///< The substitution key of placeholders and conditions
+@property (nonatomic, strong) NSMutableArray *children;					///< The segments inside a condition
+
++ (id)segmentOfType:(INTemplateSegmentType)aType text:(NSString *)aText key:(NSString *)aKey;
+
+@end
+
+
+@implementation INTemplateSegment
+
+@synthesize type, text, key, children;
+
+
++ (id)segmentOfType:(INTemplateSegmentType)aType text:(NSString *)aText key:(NSString *)aKey
+{
+	INTemplateSegment *segment = [self new];
+	segment.type = aType;
+	segment.text = aText;
+	segment.key = aKey;
+	if (INTemplateSegmentCondition == aType) {
+		segment.children = [NSMutableArray array];
+	}
+	return segment;
+}
+
+@end
+
+
+
+@interface INClassTemplate ()
+
+@property (nonatomic, copy) NSArray *segments;							///< The top level segments
+@property (nonatomic, assign) NSUInteger literalLength;					///< Total length of all literals, a good guess for the rendered length
+
+- (void)compile:(NSString *)aString;
+- (void)render:(NSArray *)someSegments withSubstitutions:(NSDictionary *)substitutions into:(NSMutableString *)rendered;
+
+@end
+
+
+@implementation INClassTemplate
+
+@synthesize segments, literalLength;
+
+
++ (id)templateWithString:(NSString *)aString
+{
+	return [[self alloc] initWithString:aString];
+}
+
+- (id)initWithString:(NSString *)aString
+{
+	if ((self = [super init])) {
+		[self compile:aString];
+	}
+	return self;
+}
+
+
+
+#pragma mark - Compiling
+/**
+ *	Splits the template into literals, placeholders and conditions in one pass.
+ *	Tags that don't look like ours are treated as literal text, an unbalanced endif is left in place and an if without endif is kept as literal
+ *	text followed by its content.
+ */
+- (void)compile:(NSString *)aString
+{
+	NSMutableArray *root = [NSMutableArray array];
+	NSMutableArray *open = [NSMutableArray array];						// the condition segments we are currently in
+	NSMutableArray *current = root;
+	NSCharacterSet *ws = [NSCharacterSet whitespaceAndNewlineCharacterSet];
+	NSUInteger length = [aString length];
+	NSUInteger pos = 0;
+	NSUInteger literals = 0;
+	
+	while (pos < length) {
+		NSRange searchRange = NSMakeRange(pos, length - pos);
+		NSRange openRange = [aString rangeOfString:@"{" options:NSLiteralSearch range:searchRange];
+		
+		// find the next tag opener
+		NSString *closer = nil;
+		while (NSNotFound != openRange.location && openRange.location + 1 < length) {
+			unichar next = [aString characterAtIndex:openRange.location + 1];
+			if ('{' == next) {
+				closer = @"}}";
+				break;
+			}
+			if ('%' == next) {
+				closer = @"%}";
+				break;
+			}
+			NSUInteger from = openRange.location + 1;
+			openRange = [aString rangeOfString:@"{" options:NSLiteralSearch range:NSMakeRange(from, length - from)];
+		}
+		NSRange closeRange = NSMakeRange(NSNotFound, 0);
+		if (closer) {
+			NSUInteger from = openRange.location + 2;
+			closeRange = [aString rangeOfString:closer options:NSLiteralSearch range:NSMakeRange(from, length - from)];
+		}
+		
+		// no more tags, the rest is literal
+		if (NSNotFound == closeRange.location) {
+			NSString *rest = [aString substringFromIndex:pos];
+			[current addObject:[INTemplateSegment segmentOfType:INTemplateSegmentLiteral text:rest key:nil]];
+			literals += [rest length];
+			break;
+		}
+		
+		// literal up to the tag
+		if (openRange.location > pos) {
+			NSString *literal = [aString substringWithRange:NSMakeRange(pos, openRange.location - pos)];
+			[current addObject:[INTemplateSegment segmentOfType:INTemplateSegmentLiteral text:literal key:nil]];
+			literals += [literal length];
+		}
+		
+		// interpret the tag
+		NSRange tagRange = NSMakeRange(openRange.location, NSMaxRange(closeRange) - openRange.location);
+		NSString *tag = [aString substringWithRange:tagRange];
+		NSString *inner = [[tag substringWithRange:NSMakeRange(2, [tag length] - 4)] stringByTrimmingCharactersInSet:ws];
+		NSArray *words = [[inner componentsSeparatedByCharactersInSet:ws] filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"length > 0"]];
+		INTemplateSegment *segment = nil;
+		
+		if ([@"}}" isEqualToString:closer] && 1 == [words count]) {
+			segment = [INTemplateSegment segmentOfType:INTemplateSegmentPlaceholder text:tag key:inner];
+		}
+		else if ([@"%}" isEqualToString:closer] && 2 == [words count] && NSOrderedSame == [@"if" caseInsensitiveCompare:[words objectAtIndex:0]]) {
+			segment = [INTemplateSegment segmentOfType:INTemplateSegmentCondition text:tag key:[words objectAtIndex:1]];
+		}
+		else if ([@"%}" isEqualToString:closer] && 1 == [words count] && NSOrderedSame == [@"endif" caseInsensitiveCompare:inner] && [open count] > 0) {
+			[open removeLastObject];
+			current = ([open count] > 0) ? [[open lastObject] children] : root;
+		}
+		else {
+			segment = [INTemplateSegment segmentOfType:INTemplateSegmentLiteral text:tag key:nil];
+			literals += [tag length];
+		}
+		
+		if (segment) {
+			[current addObject:segment];
+			if (INTemplateSegmentCondition == segment.type) {
+				[open addObject:segment];
+				current = segment.children;
+			}
+		}
+		pos = NSMaxRange(tagRange);
+	}
+	
+	// unterminated conditions turn into literals followed by their content
+	while ([open count] > 0) {
+		INTemplateSegment *unterminated = [open lastObject];
+		[open removeLastObject];
+		NSMutableArray *parent = ([open count] > 0) ? [[open lastObject] children] : root;
+		NSUInteger idx = [parent indexOfObjectIdenticalTo:unterminated];
+		[parent replaceObjectsInRange:NSMakeRange(idx, 1) withObjectsFromArray:unterminated.children];
+		[parent insertObject:[INTemplateSegment segmentOfType:INTemplateSegmentLiteral text:unterminated.text key:nil] atIndex:idx];
+		DLog(@"Template condition \"%@\" is never closed", unterminated.text);
+	}
+	
+	self.segments = root;
+	self.literalLength = literals;
+}
+
+
+
+#pragma mark - Rendering
+/**
+ *	Renders the template in a single append pass.
+ *	The compiled template is never modified, so the same instance can render on multiple threads at the same time.
+ */
+- (NSString *)renderWithSubstitutions:(NSDictionary *)substitutions
+{
+	NSMutableString *rendered = [NSMutableString stringWithCapacity:literalLength * 2];
+	[self render:segments withSubstitutions:substitutions into:rendered];
+	return rendered;
+}
+
+- (void)render:(NSArray *)someSegments withSubstitutions:(NSDictionary *)substitutions into:(NSMutableString *)rendered
+{
+	for (INTemplateSegment *segment in someSegments) {
+		if (INTemplateSegmentLiteral == segment.type) {
+			[rendered appendString:segment.text];
+		}
+		else if (INTemplateSegmentPlaceholder == segment.type) {
+			NSString *replacement = [substitutions objectForKey:segment.key];
+			if (replacement) {
+				[rendered appendString:replacement];
+			}
+			else {
+				DLog(@"No replacement for %@ found", segment.key);
+				[rendered appendString:segment.text];
+			}
+		}
+		else if ([substitutions objectForKey:segment.key]) {
+			[self render:segment.children withSubstitutions:substitutions into:rendered];
+		}
+	}
+}
+
+
+@end
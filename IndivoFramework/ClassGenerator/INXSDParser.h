@@ -8,11 +8,17 @@
 
 #import "INSchemaParser.h"
 
+@class INXMLNode;
+
 
 /**
  *	This class parses XSD files and tries to create Obj-C classes for the types it encounters
  */
 @interface INXSDParser : INSchemaParser
 
++ (INXMLNode *)schemaAtPath:(NSString *)path error:(NSError **)error;
++ (NSArray *)includePathsOfSchema:(INXMLNode *)schema atPath:(NSString *)path;
+
+- (BOOL)runSchema:(INXMLNode *)schema atPath:(NSString *)path error:(NSError **)error;
 
 @end
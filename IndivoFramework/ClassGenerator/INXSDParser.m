@@ -13,6 +13,7 @@
 @interface INXSDParser ()
 
 @property (nonatomic, strong) NSMutableArray *typeStack;				///< Every time we encounter a type definition, its name is pushed here so we always know where we are.
+@property (nonatomic, strong) NSMutableSet *processedPaths;				///< Standardized paths of the files we have already run
 
 - (NSDictionary *)processType:(INXMLNode *)type;
 - (NSDictionary *)processElement:(INXMLNode *)element;
@@ -23,53 +24,98 @@
 
 @implementation INXSDParser
 
-@synthesize typeStack;
+@synthesize typeStack, processedPaths;
 
 
 /**
- *	Runs the given file
+ *	Reads and parses the schema file at the given path
  */
-- (BOOL)runFileAtPath:(NSString *)path error:(NSError **)error
++ (INXMLNode *)schemaAtPath:(NSString *)path error:(NSError **)error
 {
 	if (!path) {
-		return NO;
+		return nil;
 	}
-	[self.delegate schemaParser:self isProcessingFileAtPath:path];
 	
 	// get XML
 	NSString *xml = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:error];
 	if (!xml) {
-		return NO;
+		return nil;
 	}
 	
 	// parse XML
-	INXMLNode *schema = [INXMLParser parseXML:xml error:error];
-	if (!schema) {
+	return [INXMLParser parseXML:xml error:error];
+}
+
+/**
+ *	Returns the standardized paths of all existing files the schema includes, in the order they are included
+ */
++ (NSArray *)includePathsOfSchema:(INXMLNode *)schema atPath:(NSString *)path
+{
+	NSArray *includes = [schema childrenNamed:@"include"];
+	if ([includes count] < 1) {
+		return nil;
+	}
+	
+	NSString *baseDir = [path stringByDeletingLastPathComponent];
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSMutableArray *paths = [NSMutableArray arrayWithCapacity:[includes count]];
+	for (INXMLNode *include in includes) {
+		NSString *includePath = [[baseDir stringByAppendingPathComponent:[include attr:@"schemaLocation"]] stringByStandardizingPath];
+		if ([fm fileExistsAtPath:includePath]) {
+			[paths addObject:includePath];
+		}
+	}
+	return paths;
+}
+
+
+/**
+ *	Runs the given file, running its includes first. Every file is only run once per parser, no matter how often it is included.
+ */
+- (BOOL)runFileAtPath:(NSString *)path error:(NSError **)error
+{
+	if (!path) {
 		return NO;
 	}
+	path = [path stringByStandardizingPath];
+	if ([processedPaths containsObject:path]) {
+		return YES;
+	}
+	if (!processedPaths) {
+		self.processedPaths = [NSMutableSet set];
+	}
+	[processedPaths addObject:path];
+	[self.delegate schemaParser:self isProcessingFileAtPath:path];
 	
-	if (!typeStack) {
-		self.typeStack = [NSMutableArray array];
+	INXMLNode *schema = [[self class] schemaAtPath:path error:error];
+	if (!schema) {
+		return NO;
 	}
 	
 	// process includes first
-	NSArray *includes = [schema childrenNamed:@"include"];
-	if ([includes count] > 0) {
-		NSString *baseDir = [path stringByDeletingLastPathComponent];
-		NSFileManager *fm = [NSFileManager defaultManager];
-		
-		for (INXMLNode *include in includes) {
-			NSString *includePath = [baseDir stringByAppendingPathComponent:[include attr:@"schemaLocation"]];
-			
-			// run include first
-			if ([fm fileExistsAtPath:includePath]) {
-				[self.delegate schemaParser:self isProcessingFileAtPath:includePath];
-				if (![self runFileAtPath:includePath error:error]) {
-					return NO;
-				}
-			}
+	NSArray *includes = [[self class] includePathsOfSchema:schema atPath:path];
+	for (NSString *includePath in includes) {
+		if (![self runFileAtPath:includePath error:error]) {
+			return NO;
 		}
-		[self.delegate schemaParser:self isProcessingFileAtPath:path];
+	}
+	
+	return [self runSchema:schema atPath:path error:error];
+}
+
+/**
+ *	Processes the types and elements of an already parsed schema. Does NOT process includes, those must have been run before.
+ */
+- (BOOL)runSchema:(INXMLNode *)schema atPath:(NSString *)path error:(NSError **)error
+{
+	if (!schema) {
+		ERR(error, @"No schema given", 0)
+		return NO;
+	}
+	[self.delegate schemaParser:self isProcessingFileAtPath:path];
+	
+	if (!typeStack) {
+		self.typeStack = [NSMutableArray array];
 	}
 	
 	// process root nodes
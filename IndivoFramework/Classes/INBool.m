@@ -21,6 +21,7 @@
  */
 
 #import "INBool.h"
+#import "INXMLWriter.h"
 
 @implementation INBool
 
@@ -59,9 +60,9 @@
 	return @"xs:boolean";
 }
 
-- (NSString *)xml
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
-	return [NSString stringWithFormat:@"<%@>%@</%@>", self.nodeName, (self.flag ? @"true" : @"false"), self.nodeName];
+	[writer appendElement:self.nodeName content:(self.flag ? @"true" : @"false")];
 }
 
 - (NSString *)attributeValue
@@ -77,13 +78,7 @@
 
 - (void)setFromFlatParent:(INXMLNode *)parent prefix:(NSString *)prefix
 {
-	INXMLNode *myNode = nil;
-	for (INXMLNode *child in [parent children]) {
-		if ([prefix isEqualToString:[child attr:@"name"]]) {
-			myNode = child;
-			break;
-		}
-	}
+	INXMLNode *myNode = [parent childWithNameAttribute:prefix];
 	
 	if (myNode) {
 		self.flag = [@"True" isEqualToString:myNode.text] || [@"true" isEqualToString:myNode.text];
@@ -21,11 +21,10 @@
  */
 
 #import "INDate.h"
+#import "INISO8601.h"
 
 @implementation INDate
 
-static NSDateFormatter *isoDateFormatter = nil;
-
 @synthesize date;
 
 
@@ -52,12 +51,7 @@ static NSDateFormatter *isoDateFormatter = nil;
  */
 + (id)dateFromISOString:(NSString *)dateString
 {
-	if (!isoDateFormatter) {
-		isoDateFormatter = [NSDateFormatter new];
-		[isoDateFormatter setDateFormat:@"yyyy-MM-dd"];
-	}
-	
-	return [self dateWithDate:[isoDateFormatter dateFromString:dateString]];
+	return [self dateWithDate:[self parseDateFromISOString:dateString]];
 }
 
 
@@ -101,13 +95,7 @@ static NSDateFormatter *isoDateFormatter = nil;
 
 - (void)setFromFlatParent:(INXMLNode *)parent prefix:(NSString *)prefix
 {
-	INXMLNode *myNode = nil;
-	for (INXMLNode *child in [parent children]) {
-		if ([prefix isEqualToString:[child attr:@"name"]]) {
-			myNode = child;
-			break;
-		}
-	}
+	INXMLNode *myNode = [parent childWithNameAttribute:prefix];
 	
 	if (myNode) {
 		self.date = [[self class] parseDateFromISOString:myNode.text];
@@ -122,28 +110,23 @@ static NSDateFormatter *isoDateFormatter = nil;
 	return [[self class] isoStringFrom:self.date];
 }
 
+/**
+ *	Returns the date as "YYYY-MM-DD" in the local time zone. Thread-safe.
+ */
 + (NSString *)isoStringFrom:(NSDate *)aDate
 {
 	if (!aDate) {
 		return @"0000-00-00";
 	}
-	
-	if (!isoDateFormatter) {
-		isoDateFormatter = [NSDateFormatter new];
-		[isoDateFormatter setDateFormat:@"yyyy-MM-dd"];
-	}
-	
-	return [isoDateFormatter stringFromDate:aDate];
+	return INISO8601StringFromDate(aDate, NO);
 }
 
+/**
+ *	Parses "YYYY-MM-DD" into a date at midnight in the local time zone, unless the string specifies a time zone. Thread-safe.
+ */
 + (NSDate *)parseDateFromISOString:(NSString *)dateString
 {
-	if (!isoDateFormatter) {
-		isoDateFormatter = [NSDateFormatter new];
-		[isoDateFormatter setDateFormat:@"yyyy-MM-dd"];
-	}
-	
-	return [isoDateFormatter dateFromString:dateString];
+	return INDateFromISO8601String(dateString, YES);
 }
 
 
@@ -21,6 +21,7 @@
  */
 
 #import "INDateTime.h"
+#import "INISO8601.h"
 
 @implementation INDateTime
 
@@ -33,38 +34,24 @@
 
 
 #pragma mark - Date Formatting
-static NSDateFormatter *isoDateFormatter = nil;
-
+/**
+ *	Returns the date as "YYYY-MM-DDThh:mm:ssZ" in UTC. Thread-safe.
+ */
 + (NSString *)isoStringFrom:(NSDate *)aDate
 {
 	if (!aDate) {
 		return @"0000-00-00T00:00:00Z";
 	}
-	
-	if (!isoDateFormatter) {
-		isoDateFormatter = [NSDateFormatter new];
-		[isoDateFormatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss'Z'"];
-	}
-	
-	NSString *formatted = [isoDateFormatter stringFromDate:aDate];
-	if (formatted) {
-		return formatted;
-	}
-	return [super isoStringFrom:aDate];
+	return INISO8601StringFromDate(aDate, YES);
 }
 
+/**
+ *	Parses xs:dateTime strings, with or without fractional seconds and time zone offset; strings without time zone are taken as UTC. Plain dates
+ *	are accepted as well and represent midnight UTC. Thread-safe.
+ */
 + (NSDate *)parseDateFromISOString:(NSString *)dateString
 {
-	if (!isoDateFormatter) {
-		isoDateFormatter = [NSDateFormatter new];
-		[isoDateFormatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss'Z'"];
-	}
-	
-	NSDate *parsed = [isoDateFormatter dateFromString:dateString];
-	if (parsed) {
-		return parsed;
-	}
-	return [super parseDateFromISOString:dateString];
+	return INDateFromISO8601String(dateString, NO);
 }
 
 
@@ -0,0 +1,77 @@
+/*
+ INDocumentCache.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *	How the memory tier picks the object to evict when it's over budget
+ */
+typedef enum {
+	INDocumentCacheEvictLeastRecentlyUsed = 0,				///< Evict the object that was used longest ago
+	INDocumentCacheEvictLeastFrequentlyUsed					///< Evict the object with the fewest hits, the least recently used one among equals
+} INDocumentCacheEvictionPolicy;
+
+
+/**
+ *	A two-tier cache for objects belonging to documents, e.g. a medication's pill image.
+ *	
+ *	Objects are identified by a type and a document id. Objects are kept in memory within a count and a byte budget, which can also be set per type,
+ *	the cost of an object is supplied when storing it or estimated. Objects conforming to NSCoding are also written to disk in the background so they
+ *	survive app restarts. Objects can be stored together with the digest of the document they belong to, if a different digest is given when
+ *	retrieving the object, the document has changed and the cached object is discarded.
+ *	The memory tier is purged when the app receives a memory warning. All methods are thread-safe and none of them blocks on disk I/O;
+ *	lookups in memory only take a shared lock, so concurrent readers never wait for each other, while stores and evictions are exclusive.
+ */
+@interface INDocumentCache : NSObject
+
+@property (nonatomic, readonly, copy) NSString *directory;					///< The directory where we store our files
+@property (nonatomic, assign) NSUInteger memoryCountLimit;					///< How many objects to keep in memory, 100 by default
+@property (nonatomic, assign) NSUInteger memoryByteLimit;					///< How many bytes the objects in memory may cost, 10 MB by default
+@property (nonatomic, assign) unsigned long long diskByteLimit;				///< How many bytes our files may use, 20 MB by default
+@property (nonatomic, assign) INDocumentCacheEvictionPolicy evictionPolicy;	///< How to pick objects to evict from memory, LRU by default
+
+@property (nonatomic, readonly, assign) NSUInteger memoryCount;				///< The number of objects in memory
+@property (nonatomic, readonly, assign) NSUInteger memoryBytes;				///< The total cost of the objects in memory
+@property (nonatomic, readonly, assign) NSUInteger memoryHits;				///< Lookups answered from memory
+@property (nonatomic, readonly, assign) NSUInteger diskHits;				///< Lookups answered from disk
+@property (nonatomic, readonly, assign) NSUInteger misses;					///< Lookups that found nothing
+@property (nonatomic, readonly, assign) NSUInteger evictions;				///< Objects evicted from memory to stay within budget
+
++ (INDocumentCache *)sharedCache;
+- (id)initWithDirectory:(NSString *)aDirectory;
+
+- (void)setCountLimit:(NSUInteger)countLimit byteLimit:(NSUInteger)byteLimit forType:(NSString *)aType;
++ (NSUInteger)estimatedCostOfObject:(id)anObject;
+
+- (BOOL)storeObject:(id)anObject type:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest error:(NSError * __autoreleasing *)error;
+- (BOOL)storeObject:(id)anObject type:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest cost:(NSUInteger)cost error:(NSError * __autoreleasing *)error;
+- (id)objectOfType:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest;
+- (void)loadObjectOfType:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest callback:(void (^)(id cachedObject))callback;
+- (void)removeObjectOfType:(NSString *)aType forId:(NSString *)anId;
+- (void)removeAllObjects;
+
+- (void)purgeMemory;
+- (void)purgeDisk;
+- (void)resetStatistics;
+
+
+@end
@@ -0,0 +1,745 @@
+/*
+ INDocumentCache.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import "INDocumentCache.h"
+#import "Indivo.h"
+#import <UIKit/UIKit.h>
+#import <objc/runtime.h>
+#import <libkern/OSAtomic.h>
+#import <pthread.h>
+
+#define kINDocumentCacheDefaultMemoryCountLimit 100
+#define kINDocumentCacheDefaultMemoryByteLimit (10 * 1024 * 1024)
+#define kINDocumentCacheDefaultDiskByteLimit (20 * 1024 * 1024)
+#define kINDocumentCacheObjectKey @"object"
+#define kINDocumentCacheDigestKey @"digest"
+
+
+/**
+ *	An object in the memory tier
+ */
+@interface INDocumentCacheEntry : NSObject {
+@public
+	volatile int64_t hitCount;												///< Incremented atomically by concurrent readers
+	volatile int64_t lastAccess;											///< Value of the cache's access clock at the last hit
+}
+
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, copy) NSString *type;
+@property (nonatomic, strong) id object;
+@property (nonatomic, copy) NSString *digest;
+@property (nonatomic, assign) NSUInteger cost;
+
+@end
+
+@implementation INDocumentCacheEntry
+
+@synthesize key, type, object, digest, cost;
+
+@end
+
+
+/**
+ *	Budget and usage of one type in the memory tier
+ */
+@interface INDocumentCacheBudget : NSObject
+
+@property (nonatomic, assign) NSUInteger countLimit;						///< 0 means no type-specific limit
+@property (nonatomic, assign) NSUInteger byteLimit;							///< 0 means no type-specific limit
+@property (nonatomic, assign) NSUInteger count;
+@property (nonatomic, assign) NSUInteger bytes;
+
+@end
+
+@implementation INDocumentCacheBudget
+
+@synthesize countLimit, byteLimit, count, bytes;
+
+@end
+
+
+@interface INDocumentCache () {
+	pthread_rwlock_t memoryLock;											///< Readers share the memory tier, writers get it exclusively
+	dispatch_queue_t diskQueue;
+	volatile int64_t accessClock;
+	volatile int64_t memoryHitCount;
+	int64_t removalClock;													///< Incremented by every removal and purge, guarded by memoryLock
+	int64_t lastPurge;														///< Value of removalClock at the last purge
+}
+
+@property (nonatomic, readwrite, copy) NSString *directory;
+@property (nonatomic, strong) NSMutableDictionary *entries;						///< INDocumentCacheEntry instances by key
+@property (nonatomic, strong) NSMutableDictionary *budgets;						///< INDocumentCacheBudget instances by type
+@property (nonatomic, strong) NSMutableDictionary *removals;					///< Value of removalClock when the key was last removed, by key
+@property (nonatomic, readwrite, assign) NSUInteger diskHits;
+@property (nonatomic, readwrite, assign) NSUInteger misses;
+@property (nonatomic, readwrite, assign) NSUInteger evictions;
+@property (nonatomic, assign) NSUInteger totalBytes;							///< Backs "memoryBytes"
+@property (nonatomic, assign) long long diskBytes;								///< How many bytes our files use, -1 until we have looked
+
+- (NSString *)keyForType:(NSString *)aType id:(NSString *)anId;
+- (NSString *)pathForType:(NSString *)aType id:(NSString *)anId;
+- (INDocumentCacheBudget *)budgetForType:(NSString *)aType;
+- (id)memoryObjectForKey:(NSString *)aKey digest:(NSString *)aDigest;
+- (void)memorizeObject:(id)anObject type:(NSString *)aType digest:(NSString *)aDigest cost:(NSUInteger)cost forKey:(NSString *)aKey;
+- (void)evictFromType:(NSString *)aType sparing:(NSString *)aKey;
+- (void)forgetObjectForKey:(NSString *)aKey;
+- (BOOL)wasRemovedKey:(NSString *)aKey since:(int64_t)aClock;
+- (void)didReceiveMemoryWarning:(NSNotification *)notification;
+- (id)diskObjectAtPath:(NSString *)aPath digest:(NSString *)aDigest storedDigest:(NSString * __autoreleasing *)storedDigest;
+- (void)writeData:(NSData *)data toPath:(NSString *)aPath;
+- (void)removeFileAtPath:(NSString *)aPath;
+- (void)trimDisk;
+
+@end
+
+
+@implementation INDocumentCache
+
+@synthesize directory, memoryCountLimit, memoryByteLimit, diskByteLimit, evictionPolicy;
+@synthesize diskHits, misses, evictions;
+@synthesize entries, budgets, removals, totalBytes, diskBytes;
+
+
+/**
+ *	The cache used by IndivoDocument, storing its files in the app's caches directory
+ */
++ (INDocumentCache *)sharedCache
+{
+	static INDocumentCache *sharedCache = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		NSString *caches = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+		sharedCache = [[self alloc] initWithDirectory:[caches stringByAppendingPathComponent:@"IndivoDocumentCache"]];
+	});
+	return sharedCache;
+}
+
+/**
+ *	The designated initializer
+ *	@param aDirectory The directory to store files in, will be created if necessary
+ */
+- (id)initWithDirectory:(NSString *)aDirectory
+{
+	if ((self = [super init])) {
+		self.directory = aDirectory;
+		self.memoryCountLimit = kINDocumentCacheDefaultMemoryCountLimit;
+		self.memoryByteLimit = kINDocumentCacheDefaultMemoryByteLimit;
+		self.diskByteLimit = kINDocumentCacheDefaultDiskByteLimit;
+		self.entries = [NSMutableDictionary dictionary];
+		self.budgets = [NSMutableDictionary dictionary];
+		self.removals = [NSMutableDictionary dictionary];
+		self.diskBytes = -1;
+		
+		pthread_rwlock_init(&memoryLock, NULL);
+		diskQueue = dispatch_queue_create("org.chip.indivo.framework.cachediskqueue", NULL);
+		
+		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didReceiveMemoryWarning:) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	}
+	return self;
+}
+
+- (id)init
+{
+	NSString *caches = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+	return [self initWithDirectory:[caches stringByAppendingPathComponent:@"IndivoDocumentCache"]];
+}
+
+- (void)dealloc
+{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	pthread_rwlock_destroy(&memoryLock);
+	dispatch_release(diskQueue);
+}
+
+
+
+#pragma mark - Budgets
+/**
+ *	Limits the memory used by objects of the given type, on top of the overall limits.
+ *	@param countLimit How many objects of this type to keep in memory, 0 for no type-specific limit
+ *	@param byteLimit How many bytes objects of this type may cost, 0 for no type-specific limit
+ */
+- (void)setCountLimit:(NSUInteger)countLimit byteLimit:(NSUInteger)byteLimit forType:(NSString *)aType
+{
+	pthread_rwlock_wrlock(&memoryLock);
+	INDocumentCacheBudget *budget = [self budgetForType:aType];
+	budget.countLimit = countLimit;
+	budget.byteLimit = byteLimit;
+	[self evictFromType:(aType ? aType : @"generic") sparing:nil];
+	pthread_rwlock_unlock(&memoryLock);
+}
+
+/**
+ *	A rough guess at how many bytes an object occupies. Images are counted by their bitmap size, data and strings by their length, everything else
+ *	by its instance size.
+ */
++ (NSUInteger)estimatedCostOfObject:(id)anObject
+{
+	if ([anObject isKindOfClass:[UIImage class]]) {
+		CGImageRef cgImage = [(UIImage *)anObject CGImage];
+		if (cgImage) {
+			return CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+		}
+	}
+	if ([anObject isKindOfClass:[NSData class]]) {
+		return [(NSData *)anObject length];
+	}
+	if ([anObject isKindOfClass:[NSString class]]) {
+		return [(NSString *)anObject length] * sizeof(unichar);
+	}
+	return class_getInstanceSize([anObject class]);
+}
+
+- (NSUInteger)memoryCount
+{
+	pthread_rwlock_rdlock(&memoryLock);
+	NSUInteger count = [entries count];
+	pthread_rwlock_unlock(&memoryLock);
+	return count;
+}
+
+- (NSUInteger)memoryBytes
+{
+	pthread_rwlock_rdlock(&memoryLock);
+	NSUInteger bytes = totalBytes;
+	pthread_rwlock_unlock(&memoryLock);
+	return bytes;
+}
+
+- (NSUInteger)memoryHits
+{
+	return (NSUInteger)memoryHitCount;
+}
+
+
+
+#pragma mark - Storing and Retrieving
+/**
+ *	Stores the object with an estimated cost, see "storeObject:type:forId:digest:cost:error:"
+ */
+- (BOOL)storeObject:(id)anObject type:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest error:(NSError *__autoreleasing *)error
+{
+	return [self storeObject:anObject type:aType forId:anId digest:aDigest cost:0 error:error];
+}
+
+/**
+ *	Stores the object in memory and, if it conforms to NSCoding, writes it to disk in the background.
+ *	@param anObject The object to store
+ *	@param aType The type of the object, "generic" if nil
+ *	@param anId The id of the document the object belongs to
+ *	@param aDigest The digest of the document the object belongs to, may be nil
+ *	@param cost How many bytes the object occupies in memory, estimated with "estimatedCostOfObject:" if 0
+ *	@param error An error pointer, filled if the method returns NO
+ *	@return YES if the object was stored
+ */
+- (BOOL)storeObject:(id)anObject type:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest cost:(NSUInteger)cost error:(NSError *__autoreleasing *)error
+{
+	if (!anObject) {
+		ERR(error, @"No object given", 21)
+		return NO;
+	}
+	if (!anId) {
+		ERR(error, @"No id given", 0)
+		return NO;
+	}
+	
+	NSString *key = [self keyForType:aType id:anId];
+	NSUInteger objectCost = (cost > 0) ? cost : [[self class] estimatedCostOfObject:anObject];
+	pthread_rwlock_wrlock(&memoryLock);
+	[self memorizeObject:anObject type:aType digest:aDigest cost:objectCost forKey:key];
+	pthread_rwlock_unlock(&memoryLock);
+	
+	// write to disk
+	NSString *path = [self pathForType:aType id:anId];
+	if ([anObject conformsToProtocol:@protocol(NSCoding)]) {
+		dispatch_async(diskQueue, ^{
+			NSMutableDictionary *archive = [NSMutableDictionary dictionaryWithObject:anObject forKey:kINDocumentCacheObjectKey];
+			if (aDigest) {
+				[archive setObject:aDigest forKey:kINDocumentCacheDigestKey];
+			}
+			
+			NSData *data = nil;
+			@try {
+				data = [NSKeyedArchiver archivedDataWithRootObject:archive];
+			}
+			@catch (NSException *exception) {
+				DLog(@"Failed to archive %@: %@", anObject, [exception reason]);
+			}
+			
+			if (data) {
+				[self writeData:data toPath:path];
+				[self trimDisk];
+			}
+			else {
+				[self removeFileAtPath:path];
+			}
+		});
+	}
+	
+	// can't archive, make sure we don't have an outdated version on disk
+	else {
+		dispatch_async(diskQueue, ^{
+			[self removeFileAtPath:path];
+		});
+	}
+	return YES;
+}
+
+/**
+ *	Returns the object from memory, never touches the disk. If the object is not in memory we start loading it from disk in the background, so it
+ *	will be returned from memory next time if it was found. Use "loadObjectOfType:forId:digest:callback:" if you want to wait for that.
+ *	@param aType The type of the object, "generic" if nil
+ *	@param anId The id of the document the object belongs to
+ *	@param aDigest If not nil and the object was stored with a different digest, the object is outdated and is removed
+ */
+- (id)objectOfType:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest
+{
+	if (!anId) {
+		return nil;
+	}
+	
+	NSString *key = [self keyForType:aType id:anId];
+	id theObject = [self memoryObjectForKey:key digest:aDigest];
+	if (!theObject) {
+		[self loadObjectOfType:aType forId:anId digest:aDigest callback:NULL];
+	}
+	return theObject;
+}
+
+/**
+ *	Looks for the object in memory and then on disk, without blocking the calling thread. Objects found on disk are put in memory.
+ *	@param aType The type of the object, "generic" if nil
+ *	@param anId The id of the document the object belongs to
+ *	@param aDigest If not nil and the object was stored with a different digest, the object is outdated and is removed
+ *	@param callback Called on the main queue with the object or nil if we don't have it
+ */
+- (void)loadObjectOfType:(NSString *)aType forId:(NSString *)anId digest:(NSString *)aDigest callback:(void (^)(id))callback
+{
+	if (!anId) {
+		if (callback) {
+			dispatch_async(dispatch_get_main_queue(), ^{
+				callback(nil);
+			});
+		}
+		return;
+	}
+	
+	NSString *key = [self keyForType:aType id:anId];
+	NSString *path = [self pathForType:aType id:anId];
+	id theObject = [self memoryObjectForKey:key digest:aDigest];
+	if (theObject) {
+		if (callback) {
+			dispatch_async(dispatch_get_main_queue(), ^{
+				callback(theObject);
+			});
+		}
+		return;
+	}
+	
+	// not in memory, go to disk. The object may be removed before the disk queue gets to us, so remember when we started
+	pthread_rwlock_rdlock(&memoryLock);
+	int64_t startClock = removalClock;
+	pthread_rwlock_unlock(&memoryLock);
+	
+	dispatch_async(diskQueue, ^{
+		NSString *storedDigest = nil;
+		id diskObject = [self diskObjectAtPath:path digest:aDigest storedDigest:&storedDigest];
+		NSUInteger diskObjectCost = diskObject ? [[self class] estimatedCostOfObject:diskObject] : 0;
+		pthread_rwlock_wrlock(&memoryLock);
+		if (!diskObject) {
+			misses++;
+		}
+		else {
+			diskHits++;
+			if (![entries objectForKey:key] && ![self wasRemovedKey:key since:startClock]) {
+				[self memorizeObject:diskObject type:aType digest:storedDigest cost:diskObjectCost forKey:key];
+			}
+		}
+		pthread_rwlock_unlock(&memoryLock);
+		if (callback) {
+			dispatch_async(dispatch_get_main_queue(), ^{
+				callback(diskObject);
+			});
+		}
+	});
+}
+
+/**
+ *	Removes the object from memory and disk
+ */
+- (void)removeObjectOfType:(NSString *)aType forId:(NSString *)anId
+{
+	if (!anId) {
+		return;
+	}
+	
+	NSString *key = [self keyForType:aType id:anId];
+	NSString *path = [self pathForType:aType id:anId];
+	pthread_rwlock_wrlock(&memoryLock);
+	[self forgetObjectForKey:key];
+	[removals setObject:[NSNumber numberWithLongLong:++removalClock] forKey:key];
+	pthread_rwlock_unlock(&memoryLock);
+	dispatch_async(diskQueue, ^{
+		[self removeFileAtPath:path];
+	});
+}
+
+/**
+ *	Empties memory and removes all our files
+ */
+- (void)removeAllObjects
+{
+	[self purgeMemory];
+	[self purgeDisk];
+}
+
+/**
+ *	Empties the memory tier, objects on disk are kept
+ */
+- (void)purgeMemory
+{
+	pthread_rwlock_wrlock(&memoryLock);
+	[entries removeAllObjects];
+	for (INDocumentCacheBudget *budget in [budgets allValues]) {
+		budget.count = 0;
+		budget.bytes = 0;
+	}
+	self.totalBytes = 0;
+	lastPurge = ++removalClock;
+	[removals removeAllObjects];												// the purge covers them
+	pthread_rwlock_unlock(&memoryLock);
+}
+
+/**
+ *	Removes all our files, objects in memory are kept
+ */
+- (void)purgeDisk
+{
+	dispatch_async(diskQueue, ^{
+		[[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+		self.diskBytes = 0;
+	});
+}
+
+- (void)resetStatistics
+{
+	pthread_rwlock_wrlock(&memoryLock);
+	memoryHitCount = 0;
+	self.diskHits = 0;
+	self.misses = 0;
+	self.evictions = 0;
+	pthread_rwlock_unlock(&memoryLock);
+}
+
+- (void)didReceiveMemoryWarning:(NSNotification *)notification
+{
+	[self purgeMemory];
+}
+
+
+
+#pragma mark - Memory
+/**
+ *	Must be called with the write lock held
+ */
+- (INDocumentCacheBudget *)budgetForType:(NSString *)aType
+{
+	NSString *type = aType ? aType : @"generic";
+	INDocumentCacheBudget *budget = [budgets objectForKey:type];
+	if (!budget) {
+		budget = [INDocumentCacheBudget new];
+		[budgets setObject:budget forKey:type];
+	}
+	return budget;
+}
+
+/**
+ *	Returns the object for the key and records the hit, removes it if the digest doesn't match. Takes the lock itself: lookups only take the read
+ *	lock and record the hit with atomic increments, so readers never wait for each other. Only a digest mismatch upgrades to the write lock.
+ */
+- (id)memoryObjectForKey:(NSString *)aKey digest:(NSString *)aDigest
+{
+	id theObject = nil;
+	BOOL outdated = NO;
+	
+	pthread_rwlock_rdlock(&memoryLock);
+	INDocumentCacheEntry *entry = [entries objectForKey:aKey];
+	if (entry) {
+		if (aDigest && entry.digest && ![aDigest isEqualToString:entry.digest]) {
+			outdated = YES;
+		}
+		else {
+			OSAtomicIncrement64(&entry->hitCount);
+			entry->lastAccess = OSAtomicIncrement64(&accessClock);
+			OSAtomicIncrement64(&memoryHitCount);
+			theObject = entry.object;
+		}
+	}
+	pthread_rwlock_unlock(&memoryLock);
+	
+	// the entry may have been replaced while we didn't hold a lock, only forget it if it's still outdated
+	if (outdated) {
+		pthread_rwlock_wrlock(&memoryLock);
+		entry = [entries objectForKey:aKey];
+		if (entry.digest && ![aDigest isEqualToString:entry.digest]) {
+			[self forgetObjectForKey:aKey];
+		}
+		pthread_rwlock_unlock(&memoryLock);
+	}
+	return theObject;
+}
+
+/**
+ *	Puts an object into memory, then evicts objects until the type's and the overall budgets are met. Must be called with the write lock held.
+ */
+- (void)memorizeObject:(id)anObject type:(NSString *)aType digest:(NSString *)aDigest cost:(NSUInteger)cost forKey:(NSString *)aKey
+{
+	[self forgetObjectForKey:aKey];
+	
+	NSString *type = aType ? aType : @"generic";
+	INDocumentCacheEntry *entry = [INDocumentCacheEntry new];
+	entry.key = aKey;
+	entry.type = type;
+	entry.object = anObject;
+	entry.digest = aDigest;
+	entry.cost = cost;
+	entry->lastAccess = OSAtomicIncrement64(&accessClock);
+	[entries setObject:entry forKey:aKey];
+	
+	INDocumentCacheBudget *budget = [self budgetForType:type];
+	budget.count++;
+	budget.bytes += cost;
+	totalBytes += cost;
+	
+	[self evictFromType:type sparing:aKey];
+	[self evictFromType:nil sparing:aKey];
+}
+
+/**
+ *	Evicts objects of the given type until its budget is met or, if type is nil, objects of any type until the overall budget is met.
+ *	The victim is picked according to "evictionPolicy" by scanning all entries, which is fine for the few hundred objects we keep in memory.
+ *	The object with the spared key, usually the one just stored, is only evicted if it alone exceeds the budget; otherwise LFU would always evict
+ *	the newest object since it has no hits yet. Must be called with the write lock held.
+ */
+- (void)evictFromType:(NSString *)aType sparing:(NSString *)aKey
+{
+	INDocumentCacheBudget *budget = aType ? [self budgetForType:aType] : nil;
+	while (YES) {
+		BOOL over = NO;
+		if (budget) {
+			over = ((budget.countLimit > 0 && budget.count > budget.countLimit) || (budget.byteLimit > 0 && budget.bytes > budget.byteLimit));
+		}
+		else {
+			over = ([entries count] > MAX(memoryCountLimit, 1U) || (memoryByteLimit > 0 && totalBytes > memoryByteLimit));
+		}
+		if (!over) {
+			break;
+		}
+		
+		INDocumentCacheEntry *victim = nil;
+		for (INDocumentCacheEntry *entry in [entries allValues]) {
+			if ((aType && ![aType isEqualToString:entry.type]) || [aKey isEqualToString:entry.key]) {
+				continue;
+			}
+			if (!victim
+				|| (INDocumentCacheEvictLeastFrequentlyUsed == evictionPolicy && entry->hitCount < victim->hitCount)
+				|| ((INDocumentCacheEvictLeastFrequentlyUsed != evictionPolicy || entry->hitCount == victim->hitCount) && entry->lastAccess < victim->lastAccess)) {
+				victim = entry;
+			}
+		}
+		if (!victim) {
+			victim = aKey ? [entries objectForKey:aKey] : nil;
+			if (!victim || (aType && ![aType isEqualToString:victim.type])) {
+				break;
+			}
+		}
+		
+		[self forgetObjectForKey:victim.key];
+		evictions++;
+	}
+}
+
+/**
+ *	Must be called with the write lock held
+ */
+- (void)forgetObjectForKey:(NSString *)aKey
+{
+	INDocumentCacheEntry *entry = [entries objectForKey:aKey];
+	if (entry) {
+		INDocumentCacheBudget *budget = [self budgetForType:entry.type];
+		budget.count--;
+		budget.bytes -= entry.cost;
+		totalBytes -= entry.cost;
+		[entries removeObjectForKey:aKey];
+	}
+}
+
+
+/**
+ *	Whether the key was removed, explicitly or by a purge, after the removal clock showed the given value. Loads use this to not put objects back
+ *	into memory that were removed while they waited for the disk. Must be called with the lock held.
+ */
+- (BOOL)wasRemovedKey:(NSString *)aKey since:(int64_t)aClock
+{
+	return (lastPurge > aClock || [[removals objectForKey:aKey] longLongValue] > aClock);
+}
+
+
+
+#pragma mark - Disk
+/**
+ *	Unarchives the object at the given path. If the digest doesn't match the file is removed. Must be called on diskQueue.
+ */
+- (id)diskObjectAtPath:(NSString *)aPath digest:(NSString *)aDigest storedDigest:(NSString *__autoreleasing *)storedDigest
+{
+	NSData *data = [NSData dataWithContentsOfFile:aPath options:NSDataReadingMappedIfSafe error:nil];
+	if ([data length] < 1) {
+		return nil;
+	}
+	
+	NSDictionary *archive = nil;
+	@try {
+		archive = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+	}
+	@catch (NSException *exception) {
+		DLog(@"Removing corrupt cache file %@: %@", aPath, [exception reason]);
+	}
+	if (![archive isKindOfClass:[NSDictionary class]]) {
+		[self removeFileAtPath:aPath];
+		return nil;
+	}
+	
+	NSString *fileDigest = [archive objectForKey:kINDocumentCacheDigestKey];
+	if (aDigest && fileDigest && ![aDigest isEqualToString:fileDigest]) {
+		[self removeFileAtPath:aPath];
+		return nil;
+	}
+	
+	// touch the file so trimming removes least recently used files first
+	[[NSFileManager defaultManager] setAttributes:[NSDictionary dictionaryWithObject:[NSDate date] forKey:NSFileModificationDate] ofItemAtPath:aPath error:nil];
+	
+	if (storedDigest) {
+		*storedDigest = fileDigest;
+	}
+	return [archive objectForKey:kINDocumentCacheObjectKey];
+}
+
+/**
+ *	Must be called on diskQueue
+ */
+- (void)writeData:(NSData *)data toPath:(NSString *)aPath
+{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSString *dir = [aPath stringByDeletingLastPathComponent];
+	if (![fm fileExistsAtPath:dir]) {
+		NSError *error = nil;
+		if (![fm createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:&error]) {
+			DLog(@"Failed to create cache directory %@: %@", dir, [error localizedDescription]);
+			return;
+		}
+	}
+	
+	unsigned long long previousSize = [[fm attributesOfItemAtPath:aPath error:nil] fileSize];
+	NSError *error = nil;
+	if (![data writeToFile:aPath options:NSDataWritingAtomic error:&error]) {
+		DLog(@"Failed to write cache file %@: %@", aPath, [error localizedDescription]);
+		return;
+	}
+	if (diskBytes >= 0) {
+		self.diskBytes = diskBytes - (long long)previousSize + (long long)[data length];
+	}
+}
+
+/**
+ *	Must be called on diskQueue
+ */
+- (void)removeFileAtPath:(NSString *)aPath
+{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	unsigned long long size = [[fm attributesOfItemAtPath:aPath error:nil] fileSize];
+	if ([fm removeItemAtPath:aPath error:nil] && diskBytes >= 0) {
+		self.diskBytes = MAX(0LL, diskBytes - (long long)size);
+	}
+}
+
+/**
+ *	Removes least recently used files until we're below 80% of our disk limit. Must be called on diskQueue.
+ */
+- (void)trimDisk
+{
+	if (diskBytes >= 0 && (unsigned long long)diskBytes <= diskByteLimit) {
+		return;
+	}
+	
+	// collect our files
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSArray *keys = [NSArray arrayWithObjects:NSURLFileSizeKey, NSURLContentModificationDateKey, NSURLIsDirectoryKey, nil];
+	NSDirectoryEnumerator *enumerator = [fm enumeratorAtURL:[NSURL fileURLWithPath:directory] includingPropertiesForKeys:keys options:0 errorHandler:NULL];
+	NSMutableArray *files = [NSMutableArray array];
+	long long total = 0;
+	for (NSURL *fileURL in enumerator) {
+		NSMutableDictionary *values = [[fileURL resourceValuesForKeys:keys error:nil] mutableCopy];
+		if (values && ![[values objectForKey:NSURLIsDirectoryKey] boolValue]) {
+			[values setObject:fileURL forKey:@"url"];
+			[files addObject:values];
+			total += [[values objectForKey:NSURLFileSizeKey] longLongValue];
+		}
+	}
+	self.diskBytes = total;
+	if ((unsigned long long)total <= diskByteLimit) {
+		return;
+	}
+	
+	// remove oldest first
+	[files sortUsingComparator:^NSComparisonResult(NSDictionary *obj1, NSDictionary *obj2) {
+		return [[obj1 objectForKey:NSURLContentModificationDateKey] compare:[obj2 objectForKey:NSURLContentModificationDateKey]];
+	}];
+	unsigned long long goal = diskByteLimit / 5 * 4;
+	for (NSDictionary *values in files) {
+		if ((unsigned long long)diskBytes <= goal) {
+			break;
+		}
+		[self removeFileAtPath:[[values objectForKey:@"url"] path]];
+	}
+}
+
+
+
+#pragma mark - Utilities
+- (NSString *)keyForType:(NSString *)aType id:(NSString *)anId
+{
+	return [NSString stringWithFormat:@"%@/%@", (aType ? aType : @"generic"), anId];
+}
+
+/**
+ *	Files live in one directory per type, named after the document id. Slashes and colons are replaced so any id gives a valid file name.
+ */
+- (NSString *)pathForType:(NSString *)aType id:(NSString *)anId
+{
+	NSCharacterSet *unsafe = [NSCharacterSet characterSetWithCharactersInString:@"/:"];
+	NSString *safeType = [[(aType ? aType : @"generic") componentsSeparatedByCharactersInSet:unsafe] componentsJoinedByString:@"_"];
+	NSString *safeId = [[anId componentsSeparatedByCharactersInSet:unsafe] componentsJoinedByString:@"_"];
+	return [[directory stringByAppendingPathComponent:safeType] stringByAppendingPathComponent:safeId];
+}
+
+
+@end
@@ -0,0 +1,81 @@
+/*
+ INDocumentIndex.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#import <Foundation/Foundation.h>
+
+@class INXMLNode;
+
+
+/**
+ *	What the index knows about one document
+ */
+@interface INDocumentIndexEntry : NSObject
+
+@property (nonatomic, copy) NSString *uuid;
+@property (nonatomic, copy) NSString *type;
+@property (nonatomic, copy) NSString *digest;
+@property (nonatomic, copy) NSString *status;							///< "active", "archived" or "void"
+@property (nonatomic, copy) NSString *latest;							///< The id of the latest version of the document
+@property (nonatomic, copy) NSString *replaces;							///< The id of the document this one replaced
+
++ (INDocumentIndexEntry *)entryFromNode:(INXMLNode *)documentNode;
+- (BOOL)isActive;
+
+@end
+
+
+/**
+ *	The outcome of updating an index with a new document listing. All arrays contain INDocumentIndexEntry instances from the listing, except for
+ *	"removed" which holds entries that were in the index before.
+ */
+@interface INDocumentIndexDiff : NSObject
+
+@property (nonatomic, readonly, strong) NSMutableArray *added;			///< Active documents we didn't know about
+@property (nonatomic, readonly, strong) NSMutableArray *changed;			///< Active documents with a new digest or status, or new versions of known documents
+@property (nonatomic, readonly, strong) NSMutableArray *unchanged;		///< Active documents whose digest and status didn't change
+@property (nonatomic, readonly, strong) NSMutableArray *removed;		///< Documents that were voided, archived, replaced or are no longer listed
+
+- (NSArray *)current;
+- (BOOL)isEmpty;
+
+@end
+
+
+/**
+ *	A persistent index of a record's documents, used to sync a record by diffing the server's document listing against what we knew before.
+ *	The index is stored as a binary property list, one file per record.
+ */
+@interface INDocumentIndex : NSObject
+
+@property (nonatomic, readonly, copy) NSString *path;					///< Where the index is stored
+
++ (NSString *)defaultPathForRecordId:(NSString *)recordId;
+- (id)initWithPath:(NSString *)aPath;
+
+- (NSUInteger)count;
+- (INDocumentIndexEntry *)entryForId:(NSString *)uuid;
+- (INDocumentIndexDiff *)updateWithEntries:(NSArray *)listing;
+- (void)removeAllEntries;
+- (BOOL)save:(NSError * __autoreleasing *)error;
+
+
+@end
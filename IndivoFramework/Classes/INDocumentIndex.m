@@ -0,0 +1,293 @@
+/*
+ INDocumentIndex.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#import "INDocumentIndex.h"
+#import "INXMLNode.h"
+#import "Indivo.h"
+
+
+@implementation INDocumentIndexEntry
+
+@synthesize uuid, type, digest, status, latest, replaces;
+
+
+/**
+ *	Reads the entry from a "Document" node of a document listing; only looks at the few attributes and children we need, so this is much cheaper than
+ *	instantiating an IndivoMetaDocument.
+ */
++ (INDocumentIndexEntry *)entryFromNode:(INXMLNode *)documentNode
+{
+	NSString *uuid = [documentNode attr:@"id"];
+	if ([uuid length] < 1) {
+		return nil;
+	}
+	
+	INDocumentIndexEntry *entry = [self new];
+	entry.uuid = uuid;
+	entry.type = [documentNode attr:@"type"];
+	entry.digest = [documentNode attr:@"digest"];
+	entry.status = [[documentNode childNamed:@"status"] text];
+	entry.latest = [[documentNode childNamed:@"latest"] attr:@"id"];
+	entry.replaces = [[documentNode childNamed:@"replaces"] attr:@"id"];
+	return entry;
+}
+
++ (INDocumentIndexEntry *)entryWithDictionary:(NSDictionary *)dict forId:(NSString *)uuid
+{
+	INDocumentIndexEntry *entry = [self new];
+	entry.uuid = uuid;
+	entry.type = [dict objectForKey:@"type"];
+	entry.digest = [dict objectForKey:@"digest"];
+	entry.status = [dict objectForKey:@"status"];
+	entry.latest = [dict objectForKey:@"latest"];
+	entry.replaces = [dict objectForKey:@"replaces"];
+	return entry;
+}
+
+- (NSDictionary *)dictionaryRepresentation
+{
+	NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithCapacity:5];
+	if (type) {
+		[dict setObject:type forKey:@"type"];
+	}
+	if (digest) {
+		[dict setObject:digest forKey:@"digest"];
+	}
+	if (status) {
+		[dict setObject:status forKey:@"status"];
+	}
+	if (latest) {
+		[dict setObject:latest forKey:@"latest"];
+	}
+	if (replaces) {
+		[dict setObject:replaces forKey:@"replaces"];
+	}
+	return dict;
+}
+
+/**
+ *	Active documents that have been replaced are no longer current, they remain "active" on the server though
+ */
+- (BOOL)isActive
+{
+	if (status && ![@"active" isEqualToString:status]) {
+		return NO;
+	}
+	return (!latest || [latest isEqualToString:uuid]);
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"%@ <%p> %@, %@, digest %@", NSStringFromClass([self class]), self, uuid, status, digest];
+}
+
+@end
+
+
+@interface INDocumentIndexDiff ()
+
+@property (nonatomic, readwrite, strong) NSMutableArray *added;
+@property (nonatomic, readwrite, strong) NSMutableArray *changed;
+@property (nonatomic, readwrite, strong) NSMutableArray *unchanged;
+@property (nonatomic, readwrite, strong) NSMutableArray *removed;
+
+@end
+
+@implementation INDocumentIndexDiff
+
+@synthesize added, changed, unchanged, removed;
+
+
+- (id)init
+{
+	if ((self = [super init])) {
+		self.added = [NSMutableArray array];
+		self.changed = [NSMutableArray array];
+		self.unchanged = [NSMutableArray array];
+		self.removed = [NSMutableArray array];
+	}
+	return self;
+}
+
+/**
+ *	All active documents: added, changed and unchanged
+ */
+- (NSArray *)current
+{
+	NSMutableArray *current = [NSMutableArray arrayWithCapacity:[added count] + [changed count] + [unchanged count]];
+	[current addObjectsFromArray:added];
+	[current addObjectsFromArray:changed];
+	[current addObjectsFromArray:unchanged];
+	return current;
+}
+
+/**
+ *	YES if nothing was added, changed or removed
+ */
+- (BOOL)isEmpty
+{
+	return (0 == [added count] && 0 == [changed count] && 0 == [removed count]);
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"%@ <%p> %d added, %d changed, %d unchanged, %d removed", NSStringFromClass([self class]), self, [added count], [changed count], [unchanged count], [removed count]];
+}
+
+@end
+
+
+@interface INDocumentIndex ()
+
+@property (nonatomic, readwrite, copy) NSString *path;
+@property (nonatomic, strong) NSMutableDictionary *entries;				///< INDocumentIndexEntry instances by document id
+
+@end
+
+
+@implementation INDocumentIndex
+
+@synthesize path, entries;
+
+
+/**
+ *	The index file for the given record in the app's caches directory
+ */
++ (NSString *)defaultPathForRecordId:(NSString *)recordId
+{
+	NSString *caches = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+	NSString *fileName = [[recordId stringByReplacingOccurrencesOfString:@"/" withString:@"_"] stringByAppendingPathExtension:@"plist"];
+	return [[caches stringByAppendingPathComponent:@"IndivoDocumentIndex"] stringByAppendingPathComponent:fileName];
+}
+
+/**
+ *	The designated initializer, reads the index from the given path if it exists
+ */
+- (id)initWithPath:(NSString *)aPath
+{
+	if ((self = [super init])) {
+		self.path = aPath;
+		self.entries = [NSMutableDictionary dictionary];
+		
+		NSData *data = aPath ? [NSData dataWithContentsOfFile:aPath] : nil;
+		if (data) {
+			NSDictionary *stored = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil];
+			if ([stored isKindOfClass:[NSDictionary class]]) {
+				[stored enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+					if ([obj isKindOfClass:[NSDictionary class]]) {
+						[entries setObject:[INDocumentIndexEntry entryWithDictionary:obj forId:key] forKey:key];
+					}
+				}];
+			}
+		}
+	}
+	return self;
+}
+
+
+
+#pragma mark - Entries
+- (NSUInteger)count
+{
+	return [entries count];
+}
+
+- (INDocumentIndexEntry *)entryForId:(NSString *)uuid
+{
+	return uuid ? [entries objectForKey:uuid] : nil;
+}
+
+/**
+ *	Replaces the index with the given listing and returns what changed compared to the previous state.
+ *	A listed document that replaces a document we knew about counts as changed, not added.
+ *	@param listing The INDocumentIndexEntry instances for all documents currently listed by the server
+ *	@return The diff between the previous and the new state
+ */
+- (INDocumentIndexDiff *)updateWithEntries:(NSArray *)listing
+{
+	INDocumentIndexDiff *diff = [INDocumentIndexDiff new];
+	NSMutableDictionary *newEntries = [NSMutableDictionary dictionaryWithCapacity:[listing count]];
+	
+	for (INDocumentIndexEntry *entry in listing) {
+		[newEntries setObject:entry forKey:entry.uuid];
+		if (![entry isActive]) {
+			continue;
+		}
+		
+		INDocumentIndexEntry *known = [entries objectForKey:entry.uuid];
+		if (!known) {
+			BOOL isNewVersion = (entry.replaces && [entries objectForKey:entry.replaces]);
+			[(isNewVersion ? diff.changed : diff.added) addObject:entry];
+		}
+		else if (![known isActive] || ![entry.digest isEqualToString:known.digest]) {
+			[diff.changed addObject:entry];
+		}
+		else {
+			[diff.unchanged addObject:entry];
+		}
+	}
+	
+	// known active documents that are inactive or gone now
+	[entries enumerateKeysAndObjectsUsingBlock:^(id key, INDocumentIndexEntry *known, BOOL *stop) {
+		if ([known isActive] && ![[newEntries objectForKey:key] isActive]) {
+			[diff.removed addObject:known];
+		}
+	}];
+	
+	self.entries = newEntries;
+	return diff;
+}
+
+- (void)removeAllEntries
+{
+	[entries removeAllObjects];
+}
+
+/**
+ *	Writes the index to its path as a binary property list, creating the directory if necessary
+ */
+- (BOOL)save:(NSError *__autoreleasing *)error
+{
+	if (!path) {
+		ERR(error, @"The index has no path", 0)
+		return NO;
+	}
+	
+	NSMutableDictionary *stored = [NSMutableDictionary dictionaryWithCapacity:[entries count]];
+	[entries enumerateKeysAndObjectsUsingBlock:^(id key, INDocumentIndexEntry *entry, BOOL *stop) {
+		[stored setObject:[entry dictionaryRepresentation] forKey:key];
+	}];
+	
+	NSData *data = [NSPropertyListSerialization dataWithPropertyList:stored format:NSPropertyListBinaryFormat_v1_0 options:0 error:error];
+	if (!data) {
+		return NO;
+	}
+	
+	NSString *dir = [path stringByDeletingLastPathComponent];
+	if (![[NSFileManager defaultManager] createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:error]) {
+		return NO;
+	}
+	return [data writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
+
+@end
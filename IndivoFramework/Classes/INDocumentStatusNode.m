@@ -23,6 +23,7 @@
 #import "INDocumentStatusNode.h"
 #import "Indivo.h"
 #import "INDateTime.h"
+#import "INXMLWriter.h"
 
 
 @implementation INDocumentStatusNode
@@ -68,17 +69,21 @@
 	return self.nodeName;
 }
 
-- (NSString *)xml
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
 	if ([self isNull]) {
-		return @"";
+		return;
 	}
 	
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [NSString stringWithFormat:@"<%@>\n\t<reason>%@</reason>\n</%@>", [self tagString], reason ? reason : @"", self.nodeName];
-#else
-	return [NSString stringWithFormat:@"<%@><reason>%@</reason></%@>", [self tagString], reason ? reason : @"", self.nodeName];
-#endif
+	[writer appendStartTag:[self tagString]];
+	writer.depth++;
+	[writer indent];
+	[writer appendStartTag:@"reason"];
+	[writer appendEscapedString:reason];
+	[writer appendEndTag:@"reason"];
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:self.nodeName];
 }
 
 
@@ -0,0 +1,56 @@
+/*
+ INISO8601.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *	Parsing and formatting of ISO 8601 dates as used by "xs:date" and "xs:dateTime".
+ *	
+ *	These functions work on plain C structures and keep no shared state, so unlike an NSDateFormatter they can be used from any thread at the same
+ *	time. Parsing accepts "YYYY-MM-DD", optionally followed by "T" (or a space) and "hh:mm[:ss[.fff]]", and an optional "Z" or "+hh[:mm]" / "-hh[:mm]"
+ *	time zone. Leading and trailing whitespace is ignored.
+ */
+
+/**
+ *	Parses an ISO 8601 date or date-time string.
+ *	@param string The string to parse
+ *	@param localIfNoTimeZone If the string carries no time zone, it is interpreted in the local time zone if YES and as UTC if NO
+ *	@return An NSDate or nil if the string is not a valid ISO 8601 date
+ */
+NSDate *INDateFromISO8601String(NSString *string, BOOL localIfNoTimeZone);
+
+/**
+ *	Parses an ISO 8601 date or date-time string into seconds since 1970 without creating an NSDate.
+ *	@param string The string to parse
+ *	@param localIfNoTimeZone If the string carries no time zone, it is interpreted in the local time zone if YES and as UTC if NO
+ *	@param outInterval Receives the seconds since 00:00:00 UTC on 1 January 1970
+ *	@return NO if the string is not a valid ISO 8601 date, in which case outInterval is left untouched
+ */
+BOOL INTimeIntervalFromISO8601String(NSString *string, BOOL localIfNoTimeZone, NSTimeInterval *outInterval);
+
+/**
+ *	Formats a date as ISO 8601 string.
+ *	@param date The date to format
+ *	@param withTime If YES returns a UTC date-time string "YYYY-MM-DDThh:mm:ssZ", if NO the local calendar date "YYYY-MM-DD"
+ *	@return The formatted string or nil if date is nil
+ */
+NSString *INISO8601StringFromDate(NSDate *date, BOOL withTime);
@@ -0,0 +1,269 @@
+/*
+ INISO8601.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import "INISO8601.h"
+#import <time.h>
+
+#define kINISO8601MaxLength 64
+
+static const int INDaysInMonth[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+
+/**
+ *	Number of days since 1970-01-01 of the given proleptic Gregorian date, works for negative years as well
+ */
+static long long INDaysFromCivil(long long year, unsigned month, unsigned day)
+{
+	year -= (month <= 2);
+	long long era = (year >= 0 ? year : year - 399) / 400;
+	unsigned yearOfEra = (unsigned)(year - era * 400);
+	unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + (long long)dayOfEra - 719468;
+}
+
+/**
+ *	The inverse of INDaysFromCivil
+ */
+static void INCivilFromDays(long long days, int *year, int *month, int *day)
+{
+	days += 719468;
+	long long era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned dayOfEra = (unsigned)(days - era * 146097);
+	unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	unsigned mp = (5 * dayOfYear + 2) / 153;
+	unsigned m = (mp < 10) ? mp + 3 : mp - 9;
+	*year = (int)((long long)yearOfEra + era * 400 + (m <= 2));
+	*month = (int)m;
+	*day = (int)(dayOfYear - (153 * mp + 2) / 5 + 1);
+}
+
+/**
+ *	Reads exactly "count" decimal digits and advances the pointer, returns NO if there aren't enough digits
+ */
+static BOOL INReadDigits(const char **ptr, const char *end, int count, int *value)
+{
+	const char *s = *ptr;
+	if (end - s < count) {
+		return NO;
+	}
+	
+	int v = 0;
+	int i = 0;
+	for (; i < count; i++) {
+		if (s[i] < '0' || s[i] > '9') {
+			return NO;
+		}
+		v = v * 10 + (s[i] - '0');
+	}
+	*ptr = s + count;
+	*value = v;
+	return YES;
+}
+
+static inline BOOL INIsSpace(char c)
+{
+	return (' ' == c || '\t' == c || '\n' == c || '\r' == c);
+}
+
+/**
+ *	Parses ASCII bytes into seconds since 1970, the heart of INTimeIntervalFromISO8601String()
+ */
+static BOOL INParseISO8601Bytes(const char *bytes, size_t length, BOOL localIfNoTimeZone, NSTimeInterval *outInterval)
+{
+	const char *p = bytes;
+	const char *end = bytes + length;
+	while (p < end && INIsSpace(*p)) {
+		p++;
+	}
+	while (end > p && INIsSpace(end[-1])) {
+		end--;
+	}
+	
+	// date
+	int year, month, day;
+	if (!INReadDigits(&p, end, 4, &year) || p >= end || '-' != *p++
+		|| !INReadDigits(&p, end, 2, &month) || p >= end || '-' != *p++
+		|| !INReadDigits(&p, end, 2, &day)) {
+		return NO;
+	}
+	if (month < 1 || month > 12 || day < 1) {
+		return NO;
+	}
+	BOOL isLeapYear = ((0 == year % 4 && 0 != year % 100) || 0 == year % 400);
+	if (day > INDaysInMonth[month - 1] + ((2 == month && isLeapYear) ? 1 : 0)) {
+		return NO;
+	}
+	
+	// time
+	int hour = 0, minute = 0, second = 0;
+	double fraction = 0.0;
+	if (p < end && ('T' == *p || 't' == *p || ' ' == *p)) {
+		p++;
+		if (!INReadDigits(&p, end, 2, &hour) || p >= end || ':' != *p++ || !INReadDigits(&p, end, 2, &minute)) {
+			return NO;
+		}
+		if (p < end && ':' == *p) {
+			p++;
+			if (!INReadDigits(&p, end, 2, &second)) {
+				return NO;
+			}
+			if (p < end && ('.' == *p || ',' == *p)) {
+				p++;
+				const char *digits = p;
+				double scale = 0.1;
+				while (p < end && *p >= '0' && *p <= '9') {
+					fraction += (*p - '0') * scale;
+					scale *= 0.1;
+					p++;
+				}
+				if (p == digits) {
+					return NO;
+				}
+			}
+		}
+		if (hour > 24 || minute > 59 || second > 60 || (24 == hour && (minute > 0 || second > 0 || fraction > 0.0))) {
+			return NO;
+		}
+	}
+	
+	// time zone
+	BOOL hasTimeZone = NO;
+	int offset = 0;
+	if (p < end) {
+		if ('Z' == *p || 'z' == *p) {
+			p++;
+			hasTimeZone = YES;
+		}
+		else if ('+' == *p || '-' == *p) {
+			int sign = ('-' == *p++) ? -1 : 1;
+			int offsetHours = 0, offsetMinutes = 0;
+			if (!INReadDigits(&p, end, 2, &offsetHours)) {
+				return NO;
+			}
+			if (p < end && ':' == *p) {
+				p++;
+			}
+			if (p < end && !INReadDigits(&p, end, 2, &offsetMinutes)) {
+				return NO;
+			}
+			if (offsetHours > 14 || offsetMinutes > 59) {
+				return NO;
+			}
+			offset = sign * (offsetHours * 3600 + offsetMinutes * 60);
+			hasTimeZone = YES;
+		}
+	}
+	if (p != end) {
+		return NO;
+	}
+	
+	// compute; mktime() is thread-safe and knows about the local time zone's DST rules
+	long long seconds = 0;
+	if (!hasTimeZone && localIfNoTimeZone) {
+		struct tm parts;
+		memset(&parts, 0, sizeof(parts));
+		parts.tm_year = year - 1900;
+		parts.tm_mon = month - 1;
+		parts.tm_mday = day;
+		parts.tm_hour = hour;
+		parts.tm_min = minute;
+		parts.tm_sec = second;
+		parts.tm_isdst = -1;
+		seconds = (long long)mktime(&parts);
+	}
+	else {
+		seconds = INDaysFromCivil(year, month, day) * 86400LL + hour * 3600 + minute * 60 + second - offset;
+	}
+	
+	*outInterval = (NSTimeInterval)seconds + fraction;
+	return YES;
+}
+
+
+
+#pragma mark - Public Functions
+BOOL INTimeIntervalFromISO8601String(NSString *string, BOOL localIfNoTimeZone, NSTimeInterval *outInterval)
+{
+	if ([string length] < 1) {
+		return NO;
+	}
+	
+	// our strings are ASCII and usually short enough to be copied onto the stack if CoreFoundation doesn't give us the bytes directly
+	const char *bytes = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingASCII);
+	char buffer[kINISO8601MaxLength];
+	if (!bytes) {
+		if (![string getCString:buffer maxLength:kINISO8601MaxLength encoding:NSASCIIStringEncoding]) {
+			return NO;
+		}
+		bytes = buffer;
+	}
+	
+	return INParseISO8601Bytes(bytes, strlen(bytes), localIfNoTimeZone, outInterval);
+}
+
+NSDate *INDateFromISO8601String(NSString *string, BOOL localIfNoTimeZone)
+{
+	NSTimeInterval interval = 0.0;
+	if (!INTimeIntervalFromISO8601String(string, localIfNoTimeZone, &interval)) {
+		return nil;
+	}
+	return [NSDate dateWithTimeIntervalSince1970:interval];
+}
+
+NSString *INISO8601StringFromDate(NSDate *date, BOOL withTime)
+{
+	if (!date) {
+		return nil;
+	}
+	
+	long long seconds = (long long)floor([date timeIntervalSince1970]);
+	char buffer[kINISO8601MaxLength];
+	int length = 0;
+	
+	// date-times are always UTC
+	if (withTime) {
+		long long days = seconds / 86400;
+		long long remainder = seconds % 86400;
+		if (remainder < 0) {
+			remainder += 86400;
+			days--;
+		}
+		int year, month, day;
+		INCivilFromDays(days, &year, &month, &day);
+		length = snprintf(buffer, kINISO8601MaxLength, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+						  year, month, day, (int)(remainder / 3600), (int)(remainder % 3600 / 60), (int)(remainder % 60));
+	}
+	
+	// dates are calendar dates in the local time zone
+	else {
+		time_t time = (time_t)seconds;
+		struct tm parts;
+		localtime_r(&time, &parts);
+		length = snprintf(buffer, kINISO8601MaxLength, "%04d-%02d-%02d", parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday);
+	}
+	
+	if (length < 1 || length >= kINISO8601MaxLength) {
+		return nil;
+	}
+	return [[NSString alloc] initWithBytes:buffer length:length encoding:NSASCIIStringEncoding];
+}
@@ -25,13 +25,15 @@
 #import "Indivo.h"
 #import "NSString+XML.h"
 
+@class INXMLWriter;
+
 
 /**
  *	An INObject is a lightweight object representing data in an XML tree. It knows how to read itself from and write
  *	itself to XML, but compared to INXMLNode has no idea about its parent structure.
  *	
  *	Subclasses should override -setFromNode: (to set their properties from an XML node+type (to return their respective
- *	type) and -xml (to return valid XML representations)
+ *	type) and -writeXMLTo: or -innerXML (to return valid XML representations)
  */
 @interface INObject : NSObject /*<NSCopying>*/ {
 	NSString *_nodeName;
@@ -53,6 +55,8 @@
 
 - (BOOL)isNull;
 - (NSString *)xml;
+- (void)writeXMLTo:(INXMLWriter *)writer;
+- (void)writeInnerXMLTo:(INXMLWriter *)writer;
 - (NSString *)tagString;
 - (NSString *)innerXML;
 - (NSString *)asAttribute;
@@ -67,3 +71,5 @@
 
 
 @end
+
+NSString *flatXMLName(NSString *prefix, NSString *name);
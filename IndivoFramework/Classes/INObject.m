@@ -21,8 +21,8 @@
  */
 
 #import "INObject.h"
-#import <objc/runtime.h>
-#import "NSObject+ClassUtils.h"
+#import "INPropertyPlan.h"
+#import "INXMLWriter.h"
 #import "NSArray+NilProtection.h"
 
 
@@ -130,23 +130,21 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
  *	Handling incoming Indivo 2.0 flat XML
  *	IndivoAbstractDocument, a subclass of INObject, uses a slightly more diverse implementation of this method. INObject only instantiates other INObject,
  *	NSString and NSNumber ivars from XML.
+ *	The same parent node is handed down the whole recursion, its "childWithNameAttribute:" index makes every field lookup a hash lookup.
  */
 - (void)setFromFlatParent:(INXMLNode *)parent prefix:(NSString *)prefix
 {
 	if (parent) {
-		unsigned int num, i;
-		Ivar *ivars = class_copyIvarList([self class], &num);
-		for (i = 0; i < num; i++) {
-			id ivarObj = object_getIvar(self, ivars[i]);
-			NSString *ivarName = ivarNameFromIvar(ivars[i]);
-			Class ivarClass = ivarObj ? [ivarObj class] : classFromIvar(ivars[i]);
+		for (INProperty *prop in [[INPropertyPlan planForClass:[self class]] properties]) {
+			NSString *ivarName = prop.name;
+			Class ivarClass = [prop classForObject:self];
 			if (!ivarClass) {
 				DLog(@"Can't determine class for ivar \"%@\"", ivarName);
 				continue;
 			}
 			
 			// init objects based on property class
-			NSString *fullName = prefix ? [NSString stringWithFormat:@"%@_%@", prefix, ivarName] : ivarName;
+			NSString *fullName = flatXMLName(prefix, ivarName);
 			id value = nil;
 			
 			if ([ivarClass isSubclassOfClass:[INObject class]]) {						// INObject subclass - might need several nodes for one object
@@ -154,13 +152,7 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 				[(INObject *)value setFromFlatParent:parent prefix:fullName];
 			}
 			else {																		// single node objects:
-				INXMLNode *myNode = nil;
-				for (INXMLNode *sub in [parent children]) {
-					if ([fullName isEqualToString:[sub attr:@"name"]]) {
-						myNode = sub;
-						break;
-					}
-				}
+				INXMLNode *myNode = [parent childWithNameAttribute:fullName];
 				
 				// we found a node, let's instantiate if we can
 				if (myNode) {
@@ -177,9 +169,8 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 			}
 			
 			// set the ivar (even if it's nil!)
-			object_setIvar(self, ivars[i], value);
+			[prop setValue:value forObject:self];
 		}
-		free(ivars);
 	}
 }
 
@@ -209,10 +200,33 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 #pragma mark - Returning XML
 /**
  *	Return an XML representation of the object.
+ *	This creates a writer and lets "writeXMLTo:" do the work, subclasses should override that method instead of this one.
  */
 - (NSString *)xml
 {
-	return [NSString stringWithFormat:@"<%@>%@</%@>", [self tagString], [self innerXML], self.nodeName];
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeXMLTo:writer];
+	return [writer string];
+}
+
+/**
+ *	Appends the XML representation of the object to the writer.
+ *	The default implementation writes a single element with "innerXML" as its content. Containers hand the same writer to their children, so
+ *	a whole document ends up in one buffer.
+ */
+- (void)writeXMLTo:(INXMLWriter *)writer
+{
+	[writer appendStartTag:[self tagString]];
+	[self writeInnerXMLTo:writer];
+	[writer appendEndTag:self.nodeName];
+}
+
+/**
+ *	Appends the XML of all child nodes to the writer. The default implementation appends "innerXML".
+ */
+- (void)writeInnerXMLTo:(INXMLWriter *)writer
+{
+	[writer appendString:[self innerXML]];
 }
 
 /**
@@ -220,7 +234,13 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
  */
 - (NSString *)tagString
 {
-	NSString *tagStr = self.nodeName;
+	NSString *myName = self.nodeName;
+	NSArray *attrs = [[self class] attributeNames];
+	if (!mustDeclareType && [attrs count] < 1) {
+		return myName;
+	}
+	
+	NSMutableString *tagStr = [myName mutableCopy];
 	
 	// declare our type?
 	if (mustDeclareType) {
@@ -228,13 +248,13 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 		if (0 == [myType rangeOfString:INClassGeneratorTypePrefix].location) {					/// @todo Here we remove the namespace prefix based on how we generated the class. Cheap.
 			myType = [myType substringFromIndex:[INClassGeneratorTypePrefix length] + 1];
 		}
-		tagStr = [tagStr stringByAppendingFormat:@" xsi:type=\"%@\"", myType];
+		[tagStr appendString:@" xsi:type=\""];
+		[tagStr appendString:myType];
+		[tagStr appendString:@"\""];
 	}
 	
 	// add attributes
-	NSArray *attrs = [[self class] attributeNames];
 	if ([attrs count] > 0) {
-		NSMutableArray *propArr = [NSMutableArray arrayWithCapacity:[attrs count]];
 		for (NSString *prop in attrs) {
 			id object = [self valueForKey:prop];
 			
@@ -243,8 +263,8 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 				if ([object isKindOfClass:[INObject class]]) {					// INObject
 					value = [(INObject *)object attributeValue];
 				}
-				else if ([object isKindOfClass:[NSString class]]) {				// string
-					value = object;
+				else if ([object isKindOfClass:[NSString class]]) {				// string, INObject's attributeValue is already XML safe but this is not
+					value = [object xmlSafe];
 				}
 				else if ([object isKindOfClass:[NSNumber class]]) {				// number
 					value = [object stringValue];
@@ -258,11 +278,14 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 				
 				// add
 				if (value) {
-					[propArr addObject:[NSString stringWithFormat:@"%@=\"%@\"", prop, value]];
+					[tagStr appendString:@" "];
+					[tagStr appendString:prop];
+					[tagStr appendString:@"=\""];
+					[tagStr appendString:value];
+					[tagStr appendString:@"\""];
 				}
 			}
 		}
-		tagStr = [tagStr stringByAppendingFormat:@" %@", [propArr componentsJoinedByString:@" "]];
 	}
 	
 	return tagStr;
@@ -302,16 +325,13 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 	NSMutableArray *parts = [NSMutableArray array];
 	
 	// collect all ivars
-	unsigned int num, i;
-	Ivar *ivars = class_copyIvarList([self class], &num);
-	for (i = 0; i < num; ++i) {
-		id anObject = object_getIvar(self, ivars[i]);
+	for (INProperty *prop in [[INPropertyPlan planForClass:[self class]] properties]) {
+		id anObject = [prop valueForObject:self];
 		
 		// we can omit empty ivars
 		if (anObject) {
-			NSString *propertyName = [NSString stringWithCString:ivar_getName(ivars[i]) encoding:NSUTF8StringEncoding];
-			propertyName = [[self class] flatXMLNameForPropertyName:propertyName];
-			NSString *fullName = ([prefix length] > 0) ? [NSString stringWithFormat:@"%@_%@", prefix, propertyName] : propertyName;
+			NSString *propertyName = [[self class] flatXMLNameForPropertyName:prop.name];
+			NSString *fullName = flatXMLName(prefix, propertyName);
 			
 			// ivar is an IndivoAbstractDocument subclass
 			if ([anObject respondsToSelector:@selector(flatXML)]) {
@@ -343,7 +363,6 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 			}
 		}
 	}
-	free(ivars);
 	
 	return parts;
 }
@@ -418,3 +437,22 @@ NSString *const INClassGeneratorTypePrefix = @"indivo";
 
 
 @end
+
+
+/**
+ *	Returns the flat XML field name for a property name, which is "prefix_name" or only "name" if there is no prefix.
+ *	This is called for every property at every nesting level when reading and writing flat XML, so we don't go through format string parsing.
+ */
+NSString *flatXMLName(NSString *prefix, NSString *name)
+{
+	NSUInteger prefixLength = [prefix length];
+	if (prefixLength < 1) {
+		return name;
+	}
+	
+	NSMutableString *fullName = [[NSMutableString alloc] initWithCapacity:prefixLength + 1 + [name length]];
+	[fullName appendString:prefix];
+	[fullName appendString:@"_"];
+	[fullName appendString:name];
+	return fullName;
+}
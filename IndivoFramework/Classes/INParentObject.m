@@ -21,19 +21,20 @@
  */
 
 #import "INParentObject.h"
-#import "NSObject+ClassUtils.h"
-#import <objc/runtime.h>
+#import "INPropertyPlan.h"
+#import "INXMLWriter.h"
 
 @implementation INParentObject
 
 
-- (NSString *)xml
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [NSString stringWithFormat:@"<%@>\n\t%@\n</%@>", [self tagString], [self innerXML], self.nodeName];
-#else
-	return [NSString stringWithFormat:@"<%@>%@</%@>", [self tagString], [self innerXML], self.nodeName];
-#endif
+	[writer appendStartTag:[self tagString]];
+	writer.depth++;
+	[self writeInnerXMLTo:writer];
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:self.nodeName];
 }
 
 
@@ -46,21 +47,16 @@
 	if (aNode) {
 		[super setFromNode:aNode];
 		
-		NSArray *myAttrs = [[self class] attributeNames];
-		
 		// try to auto-generate properties for all ivar names by inferring the node name and pull out their content
-		unsigned int num, i;
-		Ivar *ivars = class_copyIvarList([self class], &num);
-		for (i = 0; i < num; i++) {
-			id ivarObj = object_getIvar(self, ivars[i]);
-			NSString *ivarName = ivarNameFromIvar(ivars[i]);
-			Class ivarClass = ivarObj ? [ivarObj class] : classFromIvar(ivars[i]);
+		for (INProperty *prop in [[INPropertyPlan planForClass:[self class]] properties]) {
+			NSString *ivarName = prop.name;
+			Class ivarClass = [prop classForObject:self];
 			if (!ivarClass) {
 				DLog(@"Can't determine class for ivar \"%@\"", ivarName);
 				continue;
 			}
 			
-			BOOL useAttribute = [myAttrs containsObject:ivarName];
+			BOOL useAttribute = prop.isAttribute;
 			id value = nil;
 			INXMLNode *myNode = [aNode childNamed:ivarName];
 			
@@ -82,30 +78,47 @@
 			}
 			
 			// set the ivar (even if it's nil!)
-			object_setIvar(self, ivars[i], value);
+			[prop setValue:value forObject:self];
 		}
-		free(ivars);
 	}
 }
 
 
 /**
  *	Returns the XML of all child nodes.
- *	By default, this walks all the ivars of the class (NOT including the ivars of the superclass) and creates nodes based on the ivar name.
  */
 - (NSString *)innerXML
 {
-	NSMutableArray *xmlValues = [NSMutableArray array];
-	
-	// collect all ivars
-	unsigned int num, i;
-	Ivar *ivars = class_copyIvarList([self class], &num);
-	for (i = 0; i < num; ++i) {
-		id anObject = object_getIvar(self, ivars[i]);
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeInnerXMLTo:writer];
+	return [writer string];
+}
+
+/**
+ *	Appends the XML of all child nodes to the writer, each on its own line when pretty formatting.
+ *	By default, this walks all the ivars of the class (NOT including the ivars of the superclass) and creates nodes based on the ivar name.
+ */
+- (void)writeInnerXMLTo:(INXMLWriter *)writer
+{
+	for (INProperty *prop in [[INPropertyPlan planForClass:[self class]] properties]) {
+		id anObject = [prop valueForObject:self];
 		
 		// we can omit empty ivars
 		if (anObject) {
-			NSString *ivarName = ivarNameFromIvar(ivars[i]);
+			NSString *ivarName = prop.name;
+			
+			// ivar is another parent object, let it write its children directly
+			if ([anObject isKindOfClass:[INParentObject class]]) {
+				[writer indent];
+				[writer appendStartTag:ivarName];
+				writer.depth++;
+				[anObject writeInnerXMLTo:writer];
+				writer.depth--;
+				[writer indent];
+				[writer appendEndTag:ivarName];
+				continue;
+			}
+			
 			NSString *content = @"";
 			
 			// ivar is another INObject
@@ -129,18 +142,11 @@
 			}
 			
 			if (content) {
-				[xmlValues addObject:[NSString stringWithFormat:@"<%@>%@</%@>", ivarName, content, ivarName]];
+				[writer indent];
+				[writer appendElement:ivarName content:content];
 			}
 		}
 	}
-	free(ivars);
-	
-	// compose
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [xmlValues componentsJoinedByString:@"\n\t"];
-#else
-	return [xmlValues componentsJoinedByString:@""];
-#endif
 }
 
 
@@ -0,0 +1,58 @@
+/*
+ INPropertyPlan.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+
+
+/**
+ *	Describes one instance variable of a class as needed to (de)serialize it from and to XML.
+ */
+@interface INProperty : NSObject
+
+@property (nonatomic, readonly, copy) NSString *name;						///< The ivar name, which is also the XML node or attribute name
+@property (nonatomic, readonly, assign) Ivar ivar;							///< The runtime ivar
+@property (nonatomic, readonly, assign) ptrdiff_t offset;					///< The ivar's offset in the instance
+@property (nonatomic, readonly, assign) BOOL isObject;						///< YES if the ivar holds an object, NO for primitives
+@property (nonatomic, readonly, unsafe_unretained) Class ivarClass;			///< The declared class of the ivar, Nil for primitives and "id" ivars
+@property (nonatomic, readonly, unsafe_unretained) Class itemClass;			///< For NSArray ivars, the class of the items as given by "propertyClassMapper"
+@property (nonatomic, readonly, assign) BOOL isAttribute;					///< YES if the ivar name appears in the class' "attributeNames"
+
+- (id)valueForObject:(id)object;
+- (Class)classForObject:(id)object;
+- (void)setValue:(id)value forObject:(id)object;
+
+@end
+
+
+/**
+ *	The property plan of a class lists all its own instance variables (not the inherited ones) in declaration order.
+ *	Reflecting on a class with class_copyIvarList and friends is expensive, so plans are computed once per class and kept in a thread-safe registry.
+ */
+@interface INPropertyPlan : NSObject
+
+@property (nonatomic, readonly, unsafe_unretained) Class planClass;			///< The class this plan describes
+@property (nonatomic, readonly, copy) NSArray *properties;					///< INProperty instances for all of planClass' own ivars
+
++ (INPropertyPlan *)planForClass:(Class)aClass;
+
+
+@end
@@ -0,0 +1,188 @@
+/*
+ INPropertyPlan.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import "INPropertyPlan.h"
+#import "NSObject+ClassUtils.h"
+
+
+@interface INProperty ()
+
+@property (nonatomic, readwrite, copy) NSString *name;
+@property (nonatomic, readwrite, assign) Ivar ivar;
+@property (nonatomic, readwrite, assign) ptrdiff_t offset;
+@property (nonatomic, readwrite, assign) BOOL isObject;
+@property (nonatomic, readwrite, unsafe_unretained) Class ivarClass;
+@property (nonatomic, readwrite, unsafe_unretained) Class itemClass;
+@property (nonatomic, readwrite, assign) BOOL isAttribute;
+
+@end
+
+
+@implementation INProperty
+
+@synthesize name, ivar, offset, isObject, ivarClass, itemClass, isAttribute;
+
+
+/**
+ *	Returns the ivar value of the given object, read directly at the ivar's offset
+ */
+- (id)valueForObject:(id)object
+{
+	if (!object || !isObject) {
+		return nil;
+	}
+	return *(__unsafe_unretained id *)((char *)(__bridge void *)object + offset);
+}
+
+/**
+ *	Returns the class of the current ivar value if it is set, the declared ivar class otherwise
+ */
+- (Class)classForObject:(id)object
+{
+	id value = [self valueForObject:object];
+	return value ? [value class] : ivarClass;
+}
+
+/**
+ *	Sets the ivar of the given object
+ */
+- (void)setValue:(id)value forObject:(id)object
+{
+	object_setIvar(object, ivar, value);
+}
+
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"%@ <%p> %@ [%@]%@", NSStringFromClass([self class]), self, name, NSStringFromClass(ivarClass), (isAttribute ? @" (attribute)" : @"")];
+}
+
+
+@end
+
+
+@interface INPropertyPlan ()
+
+@property (nonatomic, readwrite, unsafe_unretained) Class planClass;
+@property (nonatomic, readwrite, copy) NSArray *properties;
+
+- (id)initWithClass:(Class)aClass;
++ (dispatch_queue_t)registryQueue;
+
+@end
+
+
+@implementation INPropertyPlan
+
+@synthesize planClass, properties;
+
+
+/**
+ *	Collects the ivars of the given class. This is the only place where we use the expensive runtime reflection.
+ */
+- (id)initWithClass:(Class)aClass
+{
+	if ((self = [super init])) {
+		self.planClass = aClass;
+		
+		NSArray *attributes = [aClass respondsToSelector:@selector(attributeNames)] ? [aClass performSelector:@selector(attributeNames)] : nil;
+		BOOL hasItemClasses = [aClass respondsToSelector:@selector(classForProperty:)];
+		
+		unsigned int num, i;
+		Ivar *ivars = class_copyIvarList(aClass, &num);
+		NSMutableArray *props = [NSMutableArray arrayWithCapacity:num];
+		for (i = 0; i < num; i++) {
+			INProperty *prop = [INProperty new];
+			prop.ivar = ivars[i];
+			prop.offset = ivar_getOffset(ivars[i]);
+			prop.name = ivarNameFromIvar(ivars[i]);
+			
+			// only object ivars have a class, we leave primitives at Nil
+			const char *type = ivar_getTypeEncoding(ivars[i]);
+			if (type && '@' == type[0]) {
+				prop.isObject = YES;
+				prop.ivarClass = classFromIvar(ivars[i]);
+			}
+			prop.isAttribute = [attributes containsObject:prop.name];
+			if (hasItemClasses) {
+				prop.itemClass = [aClass performSelector:@selector(classForProperty:) withObject:prop.name];
+			}
+			[props addObject:prop];
+		}
+		free(ivars);
+		
+		self.properties = props;
+	}
+	return self;
+}
+
+
+/**
+ *	Returns the cached plan for the given class, creating it on first access.
+ *	Plans are never invalidated, classes don't change their ivars at runtime. If two threads ask for a new plan at the same time both compute it, but only
+ *	the first one ends up in the registry.
+ */
++ (INPropertyPlan *)planForClass:(Class)aClass
+{
+	if (!aClass) {
+		return nil;
+	}
+	
+	static CFMutableDictionaryRef registry = NULL;
+	dispatch_queue_t queue = [self registryQueue];
+	
+	__block INPropertyPlan *plan = nil;
+	dispatch_sync(queue, ^{
+		if (!registry) {
+			registry = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+		}
+		plan = (__bridge INPropertyPlan *)CFDictionaryGetValue(registry, (__bridge const void *)aClass);
+	});
+	if (plan) {
+		return plan;
+	}
+	
+	INPropertyPlan *newPlan = [[self alloc] initWithClass:aClass];
+	dispatch_sync(queue, ^{
+		plan = (__bridge INPropertyPlan *)CFDictionaryGetValue(registry, (__bridge const void *)aClass);
+		if (!plan) {
+			CFDictionarySetValue(registry, (__bridge const void *)aClass, (__bridge const void *)newPlan);
+			plan = newPlan;
+		}
+	});
+	return plan;
+}
+
+/**
+ *	The queue guarding the plan registry
+ */
++ (dispatch_queue_t)registryQueue
+{
+	static dispatch_queue_t registryQueue = NULL;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		registryQueue = dispatch_queue_create("org.chip.indivo.framework.propertyplanqueue", NULL);
+	});
+	return registryQueue;
+}
+
+
+@end
@@ -0,0 +1,51 @@
+/*
+ INQueryEngine.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+@class INQueryParameter;
+
+
+/**
+ *	Runs INQueryParameter queries against report objects held in memory, so data that has been fetched once can be filtered, sorted, grouped and
+ *	aggregated again without going back to the server.
+ *
+ *	Fields are addressed by their flat Indivo 2.0 field names, e.g. "collected_at" or "quantitative_result_value_value" for lab results, just like they
+ *	are when querying the server. Values of a field are extracted once and kept, as are date buckets, so re-slicing the same reports (e.g. switching from
+ *	monthly to weekly grouping) only costs a pass over the cached columns. The engine is not thread safe.
+ */
+@interface INQueryEngine : NSObject
+
+@property (nonatomic, readonly, copy) NSArray *reports;					///< The objects being queried, usually IndivoDocument subclass instances
+
+- (id)initWithReports:(NSArray *)someReports;
+
+- (NSArray *)resultsForQuery:(INQueryParameter *)aQuery;
+- (NSArray *)reportsMatchingQuery:(INQueryParameter *)aQuery;
+- (NSArray *)aggregateReportsForQuery:(INQueryParameter *)aQuery;
+
+- (NSArray *)valuesOfField:(NSString *)fieldName;
++ (id)valueOfField:(NSString *)fieldName inObject:(id)anObject;
+
+
+@end
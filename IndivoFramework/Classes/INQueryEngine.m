@@ -0,0 +1,588 @@
+/*
+ INQueryEngine.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#import "INQueryEngine.h"
+#import "INQueryParameter.h"
+#import "INPropertyPlan.h"
+#import "INObjects.h"
+#import "IndivoDocument.h"
+#import "IndivoAggregateReport.h"
+#import <objc/runtime.h>
+
+
+/**
+ *	Collects the values of one group while aggregating
+ */
+@interface INAggregateBucket : NSObject {
+@public
+	NSUInteger count;
+	NSDecimalNumber *sum;
+	NSDecimalNumber *min;
+	NSDecimalNumber *max;
+}
+
+@property (nonatomic, copy) NSString *group;						///< The group label, nil if the query doesn't group
+@property (nonatomic, strong) NSDecimalNumber *result;				///< The aggregated value, set by "resultForOperator:"
+
+- (void)addValue:(id)value forOperator:(INAggregationOperator)aggOperator;
+- (NSDecimalNumber *)resultForOperator:(INAggregationOperator)aggOperator;
+
+@end
+
+
+@interface INQueryEngine ()
+
+@property (nonatomic, readwrite, copy) NSArray *reports;
+@property (nonatomic, strong) NSMutableDictionary *columns;			///< Field name (or "field*increment" for date buckets) -> array with one value per report, NSNull where there is none
+@property (nonatomic, strong) NSCalendar *calendar;					///< Gregorian calendar in UTC with ISO 8601 weeks, used for date buckets
+
+- (NSMutableArray *)indexesMatchingQuery:(INQueryParameter *)aQuery;
+- (NSArray *)bucketsOfField:(NSString *)fieldName increment:(INDateGroup)increment;
+- (NSString *)bucketForDate:(NSDate *)date increment:(INDateGroup)increment;
+
+@end
+
+static NSArray *INPropertyPathForField(Class aClass, NSString *fieldName);
+static id INValueAtPath(id anObject, NSArray *path);
+static BOOL INValueMatchesFilter(id value, NSString *filterString, NSDecimalNumber *filterNumber, NSDate *filterDate);
+static NSComparisonResult INCompareQueryValues(id value1, id value2, BOOL descending);
+static NSString *INGroupString(id value);
+static NSRange INPageRange(NSUInteger count, INQueryParameter *aQuery);
+
+
+@implementation INQueryEngine
+
+@synthesize reports, columns, calendar;
+
+
+- (id)initWithReports:(NSArray *)someReports
+{
+	if ((self = [super init])) {
+		self.reports = someReports ? someReports : [NSArray array];
+		self.columns = [NSMutableDictionary dictionary];
+	}
+	return self;
+}
+
+
+
+#pragma mark - Querying
+/**
+ *	Runs the query the way the server would: if the query groups or aggregates, IndivoAggregateReport instances are returned, otherwise the matching
+ *	reports themselves.
+ */
+- (NSArray *)resultsForQuery:(INQueryParameter *)aQuery
+{
+	if ([aQuery.groupBy length] > 0
+		|| ([aQuery.aggregateBy length] > 0 && INAggregationOperatorUnknown != aQuery.aggregateOperator)
+		|| ([aQuery.dateGroupField length] > 0 && INDateGroupUnknown != aQuery.dateGroupIncrement)) {
+		return [self aggregateReportsForQuery:aQuery];
+	}
+	return [self reportsMatchingQuery:aQuery];
+}
+
+/**
+ *	Returns the reports passing the status, filters and date range of the query, ordered and paged accordingly. Grouping and aggregation are ignored.
+ */
+- (NSArray *)reportsMatchingQuery:(INQueryParameter *)aQuery
+{
+	NSMutableArray *indexes = [self indexesMatchingQuery:aQuery];
+	
+	// order
+	if ([aQuery.orderBy length] > 0) {
+		NSArray *column = [self valuesOfField:aQuery.orderBy];
+		BOOL descending = aQuery.descending;
+		[indexes sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(NSNumber *idx1, NSNumber *idx2) {
+			return INCompareQueryValues([column objectAtIndex:[idx1 unsignedIntegerValue]], [column objectAtIndex:[idx2 unsignedIntegerValue]], descending);
+		}];
+	}
+	
+	// page and collect
+	NSRange range = INPageRange([indexes count], aQuery);
+	NSMutableArray *matching = [NSMutableArray arrayWithCapacity:range.length];
+	for (NSNumber *idx in [indexes subarrayWithRange:range]) {
+		[matching addObject:[reports objectAtIndex:[idx unsignedIntegerValue]]];
+	}
+	return matching;
+}
+
+/**
+ *	Groups the reports passing the query by "dateGroupField"/"dateGroupIncrement" or "groupBy" and aggregates each group with "aggregateOperator" over
+ *	"aggregateBy". Without an aggregate field the grouped field is counted, which is what "queryParameters" asks the server for, too.
+ *	@return An array of IndivoAggregateReport instances, ordered by group unless the query orders by the aggregated field
+ */
+- (NSArray *)aggregateReportsForQuery:(INQueryParameter *)aQuery
+{
+	NSMutableArray *indexes = [self indexesMatchingQuery:aQuery];
+	
+	// what to group by
+	NSArray *groups = nil;
+	NSString *groupField = nil;
+	if ([aQuery.groupBy length] > 0) {
+		groupField = aQuery.groupBy;
+		groups = [self valuesOfField:groupField];
+	}
+	else if ([aQuery.dateGroupField length] > 0 && INDateGroupUnknown != aQuery.dateGroupIncrement) {
+		groupField = aQuery.dateGroupField;
+		groups = [self bucketsOfField:groupField increment:aQuery.dateGroupIncrement];
+	}
+	
+	// what to aggregate
+	NSString *aggregateField = aQuery.aggregateBy;
+	INAggregationOperator aggOperator = aQuery.aggregateOperator;
+	if ([aggregateField length] < 1 || INAggregationOperatorUnknown == aggOperator) {
+		aggregateField = groupField;
+		aggOperator = INAggregationOperatorCount;
+	}
+	NSArray *values = ([aggregateField length] > 0) ? [self valuesOfField:aggregateField] : nil;
+	
+	// fill the buckets
+	NSMutableDictionary *buckets = [NSMutableDictionary dictionary];
+	for (NSNumber *idx in indexes) {
+		NSUInteger i = [idx unsignedIntegerValue];
+		NSString *group = groups ? INGroupString([groups objectAtIndex:i]) : @"";
+		if (!group) {
+			continue;
+		}
+		
+		INAggregateBucket *bucket = [buckets objectForKey:group];
+		if (!bucket) {
+			bucket = [INAggregateBucket new];
+			bucket.group = groups ? group : nil;
+			[buckets setObject:bucket forKey:group];
+		}
+		[bucket addValue:(values ? [values objectAtIndex:i] : nil) forOperator:aggOperator];
+	}
+	
+	// aggregate and order
+	NSMutableArray *aggregated = [NSMutableArray arrayWithCapacity:[buckets count]];
+	for (INAggregateBucket *bucket in [buckets allValues]) {
+		bucket.result = [bucket resultForOperator:aggOperator];
+		if (bucket.result) {
+			[aggregated addObject:bucket];
+		}
+	}
+	
+	BOOL byValue = ([aQuery.orderBy length] > 0 && [aQuery.orderBy isEqualToString:aggregateField] && ![aQuery.orderBy isEqualToString:groupField]);
+	BOOL descending = aQuery.descending;
+	[aggregated sortUsingComparator:^NSComparisonResult(INAggregateBucket *bucket1, INAggregateBucket *bucket2) {
+		if (byValue) {
+			return INCompareQueryValues(bucket1.result, bucket2.result, descending);
+		}
+		NSComparisonResult result = [bucket1.group compare:bucket2.group options:NSNumericSearch];
+		return descending ? (NSComparisonResult)-result : result;
+	}];
+	
+	// create the reports
+	NSRange range = INPageRange([aggregated count], aQuery);
+	IndivoRecord *record = [[reports lastObject] isKindOfClass:[IndivoAbstractDocument class]] ? [[reports lastObject] record] : nil;
+	NSMutableArray *results = [NSMutableArray arrayWithCapacity:range.length];
+	for (INAggregateBucket *bucket in [aggregated subarrayWithRange:range]) {
+		IndivoAggregateReport *report = [IndivoAggregateReport newWithRecord:record];
+		report.value = [INString newWithString:[bucket.result stringValue]];
+		if (bucket.group) {
+			report.group = [INString newWithString:bucket.group];
+		}
+		[results addObject:report];
+	}
+	return results;
+}
+
+/**
+ *	Applies status, filters and date range of the query, column by column.
+ *	@return A mutable array with the indexes of the passing reports as NSNumber, in original order
+ */
+- (NSMutableArray *)indexesMatchingQuery:(INQueryParameter *)aQuery
+{
+	NSMutableIndexSet *passing = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, [reports count])];
+	
+	// status; reports fetched without meta data don't know their status and are kept
+	INDocumentStatus status = aQuery.status;
+	if (INDocumentStatusUnknown != status) {
+		[passing removeIndexes:[passing indexesPassingTest:^BOOL(NSUInteger idx, BOOL *stop) {
+			id report = [reports objectAtIndex:idx];
+			if ([report isKindOfClass:[IndivoDocument class]]) {
+				INDocumentStatus docStatus = [(IndivoDocument *)report documentStatus];
+				return (INDocumentStatusUnknown != docStatus && status != docStatus);
+			}
+			return NO;
+		}]];
+	}
+	
+	// filters
+	for (NSString *field in [aQuery.filters allKeys]) {
+		NSString *filterString = [aQuery.filters objectForKey:field];
+		if ([filterString length] < 1) {
+			continue;
+		}
+		
+		NSDecimalNumber *filterNumber = [NSDecimalNumber decimalNumberWithString:filterString];
+		if ([filterNumber isEqualToNumber:[NSDecimalNumber notANumber]]) {
+			filterNumber = nil;
+		}
+		NSDate *filterDate = [INDateTime parseDateFromISOString:filterString];
+		if (!filterDate) {
+			filterDate = [INDate parseDateFromISOString:filterString];
+		}
+		
+		NSArray *column = [self valuesOfField:field];
+		[passing removeIndexes:[passing indexesPassingTest:^BOOL(NSUInteger idx, BOOL *stop) {
+			return !INValueMatchesFilter([column objectAtIndex:idx], filterString, filterNumber, filterDate);
+		}]];
+	}
+	
+	// date range
+	if ([aQuery.dateRangeField length] > 0 && (aQuery.dateRangeStart || aQuery.dateRangeEnd)) {
+		NSDate *start = aQuery.dateRangeStart;
+		NSDate *end = aQuery.dateRangeEnd;
+		NSArray *column = [self valuesOfField:aQuery.dateRangeField];
+		[passing removeIndexes:[passing indexesPassingTest:^BOOL(NSUInteger idx, BOOL *stop) {
+			NSDate *date = [column objectAtIndex:idx];
+			if (![date isKindOfClass:[NSDate class]]) {
+				return YES;
+			}
+			return ((start && NSOrderedAscending == [date compare:start]) || (end && NSOrderedDescending == [date compare:end]));
+		}]];
+	}
+	
+	NSMutableArray *indexes = [NSMutableArray arrayWithCapacity:[passing count]];
+	[passing enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+		[indexes addObject:[NSNumber numberWithUnsignedInteger:idx]];
+	}];
+	return indexes;
+}
+
+
+
+#pragma mark - Columns
+/**
+ *	The values of the given flat field name for all reports, in report order, with NSNull for reports that don't have a value. Values are NSString,
+ *	NSDecimalNumber/NSNumber or NSDate instances. The column is extracted on first use and cached.
+ */
+- (NSArray *)valuesOfField:(NSString *)fieldName
+{
+	NSArray *column = [columns objectForKey:fieldName];
+	if (!column) {
+		NSMutableArray *values = [NSMutableArray arrayWithCapacity:[reports count]];
+		Class lastClass = Nil;
+		NSArray *path = nil;
+		
+		for (id report in reports) {
+			if ([report class] != lastClass) {
+				lastClass = [report class];
+				path = INPropertyPathForField(lastClass, fieldName);
+			}
+			id value = INValueAtPath(report, path);
+			[values addObject:(value ? value : [NSNull null])];
+		}
+		
+		column = [values copy];
+		[columns setObject:column forKey:fieldName];
+	}
+	return column;
+}
+
+/**
+ *	Returns the query value (NSString, NSNumber or NSDate) of the given flat field name in the object, nil if the object has no such field or no value.
+ */
++ (id)valueOfField:(NSString *)fieldName inObject:(id)anObject
+{
+	return INValueAtPath(anObject, INPropertyPathForField([anObject class], fieldName));
+}
+
+/**
+ *	The date bucket labels of a date field for all reports, cached like the field values themselves.
+ */
+- (NSArray *)bucketsOfField:(NSString *)fieldName increment:(INDateGroup)increment
+{
+	NSString *key = [NSString stringWithFormat:@"%@*%@", fieldName, dateGroupIncrementStringFor(increment)];
+	NSArray *column = [columns objectForKey:key];
+	if (!column) {
+		NSArray *dates = [self valuesOfField:fieldName];
+		NSMutableArray *buckets = [NSMutableArray arrayWithCapacity:[dates count]];
+		for (id date in dates) {
+			NSString *bucket = [date isKindOfClass:[NSDate class]] ? [self bucketForDate:date increment:increment] : nil;
+			[buckets addObject:(bucket ? bucket : (id)[NSNull null])];
+		}
+		
+		column = [buckets copy];
+		[columns setObject:column forKey:key];
+	}
+	return column;
+}
+
+/**
+ *	The label of the bucket the date falls into, zero-padded so labels sort chronologically: "2012-03-05T14" for hours, "2012-03-05" for days,
+ *	"2012-W10" for ISO weeks, "2012-03" for months, "2012" for years and "14", "1" (Monday) to "7", "10" and "03" for hour of day, day of week, week of
+ *	year and month of year.
+ */
+- (NSString *)bucketForDate:(NSDate *)date increment:(INDateGroup)increment
+{
+	NSUInteger units = NSYearCalendarUnit | NSMonthCalendarUnit | NSDayCalendarUnit | NSHourCalendarUnit | NSWeekCalendarUnit | NSWeekdayCalendarUnit;
+	NSDateComponents *comps = [self.calendar components:units fromDate:date];
+	int year = (int)[comps year];
+	int month = (int)[comps month];
+	int week = (int)[comps week];
+	
+	// the first days of January may belong to the last week of the previous year and the last days of December to the first week of the next
+	int weekYear = year;
+	if (week > 50 && 1 == month) {
+		weekYear--;
+	}
+	else if (1 == week && 12 == month) {
+		weekYear++;
+	}
+	
+	switch (increment) {
+		case INDateGroupHour:
+			return [NSString stringWithFormat:@"%04d-%02d-%02dT%02d", year, month, (int)[comps day], (int)[comps hour]];
+		case INDateGroupDay:
+			return [NSString stringWithFormat:@"%04d-%02d-%02d", year, month, (int)[comps day]];
+		case INDateGroupWeek:
+			return [NSString stringWithFormat:@"%04d-W%02d", weekYear, week];
+		case INDateGroupMonth:
+			return [NSString stringWithFormat:@"%04d-%02d", year, month];
+		case INDateGroupYear:
+			return [NSString stringWithFormat:@"%04d", year];
+		case INDateGroupHourOfDay:
+			return [NSString stringWithFormat:@"%02d", (int)[comps hour]];
+		case INDateGroupDayOfWeek:
+			return [NSString stringWithFormat:@"%d", (int)(([comps weekday] + 5) % 7) + 1];
+		case INDateGroupWeekOfYear:
+			return [NSString stringWithFormat:@"%02d", week];
+		case INDateGroupMonthOfYear:
+			return [NSString stringWithFormat:@"%02d", month];
+		default:
+			return nil;
+	}
+}
+
+- (NSCalendar *)calendar
+{
+	if (!calendar) {
+		NSCalendar *gregorian = [[NSCalendar alloc] initWithCalendarIdentifier:NSGregorianCalendar];
+		gregorian.timeZone = [NSTimeZone timeZoneWithName:@"UTC"];
+		gregorian.firstWeekday = 2;
+		gregorian.minimumDaysInFirstWeek = 4;
+		self.calendar = gregorian;
+	}
+	return calendar;
+}
+
+
+@end
+
+
+@implementation INAggregateBucket
+
+@synthesize group, result;
+
+
+- (void)addValue:(id)value forOperator:(INAggregationOperator)aggOperator
+{
+	if (!value || [NSNull null] == value) {
+		return;
+	}
+	if (INAggregationOperatorCount == aggOperator) {
+		count++;
+		return;
+	}
+	if (![value isKindOfClass:[NSNumber class]]) {
+		return;
+	}
+	
+	NSDecimalNumber *number = [value isKindOfClass:[NSDecimalNumber class]] ? value : [NSDecimalNumber decimalNumberWithDecimal:[value decimalValue]];
+	count++;
+	sum = sum ? [sum decimalNumberByAdding:number] : number;
+	if (!min || NSOrderedAscending == [number compare:min]) {
+		min = number;
+	}
+	if (!max || NSOrderedDescending == [number compare:max]) {
+		max = number;
+	}
+}
+
+/**
+ *	The aggregated value, nil if the group has no values to aggregate
+ */
+- (NSDecimalNumber *)resultForOperator:(INAggregationOperator)aggOperator
+{
+	if (INAggregationOperatorCount == aggOperator) {
+		return [NSDecimalNumber decimalNumberWithMantissa:count exponent:0 isNegative:NO];
+	}
+	if (count < 1) {
+		return nil;
+	}
+	
+	switch (aggOperator) {
+		case INAggregationOperatorSum:
+			return sum;
+		case INAggregationOperatorAverage:
+			return [sum decimalNumberByDividingBy:[NSDecimalNumber decimalNumberWithMantissa:count exponent:0 isNegative:NO]];
+		case INAggregationOperatorMin:
+			return min;
+		case INAggregationOperatorMax:
+			return max;
+		default:
+			return nil;
+	}
+}
+
+
+@end
+
+
+
+#pragma mark - Field Values
+/**
+ *	Finds the chain of properties leading from instances of the class to the flat field name, e.g. "quantitative_result", "value", "value" for
+ *	"quantitative_result_value_value" on lab results. Walks the class' own properties and those of its superclasses up to IndivoDocument/INParentObject.
+ */
+static NSArray *INPropertyPathForField(Class aClass, NSString *fieldName)
+{
+	for (Class cls = aClass; cls && cls != [IndivoDocument class] && cls != [INParentObject class] && cls != [INObject class]; cls = class_getSuperclass(cls)) {
+		BOOL renames = [cls respondsToSelector:@selector(flatXMLNameForPropertyName:)];
+		
+		for (INProperty *prop in [[INPropertyPlan planForClass:cls] properties]) {
+			if (!prop.isObject) {
+				continue;
+			}
+			NSString *name = renames ? [cls flatXMLNameForPropertyName:prop.name] : prop.name;
+			NSUInteger length = [name length];
+			
+			if ([fieldName isEqualToString:name]) {
+				return [NSArray arrayWithObject:prop];
+			}
+			if ([fieldName length] > length + 1 && [fieldName hasPrefix:name] && '_' == [fieldName characterAtIndex:length] && prop.ivarClass) {
+				NSArray *subPath = INPropertyPathForField(prop.ivarClass, [fieldName substringFromIndex:length + 1]);
+				if (subPath) {
+					return [[NSArray arrayWithObject:prop] arrayByAddingObjectsFromArray:subPath];
+				}
+			}
+		}
+	}
+	return nil;
+}
+
+/**
+ *	Follows the property path and returns the value at its end as NSString, NSNumber or NSDate, nil if there is none.
+ */
+static id INValueAtPath(id anObject, NSArray *path)
+{
+	if (!path) {
+		return nil;
+	}
+	for (INProperty *prop in path) {
+		anObject = [prop valueForObject:anObject];
+		if (!anObject) {
+			return nil;
+		}
+	}
+	
+	if ([anObject isKindOfClass:[NSString class]] || [anObject isKindOfClass:[NSNumber class]] || [anObject isKindOfClass:[NSDate class]]) {
+		return anObject;
+	}
+	if ([anObject isKindOfClass:[INString class]]) {
+		return [(INString *)anObject string];
+	}
+	if ([anObject isKindOfClass:[INDate class]]) {
+		return [(INDate *)anObject date];
+	}
+	if ([anObject isKindOfClass:[INDecimal class]]) {
+		return [(INDecimal *)anObject number];
+	}
+	if ([anObject isKindOfClass:[INBool class]]) {
+		return [NSNumber numberWithBool:[(INBool *)anObject flag]];
+	}
+	return nil;
+}
+
+/**
+ *	Filters match exactly, numbers and dates are compared by value.
+ */
+static BOOL INValueMatchesFilter(id value, NSString *filterString, NSDecimalNumber *filterNumber, NSDate *filterDate)
+{
+	if ([value isKindOfClass:[NSString class]]) {
+		return [value isEqualToString:filterString];
+	}
+	if ([value isKindOfClass:[NSNumber class]]) {
+		return (filterNumber && NSOrderedSame == [value compare:filterNumber]);
+	}
+	if ([value isKindOfClass:[NSDate class]]) {
+		return (filterDate && [value isEqualToDate:filterDate]);
+	}
+	return NO;
+}
+
+/**
+ *	Compares two column values, always sorting NSNull to the end no matter the direction.
+ */
+static NSComparisonResult INCompareQueryValues(id value1, id value2, BOOL descending)
+{
+	BOOL null1 = ([NSNull null] == value1);
+	BOOL null2 = ([NSNull null] == value2);
+	if (null1 || null2) {
+		return (null1 == null2) ? NSOrderedSame : (null1 ? NSOrderedDescending : NSOrderedAscending);
+	}
+	
+	NSComparisonResult result = NSOrderedSame;
+	if (([value1 isKindOfClass:[NSString class]] && [value2 isKindOfClass:[NSString class]])
+		|| ([value1 isKindOfClass:[NSNumber class]] && [value2 isKindOfClass:[NSNumber class]])
+		|| ([value1 isKindOfClass:[NSDate class]] && [value2 isKindOfClass:[NSDate class]])) {
+		result = [value1 compare:value2];
+	}
+	else {
+		result = [[value1 description] compare:[value2 description]];
+	}
+	return descending ? (NSComparisonResult)-result : result;
+}
+
+/**
+ *	The group label for a column value, nil for NSNull.
+ */
+static NSString *INGroupString(id value)
+{
+	if ([value isKindOfClass:[NSString class]]) {
+		return value;
+	}
+	if ([value isKindOfClass:[NSDate class]]) {
+		return [INDateTime isoStringFrom:value];
+	}
+	if ([value isKindOfClass:[NSNumber class]]) {
+		return [value stringValue];
+	}
+	return nil;
+}
+
+/**
+ *	The part of "count" results selected by the query's offset and limit.
+ */
+static NSRange INPageRange(NSUInteger count, INQueryParameter *aQuery)
+{
+	NSUInteger start = MIN(aQuery.offset, count);
+	NSUInteger length = count - start;
+	if (aQuery.limit > 0) {
+		length = MIN(aQuery.limit, length);
+	}
+	return NSMakeRange(start, length);
+}
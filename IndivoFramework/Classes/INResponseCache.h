@@ -0,0 +1,58 @@
+/*
+ INResponseCache.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *	A response we received for a GET request, together with the validators the server sent along
+ */
+@interface INCachedResponse : NSObject
+
+@property (nonatomic, copy) NSString *ETag;								///< The "ETag" header of the response
+@property (nonatomic, copy) NSString *lastModified;						///< The "Last-Modified" header of the response
+@property (nonatomic, copy) NSDictionary *responseObject;				///< The response as handed to the call's callback, including the parsed INXMLNode
+
+- (NSDictionary *)validatorHeaders;
+
+@end
+
+
+/**
+ *	Remembers responses to GET requests by URL, so we can ask the server whether they changed instead of downloading them again.
+ *	
+ *	Only responses that came with an "ETag" or a "Last-Modified" header are kept. Entries are held in an NSCache, so they are evicted under memory
+ *	pressure and the class is thread-safe.
+ */
+@interface INResponseCache : NSObject
+
+@property (nonatomic, assign) NSUInteger totalCostLimit;				///< Roughly how many characters of response text to keep, 2 million by default
+
++ (NSString *)canonicalURLStringForURL:(NSURL *)baseURL method:(NSString *)method parameters:(NSArray *)parameters;
+
+- (INCachedResponse *)responseForURLString:(NSString *)urlString;
+- (BOOL)storeResponseObject:(NSDictionary *)responseObject headers:(NSDictionary *)headers forURLString:(NSString *)urlString;
+- (void)removeResponseForURLString:(NSString *)urlString;
+- (void)removeAllResponses;
+
+
+@end
@@ -0,0 +1,154 @@
+/*
+ INResponseCache.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#import "INResponseCache.h"
+#import "Indivo.h"
+#import "INURLLoader.h"
+
+#define kINResponseCacheDefaultTotalCostLimit 2000000
+
+
+
+
+@implementation INCachedResponse
+
+@synthesize ETag, lastModified, responseObject;
+
+
+/**
+ *	The headers to send along a GET request to only receive the response again if it has changed
+ */
+- (NSDictionary *)validatorHeaders
+{
+	NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithCapacity:2];
+	if (ETag) {
+		[headers setObject:ETag forKey:@"If-None-Match"];
+	}
+	if (lastModified) {
+		[headers setObject:lastModified forKey:@"If-Modified-Since"];
+	}
+	return headers;
+}
+
+@end
+
+
+@interface INResponseCache ()
+
+@property (nonatomic, strong) NSCache *responses;						///< INCachedResponse instances by canonical URL string
+
+@end
+
+
+@implementation INResponseCache
+
+@synthesize responses;
+
+
+- (id)init
+{
+	if ((self = [super init])) {
+		self.responses = [NSCache new];
+		self.totalCostLimit = kINResponseCacheDefaultTotalCostLimit;
+	}
+	return self;
+}
+
+- (NSUInteger)totalCostLimit
+{
+	return [responses totalCostLimit];
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit
+{
+	[responses setTotalCostLimit:totalCostLimit];
+}
+
+
+
+#pragma mark - Storing and Retrieving
+/**
+ *	The string by which we identify a GET request: the full URL with the parameters sorted, so the same request always maps to the same string.
+ *	@param baseURL The server URL
+ *	@param method The REST path
+ *	@param parameters An array full of @"key=value" NSString objects, can be nil
+ */
++ (NSString *)canonicalURLStringForURL:(NSURL *)baseURL method:(NSString *)method parameters:(NSArray *)parameters
+{
+	NSString *base = baseURL ? [baseURL absoluteString] : @"";
+	if ([parameters count] > 0) {
+		NSArray *sorted = [parameters sortedArrayUsingSelector:@selector(compare:)];
+		return [NSString stringWithFormat:@"%@%@?%@", base, method, [sorted componentsJoinedByString:@"&"]];
+	}
+	return [NSString stringWithFormat:@"%@%@", base, method];
+}
+
+- (INCachedResponse *)responseForURLString:(NSString *)urlString
+{
+	if (!urlString) {
+		return nil;
+	}
+	return [responses objectForKey:urlString];
+}
+
+/**
+ *	Stores the response if the headers contain an "ETag" or "Last-Modified" validator, otherwise removes a previously stored response for the URL.
+ *	@param responseObject The response dictionary, usually containing the response string and the parsed INXMLNode
+ *	@param headers The HTTP headers of the response
+ *	@param urlString The canonical URL string of the request
+ *	@return YES if the response was stored
+ */
+- (BOOL)storeResponseObject:(NSDictionary *)responseObject headers:(NSDictionary *)headers forURLString:(NSString *)urlString
+{
+	if (!urlString) {
+		return NO;
+	}
+	
+	NSString *etag = INHeaderValue(headers, @"ETag");
+	NSString *modified = INHeaderValue(headers, @"Last-Modified");
+	if (!responseObject || (!etag && !modified)) {
+		[responses removeObjectForKey:urlString];
+		return NO;
+	}
+	
+	INCachedResponse *cached = [INCachedResponse new];
+	cached.ETag = etag;
+	cached.lastModified = modified;
+	cached.responseObject = responseObject;
+	[responses setObject:cached forKey:urlString cost:[[responseObject objectForKey:INResponseStringKey] length]];
+	return YES;
+}
+
+- (void)removeResponseForURLString:(NSString *)urlString
+{
+	if (urlString) {
+		[responses removeObjectForKey:urlString];
+	}
+}
+
+- (void)removeAllResponses
+{
+	[responses removeAllObjects];
+}
+
+
+@end
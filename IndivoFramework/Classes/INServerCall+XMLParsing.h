@@ -29,5 +29,6 @@
 @interface INServerCall (XMLParsing)
 
 - (void)parseXML:(NSString *)xmlString intoResponseDictionary:(NSMutableDictionary *)dict;
+- (void)parseXMLData:(NSData *)xmlData intoResponseDictionary:(NSMutableDictionary *)dict;
 
 @end
@@ -42,5 +42,23 @@
 	}
 }
 
+/**
+ *	Parses the raw response data with the SAX parser, this avoids decoding the response into a string first
+ */
+- (void)parseXMLData:(NSData *)xmlData intoResponseDictionary:(NSMutableDictionary *)dict
+{
+	if ([xmlData length] > 0) {
+		NSError *xmlParseError = nil;
+		
+		INXMLNode *xmlDoc = [INXMLParser parseXMLData:xmlData error:&xmlParseError];
+		if (xmlDoc) {
+			[dict setObject:xmlDoc forKey:INResponseXMLKey];
+		}
+		if (xmlParseError) {
+			[dict setObject:xmlParseError forKey:INErrorKey];
+		}
+	}
+}
+
 
 @end
@@ -37,11 +37,17 @@
 @property (nonatomic, copy) NSString *method;								///< The method to call on the server URL
 @property (nonatomic, copy) NSString *HTTPMethod;							///< Will be GET by default
 @property (nonatomic, copy) NSString *body;									///< Body data, takes precedence over "parameters" if length is > 0
+@property (nonatomic, copy) NSData *bodyData;								///< Raw body data, takes precedence over "body" if length is > 0
 @property (nonatomic, strong) NSArray *parameters;							///< An array with @"key=value" strings to be passed to the server, overridden by "body"
 @property (nonatomic, strong) MPOAuthAPI *oauth;							///< The call will retain a copy of the oauth instance
+@property (nonatomic, assign) BOOL oauthIsCopy;								///< YES if the server gave the call its own copy of its OAuth instance to run concurrently
 @property (nonatomic, assign) BOOL finishIfAuthenticated;					///< If YES the call is merely a proxy to the OAuth authentication call
 @property (nonatomic, copy) INSuccessRetvalueBlock myCallback;				///< The callback after finishing our call
 @property (nonatomic, readonly, assign) BOOL hasBeenFired;					///< As the name suggests, tells us whether it has been sent on the journey
+@property (nonatomic, readonly, assign) NSUInteger bytesSent;				///< Body bytes sent, after compression
+@property (nonatomic, readonly, assign) NSUInteger uncompressedBytesSent;	///< Body bytes sent, before compression
+@property (nonatomic, readonly, assign) NSUInteger bytesReceived;			///< Response bytes received, before decompression if the server reported the compressed size
+@property (nonatomic, readonly, assign) NSUInteger uncompressedBytesReceived;	///< Response bytes received, after decompression
 
 + (INServerCall *)newForServer:(IndivoServer *)aServer;
 - (id)initWithServer:(IndivoServer *)aServer;
@@ -51,12 +57,18 @@
 - (void)post:(NSString *)inMethod body:(NSString *)dataString oauth:(MPOAuthAPI *)inOAuth callback:(INSuccessRetvalueBlock)inCallback;
 - (void)fire:(NSString *)inMethod withParameters:(NSArray *)inParameters httpMethod:(NSString *)httpMethod oauth:(MPOAuthAPI *)inOAuth callback:(INSuccessRetvalueBlock)inCallback;
 - (void)fire;
+- (NSMutableURLRequest *)requestWithValidators:(NSDictionary *)validators;
+- (NSMutableURLRequest *)requestWithBodyData:(NSData *)data;
 
 - (void)finishWith:(NSDictionary *)returnObject;
+- (void)finishWith:(NSDictionary *)returnObject statusCode:(NSInteger)statusCode responseHeaders:(NSDictionary *)headers;
 - (void)cancel;
 - (void)abortWithError:(NSError *)error;
 
 - (BOOL)isAuthenticationCall;
+- (NSString *)canonicalURLString;
+- (NSURL *)requestURL;
+- (NSDictionary *)conditionalRequestHeaders;
 
 
 @end
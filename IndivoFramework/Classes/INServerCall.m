@@ -23,6 +23,8 @@
 
 #import "INServerCall.h"
 #import "IndivoServer.h"
+#import "INResponseCache.h"
+#import "NSData+Gzip.h"
 
 
 @interface INServerCall ()
@@ -31,6 +33,10 @@
 @property (nonatomic, assign) BOOL retryWithNewTokenAfterFailure;
 @property (nonatomic, assign) BOOL didRetryWithNewTokenAfterFailure;
 @property (nonatomic, strong) NSDictionary *responseObject;
+@property (nonatomic, readwrite, assign) NSUInteger bytesSent;
+@property (nonatomic, readwrite, assign) NSUInteger uncompressedBytesSent;
+@property (nonatomic, readwrite, assign) NSUInteger bytesReceived;
+@property (nonatomic, readwrite, assign) NSUInteger uncompressedBytesReceived;
 
 - (void)didFinishSuccessfully:(BOOL)success returnObject:(NSDictionary *)returnObject;
 
@@ -40,8 +46,9 @@
 @implementation INServerCall
 
 @synthesize server;
-@synthesize method, body, parameters, HTTPMethod, oauth, finishIfAuthenticated;
+@synthesize method, body, bodyData, parameters, HTTPMethod, oauth, oauthIsCopy, finishIfAuthenticated;
 @synthesize hasBeenFired, retryWithNewTokenAfterFailure, didRetryWithNewTokenAfterFailure, responseObject, myCallback;
+@synthesize bytesSent, uncompressedBytesSent, bytesReceived, uncompressedBytesReceived;
 
 
 /**
@@ -192,6 +199,10 @@
 		return;
 	}
 	
+	// calls queued on the same instance have registered as delegates in the meantime, so claim it back
+	oauth.authDelegate = self;
+	oauth.loadDelegate = self;
+	
 	if (HTTPMethod) {
 		oauth.defaultHTTPMethod = HTTPMethod;
 	}
@@ -207,21 +218,23 @@
 	
 	// the main work performing call
 	else if (!self.finishIfAuthenticated) {
-		if ([body length] > 0) {
-			NSData *bodyData = [body dataUsingEncoding:NSUTF8StringEncoding];
-			
-			NSURL *fullURL = [NSURL URLWithString:[NSString stringWithFormat:@"%@%@", [self.oauth.baseURL absoluteString], self.method]];
-			NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:fullURL];
-			
-			[request setHTTPMethod:HTTPMethod];
-			[request setValue:@"application/xml" forHTTPHeaderField:@"Content-Type"];
-			[request setValue:[NSString stringWithFormat:@"%d", [bodyData length]] forHTTPHeaderField:@"Content-Length"];
-			[request setHTTPBody:bodyData];
-			
+		NSData *data = ([bodyData length] > 0) ? bodyData : [body dataUsingEncoding:NSUTF8StringEncoding];
+		if ([data length] > 0) {
+			NSMutableURLRequest *request = [self requestWithBodyData:data];
 			[self.oauth performURLRequest:request withDelegate:self];
 		}
 		else {
-			[self.oauth performMethod:method withParameters:parameters delegate:self];
+			
+			// MPOAuth can neither send validators nor ask for a compressed response, GETs that need either get a request of our own
+			NSDictionary *validators = [self conditionalRequestHeaders];
+			BOOL isGET = (!HTTPMethod || [@"GET" isEqualToString:HTTPMethod]);
+			if ([validators count] > 0 || (isGET && server.useCompression)) {
+				NSMutableURLRequest *request = [self requestWithValidators:validators];
+				[self.oauth performURLRequest:request withDelegate:self];
+			}
+			else {
+				[self.oauth performMethod:method withParameters:parameters delegate:self];
+			}
 		}
 	}
 	
@@ -233,6 +246,62 @@
 
 
 
+/**
+ *	Creates the GET request for our method and parameters. If the server has "useCompression" set, the request asks for a compressed response.
+ *	@param validators The "If-None-Match" and "If-Modified-Since" headers of a previous response, may be nil
+ *	@return The request, ready to be signed and sent
+ */
+- (NSMutableURLRequest *)requestWithValidators:(NSDictionary *)validators
+{
+	NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[self requestURL]];
+	[request setHTTPMethod:@"GET"];
+	
+	if ([validators count] > 0) {
+		[request setCachePolicy:NSURLRequestReloadIgnoringLocalCacheData];			// we want to see the 304 ourselves
+		for (NSString *field in [validators allKeys]) {
+			[request setValue:[validators objectForKey:field] forHTTPHeaderField:field];
+		}
+	}
+	if (server.useCompression) {
+		[request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"];
+	}
+	return request;
+}
+
+/**
+ *	Creates the request to send body data to our method. If the server has "useCompression" set, the request asks for a compressed response and bodies
+ *	of at least "compressionThreshold" bytes are sent gzipped.
+ *	@param data The body data, uncompressed
+ *	@return The request, ready to be signed and sent
+ */
+- (NSMutableURLRequest *)requestWithBodyData:(NSData *)data
+{
+	NSURL *fullURL = [NSURL URLWithString:[NSString stringWithFormat:@"%@%@", [self.oauth.baseURL absoluteString], self.method]];
+	NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:fullURL];
+	
+	[request setHTTPMethod:HTTPMethod];
+	[request setValue:@"application/xml" forHTTPHeaderField:@"Content-Type"];
+	self.uncompressedBytesSent = [data length];
+	
+	if (server.useCompression) {
+		[request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"];
+		if ([data length] >= server.compressionThreshold) {
+			NSData *gzipped = [data gzippedData];
+			if ([gzipped length] > 0 && [gzipped length] < [data length]) {
+				data = gzipped;
+				[request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+			}
+		}
+	}
+	
+	self.bytesSent = [data length];
+	[request setValue:[NSString stringWithFormat:@"%d", [data length]] forHTTPHeaderField:@"Content-Length"];
+	[request setHTTPBody:data];
+	return request;
+}
+
+
+
 #pragma mark - Finishing and Aborting
 /**
  *	A method to finish the call early, but successfully.
@@ -244,6 +313,39 @@
 	[self didFinishSuccessfully:YES returnObject:returnObject];
 }
 
+/**
+ *	Finishes the call with a server response. Successful GET responses carrying validators are remembered in the server's response cache, a 304
+ *	"Not Modified" finishes the call with the remembered response, including its already parsed INXMLNode.
+ *	The URL connection ends up here, the mock server in our tests uses this method directly.
+ *	@param returnObject The response dictionary, ignored for 304 responses
+ *	@param statusCode The HTTP status code of the response
+ *	@param headers The HTTP headers of the response
+ */
+- (void)finishWith:(NSDictionary *)returnObject statusCode:(NSInteger)statusCode responseHeaders:(NSDictionary *)headers
+{
+	NSString *urlString = [self canonicalURLString];
+	
+	// not modified, hand out what we got last time
+	if (304 == statusCode) {
+		INCachedResponse *cached = [server.responseCache responseForURLString:urlString];
+		if (cached.responseObject) {
+			[self didFinishSuccessfully:YES returnObject:cached.responseObject];
+		}
+		else {
+			NSError *error = nil;
+			ERR(&error, @"The server reported no changes, but we don't have the previous response anymore", 304)
+			[self didFinishSuccessfully:NO returnObject:[NSDictionary dictionaryWithObject:error forKey:INErrorKey]];
+		}
+		return;
+	}
+	
+	// remember validators and response of successful GETs
+	if (urlString && statusCode >= 200 && statusCode < 300 && ![returnObject objectForKey:INErrorKey]) {
+		[server.responseCache storeResponseObject:returnObject headers:headers forURLString:urlString];
+	}
+	[self didFinishSuccessfully:YES returnObject:returnObject];
+}
+
 /**
  *	Cancels the call, calling "abortWithError:nil" has the same effect
  */
@@ -352,6 +454,11 @@
  */
 - (void)oauthNotificationReceived:(NSNotification *)aNotification
 {
+	// MPOAuth posts for the instance, only the call currently running on it is concerned
+	if (!hasBeenFired || self != oauth.authDelegate) {
+		return;
+	}
+	
 	NSString *nName = [aNotification name];
 	NSDictionary *nDict = [aNotification userInfo];
 	
@@ -399,11 +506,44 @@
 #pragma mark - OAuth Load Delegate
 - (void)connectionFinishedWithResponse:(NSURLResponse *)aResponse data:(NSData *)inData
 {
+	NSInteger statusCode = 200;
+	NSDictionary *headers = nil;
+	if ([aResponse isKindOfClass:[NSHTTPURLResponse class]]) {
+		statusCode = [(NSHTTPURLResponse *)aResponse statusCode];
+		headers = [(NSHTTPURLResponse *)aResponse allHeaderFields];
+	}
+	
+	// nothing changed, no need to look at the (empty) data
+	if (304 == statusCode) {
+		[self finishWith:nil statusCode:statusCode responseHeaders:headers];
+		return;
+	}
+	
+	// URL loading inflates "Content-Encoding: gzip" while receiving, the "Content-Length" header is then the only trace of the compressed size. If the
+	// data still arrives gzipped we inflate it here, but only if we asked for compression and the server says it compressed: anything else is
+	// what was stored, e.g. a gzipped document, and must be handed out as is.
+	NSData *data = inData;
+	self.bytesReceived = [inData length];
+	NSString *encoding = [headers objectForKey:@"Content-Encoding"];
+	if (server.useCompression && ([@"gzip" isEqualToString:encoding] || [@"deflate" isEqualToString:encoding])) {
+		NSData *inflated = [inData isGzipped] ? [inData gunzippedData] : nil;
+		if (inflated) {
+			data = inflated;
+		}
+		else {
+			NSInteger contentLength = [[headers objectForKey:@"Content-Length"] integerValue];
+			if (contentLength > 0) {
+				self.bytesReceived = contentLength;
+			}
+		}
+	}
+	self.uncompressedBytesReceived = [data length];
+	
 	NSString *retString = nil;
 	
 	// we always assume string data, so just create a string when we have response data
-	if ([inData length] > 0) {
-		retString = [[NSString alloc] initWithData:inData encoding:NSUTF8StringEncoding];
+	if ([data length] > 0) {
+		retString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
 	}
 	//DLog(@"%@ %@  -----  %@", HTTPMethod, method, retString);
 	
@@ -416,18 +556,27 @@
 		
 		// parse XML if we got XML and if we can parse XML (implemented in a category)
 		if ([@"application/xml" isEqualToString:[aResponse MIMEType]]) {
-			if ([self respondsToSelector:@selector(parseXML:intoResponseDictionary:)]) {
+			if ([self respondsToSelector:@selector(parseXMLData:intoResponseDictionary:)]) {
+				[self performSelector:@selector(parseXMLData:intoResponseDictionary:) withObject:data withObject:retDict];
+			}
+			else if ([self respondsToSelector:@selector(parseXML:intoResponseDictionary:)]) {
 				[self performSelector:@selector(parseXML:intoResponseDictionary:) withObject:retString withObject:retDict];
 			}
 		}
 		
 		self.responseObject = retDict;
 	}
-	[self didFinishSuccessfully:YES returnObject:responseObject];
+	[self finishWith:responseObject statusCode:statusCode responseHeaders:headers];
 }
 
 - (void)connectionFailedWithResponse:(NSURLResponse *)aResponse error:(NSError *)inError
 {
+	// MPOAuth may consider a 304 a failure, it isn't
+	if ([aResponse isKindOfClass:[NSHTTPURLResponse class]] && 304 == [(NSHTTPURLResponse *)aResponse statusCode]) {
+		[self finishWith:nil statusCode:304 responseHeaders:[(NSHTTPURLResponse *)aResponse allHeaderFields]];
+		return;
+	}
+	
 	// get the correct error (if we have one in responseObject alread, we ignore inError)
 	NSError *prevError = [responseObject objectForKey:INErrorKey];
 	NSError *actualError = prevError ? prevError : inError;
@@ -435,6 +584,7 @@
 	
 	// we should arrive here if the token was rejected
 	if (retryWithNewTokenAfterFailure) {
+		[server suspendCall:self];
 		[server authenticate:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
 			if (userDidCancel || errorMessage) {
 				NSError *error = actualError;
@@ -444,7 +594,7 @@
 				[self authenticationDidFailWithError:error];
 			}
 			else {
-				[self authenticationDidSucceed];
+				[server performCall:self];
 			}
 		}];
 		return;
@@ -468,12 +618,55 @@
 	return (nil == method);			// seems hackish...
 }
 
+/**
+ *	The canonical URL of a plain GET request, used to look up previous responses. Returns nil for all other calls.
+ */
+- (NSString *)canonicalURLString
+{
+	if (![@"GET" isEqualToString:HTTPMethod] || [self isAuthenticationCall] || finishIfAuthenticated || [body length] > 0 || [bodyData length] > 0) {
+		return nil;
+	}
+	return [INResponseCache canonicalURLStringForURL:server.url method:method parameters:parameters];
+}
+
+/**
+ *	The full URL of the call including its parameters. MPOAuth escapes parameters when it builds the URL itself, we need to do the same when we
+ *	build the request ourselves. Names and values are unescaped first, so parameters that come escaped already aren't escaped twice.
+ */
+- (NSURL *)requestURL
+{
+	NSMutableArray *escaped = [NSMutableArray arrayWithCapacity:[parameters count]];
+	for (NSString *param in parameters) {
+		NSRange equals = [param rangeOfString:@"="];
+		NSArray *parts = (NSNotFound == equals.location) ? [NSArray arrayWithObject:param] : [NSArray arrayWithObjects:[param substringToIndex:equals.location], [param substringFromIndex:equals.location + 1], nil];
+		NSMutableArray *escapedParts = [NSMutableArray arrayWithCapacity:2];
+		for (NSString *part in parts) {
+			NSString *unescaped = [part stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+			CFStringRef escapedPart = CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault, (__bridge CFStringRef)(unescaped ? unescaped : part), NULL, CFSTR("!*'();:@&=+$,/?%#[]"), kCFStringEncodingUTF8);
+			[escapedParts addObject:(__bridge_transfer NSString *)escapedPart];
+		}
+		[escaped addObject:[escapedParts componentsJoinedByString:@"="]];
+	}
+	
+	NSString *query = ([escaped count] > 0) ? [@"?" stringByAppendingString:[escaped componentsJoinedByString:@"&"]] : @"";
+	return [NSURL URLWithString:[NSString stringWithFormat:@"%@%@%@", [self.oauth.baseURL absoluteString], self.method, query]];
+}
+
+/**
+ *	The "If-None-Match" and "If-Modified-Since" headers to send along if we have a previous response to this call, nil otherwise
+ */
+- (NSDictionary *)conditionalRequestHeaders
+{
+	return [[server.responseCache responseForURLString:[self canonicalURLString]] validatorHeaders];
+}
+
 - (NSString *)description
 {
 	NSString *action = method ? [@"\n" stringByAppendingString:method] : @"Authentication";
-	NSString *bodyString = body ? [@"\n" stringByAppendingString:body] : @"";
+	NSString *bodyString = body ? [@"\n" stringByAppendingString:body] : ([bodyData length] > 0 ? [NSString stringWithFormat:@"\n<%d bytes of body data>", [bodyData length]] : @"");
 	NSString *paramString = parameters ? [NSString stringWithFormat:@" with %@", parameters] : @"";
-	return [NSString stringWithFormat:@"%@ <%p> %@: \"%@\"%@%@", NSStringFromClass([self class]), self, HTTPMethod, action, paramString, bodyString];
+	NSString *bytesString = (bytesSent > 0 || bytesReceived > 0) ? [NSString stringWithFormat:@"\n%d bytes sent (%d uncompressed), %d received (%d uncompressed)", bytesSent, uncompressedBytesSent, bytesReceived, uncompressedBytesReceived] : @"";
+	return [NSString stringWithFormat:@"%@ <%p> %@: \"%@\"%@%@%@", NSStringFromClass([self class]), self, HTTPMethod, action, paramString, bodyString, bytesString];
 }
 
 
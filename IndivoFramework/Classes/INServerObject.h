@@ -42,8 +42,11 @@
 - (void)put:(NSString *)aMethod body:(NSString *)bodyString callback:(INSuccessRetvalueBlock)callback;
 - (void)post:(NSString *)aMethod body:(NSString *)bodyString callback:(INSuccessRetvalueBlock)callback;
 - (void)post:(NSString *)aMethod parameters:(NSArray *)paramArray callback:(INSuccessRetvalueBlock)callback;
+- (void)put:(NSString *)aMethod bodyData:(NSData *)bodyData callback:(INSuccessRetvalueBlock)callback;
+- (void)post:(NSString *)aMethod bodyData:(NSData *)bodyData callback:(INSuccessRetvalueBlock)callback;
 
 - (void)performMethod:(NSString *)aMethod withBody:(NSString *)body orParameters:(NSArray *)parameters httpMethod:(NSString *)httpMethod callback:(INSuccessRetvalueBlock)callback;
+- (void)performMethod:(NSString *)aMethod withBodyData:(NSData *)bodyData orParameters:(NSArray *)parameters httpMethod:(NSString *)httpMethod callback:(INSuccessRetvalueBlock)callback;
 
 // Utils
 - (BOOL)is:(NSString *)anId;
@@ -74,6 +74,20 @@
  *	@param callback A block to execute when the call has finished
  */
 - (void)performMethod:(NSString *)aMethod withBody:(NSString *)body orParameters:(NSArray *)parameters httpMethod:(NSString *)httpMethod callback:(INSuccessRetvalueBlock)callback
+{
+	[self performMethod:aMethod withBodyData:[body dataUsingEncoding:NSUTF8StringEncoding] orParameters:parameters httpMethod:httpMethod callback:callback];
+}
+
+/**
+ *	Same as "performMethod:withBody:orParameters:httpMethod:callback:" but takes the body as raw data, which saves converting XML produced by an
+ *	INXMLWriter to a string and back. Subclasses wanting to customize server calls should override this method.
+ *	@param aMethod The path to call on the server
+ *	@param bodyData The body data, UTF-8 encoded
+ *	@param parameters An array full of strings in the form "key=value"
+ *	@param httpMethod The http method, for now GET, PUT or POST
+ *	@param callback A block to execute when the call has finished
+ */
+- (void)performMethod:(NSString *)aMethod withBodyData:(NSData *)bodyData orParameters:(NSArray *)parameters httpMethod:(NSString *)httpMethod callback:(INSuccessRetvalueBlock)callback
 {
 	if (!self.server) {
 		NSString *errStr = [NSString stringWithFormat:@"Fatal Error: I have no server! %@", self];
@@ -84,7 +98,7 @@
 	// create the desired INServerCall instance
 	INServerCall *call = [INServerCall new];
 	call.method = aMethod;
-	call.body = body;
+	call.bodyData = bodyData;
 	call.parameters = parameters;
 	call.HTTPMethod = httpMethod;
 	call.myCallback = callback;
@@ -141,6 +155,30 @@
 	[self performMethod:aMethod withBody:bodyString orParameters:nil httpMethod:@"POST" callback:callback];
 }
 
+/**
+ *	Shortcut for PUTting raw body data.
+ *	Calls "performMethod:withBodyData:orParameters:httpMethod:callback:" internally.
+ *	@param aMethod The method to perform, e.g. "/records/id/documents/document-id"
+ *	@param bodyData The UTF-8 encoded body data to PUT
+ *	@param callback The callback block to execute when the call has finished
+ */
+- (void)put:(NSString *)aMethod bodyData:(NSData *)bodyData callback:(INSuccessRetvalueBlock)callback
+{
+	[self performMethod:aMethod withBodyData:bodyData orParameters:nil httpMethod:@"PUT" callback:callback];
+}
+
+/**
+ *	Shortcut for POSTing raw body data.
+ *	Calls "performMethod:withBodyData:orParameters:httpMethod:callback:" internally.
+ *	@param aMethod The method to perform, e.g. "/records/id/documents/"
+ *	@param bodyData The UTF-8 encoded body data to POST
+ *	@param callback The callback block to execute when the call has finished
+ */
+- (void)post:(NSString *)aMethod bodyData:(NSData *)bodyData callback:(INSuccessRetvalueBlock)callback
+{
+	[self performMethod:aMethod withBodyData:bodyData orParameters:nil httpMethod:@"POST" callback:callback];
+}
+
 /**
  *	Shortcut for POSTing parameters.
  *	Calls "performMethod:withBody:orParameters:httpMethod:callback:" internally.
@@ -74,13 +74,7 @@
 
 - (void)setFromFlatParent:(INXMLNode *)parent prefix:(NSString *)prefix
 {
-	INXMLNode *myNode = nil;
-	for (INXMLNode *child in [parent children]) {
-		if ([prefix isEqualToString:[child attr:@"name"]]) {
-			myNode = child;
-			break;
-		}
-	}
+	INXMLNode *myNode = [parent childWithNameAttribute:prefix];
 	
 	if (myNode) {
 		self.string = myNode.text;
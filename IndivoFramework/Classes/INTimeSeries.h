@@ -0,0 +1,73 @@
+/*
+ INTimeSeries.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+@class INXMLNode;
+
+
+/**
+ *	The values of one code in one unit over time, e.g. all serum sodium results in mEq/L, held in two contiguous C arrays.
+ *	Timestamps are seconds since 1970 and ascending; the kernels below are plain loops over these arrays which the compiler can vectorize.
+ */
+@interface INTimeSeries : NSObject
+
+@property (nonatomic, readonly, copy) NSString *code;					///< The code of the measured quantity, e.g. the LOINC code
+@property (nonatomic, readonly, copy) NSString *title;					///< The title of the code as found in the first report
+@property (nonatomic, readonly, copy) NSString *unit;
+
+- (NSUInteger)count;
+- (const NSTimeInterval *)timestamps;
+- (const double *)values;
+
+- (NSRange)rangeFromDate:(NSDate *)startDate toDate:(NSDate *)endDate;
+- (double)minimumInRange:(NSRange)range;
+- (double)maximumInRange:(NSRange)range;
+- (double)meanInRange:(NSRange)range;
+- (NSUInteger)downsampleRange:(NSRange)range
+					toBuckets:(NSUInteger)numBuckets
+				   timestamps:(NSTimeInterval *)outTimestamps
+					 minimums:(double *)outMinimums
+					 maximums:(double *)outMaximums
+						means:(double *)outMeans;
+
+@end
+
+
+/**
+ *	Columnar storage for numeric lab results and vital signs, filled straight from report XML without instantiating document objects.
+ *	Every Model node yields one value per measurement it contains (one for LabResult, up to nine for VitalSigns), which is appended to the series for
+ *	its code and unit; series are looked up through a dictionary of codes, each holding the series of that code by unit.
+ */
+@interface INTimeSeriesStore : NSObject
+
+- (NSUInteger)addReportsFromNode:(INXMLNode *)reportsNode;
+- (NSUInteger)addReportsFromXML:(NSString *)xmlString error:(NSError * __autoreleasing *)error;
+
+- (NSArray *)allSeries;
+- (NSArray *)seriesForCode:(NSString *)code;
+- (INTimeSeries *)seriesForCode:(NSString *)code unit:(NSString *)unit;
+- (void)removeAllSeries;
+
+
+@end
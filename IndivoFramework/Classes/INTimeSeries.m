@@ -0,0 +1,529 @@
+/*
+ INTimeSeries.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#import "INTimeSeries.h"
+#import "INXMLParser.h"
+#import "INISO8601.h"
+#import <xlocale.h>
+
+
+/**
+ *	Where to find one numeric measurement in the fields of a Model node
+ */
+typedef struct {
+	__unsafe_unretained NSString *model;			///< The "name" of the Model node
+	__unsafe_unretained NSString *date;				///< The field holding the timestamp of the measurement
+	__unsafe_unretained NSString *value;
+	__unsafe_unretained NSString *unit;
+	__unsafe_unretained NSString *code;
+	__unsafe_unretained NSString *title;
+} INSeriesField;
+
+static const INSeriesField INSeriesFields[] = {
+	{ @"LabResult", @"collected_at", @"quantitative_result_value_value", @"quantitative_result_value_unit", @"test_name_identifier", @"test_name_title" },
+	{ @"VitalSigns", @"date", @"bp_systolic_value", @"bp_systolic_unit", @"bp_systolic_name_identifier", @"bp_systolic_name_title" },
+	{ @"VitalSigns", @"date", @"bp_diastolic_value", @"bp_diastolic_unit", @"bp_diastolic_name_identifier", @"bp_diastolic_name_title" },
+	{ @"VitalSigns", @"date", @"bmi_value", @"bmi_unit", @"bmi_name_identifier", @"bmi_name_title" },
+	{ @"VitalSigns", @"date", @"heart_rate_value", @"heart_rate_unit", @"heart_rate_name_identifier", @"heart_rate_name_title" },
+	{ @"VitalSigns", @"date", @"height_value", @"height_unit", @"height_name_identifier", @"height_name_title" },
+	{ @"VitalSigns", @"date", @"oxygen_saturation_value", @"oxygen_saturation_unit", @"oxygen_saturation_name_identifier", @"oxygen_saturation_name_title" },
+	{ @"VitalSigns", @"date", @"respiratory_rate_value", @"respiratory_rate_unit", @"respiratory_rate_name_identifier", @"respiratory_rate_name_title" },
+	{ @"VitalSigns", @"date", @"temperature_value", @"temperature_unit", @"temperature_name_identifier", @"temperature_name_title" },
+	{ @"VitalSigns", @"date", @"weight_value", @"weight_unit", @"weight_name_identifier", @"weight_name_title" },
+};
+
+typedef struct {
+	NSTimeInterval timestamp;
+	double value;
+} INTimeSeriesSample;
+
+static BOOL INParseDouble(NSString *string, double *outValue);
+static int INCompareSamples(const void *sample1, const void *sample2);
+static NSUInteger INLowerBound(const NSTimeInterval *timestamps, NSUInteger count, NSTimeInterval timestamp, BOOL inclusive);
+static double INMinimum(const double *values, NSUInteger count);
+static double INMaximum(const double *values, NSUInteger count);
+static double INSum(const double *values, NSUInteger count);
+
+
+@interface INTimeSeries () {
+	NSMutableData *timestampData;
+	NSMutableData *valueData;
+	BOOL sorted;
+}
+
+@property (nonatomic, readwrite, copy) NSString *code;
+@property (nonatomic, readwrite, copy) NSString *title;
+@property (nonatomic, readwrite, copy) NSString *unit;
+
+- (id)initWithCode:(NSString *)aCode title:(NSString *)aTitle unit:(NSString *)aUnit;
+- (void)appendValue:(double)value atTime:(NSTimeInterval)timestamp;
+- (void)sortIfNeeded;
+- (NSRange)clampRange:(NSRange)range;
+
+@end
+
+
+@implementation INTimeSeries
+
+@synthesize code, title, unit;
+
+
+- (id)initWithCode:(NSString *)aCode title:(NSString *)aTitle unit:(NSString *)aUnit
+{
+	if ((self = [super init])) {
+		self.code = aCode;
+		self.title = aTitle;
+		self.unit = aUnit;
+		timestampData = [NSMutableData new];
+		valueData = [NSMutableData new];
+		sorted = YES;
+	}
+	return self;
+}
+
+/**
+ *	Appends a sample. Reports usually arrive in date order, so the series only needs sorting if a sample is older than the last one.
+ */
+- (void)appendValue:(double)value atTime:(NSTimeInterval)timestamp
+{
+	NSUInteger count = [self count];
+	if (sorted && count > 0 && timestamp < ((const NSTimeInterval *)[timestampData bytes])[count - 1]) {
+		sorted = NO;
+	}
+	[timestampData appendBytes:&timestamp length:sizeof(NSTimeInterval)];
+	[valueData appendBytes:&value length:sizeof(double)];
+}
+
+/**
+ *	Brings timestamps and values into ascending time order, keeping the order of samples with the same timestamp.
+ */
+- (void)sortIfNeeded
+{
+	if (sorted) {
+		return;
+	}
+	
+	NSUInteger count = [self count];
+	NSTimeInterval *timestamps = [timestampData mutableBytes];
+	double *values = [valueData mutableBytes];
+	INTimeSeriesSample *samples = malloc(count * sizeof(INTimeSeriesSample));
+	if (!samples) {
+		return;
+	}
+	
+	for (NSUInteger i = 0; i < count; i++) {
+		samples[i].timestamp = timestamps[i];
+		samples[i].value = values[i];
+	}
+	if (0 != mergesort(samples, count, sizeof(INTimeSeriesSample), INCompareSamples)) {
+		qsort(samples, count, sizeof(INTimeSeriesSample), INCompareSamples);
+	}
+	for (NSUInteger i = 0; i < count; i++) {
+		timestamps[i] = samples[i].timestamp;
+		values[i] = samples[i].value;
+	}
+	
+	free(samples);
+	sorted = YES;
+}
+
+
+
+#pragma mark - Data
+- (NSUInteger)count
+{
+	return [valueData length] / sizeof(double);
+}
+
+/**
+ *	The timestamps of all samples as seconds since 1970, in ascending order.
+ *	@attention The pointer is only valid until more reports are added to the store.
+ */
+- (const NSTimeInterval *)timestamps
+{
+	[self sortIfNeeded];
+	return [timestampData bytes];
+}
+
+/**
+ *	The values of all samples, in the order of "timestamps".
+ *	@attention The pointer is only valid until more reports are added to the store.
+ */
+- (const double *)values
+{
+	[self sortIfNeeded];
+	return [valueData bytes];
+}
+
+
+
+#pragma mark - Kernels
+/**
+ *	The range of samples taken between the two dates, both inclusive, found by binary search.
+ *	@param startDate The earliest date, nil to start with the first sample
+ *	@param endDate The latest date, nil to end with the last sample
+ */
+- (NSRange)rangeFromDate:(NSDate *)startDate toDate:(NSDate *)endDate
+{
+	const NSTimeInterval *timestamps = [self timestamps];
+	NSUInteger count = [self count];
+	NSUInteger start = startDate ? INLowerBound(timestamps, count, [startDate timeIntervalSince1970], YES) : 0;
+	NSUInteger end = endDate ? INLowerBound(timestamps, count, [endDate timeIntervalSince1970], NO) : count;
+	return NSMakeRange(start, (end > start) ? end - start : 0);
+}
+
+/**
+ *	The smallest value in the range, NAN if the range is empty
+ */
+- (double)minimumInRange:(NSRange)range
+{
+	range = [self clampRange:range];
+	return (range.length > 0) ? INMinimum([self values] + range.location, range.length) : NAN;
+}
+
+/**
+ *	The largest value in the range, NAN if the range is empty
+ */
+- (double)maximumInRange:(NSRange)range
+{
+	range = [self clampRange:range];
+	return (range.length > 0) ? INMaximum([self values] + range.location, range.length) : NAN;
+}
+
+/**
+ *	The arithmetic mean of the values in the range, NAN if the range is empty
+ */
+- (double)meanInRange:(NSRange)range
+{
+	range = [self clampRange:range];
+	return (range.length > 0) ? INSum([self values] + range.location, range.length) / range.length : NAN;
+}
+
+/**
+ *	Reduces the samples in the range to at most "numBuckets" buckets of consecutive samples, e.g. one per pixel column of a chart, and fills the output
+ *	arrays with the mean timestamp and the minimum, maximum and mean value of every bucket. Pass NULL for output arrays you don't need.
+ *	@return The number of buckets written, which is less than numBuckets if the range holds fewer samples
+ */
+- (NSUInteger)downsampleRange:(NSRange)range
+					toBuckets:(NSUInteger)numBuckets
+				   timestamps:(NSTimeInterval *)outTimestamps
+					 minimums:(double *)outMinimums
+					 maximums:(double *)outMaximums
+						means:(double *)outMeans
+{
+	range = [self clampRange:range];
+	numBuckets = MIN(numBuckets, range.length);
+	const NSTimeInterval *timestamps = [self timestamps] + range.location;
+	const double *values = [self values] + range.location;
+	
+	for (NSUInteger b = 0; b < numBuckets; b++) {
+		NSUInteger start = (b * range.length) / numBuckets;
+		NSUInteger length = ((b + 1) * range.length) / numBuckets - start;
+		
+		if (outTimestamps) {
+			outTimestamps[b] = INSum(timestamps + start, length) / length;
+		}
+		if (outMinimums) {
+			outMinimums[b] = INMinimum(values + start, length);
+		}
+		if (outMaximums) {
+			outMaximums[b] = INMaximum(values + start, length);
+		}
+		if (outMeans) {
+			outMeans[b] = INSum(values + start, length) / length;
+		}
+	}
+	return numBuckets;
+}
+
+- (NSRange)clampRange:(NSRange)range
+{
+	NSUInteger count = [self count];
+	NSUInteger location = MIN(range.location, count);
+	return NSMakeRange(location, MIN(range.length, count - location));
+}
+
+
+
+#pragma mark - Utilities
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"%@ <%p> %@ (%@) in %@, %d values", NSStringFromClass([self class]), self, code, title, unit, [self count]];
+}
+
+
+@end
+
+
+@interface INTimeSeriesStore ()
+
+@property (nonatomic, strong) NSMutableDictionary *codes;				///< Code -> dictionary of unit -> INTimeSeries
+
+- (INTimeSeries *)seriesForCode:(NSString *)code unit:(NSString *)unit title:(NSString *)title;
+
+@end
+
+
+@implementation INTimeSeriesStore
+
+@synthesize codes;
+
+
+- (id)init
+{
+	if ((self = [super init])) {
+		self.codes = [NSMutableDictionary dictionary];
+	}
+	return self;
+}
+
+
+
+#pragma mark - Filling
+/**
+ *	Adds the measurements of all Model nodes in a report listing. Models without a parseable value or date are skipped.
+ *	@param reportsNode A "Models" node as returned for reports, or a single "Model" node
+ *	@return The number of values that were added
+ */
+- (NSUInteger)addReportsFromNode:(INXMLNode *)reportsNode
+{
+	NSArray *models = [@"Model" isEqualToString:reportsNode.name] ? [NSArray arrayWithObject:reportsNode] : [reportsNode childrenNamed:@"Model"];
+	NSMutableDictionary *fields = [NSMutableDictionary dictionaryWithCapacity:64];
+	NSUInteger numAdded = 0;
+	
+	for (INXMLNode *model in models) {
+		NSString *modelName = [model attr:@"name"];
+		
+		// collect the text of all fields of this model
+		[fields removeAllObjects];
+		for (INXMLNode *field in model.children) {
+			NSString *fieldName = [field attr:@"name"];
+			if (fieldName && field.text) {
+				[fields setObject:field.text forKey:fieldName];
+			}
+		}
+		
+		// pick out the measurements
+		for (NSUInteger i = 0; i < sizeof(INSeriesFields) / sizeof(INSeriesField); i++) {
+			const INSeriesField *desc = &INSeriesFields[i];
+			if (![desc->model isEqualToString:modelName]) {
+				continue;
+			}
+			
+			double value = 0.0;
+			NSTimeInterval timestamp = 0.0;
+			if (!INParseDouble([fields objectForKey:desc->value], &value)
+				|| !INTimeIntervalFromISO8601String([fields objectForKey:desc->date], NO, &timestamp)) {
+				continue;
+			}
+			
+			NSString *title = [fields objectForKey:desc->title];
+			NSString *code = [fields objectForKey:desc->code];
+			if ([code length] < 1) {
+				code = ([title length] > 0) ? title : desc->value;
+			}
+			NSString *unit = [fields objectForKey:desc->unit];
+			
+			[[self seriesForCode:code unit:(unit ? unit : @"") title:title] appendValue:value atTime:timestamp];
+			numAdded++;
+		}
+	}
+	return numAdded;
+}
+
+/**
+ *	Parses the XML and adds the measurements of all Model nodes it contains.
+ *	@return The number of values that were added, 0 with the error set if the XML could not be parsed
+ */
+- (NSUInteger)addReportsFromXML:(NSString *)xmlString error:(NSError *__autoreleasing *)error
+{
+	INXMLNode *root = [INXMLParser parseXML:xmlString error:error];
+	if (!root) {
+		return 0;
+	}
+	return [self addReportsFromNode:root];
+}
+
+/**
+ *	Returns the series for code and unit, creating it if necessary.
+ */
+- (INTimeSeries *)seriesForCode:(NSString *)code unit:(NSString *)unit title:(NSString *)title
+{
+	NSMutableDictionary *units = [codes objectForKey:code];
+	if (!units) {
+		units = [NSMutableDictionary dictionaryWithCapacity:1];
+		[codes setObject:units forKey:code];
+	}
+	
+	INTimeSeries *series = [units objectForKey:unit];
+	if (!series) {
+		series = [[INTimeSeries alloc] initWithCode:code title:title unit:unit];
+		[units setObject:series forKey:unit];
+	}
+	return series;
+}
+
+
+
+#pragma mark - Series
+/**
+ *	All series, ordered by code and unit
+ */
+- (NSArray *)allSeries
+{
+	NSMutableArray *all = [NSMutableArray array];
+	for (NSString *code in [[codes allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+		[all addObjectsFromArray:[self seriesForCode:code]];
+	}
+	return all;
+}
+
+/**
+ *	All series for the code, one per unit the code was reported in, ordered by unit
+ */
+- (NSArray *)seriesForCode:(NSString *)code
+{
+	NSDictionary *units = [codes objectForKey:code];
+	NSMutableArray *series = [NSMutableArray arrayWithCapacity:[units count]];
+	for (NSString *unit in [[units allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+		[series addObject:[units objectForKey:unit]];
+	}
+	return series;
+}
+
+- (INTimeSeries *)seriesForCode:(NSString *)code unit:(NSString *)unit
+{
+	return [[codes objectForKey:code] objectForKey:(unit ? unit : @"")];
+}
+
+- (void)removeAllSeries
+{
+	[codes removeAllObjects];
+}
+
+
+@end
+
+
+
+#pragma mark - Kernels
+/**
+ *	Parses a decimal number independent of the current locale.
+ */
+static BOOL INParseDouble(NSString *string, double *outValue)
+{
+	if ([string length] < 1) {
+		return NO;
+	}
+	const char *bytes = [string UTF8String];
+	char *end = NULL;
+	double value = strtod_l(bytes, &end, NULL);
+	if (end == bytes || isnan(value)) {
+		return NO;
+	}
+	*outValue = value;
+	return YES;
+}
+
+static int INCompareSamples(const void *sample1, const void *sample2)
+{
+	NSTimeInterval t1 = ((const INTimeSeriesSample *)sample1)->timestamp;
+	NSTimeInterval t2 = ((const INTimeSeriesSample *)sample2)->timestamp;
+	return (t1 < t2) ? -1 : ((t1 > t2) ? 1 : 0);
+}
+
+/**
+ *	Binary search for the first index whose timestamp is not less than (inclusive) or greater than (not inclusive) the given timestamp.
+ */
+static NSUInteger INLowerBound(const NSTimeInterval *timestamps, NSUInteger count, NSTimeInterval timestamp, BOOL inclusive)
+{
+	NSUInteger low = 0;
+	NSUInteger high = count;
+	while (low < high) {
+		NSUInteger mid = low + (high - low) / 2;
+		BOOL before = inclusive ? (timestamps[mid] < timestamp) : (timestamps[mid] <= timestamp);
+		if (before) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/*
+ *	The reductions below run four independent accumulators over the contiguous array, so the loop bodies carry no dependency from one iteration to
+ *	the next and map onto two-lane double SIMD registers. "count" must be at least 1.
+ */
+static double INMinimum(const double *values, NSUInteger count)
+{
+	double m0 = values[0], m1 = values[0], m2 = values[0], m3 = values[0];
+	NSUInteger i = 0;
+	for (; i + 4 <= count; i += 4) {
+		m0 = (values[i] < m0) ? values[i] : m0;
+		m1 = (values[i + 1] < m1) ? values[i + 1] : m1;
+		m2 = (values[i + 2] < m2) ? values[i + 2] : m2;
+		m3 = (values[i + 3] < m3) ? values[i + 3] : m3;
+	}
+	for (; i < count; i++) {
+		m0 = (values[i] < m0) ? values[i] : m0;
+	}
+	m0 = (m1 < m0) ? m1 : m0;
+	m2 = (m3 < m2) ? m3 : m2;
+	return (m2 < m0) ? m2 : m0;
+}
+
+static double INMaximum(const double *values, NSUInteger count)
+{
+	double m0 = values[0], m1 = values[0], m2 = values[0], m3 = values[0];
+	NSUInteger i = 0;
+	for (; i + 4 <= count; i += 4) {
+		m0 = (values[i] > m0) ? values[i] : m0;
+		m1 = (values[i + 1] > m1) ? values[i + 1] : m1;
+		m2 = (values[i + 2] > m2) ? values[i + 2] : m2;
+		m3 = (values[i + 3] > m3) ? values[i + 3] : m3;
+	}
+	for (; i < count; i++) {
+		m0 = (values[i] > m0) ? values[i] : m0;
+	}
+	m0 = (m1 > m0) ? m1 : m0;
+	m2 = (m3 > m2) ? m3 : m2;
+	return (m2 > m0) ? m2 : m0;
+}
+
+static double INSum(const double *values, NSUInteger count)
+{
+	double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+	NSUInteger i = 0;
+	for (; i + 4 <= count; i += 4) {
+		s0 += values[i];
+		s1 += values[i + 1];
+		s2 += values[i + 2];
+		s3 += values[i + 3];
+	}
+	for (; i < count; i++) {
+		s0 += values[i];
+	}
+	return (s0 + s1) + (s2 + s3);
+}
@@ -23,17 +23,33 @@
 #import <Foundation/Foundation.h>
 #import "Indivo.h"
 
+@class INURLLoader;
+
+
+/**
+ *	A block called once for every URL of a batch as soon as its loader has finished.
+ *	@param loader The loader that has finished
+ *	@param index The index of the loader's URL in the array originally passed to the fetcher
+ *	@param errorMessage nil if the loader succeeded, an error message otherwise
+ */
+typedef void (^INURLFetcherLoaderBlock)(INURLLoader *loader, NSUInteger index, NSString * __autoreleasing errorMessage);
+
 
 /**
  *	The fetcher is an accessor-class to INURLLoader objects; for example if you want to queue up loading multiple URLs you
  *	can use one fetcher instead of handling multiple INURLLoader instances yourself.
+ *	Up to "maxConcurrentLoaders" URLs are loaded at the same time, optionally limited further per host by "maxConcurrentLoadersPerHost".
  */
 @interface INURLFetcher : NSObject
 
-@property (nonatomic, readonly, copy) NSArray *successfulLoads;					///< Contains INURLLoader instances which loaded with an HTTP response < 400
-@property (nonatomic, readonly, copy) NSArray *failedLoads;						///< Contains all INURLLoader instances that failed to load for any reason
+@property (nonatomic, assign) NSUInteger maxConcurrentLoaders;					///< How many loaders may run at the same time, 4 by default. 1 loads sequentially, 0 means no limit
+@property (nonatomic, assign) NSUInteger maxConcurrentLoadersPerHost;			///< How many loaders may talk to the same host at the same time, 0 (no limit besides "maxConcurrentLoaders") by default
+@property (nonatomic, readonly, copy) NSArray *loaders;							///< All INURLLoader instances of the last batch, in the order of the URLs that were passed in
+@property (nonatomic, readonly, copy) NSArray *successfulLoads;					///< Contains INURLLoader instances which loaded with an HTTP response < 400, in URL order
+@property (nonatomic, readonly, copy) NSArray *failedLoads;						///< Contains all INURLLoader instances that failed to load for any reason, in URL order
 
 - (void)getURLs:(NSArray *)anURLArray callback:(INCancelErrorBlock)aCallback;
+- (void)getURLs:(NSArray *)anURLArray progress:(INURLFetcherLoaderBlock)aProgressBlock callback:(INCancelErrorBlock)aCallback;
 - (void)cancel;
 - (BOOL)isIdle;
 
@@ -26,117 +26,214 @@
 
 @interface INURLFetcher ()
 
+@property (nonatomic, readwrite, copy) NSArray *loaders;
 @property (nonatomic, readwrite, copy) NSArray *successfulLoads;
 @property (nonatomic, readwrite, copy) NSArray *failedLoads;
-@property (nonatomic, strong) NSMutableArray *mySuccessfulLoads;
-@property (nonatomic, strong) NSMutableArray *myFailedLoads;
-@property (nonatomic, strong) NSMutableArray *queuedLoaders;
-@property (nonatomic, strong) INURLLoader *currentLoader;
+@property (nonatomic, strong) NSArray *batchLoaders;							///< The loaders of the batch currently being loaded, in URL order
+@property (nonatomic, strong) NSMutableIndexSet *pendingIndexes;				///< Indexes of loaders that have not yet been started
+@property (nonatomic, strong) NSMutableIndexSet *runningIndexes;				///< Indexes of loaders currently loading
+@property (nonatomic, strong) NSMutableIndexSet *failedIndexes;					///< Indexes of loaders that have failed
+@property (nonatomic, strong) NSMutableDictionary *runningPerHost;				///< Host name -> NSNumber with the number of running loaders for that host
+@property (nonatomic, copy) INURLFetcherLoaderBlock progress;
 @property (nonatomic, copy) INCancelErrorBlock callback;
+@property (nonatomic, assign) BOOL cancelling;
 
-- (void)loaderDidFinish:(INURLLoader *)aLoader withErrorMessage:(NSString *)errorMessage;
+- (void)startPendingLoaders;
+- (BOOL)canStartLoaderForHost:(NSString *)host;
+- (void)loaderAtIndex:(NSUInteger)idx didFinishWithErrorMessage:(NSString *)errorMessage;
+- (void)finish;
 - (void)didCancel;
+- (void)reset;
 
 @end
 
 
 @implementation INURLFetcher
 
-@synthesize successfulLoads, failedLoads;
-@synthesize mySuccessfulLoads, myFailedLoads, queuedLoaders, currentLoader, callback;
+@synthesize maxConcurrentLoaders, maxConcurrentLoadersPerHost;
+@synthesize loaders, successfulLoads, failedLoads;
+@synthesize batchLoaders, pendingIndexes, runningIndexes, failedIndexes, runningPerHost, progress, callback, cancelling;
 
 
+- (id)init
+{
+	if ((self = [super init])) {
+		self.maxConcurrentLoaders = 4;
+	}
+	return self;
+}
+
+
+
+#pragma mark - Loading
 /**
- *	Fetches all URLs sequentially and calls callback when finished.
- *	The calls are put on a queue and, depending on their exit status, are put in the "successfulLoads" and "failedLoads" arrays, respectively. Be
- *	sure to check these properties when the callback is called, as even if an error is reported, some URLs might have loaded successfully.
+ *	Fetches all URLs and calls callback when finished.
+ *	@see getURLs:progress:callback:
  *	@param anURLArray An NSArray full of NSURL instances
  *	@param aCallback The callback block to be executed when the call has finished
  */
 - (void)getURLs:(NSArray *)anURLArray callback:(INCancelErrorBlock)aCallback
 {
-	if (queuedLoaders) {
+	[self getURLs:anURLArray progress:nil callback:aCallback];
+}
+
+/**
+ *	Fetches all URLs, running up to "maxConcurrentLoaders" loaders at once, and calls callback when all have finished.
+ *	Depending on their exit status the loaders are put in the "successfulLoads" and "failedLoads" arrays, respectively. Be sure to check these
+ *	properties when the callback is called, as even if an error is reported, some URLs might have loaded successfully. The "loaders" property
+ *	holds all loaders in the order of anURLArray, no matter in which order they finished.
+ *	@param anURLArray An NSArray full of NSURL instances
+ *	@param aProgressBlock Called for every loader as soon as it has finished, may be nil
+ *	@param aCallback The callback block to be executed when the call has finished
+ */
+- (void)getURLs:(NSArray *)anURLArray progress:(INURLFetcherLoaderBlock)aProgressBlock callback:(INCancelErrorBlock)aCallback
+{
+	if (![self isIdle]) {
 		CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(aCallback, NO, @"A queue is already being loaded, cannot begin a new one")
 		return;
 	}
 	
-	self.queuedLoaders = nil;
+	self.loaders = nil;
 	self.successfulLoads = nil;
 	self.failedLoads = nil;
 	if ([anURLArray count] > 0) {
+		self.progress = aProgressBlock;
 		self.callback = aCallback;
-		self.queuedLoaders = [NSMutableArray arrayWithCapacity:[anURLArray count] - 1];
-		self.currentLoader = [[INURLLoader alloc] initWithURL:[anURLArray objectAtIndex:0]];
+		self.cancelling = NO;
 		
 		// create loaders for each URL
-		BOOL first = YES;
+		NSMutableArray *newLoaders = [NSMutableArray arrayWithCapacity:[anURLArray count]];
 		for (NSURL *url in anURLArray) {
-			if (!first) {
-				INURLLoader *loader = [[INURLLoader alloc] initWithURL:url];
-				[queuedLoaders addObject:loader];
-			}
-			else {
-				first = NO;
-			}
+			[newLoaders addObject:[[INURLLoader alloc] initWithURL:url]];
 		}
+		self.batchLoaders = newLoaders;
+		self.pendingIndexes = [NSMutableIndexSet indexSetWithIndexesInRange:NSMakeRange(0, [newLoaders count])];
+		self.runningIndexes = [NSMutableIndexSet indexSet];
+		self.failedIndexes = [NSMutableIndexSet indexSet];
+		self.runningPerHost = [NSMutableDictionary dictionary];
 		
-		// prepare and launch the first one!
-		self.mySuccessfulLoads = [NSMutableArray arrayWithCapacity:[anURLArray count]];
-		self.myFailedLoads = [NSMutableArray arrayWithCapacity:[anURLArray count]];
+		// launch as many as we're allowed to
+		[self startPendingLoaders];
+	}
+}
+
+/**
+ *	Starts pending loaders in URL order until we either run out of free slots or of loaders whose host has a free slot
+ */
+- (void)startPendingLoaders
+{
+	NSUInteger idx = [pendingIndexes firstIndex];
+	while (NSNotFound != idx && !cancelling) {
+		if (maxConcurrentLoaders > 0 && [runningIndexes count] >= maxConcurrentLoaders) {
+			break;
+		}
 		
-		[currentLoader getWithCallback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
-			if (userDidCancel) {
-				[self didCancel];
-			}
-			else {
-				[self loaderDidFinish:currentLoader withErrorMessage:errorMessage];
+		INURLLoader *loader = [batchLoaders objectAtIndex:idx];
+		NSString *host = [loader.url host] ?: @"";
+		if ([self canStartLoaderForHost:host]) {
+			[pendingIndexes removeIndex:idx];
+			[runningIndexes addIndex:idx];
+			[runningPerHost setObject:[NSNumber numberWithUnsignedInteger:[[runningPerHost objectForKey:host] unsignedIntegerValue] + 1] forKey:host];
+			
+			// the loader calls back on the run loop we're on, so our bookkeeping needs no locking
+			[loader getWithCallback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+				NSUInteger remaining = [[runningPerHost objectForKey:host] unsignedIntegerValue];
+				[runningPerHost setObject:[NSNumber numberWithUnsignedInteger:(remaining > 0 ? remaining - 1 : 0)] forKey:host];
+				[runningIndexes removeIndex:idx];
+				
+				if (cancelling) {
+					[self didCancel];
+				}
+				else {
+					
+					// a loader cancelled on its own has timed out, that's a failure of this URL, not of the batch
+					[self loaderAtIndex:idx didFinishWithErrorMessage:(userDidCancel && !errorMessage) ? @"Loading timed out" : errorMessage];
+				}
+			}];
+			
+			// the loader may have called back right away and thereby finished the batch
+			if (!batchLoaders) {
+				return;
 			}
-		}];
+		}
+		idx = [pendingIndexes indexGreaterThanIndex:idx];
 	}
 }
 
 /**
- *	Callback when a loader finished
+ *	Returns YES if another loader may talk to the given host
  */
-- (void)loaderDidFinish:(INURLLoader *)aLoader withErrorMessage:(NSString *)errorMessage
+- (BOOL)canStartLoaderForHost:(NSString *)host
 {
-	// load succeeded
-	if (!errorMessage && aLoader.responseStatus < 400) {
-		[mySuccessfulLoads addObject:aLoader];
+	if (0 == maxConcurrentLoadersPerHost) {
+		return YES;
 	}
+	return ([[runningPerHost objectForKey:host] unsignedIntegerValue] < maxConcurrentLoadersPerHost);
+}
+
+
+/**
+ *	Callback when a loader finished
+ */
+- (void)loaderAtIndex:(NSUInteger)idx didFinishWithErrorMessage:(NSString *)errorMessage
+{
+	INURLLoader *loader = [batchLoaders objectAtIndex:idx];
 	
 	// a failed one, poor guy
-	else {
-		[myFailedLoads addObject:aLoader];
+	if (errorMessage || loader.responseStatus >= 400) {
+		[failedIndexes addIndex:idx];
+		if (!errorMessage) {
+			errorMessage = [NSString stringWithFormat:@"Loading %@ returned status %lu", loader.url, (unsigned long)loader.responseStatus];
+		}
 	}
 	
-	// continue
-	[queuedLoaders removeObject:aLoader];
-	if ([queuedLoaders count] > 0) {
-		self.currentLoader = [queuedLoaders objectAtIndex:0];
+	if (progress) {
+		INURLFetcherLoaderBlock myProgress = progress;
+		myProgress(loader, idx, errorMessage);
 		
-		__block INURLFetcher *this = self;
-		[currentLoader getWithCallback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
-			if (userDidCancel) {
-				[self didCancel];
-			}
-			else {
-				[this loaderDidFinish:currentLoader withErrorMessage:errorMessage];
-			}
-		}];
+		// the progress block may have cancelled us, in which case the batch may already be over if the running loaders called back right away
+		if (cancelling) {
+			[self didCancel];
+			return;
+		}
+		if (!batchLoaders) {
+			return;
+		}
 	}
 	
-	// finished!
-	else {
-		if (callback) {
-			self.successfulLoads = mySuccessfulLoads;
-			self.failedLoads = myFailedLoads;
-			self.mySuccessfulLoads = nil;
-			self.myFailedLoads = nil;
-			callback(NO, ([myFailedLoads count] > 0) ? @"Some loaders failed to load" : nil);
-			self.callback = nil;
+	// continue or finish
+	if ([pendingIndexes count] > 0) {
+		[self startPendingLoaders];
+	}
+	else if ([runningIndexes count] < 1) {
+		[self finish];
+	}
+}
+
+/**
+ *	All loaders have finished, sort them into our result arrays and call the callback
+ */
+- (void)finish
+{
+	NSMutableArray *mySuccessfulLoads = [NSMutableArray arrayWithCapacity:[batchLoaders count]];
+	NSMutableArray *myFailedLoads = [NSMutableArray arrayWithCapacity:[failedIndexes count]];
+	[batchLoaders enumerateObjectsUsingBlock:^(INURLLoader *loader, NSUInteger idx, BOOL *stop) {
+		if ([failedIndexes containsIndex:idx]) {
+			[myFailedLoads addObject:loader];
+		}
+		else {
+			[mySuccessfulLoads addObject:loader];
 		}
-		self.currentLoader = nil;
+	}];
+	
+	self.loaders = batchLoaders;
+	self.successfulLoads = mySuccessfulLoads;
+	self.failedLoads = myFailedLoads;
+	
+	INCancelErrorBlock myCallback = callback;
+	[self reset];
+	if (myCallback) {
+		myCallback(NO, ([myFailedLoads count] > 0) ? @"Some loaders failed to load" : nil);
 	}
 }
 
@@ -146,30 +243,56 @@
  */
 - (void)cancel
 {
-	[self.currentLoader cancel];
+	if ([self isIdle]) {
+		return;
+	}
+	
+	self.cancelling = YES;
+	[pendingIndexes removeAllIndexes];
+	for (INURLLoader *loader in [batchLoaders objectsAtIndexes:[runningIndexes copy]]) {
+		[loader cancel];
+	}
 }
 
 /**
- *	Loading was cancelled
+ *	A loader was cancelled, calls the callback once all running loaders have returned
  */
 - (void)didCancel
 {
-	if (callback) {
-		self.mySuccessfulLoads = nil;
-		self.myFailedLoads = nil;
-		callback(YES, nil);
-		self.callback = nil;
+	if ([runningIndexes count] > 0) {
+		return;
 	}
-	self.currentLoader = nil;
+	
+	INCancelErrorBlock myCallback = callback;
+	self.loaders = batchLoaders;
+	[self reset];
+	if (myCallback) {
+		myCallback(YES, nil);
+	}
+}
+
+/**
+ *	Drops the state of the current batch
+ */
+- (void)reset
+{
+	self.batchLoaders = nil;
+	self.pendingIndexes = nil;
+	self.runningIndexes = nil;
+	self.failedIndexes = nil;
+	self.runningPerHost = nil;
+	self.progress = nil;
+	self.callback = nil;
+	self.cancelling = NO;
 }
 
 
 /**
- *	Returns YES if the queue is empty, which is true before loading has begun and after it has completed
+ *	Returns YES if no batch is being loaded, which is true before loading has begun and after it has completed
  */
 - (BOOL)isIdle
 {
-	return ([queuedLoaders count] < 1);
+	return (nil == batchLoaders);
 }
 
 
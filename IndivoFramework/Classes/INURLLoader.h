@@ -23,8 +23,12 @@
 #import <Foundation/Foundation.h>
 #import "Indivo.h"
 
+@class INXMLNode;
+
 #define kINURLLoaderDefaultTimeoutInterval 60.0								///< timeout interval in seconds
 
+NSString *INHeaderValue(NSDictionary *headers, NSString *name);
+
 
 /**
  *	This class simplifies loading data from a URL
@@ -32,10 +36,15 @@
 @interface INURLLoader : NSObject
 
 @property (nonatomic, strong) NSURL *url;									///< The URL we will load from
-@property (nonatomic, readonly, copy) NSData *responseData;					///< Will contain the response data as loaded from url
-@property (nonatomic, readonly, copy) NSString *responseString;				///< Will contain the response as NSString as loaded from url
+@property (nonatomic, readonly, strong) NSData *responseData;				///< Will contain the response data as loaded from url, handed over without copying
+@property (nonatomic, readonly, copy) NSString *responseString;				///< The response data decoded as UTF-8 string, decoded on first access
 @property (nonatomic, readonly, assign) NSUInteger responseStatus;			///< The HTTP response status code
 @property (nonatomic, assign) BOOL expectBinaryData;						///< NO by default. Set to YES if you expect binary data; "responseString" will be left nil!
+@property (nonatomic, assign) BOOL parseXMLWhileLoading;					///< NO by default. If YES, data is fed to an XML parser as it arrives and "responseXML" is filled; "responseData" and "responseString" will be left nil!
+@property (nonatomic, readonly, strong) INXMLNode *responseXML;				///< The parsed response if "parseXMLWhileLoading" is YES
+@property (nonatomic, assign) BOOL downloadToFile;							///< NO by default. If YES, data is written to "downloadPath" as it arrives and "responseData" is memory-mapped from that file; "responseString" will be left nil!
+@property (nonatomic, copy) NSString *downloadPath;							///< Where to download to if "downloadToFile" is YES. Defaults to a file in the temporary directory derived from the URL
+@property (nonatomic, assign) BOOL resumeDownload;							///< NO by default. If YES and a partial download exists at "downloadPath", only the missing bytes are requested with a Range header
 
 + (NSDictionary *)queryFromRequest:(NSURLRequest *)aRequest;
 + (NSDictionary *)queryFromRequestString:(NSString *)aString;
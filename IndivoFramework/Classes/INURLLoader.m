@@ -21,22 +21,52 @@
  */
 
 #import "INURLLoader.h"
+#import "INXMLParser.h"
+#import <CommonCrypto/CommonDigest.h>
+
+/**
+ *	Header field names are case-insensitive and NSHTTPURLResponse may hand us "Etag" instead of "ETag"
+ */
+NSString *INHeaderValue(NSDictionary *headers, NSString *name)
+{
+	NSString *value = [headers objectForKey:name];
+	if (!value) {
+		for (NSString *key in [headers allKeys]) {
+			if (NSOrderedSame == [key caseInsensitiveCompare:name]) {
+				return [headers objectForKey:key];
+			}
+		}
+	}
+	return value;
+}
+
 
 @interface INURLLoader ()
 
 @property (nonatomic, copy) INCancelErrorBlock callback;
 @property (nonatomic, strong) NSMutableData *loadingCache;
-@property (nonatomic, readwrite, copy) NSData *responseData;
+@property (nonatomic, readwrite, strong) NSData *responseData;
 @property (nonatomic, readwrite, copy) NSString *responseString;
 @property (nonatomic, readwrite, assign) NSUInteger responseStatus;
+@property (nonatomic, readwrite, strong) INXMLNode *responseXML;
+@property (nonatomic, strong) INXMLParser *xmlParser;
+@property (nonatomic, assign) unsigned long long bytesParsed;
+@property (nonatomic, strong) NSFileHandle *downloadHandle;
+@property (nonatomic, assign) unsigned long long resumeOffset;
 
 @property (nonatomic, strong) NSURLConnection *currentConnection;
+@property (nonatomic, strong) NSURLRequest *currentRequest;
 @property (nonatomic, strong) NSURLResponse *currentResponse;
 @property (nonatomic, assign) NSTimeInterval timeoutInterval;
 @property (nonatomic, strong) NSTimer *timeout;
 
 - (void)prepareWithCallback:(INCancelErrorBlock)aCallback;
+- (NSURLRequest *)prepareDownloadForRequest:(NSURLRequest *)aRequest error:(NSError **)error;
+- (void)closeDownload;
+- (NSString *)validatorPath;
+- (void)restartDownload;
 - (void)didFinishWithError:(NSError *)anError wasCancelled:(BOOL)didCancel;
+- (void)startTimeout;
 - (void)didTimeout:(NSTimer *)timer;
 
 @end
@@ -46,8 +76,9 @@
 
 @synthesize url, callback, loadingCache;
 @synthesize responseData, responseString, responseStatus;
-@synthesize currentConnection, currentResponse, timeoutInterval, timeout;
-@synthesize expectBinaryData;
+@synthesize currentConnection, currentRequest, currentResponse, timeoutInterval, timeout;
+@synthesize expectBinaryData, parseXMLWhileLoading, responseXML, xmlParser, bytesParsed;
+@synthesize downloadToFile, downloadPath, resumeDownload, downloadHandle, resumeOffset;
 
 
 - (id)initWithURL:(NSURL *)anURL
@@ -73,13 +104,112 @@
 {
 	self.responseData = nil;
 	self.responseString = nil;
+	self.responseXML = nil;
+	self.xmlParser = parseXMLWhileLoading ? [INXMLParser new] : nil;
+	self.bytesParsed = 0;
 	self.responseStatus = 1000;
 	self.currentConnection = nil;
+	self.currentRequest = nil;
 	self.currentResponse = nil;
 	self.callback = aCallback;
 	[timeout invalidate];
 	self.timeout = nil;
-	self.loadingCache = [NSMutableData data];
+	[self closeDownload];
+	self.resumeOffset = 0;
+	self.loadingCache = (downloadToFile || parseXMLWhileLoading) ? nil : [NSMutableData data];
+}
+
+/**
+ *	Opens the file we download to. If we resume a partial download, returns a copy of the request asking only for the missing bytes, provided they
+ *	still belong to the version we have the first bytes of.
+ *	@return The request to perform, nil if the download file could not be opened
+ */
+- (NSURLRequest *)prepareDownloadForRequest:(NSURLRequest *)aRequest error:(NSError **)error
+{
+	NSString *path = self.downloadPath;
+	NSFileManager *fm = [NSFileManager defaultManager];
+	unsigned long long existing = [[fm attributesOfItemAtPath:path error:nil] fileSize];
+	
+	// resuming only makes sense when GETting, and only if we know which version of the resource we have
+	NSString *validator = [NSString stringWithContentsOfFile:[self validatorPath] encoding:NSUTF8StringEncoding error:nil];
+	BOOL canResume = resumeDownload && existing > 0 && [validator length] > 0 && (!aRequest.HTTPMethod || [@"GET" isEqualToString:aRequest.HTTPMethod]);
+	if (!canResume) {
+		if (![fm createFileAtPath:path contents:nil attributes:nil]) {
+			ERR(error, ([NSString stringWithFormat:@"Failed to create download file at %@", path]), 0);
+			return nil;
+		}
+		[fm removeItemAtPath:[self validatorPath] error:nil];
+		existing = 0;
+	}
+	
+	self.downloadHandle = [NSFileHandle fileHandleForWritingAtPath:path];
+	if (!downloadHandle) {
+		ERR(error, ([NSString stringWithFormat:@"Failed to open download file at %@", path]), 0);
+		return nil;
+	}
+	[downloadHandle seekToEndOfFile];
+	
+	if (existing > 0) {
+		self.resumeOffset = existing;
+		NSMutableURLRequest *rangeRequest = [aRequest mutableCopy];
+		[rangeRequest setValue:[NSString stringWithFormat:@"bytes=%llu-", existing] forHTTPHeaderField:@"Range"];
+		[rangeRequest setValue:validator forHTTPHeaderField:@"If-Range"];			// the server sends everything if the resource has changed
+		return rangeRequest;
+	}
+	return aRequest;
+}
+
+/**
+ *	Closes the download file, if we have one open. The file itself is left in place so an interrupted download can be resumed.
+ */
+- (void)closeDownload
+{
+	[downloadHandle closeFile];
+	self.downloadHandle = nil;
+}
+
+/**
+ *	Discards what we downloaded and requests everything again, used when the server answers a resume request with bytes we didn't ask for
+ */
+- (void)restartDownload
+{
+	NSMutableURLRequest *request = [currentRequest mutableCopy];
+	[request setValue:nil forHTTPHeaderField:@"Range"];
+	[request setValue:nil forHTTPHeaderField:@"If-Range"];
+	[currentConnection cancel];
+	[self closeDownload];
+	
+	NSFileManager *fm = [NSFileManager defaultManager];
+	[fm removeItemAtPath:self.downloadPath error:nil];
+	[fm removeItemAtPath:[self validatorPath] error:nil];
+	[self performRequest:request withCallback:callback];
+}
+
+/**
+ *	The path we download to if none has been set explicitly, named after the SHA-1 of the URL so different URLs never share a partial download
+ */
+- (NSString *)downloadPath
+{
+	if (!downloadPath && url) {
+		NSData *urlData = [[url absoluteString] dataUsingEncoding:NSUTF8StringEncoding];
+		unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+		CC_SHA1([urlData bytes], (CC_LONG)[urlData length], digest);
+		
+		NSMutableString *name = [NSMutableString stringWithString:@"INURLLoader-"];
+		for (NSUInteger i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+			[name appendFormat:@"%02x", digest[i]];
+		}
+		return [NSTemporaryDirectory() stringByAppendingPathComponent:name];
+	}
+	return downloadPath;
+}
+
+/**
+ *	The file next to our download holding the ETag or Last-Modified date of the resource, sent as "If-Range" when resuming
+ */
+- (NSString *)validatorPath
+{
+	return [self.downloadPath stringByAppendingString:@".validator"];
 }
 
 /**
@@ -131,33 +261,65 @@
 	
 	// prepare and set a timeout timer manually
 	[self prepareWithCallback:aCallback];
+	if (downloadToFile && !xmlParser) {
+		NSError *error = nil;
+		aRequest = [self prepareDownloadForRequest:aRequest error:&error];
+		if (!aRequest) {
+			self.callback = nil;
+			CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(aCallback, NO, [error localizedDescription]);
+			return;
+		}
+	}
 	self.timeoutInterval = fmin(kINURLLoaderDefaultTimeoutInterval, aRequest.timeoutInterval);
-	self.timeout = [NSTimer scheduledTimerWithTimeInterval:timeoutInterval target:self selector:@selector(didTimeout:) userInfo:nil repeats:NO];
+	[self startTimeout];
 	
+	self.currentRequest = aRequest;	
 	self.currentConnection = [NSURLConnection connectionWithRequest:aRequest delegate:self];
 }
 
 
 /**
- *	This finishing method creates an NSString from any loaded data and calls the callback, if one was given
+ *	This finishing method creates an NSString from any loaded data and calls the callback, if one was given.
+ *	When parsing while loading, the parser has already seen all the data and we only need to tell it that the document is complete.
  */
 - (void)didFinishWithError:(NSError *)anError wasCancelled:(BOOL)didCancel
 {
 	[timeout invalidate];
 	self.timeout = nil;
 	
-	// extract response
-	if ([loadingCache length] > 0) {
-		if ([currentResponse isKindOfClass:[NSHTTPURLResponse class]]) {
-			self.responseStatus = [(NSHTTPURLResponse *)currentResponse statusCode];
+	if ([currentResponse isKindOfClass:[NSHTTPURLResponse class]]) {
+		self.responseStatus = [(NSHTTPURLResponse *)currentResponse statusCode];
+	}
+	
+	// finish parsing
+	if (xmlParser) {
+		NSError *parseError = nil;
+		INXMLNode *root = [xmlParser finishParsingChunks:&parseError];
+		if (!anError && !didCancel) {
+			self.responseXML = root;
+			anError = (root || 0 == bytesParsed) ? nil : parseError;			// an empty body, e.g. of a 204, is no error, there just is no XML
+		}
+		self.xmlParser = nil;
+	}
+	
+	// map the downloaded file instead of holding it in memory
+	else if (downloadHandle) {
+		[self closeDownload];
+		if (!anError && !didCancel) {
+			NSError *mapError = nil;
+			self.responseData = [NSData dataWithContentsOfFile:self.downloadPath options:NSDataReadingMappedIfSafe error:&mapError];
+			if (!responseData) {
+				anError = mapError;
+			}
 		}
+	}
+	
+	// extract response
+	else if ([loadingCache length] > 0) {
 		
-		// extract response string
+		// hand over the buffer we filled, nobody else holds on to it so there is no need to copy. The string is only decoded when asked for.
 		self.responseData = loadingCache;
 		self.loadingCache = nil;
-		if (!expectBinaryData) {
-			self.responseString = [[NSString alloc] initWithData:responseData encoding:NSUTF8StringEncoding];
-		}
 	}
 	
 	// finish up
@@ -167,6 +329,27 @@
 }
 
 
+/**
+ *	Decodes the response data on first access, so consumers that only need the bytes never pay for a string copy
+ */
+- (NSString *)responseString
+{
+	if (!responseString && !expectBinaryData && !downloadToFile && [responseData length] > 0) {
+		self.responseString = [[NSString alloc] initWithData:responseData encoding:NSUTF8StringEncoding];
+	}
+	return responseString;
+}
+
+
+/**
+ *	(Re-)starts the timeout timer
+ */
+- (void)startTimeout
+{
+	[timeout invalidate];
+	self.timeout = [NSTimer scheduledTimerWithTimeInterval:timeoutInterval target:self selector:@selector(didTimeout:) userInfo:nil repeats:NO];
+}
+
 /**
  *	Our timer calls this method when the time is up
  */
@@ -193,10 +376,86 @@
 - (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response
 {
 	self.currentResponse = response;
+	NSInteger status = [response isKindOfClass:[NSHTTPURLResponse class]] ? [(NSHTTPURLResponse *)response statusCode] : 0;
+	NSDictionary *headers = [response isKindOfClass:[NSHTTPURLResponse class]] ? [(NSHTTPURLResponse *)response allHeaderFields] : nil;
+	
+	// we asked for a range: 206 appends to what we have, 200 (or a non-HTTP URL) sends everything so we start over
+	if (resumeOffset > 0) {
+		if (206 == status) {
+			
+			// the bytes must start where our file ends, otherwise we'd splice two different things together
+			long long start = -1;
+			NSScanner *scanner = [NSScanner scannerWithString:INHeaderValue(headers, @"Content-Range") ?: @""];
+			if (!([scanner scanString:@"bytes" intoString:NULL] && [scanner scanLongLong:&start]) || start != (long long)resumeOffset) {
+				DLog(@"Server sent range \"%@\" instead of bytes %llu-, restarting the download", INHeaderValue(headers, @"Content-Range"), resumeOffset);
+				[self restartDownload];
+				return;
+			}
+		}
+		else if (200 == status || 0 == status) {
+			[downloadHandle truncateFileAtOffset:0];
+			self.resumeOffset = 0;
+		}
+		
+		// there are no bytes beyond what we have, so our file is complete. Report it like a full download.
+		else if (416 == status) {
+			[connection cancel];
+			self.currentResponse = nil;
+			self.responseStatus = 200;
+			[self didFinishWithError:nil wasCancelled:NO];
+			return;
+		}
+		
+		// any other status: keep the partial file for the next attempt and fail
+		else if (206 != status) {
+			NSError *error = nil;
+			ERR(&error, ([NSString stringWithFormat:@"Resuming the download failed with status %d", status]), status);
+			[connection cancel];
+			self.responseStatus = status;
+			[self didFinishWithError:error wasCancelled:NO];
+			return;
+		}
+	}
+	
+	// remember which version of the resource we're downloading, so we can resume it later. Weak ETags can't be used with "If-Range".
+	if (downloadHandle && resumeDownload && 0 == resumeOffset) {
+		NSString *validator = INHeaderValue(headers, @"ETag");
+		if (!validator || [validator hasPrefix:@"W/"]) {
+			validator = INHeaderValue(headers, @"Last-Modified");
+		}
+		if (200 == status && [validator length] > 0) {
+			[validator writeToFile:[self validatorPath] atomically:YES encoding:NSUTF8StringEncoding error:nil];
+		}
+		else {
+			[[NSFileManager defaultManager] removeItemAtPath:[self validatorPath] error:nil];
+		}
+	}
 }
 
 - (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data
 {
+	if (xmlParser) {
+		NSError *error = nil;
+		self.bytesParsed = bytesParsed + [data length];
+		if (![xmlParser parseChunk:data error:&error]) {
+			[connection cancel];
+			[self didFinishWithError:error wasCancelled:NO];
+		}
+		return;
+	}
+	if (downloadHandle) {
+		[self startTimeout];								// large downloads may take longer than the timeout, only stalling ones should time out
+		@try {
+			[downloadHandle writeData:data];
+		}
+		@catch (NSException *e) {
+			NSError *error = nil;
+			ERR(&error, [e reason], 0);
+			[connection cancel];
+			[self didFinishWithError:error wasCancelled:NO];
+		}
+		return;
+	}
 	[loadingCache appendData:data];
 }
 
@@ -22,6 +22,7 @@
 
 #import "INUnitValue.h"
 #import "NSString+XML.h"
+#import "INXMLWriter.h"
 
 @implementation INUnitValue
 
@@ -38,24 +39,28 @@
 	return (!value && [unit length] < 1);
 }
 
-- (NSString *)xml
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
 	if ([self isNull]) {
-		return [NSString stringWithFormat:@"<%@ />", [self tagString]];
+		[writer appendEmptyTag:[self tagString]];
+		return;
 	}
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [NSString stringWithFormat:@"<%@>%@%@\n</%@>",
-			[self tagString],
-			self.value ? [NSString stringWithFormat:@"\n\t<value>%@</value>", self.value] : @"",
-			self.unit ? [NSString stringWithFormat:@"\n\t<unit>%@</unit>", [self.unit xmlSafe]] : @"",
-			self.nodeName];
-#else
-	return [NSString stringWithFormat:@"<%@>%@%@</%@>",
-			[self tagString],
-			self.value ? [NSString stringWithFormat:@"<value>%@</value>", self.value] : @"",
-			self.unit ? [NSString stringWithFormat:@"<unit>%@</unit>", [self.unit xmlSafe]] : @"",
-			self.nodeName];
-#endif
+	
+	[writer appendStartTag:[self tagString]];
+	writer.depth++;
+	if (self.value) {
+		[writer indent];
+		[writer appendElement:@"value" content:[self.value stringValue]];
+	}
+	if (self.unit) {
+		[writer indent];
+		[writer appendStartTag:@"unit"];
+		[writer appendEscapedString:self.unit];
+		[writer appendEndTag:@"unit"];
+	}
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:self.nodeName];
 }
 
 
@@ -23,6 +23,8 @@
 
 #import <Foundation/Foundation.h>
 
+@class INXMLWriter;
+
 
 /**
  *	A class to represent one node in an XML document
@@ -43,6 +45,7 @@
 - (INXMLNode *)firstChild;
 - (INXMLNode *)childNamed:(NSString *)childName;
 - (NSArray *)childrenNamed:(NSString *)childName;
+- (INXMLNode *)childWithNameAttribute:(NSString *)aName;
 
 - (BOOL)boolValue;
 
@@ -56,6 +59,8 @@
 // getting XML back
 - (NSString *)xml;
 - (NSString *)childXML;
+- (void)writeXMLTo:(INXMLWriter *)writer;
+- (void)writeChildXMLTo:(INXMLWriter *)writer;
 
 
 @end
@@ -23,11 +23,114 @@
 
 #import "INXMLNode.h"
 #import "NSString+XML.h"
+#import "INXMLWriter.h"
+
+
+/**
+ *	The mutable array holding a node's children. It counts every mutation, so the node's child indexes notice any change made directly to the array,
+ *	including replacing a child in place.
+ */
+@interface INXMLChildArray : NSMutableArray {
+	NSMutableArray *backing;
+}
+
+@property (atomic, readonly, assign) NSUInteger mutations;
+
+@end
+
+
+@implementation INXMLChildArray
+
+@synthesize mutations;
+
+
+- (id)init
+{
+	return [self initWithCapacity:0];
+}
+
+- (id)initWithCapacity:(NSUInteger)numItems
+{
+	if ((self = [super init])) {
+		backing = [[NSMutableArray alloc] initWithCapacity:numItems];
+	}
+	return self;
+}
+
+- (id)initWithObjects:(const id [])objects count:(NSUInteger)cnt
+{
+	if ((self = [super init])) {
+		backing = [[NSMutableArray alloc] initWithObjects:objects count:cnt];
+	}
+	return self;
+}
+
+- (NSUInteger)count
+{
+	return [backing count];
+}
+
+- (id)objectAtIndex:(NSUInteger)index
+{
+	return [backing objectAtIndex:index];
+}
+
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(__unsafe_unretained id [])buffer count:(NSUInteger)len
+{
+	return [backing countByEnumeratingWithState:state objects:buffer count:len];
+}
+
+- (void)addObject:(id)anObject
+{
+	[backing addObject:anObject];
+	mutations++;
+}
+
+- (void)insertObject:(id)anObject atIndex:(NSUInteger)index
+{
+	[backing insertObject:anObject atIndex:index];
+	mutations++;
+}
+
+- (void)removeLastObject
+{
+	[backing removeLastObject];
+	mutations++;
+}
+
+- (void)removeObjectAtIndex:(NSUInteger)index
+{
+	[backing removeObjectAtIndex:index];
+	mutations++;
+}
+
+- (void)replaceObjectAtIndex:(NSUInteger)index withObject:(id)anObject
+{
+	[backing replaceObjectAtIndex:index withObject:anObject];
+	mutations++;
+}
+
+@end
+
+
+
+@interface INXMLNode ()
+
+@property (atomic, strong) NSDictionary *childIndex;					///< Maps child names to immutable arrays of children with that name, built on first lookup
+@property (atomic, assign) NSUInteger childIndexMutations;			///< The children's mutation count when the index was built
+@property (atomic, strong) NSDictionary *nameAttributeIndex;			///< Maps the "name" attribute of children to the first child carrying it
+@property (atomic, assign) NSUInteger nameAttributeIndexMutations;	///< The children's mutation count when the name attribute index was built
+
+- (NSDictionary *)indexedChildren;
+
+@end
+
 
 @implementation INXMLNode
 
 @synthesize parent, name;
 @synthesize attributes, children, text;
+@synthesize childIndex, childIndexMutations, nameAttributeIndex, nameAttributeIndexMutations;
 
 
 /**
@@ -59,13 +162,26 @@
 {
 	aNode.parent = self;
 	if (!children) {
-		self.children = [NSMutableArray arrayWithObject:aNode];
+		self.children = [INXMLChildArray arrayWithObject:aNode];
 	}
 	else {
 		[children addObject:aNode];
 	}
 }
 
+/**
+ *	Replacing the children invalidates our child name index.
+ *	The node keeps its own mutation-counting copy unless given one of its kind, so mutate "children" after setting it, not the array you passed in.
+ */
+- (void)setChildren:(NSMutableArray *)newChildren
+{
+	if (newChildren != children) {
+		children = (!newChildren || [newChildren isKindOfClass:[INXMLChildArray class]]) ? newChildren : [INXMLChildArray arrayWithArray:newChildren];
+		self.childIndex = nil;
+		self.nameAttributeIndex = nil;
+	}
+}
+
 
 /**
  *	Return the first child node or nil, if there are none
@@ -83,12 +199,8 @@
  */
 - (INXMLNode *)childNamed:(NSString *)childName
 {
-	if ([children count] > 0) {
-		for (INXMLNode *child in children) {
-			if ([child.name isEqualToString:childName]) {
-				return child;
-			}
-		}
+	if ([children count] > 0 && childName) {
+		return [[[self indexedChildren] objectForKey:childName] objectAtIndex:0];
 	}
 	return nil;
 }
@@ -99,16 +211,79 @@
  */
 - (NSArray *)childrenNamed:(NSString *)childName
 {
-	NSMutableArray *found = nil;
 	if ([children count] > 0) {
-		found = [NSMutableArray array];
+		NSArray *found = childName ? [[self indexedChildren] objectForKey:childName] : nil;			// immutable, safe to hand out
+		return found ? found : [NSArray array];
+	}
+	return nil;
+}
+
+/**
+ *	Returns the first child whose "name" attribute matches the given name.
+ *	Indivo 2.0's flat XML puts all values of a model into <Field name="..."> children of a <Model> node, and deserializing a model looks up every one of
+ *	them. The first lookup indexes all children by their name attribute, so that all further lookups on the same node are hash lookups.
+ */
+- (INXMLNode *)childWithNameAttribute:(NSString *)aName
+{
+	if ([children count] < 1 || !aName) {
+		return nil;
+	}
+	
+	NSDictionary *index = self.nameAttributeIndex;
+	NSUInteger count = [children count];
+	NSUInteger mutations = [(INXMLChildArray *)children mutations];
+	if (!index || mutations != self.nameAttributeIndexMutations) {
+		NSMutableDictionary *building = [NSMutableDictionary dictionaryWithCapacity:count];
 		for (INXMLNode *child in children) {
-			if ([child.name isEqualToString:childName]) {
-				[found addObject:child];
+			NSString *childName = [child attr:@"name"];
+			if (childName && ![building objectForKey:childName]) {
+				[building setObject:child forKey:childName];
+			}
+		}
+		self.nameAttributeIndexMutations = mutations;
+		self.nameAttributeIndex = building;
+		index = building;
+	}
+	
+	return [index objectForKey:aName];
+}
+
+/**
+ *	Returns the index mapping child names to immutable arrays of the children with that name, in document order.
+ *	The index is built lazily on the first lookup, so nodes that are never queried don't pay for it. Any mutation of the children array, be it through
+ *	"addChild:" or directly, changes its mutation count and makes us rebuild; "setChildren:" discards the index.
+ */
+- (NSDictionary *)indexedChildren
+{
+	NSDictionary *index = self.childIndex;
+	NSUInteger count = [children count];
+	NSUInteger mutations = [(INXMLChildArray *)children mutations];
+	if (index && mutations == self.childIndexMutations) {
+		return index;
+	}
+	
+	NSMutableDictionary *building = [NSMutableDictionary dictionaryWithCapacity:count];
+	for (INXMLNode *child in children) {
+		NSString *childName = child.name;
+		if (childName) {
+			NSMutableArray *named = [building objectForKey:childName];
+			if (named) {
+				[named addObject:child];
+			}
+			else {
+				[building setObject:[NSMutableArray arrayWithObject:child] forKey:childName];
 			}
 		}
 	}
-	return found;
+	
+	// freeze the arrays so callers of childrenNamed: cannot alter the index
+	for (NSString *childName in [building allKeys]) {
+		[building setObject:[[building objectForKey:childName] copy] forKey:childName];
+	}
+	
+	self.childIndexMutations = mutations;
+	self.childIndex = building;
+	return building;
 }
 
 
@@ -192,40 +367,59 @@
 
 #pragma mark - XML
 - (NSString *)xml
+{
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeXMLTo:writer];
+	return [writer string];
+}
+
+- (NSString *)childXML
+{
+	if ([children count] > 0) {
+		INXMLWriter *writer = [INXMLWriter new];
+		[self writeChildXMLTo:writer];
+		return [writer string];
+	}
+	return @"";
+}
+
+/**
+ *	Appends the node with its attributes and all of its children to the writer
+ */
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
 	NSString *nodeName = ([name length] > 0 ? name : @"node");
-	NSMutableString *xmlString = [NSMutableString stringWithFormat:@"<%@", nodeName];
+	[writer appendString:@"<"];
+	[writer appendString:nodeName];
 	
 	// add attributes
-	if ([attributes count] > 0) {
-		for (NSString *key in [attributes allKeys]) {
-			NSString *val = [attributes objectForKey:key];
-			[xmlString appendFormat:@" %@=\"%@\"", key, [val xmlSafe]];
-		}
+	for (NSString *key in attributes) {
+		[writer appendString:@" "];
+		[writer appendString:key];
+		[writer appendString:@"=\""];
+		[writer appendEscapedString:[attributes objectForKey:key]];
+		[writer appendString:@"\""];
 	}
 	
 	// add chilren
 	if ([children count] > 0) {
-		[xmlString appendFormat:@">%@</%@>", [self childXML], nodeName];
+		[writer appendString:@">"];
+		[self writeChildXMLTo:writer];
+		[writer appendEndTag:nodeName];
 	}
 	else {
-		[xmlString appendString:@" />"];
+		[writer appendString:@" />"];
 	}
-	
-	return xmlString;
 }
 
-- (NSString *)childXML
+/**
+ *	Appends the XML of all child nodes to the writer
+ */
+- (void)writeChildXMLTo:(INXMLWriter *)writer
 {
-	if ([children count] > 0) {
-		NSMutableArray *xmlArr = [NSMutableArray arrayWithCapacity:[children count]];
-		for (INXMLNode *child in children) {
-			[xmlArr addObject:[child xml]];
-		}
-		
-		return [xmlArr componentsJoinedByString:@""];
+	for (INXMLNode *child in children) {
+		[child writeXMLTo:writer];
 	}
-	return @"";
 }
 
 
@@ -31,6 +31,12 @@
 @interface INXMLParser : NSObject <NSXMLParserDelegate>
 
 + (INXMLNode *)parseXML:(NSString *)xmlString error:(NSError * __autoreleasing *)error;
++ (INXMLNode *)parseXMLData:(NSData *)xmlData error:(NSError * __autoreleasing *)error;
+// push parsing
+- (INXMLNode *)parseXMLData:(NSData *)xmlData error:(NSError * __autoreleasing *)error;
+- (BOOL)parseChunk:(NSData *)chunk error:(NSError * __autoreleasing *)error;
+- (INXMLNode *)finishParsingChunks:(NSError * __autoreleasing *)error;
+
 + (BOOL)validateXML:(NSString *)xmlString againstXSD:(NSString *)xsdPath error:(__autoreleasing NSError **)error;
 
 
@@ -25,9 +25,16 @@
 #import "INXMLReport.h"
 #import "Indivo.h"
 #include <libxml/xmlschemastypes.h>
+#include <libxml/parser.h>
 
 
-@interface INXMLParser()
+@interface INXMLParser() {
+	xmlParserCtxtPtr saxContext;				///< The libxml2 parser context while parsing raw data
+	CFMutableDictionaryRef saxNames;			///< Maps libxml2's interned name pointers to NSStrings so we create every node and attribute name only once
+	char *saxText;								///< Collects the raw UTF-8 character data of the current element
+	size_t saxTextLength;
+	size_t saxTextCapacity;
+}
 
 @property (nonatomic, strong) INXMLNode *rootNode;
 @property (nonatomic, strong) INXMLNode *currentNode;
@@ -37,9 +44,17 @@
 
 + (Class)nodeClassForNodeName:(NSString *)aNodeName;
 - (INXMLNode *)parseXML:(NSString *)xmlString error:(NSError * __autoreleasing *)error;
+- (BOOL)startSAXWithBytes:(const char *)bytes length:(int)length;
+- (INXMLNode *)finishSAXWithResult:(int)result error:(NSError * __autoreleasing *)error;
 
 void xmlSchemaValidityError(void **ctx, const char *format, ...);
 
+static void INXMLParserStartElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+									int nb_namespaces, const xmlChar **namespaces, int nb_attributes, int nb_defaulted, const xmlChar **attrs);
+static void INXMLParserEndElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI);
+static void INXMLParserCharacters(void *ctx, const xmlChar *chars, int len);
+static void INXMLParserStructuredError(void *userData, xmlErrorPtr error);
+
 @end
 
 
@@ -49,6 +64,18 @@ void xmlSchemaValidityError(void **ctx, const char *format, ...);
 @synthesize errorOnLine;
 
 
+- (void)dealloc
+{
+	if (saxContext) {
+		xmlFreeParserCtxt(saxContext);
+	}
+	if (saxNames) {
+		CFRelease(saxNames);
+	}
+	free(saxText);
+}
+
+
 /**
  *	We can use INXMLNode subclasses for certain nodes with additional functionality, return the correct class from this method
  *	@todo THIS SHOULD GO TO A DELEGATE METHOD
@@ -124,6 +151,269 @@ void xmlSchemaValidityError(void **ctx, const char *format, ...);
 
 
 
+
+#pragma mark - libxml2 SAX Parsing
+/**
+ *	Returns the root node generated from parsing the given XML data.
+ *	This uses libxml2's SAX2 interface and builds the node tree straight from the raw bytes, there is no intermediate NSString and no copy of the data. Use
+ *	this method instead of "parseXML:error:" whenever you have the data at hand, e.g. from INURLLoader's "responseData".
+ *	@param xmlData The XML document's bytes, libxml2 detects the encoding (UTF-8 unless declared otherwise)
+ *	@param error An NSError pointer which is guaranteed to not be nil if this method returns nil and a pointer was provided
+ *	@return The root INXMLNode, or nil if parsing failed
+ */
++ (INXMLNode *)parseXMLData:(NSData *)xmlData error:(NSError * __autoreleasing *)error
+{
+	INXMLParser *p = [[self alloc] init];
+	return [p parseXMLData:xmlData error:error];
+}
+
+
+/**
+ *	Parses XML data with libxml2's SAX2 interface, see the class method for details
+ */
+- (INXMLNode *)parseXMLData:(NSData *)xmlData error:(NSError * __autoreleasing *)error
+{
+	if ([xmlData length] < 1) {
+		XERR(error, @"No XML data provided", 0)
+		return nil;
+	}
+	
+	[self parseChunk:xmlData error:nil];
+	return [self finishParsingChunks:error];
+}
+
+
+/**
+ *	Feeds the next chunk of an XML document to the push parser.
+ *	Use this to parse a document while it is still being loaded: call this method for every chunk as it arrives and "finishParsingChunks:" once the last chunk
+ *	has been pushed. The node tree is built as the chunks come in, so it is complete as soon as the last byte has been parsed.
+ *	@param chunk The next bytes of the document
+ *	@param error An NSError pointer which is guaranteed to not be nil if this method returns NO and a pointer was provided
+ *	@return NO if the XML so far is not well-formed, there's no point in pushing further data in this case
+ */
+- (BOOL)parseChunk:(NSData *)chunk error:(NSError * __autoreleasing *)error
+{
+	const char *bytes = [chunk bytes];
+	NSUInteger length = [chunk length];
+	
+	// libxml2 wants the first 4 bytes to detect the encoding when creating the context
+	if (!saxContext) {
+		if (length < 1) {
+			return YES;
+		}
+		int head = (int)MIN((NSUInteger)4, length);
+		if (![self startSAXWithBytes:bytes length:head]) {
+			XERR(error, @"Failed to create the XML parser", 0)
+			return NO;
+		}
+		bytes += head;
+		length -= head;
+	}
+	
+	// libxml2 takes int lengths
+	while (length > 0) {
+		int part = (int)MIN(length, (NSUInteger)INT_MAX);
+		int res = xmlParseChunk(saxContext, bytes, part, 0);
+		if (0 != res) {
+			xmlErrorPtr xmlError = xmlCtxtGetLastError(saxContext);
+			NSString *errStr = (xmlError && xmlError->message) ? [NSString stringWithUTF8String:xmlError->message] : @"Parser Error";
+			XERR(error, errStr, res)
+			return NO;
+		}
+		bytes += part;
+		length -= part;
+	}
+	return YES;
+}
+
+
+/**
+ *	Tells the push parser that the document is complete and returns the parsed root node.
+ *	@param error An NSError pointer which is guaranteed to not be nil if this method returns nil and a pointer was provided
+ *	@return The root INXMLNode, or nil if parsing failed or no data was ever pushed
+ */
+- (INXMLNode *)finishParsingChunks:(NSError * __autoreleasing *)error
+{
+	if (!saxContext) {
+		XERR(error, @"No XML data provided", 0)
+		return nil;
+	}
+	
+	int res = xmlParseChunk(saxContext, NULL, 0, 1);
+	return [self finishSAXWithResult:res error:error];
+}
+
+
+/**
+ *	Creates the libxml2 push parser context and prepares our root node.
+ *	Note that we deliberately leave all entity callbacks unset: no DTD entity ever gets declared, hence substituting entities (XML_PARSE_NOENT) only decodes
+ *	the predefined ones and character references and can't be used to load external resources.
+ */
+- (BOOL)startSAXWithBytes:(const char *)bytes length:(int)length
+{
+	xmlSAXHandler handler;
+	memset(&handler, 0, sizeof(xmlSAXHandler));
+	handler.initialized = XML_SAX2_MAGIC;
+	handler.startElementNs = INXMLParserStartElement;
+	handler.endElementNs = INXMLParserEndElement;
+	handler.characters = INXMLParserCharacters;
+	handler.cdataBlock = INXMLParserCharacters;
+	handler.serror = INXMLParserStructuredError;
+	
+	saxContext = xmlCreatePushParserCtxt(&handler, (__bridge void *)self, bytes, length, NULL);
+	if (NULL == saxContext) {
+		return NO;
+	}
+	xmlCtxtUseOptions(saxContext, XML_PARSE_NOENT | XML_PARSE_NONET);
+	
+	saxNames = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+	saxTextLength = 0;
+	self.rootNode = [INXMLNode nodeWithName:@"root" attributes:nil];
+	self.currentNode = rootNode;
+	
+	return YES;
+}
+
+
+/**
+ *	Frees the libxml2 context and returns our root node, which is nil if parsing failed
+ */
+- (INXMLNode *)finishSAXWithResult:(int)result error:(NSError * __autoreleasing *)error
+{
+	if (0 != result || !saxContext->wellFormed) {
+		xmlErrorPtr xmlError = xmlCtxtGetLastError(saxContext);
+		NSString *errStr = @"Parser Error";
+		if (xmlError) {
+			NSString *message = xmlError->message ? [[NSString stringWithUTF8String:xmlError->message] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]] : nil;
+			errStr = [NSString stringWithFormat:@"Parser error occurred on line %d, column %d%@", xmlError->line, xmlError->int2, (message ? [@": " stringByAppendingString:message] : @"")];
+		}
+		XERR(error, errStr, (xmlError ? xmlError->code : result))
+		self.rootNode = nil;
+	}
+	else {
+		
+		// remove our artificial root node unless there were several top-level elements
+		if (1 == [[rootNode children] count]) {
+			INXMLNode *onlyChild = [[rootNode children] objectAtIndex:0];
+			onlyChild.parent = nil;
+			self.rootNode = onlyChild;
+		}
+		if (error) {
+			*error = nil;
+		}
+	}
+	
+	// cleanup
+	xmlFreeParserCtxt(saxContext);
+	saxContext = NULL;
+	if (saxNames) {
+		CFRelease(saxNames);
+		saxNames = NULL;
+	}
+	free(saxText);
+	saxText = NULL;
+	saxTextLength = saxTextCapacity = 0;
+	self.currentNode = nil;
+	
+	return rootNode;
+}
+
+
+/**
+ *	Returns the NSString for a name interned in libxml2's dictionary.
+ *	Element and attribute names are pointers into the parser context's name dictionary, so the pointer identifies the name and we only create one NSString
+ *	per distinct name and document.
+ */
+static NSString *INXMLParserName(INXMLParser *parser, const xmlChar *name)
+{
+	NSString *str = (__bridge NSString *)CFDictionaryGetValue(parser->saxNames, name);
+	if (!str) {
+		str = [[NSString alloc] initWithUTF8String:(const char *)name];
+		CFDictionarySetValue(parser->saxNames, name, (__bridge const void *)str);
+	}
+	return str;
+}
+
+static void INXMLParserStartElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+									int nb_namespaces, const xmlChar **namespaces, int nb_attributes, int nb_defaulted, const xmlChar **attrs)
+{
+	INXMLParser *parser = (__bridge INXMLParser *)ctx;
+	NSString *elementName = INXMLParserName(parser, localname);
+	
+	// attributes come in 5-tuples: localname, prefix, URI, value start, value end
+	NSMutableDictionary *attributes = nil;
+	if (nb_attributes > 0) {
+		attributes = [[NSMutableDictionary alloc] initWithCapacity:nb_attributes];
+		for (int i = 0; i < nb_attributes; i++) {
+			const xmlChar **attr = attrs + 5 * i;
+			const xmlChar *qname = attr[1] ? xmlDictQLookup(parser->saxContext->dict, attr[1], attr[0]) : attr[0];
+			NSString *value = [[NSString alloc] initWithBytes:attr[3] length:(attr[4] - attr[3]) encoding:NSUTF8StringEncoding];
+			if (value) {
+				[attributes setObject:value forKey:INXMLParserName(parser, qname)];
+			}
+		}
+	}
+	
+	INXMLNode *node = [[[parser class] nodeClassForNodeName:elementName] new];
+	node.name = elementName;
+	node.attributes = attributes;
+	
+	if (parser->currentNode) {
+		[parser->currentNode addChild:node];
+	}
+	else {
+		DLog(@"Oops, error while parsing, closed child beyond root node!");
+	}
+	parser->currentNode = node;
+}
+
+static void INXMLParserEndElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI)
+{
+	INXMLParser *parser = (__bridge INXMLParser *)ctx;
+	
+	// trim whitespace on the raw bytes, then create the string
+	const char *start = parser->saxText;
+	const char *end = start + parser->saxTextLength;
+	while (start < end && (' ' == *start || '\t' == *start || '\n' == *start || '\r' == *start)) {
+		start++;
+	}
+	while (end > start && (' ' == *(end-1) || '\t' == *(end-1) || '\n' == *(end-1) || '\r' == *(end-1))) {
+		end--;
+	}
+	parser->currentNode.text = (end > start) ? [[NSString alloc] initWithBytes:start length:(end - start) encoding:NSUTF8StringEncoding] : @"";
+	parser->saxTextLength = 0;
+	
+	parser->currentNode = parser->currentNode.parent;
+}
+
+static void INXMLParserCharacters(void *ctx, const xmlChar *chars, int len)
+{
+	INXMLParser *parser = (__bridge INXMLParser *)ctx;
+	size_t needed = parser->saxTextLength + len;
+	if (needed > parser->saxTextCapacity) {
+		size_t newCapacity = MAX(needed, 2 * parser->saxTextCapacity);
+		newCapacity = MAX(newCapacity, (size_t)256);
+		char *grown = realloc(parser->saxText, newCapacity);
+		if (!grown) {
+			xmlStopParser(parser->saxContext);
+			return;
+		}
+		parser->saxText = grown;
+		parser->saxTextCapacity = newCapacity;
+	}
+	memcpy(parser->saxText + parser->saxTextLength, chars, len);
+	parser->saxTextLength = needed;
+}
+
+/**
+ *	Silences libxml2, which would otherwise print errors to stderr. We read the last error from the context when parsing has finished.
+ */
+static void INXMLParserStructuredError(void *userData, xmlErrorPtr error)
+{
+}
+
+
+
 #pragma mark - XML Parser Delegate
 /**
  *	Called when the parser encounters a start tag for a given element.
@@ -0,0 +1,54 @@
+/*
+ INXMLWriter.h
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ *	Writes XML into one growable UTF-8 byte buffer.
+ *	
+ *	All our objects serialize themselves by appending to a writer that is handed down the object tree, so generating a document does not allocate
+ *	intermediate strings for every node. Pretty formatting is driven by "depth": "indent" starts a new line indented by as many tabs as the current depth.
+ *	Call "data" or "string" once you're done, both hand over the buffer and leave the writer empty.
+ */
+@interface INXMLWriter : NSObject
+
+@property (nonatomic, assign) NSUInteger depth;								///< The current nesting depth, used by "indent"
+@property (nonatomic, assign) BOOL prettyFormat;							///< Whether "indent" adds newlines and tabs, YES if INDIVO_XML_PRETTY_FORMAT is defined
+@property (nonatomic, readonly, assign) NSUInteger length;					///< The number of bytes written so far
+
++ (INXMLWriter *)writer;
+
+- (void)appendBytes:(const char *)bytes length:(NSUInteger)numBytes;
+- (void)appendString:(NSString *)aString;
+- (void)appendEscapedString:(NSString *)aString;
+
+- (void)indent;
+- (void)appendStartTag:(NSString *)tagString;
+- (void)appendEndTag:(NSString *)nodeName;
+- (void)appendEmptyTag:(NSString *)tagString;
+- (void)appendElement:(NSString *)nodeName content:(NSString *)content;
+
+- (NSData *)data;
+- (NSString *)string;
+
+
+@end
@@ -0,0 +1,265 @@
+/*
+ INXMLWriter.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import "INXMLWriter.h"
+#import "Indivo.h"
+
+#define kINXMLWriterInitialCapacity 4096
+
+
+@interface INXMLWriter () {
+	char *buffer;
+	NSUInteger capacity;
+}
+
+@property (nonatomic, readwrite, assign) NSUInteger length;
+
+- (char *)reserve:(NSUInteger)numBytes;
+
+@end
+
+
+@implementation INXMLWriter
+
+@synthesize depth, prettyFormat, length;
+
+
++ (INXMLWriter *)writer
+{
+	return [self new];
+}
+
+- (id)init
+{
+	if ((self = [super init])) {
+#ifdef INDIVO_XML_PRETTY_FORMAT
+		self.prettyFormat = YES;
+#endif
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free(buffer);
+}
+
+
+
+#pragma mark - Buffer
+/**
+ *	Makes sure there is room for the given number of bytes after what has been written and returns a pointer to that location.
+ *	The buffer grows by doubling, so appending is amortized constant time.
+ */
+- (char *)reserve:(NSUInteger)numBytes
+{
+	if (length + numBytes > capacity) {
+		NSUInteger newCapacity = MAX(capacity, (NSUInteger)kINXMLWriterInitialCapacity);
+		while (newCapacity < length + numBytes) {
+			newCapacity *= 2;
+		}
+		char *newBuffer = realloc(buffer, newCapacity);
+		if (!newBuffer) {
+			[NSException raise:NSMallocException format:@"Failed to grow the XML buffer to %u bytes", newCapacity];
+		}
+		buffer = newBuffer;
+		capacity = newCapacity;
+	}
+	return buffer + length;
+}
+
+- (void)appendBytes:(const char *)bytes length:(NSUInteger)numBytes
+{
+	if (numBytes > 0) {
+		memcpy([self reserve:numBytes], bytes, numBytes);
+		length += numBytes;
+	}
+}
+
+/**
+ *	Appends the string's UTF-8 bytes as they are.
+ *	Most of our strings are ASCII constants, for which CoreFoundation hands out the bytes directly; all others are converted right into the buffer.
+ */
+- (void)appendString:(NSString *)aString
+{
+	NSUInteger strLength = [aString length];
+	if (strLength < 1) {
+		return;
+	}
+	
+	const char *direct = CFStringGetCStringPtr((__bridge CFStringRef)aString, kCFStringEncodingUTF8);
+	if (direct) {
+		[self appendBytes:direct length:strlen(direct)];
+		return;
+	}
+	
+	NSUInteger maxBytes = [aString maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+	NSUInteger usedBytes = 0;
+	[aString getBytes:[self reserve:maxBytes]
+			maxLength:maxBytes
+		   usedLength:&usedBytes
+			 encoding:NSUTF8StringEncoding
+			  options:0
+				range:NSMakeRange(0, strLength)
+	   remainingRange:NULL];
+	length += usedBytes;
+}
+
+/**
+ *	Appends the string with the XML special chars & " ' < > escaped.
+ *	The string is copied into the buffer first, then we count the special chars in the new bytes and, only if there are any, expand them in place from
+ *	the back. Since all specials are ASCII we can work on UTF-8 bytes without caring about multi-byte sequences.
+ */
+- (void)appendEscapedString:(NSString *)aString
+{
+	NSUInteger start = length;
+	[self appendString:aString];
+	
+	NSUInteger extra = 0;
+	NSUInteger i = start;
+	for (; i < length; i++) {
+		switch (buffer[i]) {
+			case '&': extra += 4; break;
+			case '"': extra += 5; break;
+			case '\'': extra += 5; break;
+			case '<': extra += 3; break;
+			case '>': extra += 3; break;
+		}
+	}
+	if (0 == extra) {
+		return;
+	}
+	
+	[self reserve:extra];
+	char *src = buffer + length;
+	char *dst = buffer + length + extra;
+	char *stop = buffer + start;
+	while (src > stop) {
+		char c = *--src;
+		switch (c) {
+			case '&': dst -= 5; memcpy(dst, "&amp;", 5); break;
+			case '"': dst -= 6; memcpy(dst, "&quot;", 6); break;
+			case '\'': dst -= 6; memcpy(dst, "&#x27;", 6); break;
+			case '<': dst -= 4; memcpy(dst, "&lt;", 4); break;
+			case '>': dst -= 4; memcpy(dst, "&gt;", 4); break;
+			default: *--dst = c;
+		}
+	}
+	length += extra;
+}
+
+
+
+#pragma mark - Elements
+/**
+ *	When pretty formatting, starts a new line indented by "depth" tabs. Does nothing otherwise.
+ */
+- (void)indent
+{
+	if (prettyFormat) {
+		char *at = [self reserve:depth + 1];
+		*at = '\n';
+		memset(at + 1, '\t', depth);
+		length += depth + 1;
+	}
+}
+
+/**
+ *	Appends "<tagString>". The tag string may contain attributes, which must already be escaped.
+ */
+- (void)appendStartTag:(NSString *)tagString
+{
+	[self appendBytes:"<" length:1];
+	[self appendString:tagString];
+	[self appendBytes:">" length:1];
+}
+
+/**
+ *	Appends "</nodeName>"
+ */
+- (void)appendEndTag:(NSString *)nodeName
+{
+	[self appendBytes:"</" length:2];
+	[self appendString:nodeName];
+	[self appendBytes:">" length:1];
+}
+
+/**
+ *	Appends "<tagString />"
+ */
+- (void)appendEmptyTag:(NSString *)tagString
+{
+	[self appendBytes:"<" length:1];
+	[self appendString:tagString];
+	[self appendBytes:" />" length:3];
+}
+
+/**
+ *	Appends "<nodeName>content</nodeName>", the content is NOT escaped.
+ */
+- (void)appendElement:(NSString *)nodeName content:(NSString *)content
+{
+	[self appendStartTag:nodeName];
+	[self appendString:content];
+	[self appendEndTag:nodeName];
+}
+
+
+
+#pragma mark - Output
+/**
+ *	Returns the bytes written so far without copying them and resets the writer.
+ */
+- (NSData *)data
+{
+	if (length < 1) {
+		return [NSData data];
+	}
+	
+	NSData *data = [NSData dataWithBytesNoCopy:buffer length:length freeWhenDone:YES];
+	buffer = NULL;
+	capacity = 0;
+	length = 0;
+	return data;
+}
+
+/**
+ *	Returns the XML written so far as a string, handing over the buffer, and resets the writer.
+ */
+- (NSString *)string
+{
+	if (length < 1) {
+		return @"";
+	}
+	
+	NSString *string = [[NSString alloc] initWithBytesNoCopy:buffer length:length encoding:NSUTF8StringEncoding freeWhenDone:YES];
+	if (!string) {
+		DLog(@"The XML buffer is not valid UTF-8");
+		return nil;
+	}
+	buffer = NULL;
+	capacity = 0;
+	length = 0;
+	return string;
+}
+
+
+@end
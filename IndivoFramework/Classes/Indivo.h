@@ -33,11 +33,13 @@ extern NSString *const INResponseStringKey;				///< Dictionaries return the serv
 extern NSString *const INResponseXMLKey;				///< Dictionaries return parsed XML as an INXMLNode from the server's response for this key
 extern NSString *const INResponseArrayKey;				///< Dictionaries return an NSArray for this key
 extern NSString *const INResponseDocumentKey;			///< Dictionaries return an IndivoDocument for this key
+extern NSString *const INResponseIndexDiffKey;			///< Dictionaries return an INDocumentIndexDiff for this key
 
 // Other globals
 extern NSString *const INInternalScheme;				///< The URL scheme we use to identify when the framework should intercept a request
 extern NSString *const INClassGeneratorClassPrefix;		///< The class generator uses this prefix for our classes ("Indivo" by default). We need to know it to instantiate nodes from XML.
 extern NSString *const INClassGeneratorTypePrefix;		///< The class generator uses this prefix for our types ("indivo" by default).
+extern NSString *const INDocumentXMLCacheType;			///< The cache type under which documents store their own XML
 
 // Notifications
 extern NSString *const INRecordDocumentsDidChangeNotification;		///< Notifications with this name will be posted if documents did change, right AFTER the callback has been called
@@ -55,6 +57,12 @@ typedef void (^INSuccessRetvalueBlock)(BOOL success, NSDictionary * __autoreleas
  */
 typedef void (^INCancelErrorBlock)(BOOL userDidCancel, NSString * __autoreleasing errorMessage);
 
+/**
+ *	A block receiving one page of objects while a paged fetch is still running.
+ *	Set "stop" to YES to end the fetch after this page; the final callback of the fetch will still be called.
+ */
+typedef void (^INArrayPageBlock)(NSArray *page, BOOL *stop);
+
 /**
  *	Document status flags.
  *	Note that if a document has been replaced, its status will still be "active", but it will return NO to [document isLatest]. This is a limitation of Indivo.
@@ -44,9 +44,11 @@
 
 - (id)initFromNode:(INXMLNode *)node forRecord:(IndivoRecord *)aRecord;
 + (id)newWithRecord:(IndivoRecord *)aRecord;
++ (NSArray *)documentsFromNodes:(NSArray *)nodes forRecord:(IndivoRecord *)aRecord;
 
 + (BOOL)useFlatXMLFormat;
 - (NSString *)documentXML;
+- (NSData *)documentXMLData;
 - (NSString *)flatDocumentXML;
 - (NSString *)flatXML;
 
@@ -23,13 +23,17 @@
 #import "IndivoAbstractDocument.h"
 #import <objc/runtime.h>
 #import "IndivoRecord.h"
-#import "NSObject+ClassUtils.h"
+#import "INPropertyPlan.h"
+#import "INXMLWriter.h"
 #import "NSArray+NilProtection.h"
 
 
 @interface IndivoAbstractDocument ()
 
-- (NSString *)xmlForObject:(id)anObject nodeName:(NSString *)nodeName;
+- (void)writeDocumentXMLTo:(INXMLWriter *)writer;
+- (void)writeFlatDocumentXMLTo:(INXMLWriter *)writer;
+- (void)writeFlatXMLTo:(INXMLWriter *)writer withDocumentId:(BOOL)withId;
+- (void)writeObject:(id)anObject nodeName:(NSString *)nodeName to:(INXMLWriter *)writer;
 - (NSString *)attributeStringForObject:(id)anObject nodeName:(NSString *)nodeName;
 
 @end
@@ -49,8 +53,57 @@
 	return [[self alloc] initFromNode:nil forRecord:aRecord];
 }
 
+/**
+ *	Instantiates one document of the receiving class per node, for example for all "Model" nodes of a report. Large lists are spread over all
+ *	cores with dispatch_apply; the method returns once all documents are created, on the calling thread, and keeps the order of the nodes.
+ *	Nodes that fail to instantiate are skipped.
+ */
++ (NSArray *)documentsFromNodes:(NSArray *)nodes forRecord:(IndivoRecord *)aRecord
+{
+	NSUInteger count = [nodes count];
+	if (count < 1) {
+		return [NSArray array];
+	}
+	
+	// few nodes, not worth the overhead
+	static const NSUInteger chunkSize = 32;
+	if (count <= chunkSize) {
+		NSMutableArray *documents = [NSMutableArray arrayWithCapacity:count];
+		for (INXMLNode *node in nodes) {
+			[documents addObjectIfNotNil:[[self alloc] initFromNode:node forRecord:aRecord]];
+		}
+		return documents;
+	}
+	
+	// every chunk writes to its own slots, so the order is kept without locking
+	__strong id *slots = (__strong id *)calloc(count, sizeof(id));
+	if (!slots) {
+		return nil;
+	}
+	
+	Class docClass = self;
+	size_t numChunks = (count + chunkSize - 1) / chunkSize;
+	dispatch_apply(numChunks, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t chunk) {
+		@autoreleasepool {
+			NSUInteger end = MIN((chunk + 1) * chunkSize, count);
+			for (NSUInteger i = chunk * chunkSize; i < end; i++) {
+				slots[i] = [[docClass alloc] initFromNode:[nodes objectAtIndex:i] forRecord:aRecord];
+			}
+		}
+	});
+	
+	NSMutableArray *documents = [NSMutableArray arrayWithCapacity:count];
+	for (NSUInteger i = 0; i < count; i++) {
+		[documents addObjectIfNotNil:slots[i]];
+		slots[i] = nil;
+	}
+	free(slots);
+	return documents;
+}
+
 /**
  *	The designated initializer, initializes an instance from an XML node.
+ *	It only reads from the node and the record, so different nodes may be turned into documents on several threads at the same time.
  *	@attention This initializer assumes that the document comes from the server and sets "onServer" to YES IF (and
  *	only if) the provided node is not nil.
  */
@@ -109,21 +162,16 @@
 		self.uuid = [node attr:@"id"];
 	}
 	
-	NSArray *attributes = [[self class] attributeNames];
-	
 	// collect all ivars that are subclasses of NSArray or INObject and instantiate them from XML nodes with the same name
 	Class currentClass = [self class];
 	while (currentClass && 0 != strcmp("IndivoDocument", class_getName(currentClass)) && currentClass != [IndivoAbstractDocument class]) {
-		unsigned int num, i;
-		Ivar *ivars = class_copyIvarList(currentClass, &num);
-		for (i = 0; i < num; i++) {
-			id ivarObj = object_getIvar(self, ivars[i]);
-			NSString *ivarName = ivarNameFromIvar(ivars[i]);
-			Class ivarClass = ivarObj ? [ivarObj class] : classFromIvar(ivars[i]);
+		for (INProperty *prop in [[INPropertyPlan planForClass:currentClass] properties]) {
+			NSString *ivarName = prop.name;
+			Class ivarClass = [prop classForObject:self];
 			
 			// we got an array instance, try to fill it
 			if ([ivarClass isSubclassOfClass:[NSArray class]]) {
-				Class itemClass = [currentClass classForProperty:ivarName];
+				Class itemClass = prop.itemClass;
 				if (itemClass) {
 					NSArray *children = [node childrenNamed:ivarName];
 					NSMutableArray *objects = [NSMutableArray arrayWithCapacity:[children count]];
@@ -133,7 +181,7 @@
 					}
 					
 					/// @todo Prevent overwriting existing nodes if the node was not provided
-					object_setIvar(self, ivars[i], [objects copy]);
+					[prop setValue:[objects copy] forObject:self];
 				}
 			}
 			
@@ -142,7 +190,7 @@
 				id newVal = nil;
 				
 				// parse from attribute or child node
-				if ([attributes containsObject:ivarName]) {
+				if (prop.isAttribute) {
 					newVal = [ivarClass objectFromAttribute:ivarName inNode:node];
 				}
 				else {
@@ -150,11 +198,10 @@
 				}
 				
 				if (newVal) {
-					object_setIvar(self, ivars[i], newVal);
+					[prop setValue:newVal forObject:self];
 				}
 			}
 		}
-		free(ivars);
 		
 		currentClass = [currentClass superclass];
 	}
@@ -178,44 +225,35 @@
 		}
 		
 		//DLog(@"oo>  Setting %@ with prefix \"%@\"", NSStringFromClass([self class]), prefix ? prefix : @"");
-		unsigned int num, i;
-		Ivar *ivars = class_copyIvarList([self class], &num);
-		for (i = 0; i < num; i++) {
-			id ivarObj = object_getIvar(self, ivars[i]);
-			NSString *ivarName = ivarNameFromIvar(ivars[i]);
-			Class ivarClass = ivarObj ? [ivarObj class] : classFromIvar(ivars[i]);
+		for (INProperty *prop in [[INPropertyPlan planForClass:[self class]] properties]) {
+			NSString *ivarName = prop.name;
+			Class ivarClass = [prop classForObject:self];
 			if (!ivarClass) {
 				continue;
 			}
 			
 			// init objects based on property class
-			NSString *fullName = prefix ? [NSString stringWithFormat:@"%@_%@", prefix, ivarName] : ivarName;
+			NSString *fullName = flatXMLName(prefix, ivarName);
 			BOOL isDocument = [ivarClass isSubclassOfClass:[IndivoAbstractDocument class]];
 			
 			if (!isDocument && [ivarClass isSubclassOfClass:[INObject class]]) {			// INObject subclass which can use up multiple nodes
 				//DLog(@"-->  %@  [%@]", fullName, NSStringFromClass(ivarClass))
 				INObject *newObj = [ivarClass new];
 				[newObj setFromFlatParent:parent prefix:fullName];
-				object_setIvar(self, ivars[i], newObj);
+				[prop setValue:newObj forObject:self];
 			}
 			else {																			// single node objects:
-				INXMLNode *myNode = nil;
-				for (INXMLNode *sub in [parent children]) {
-					if ([fullName isEqualToString:[sub attr:@"name"]]) {
-						myNode = sub;
-						break;
-					}
-				}
+				INXMLNode *myNode = [parent childWithNameAttribute:fullName];
 				
 				// found the node
 				if (myNode) {
 					if (isDocument) {														// IndivoAbstractDocument subclass
 						IndivoAbstractDocument *sub = [ivarClass new];
 						[sub setFromFlatParent:[myNode childNamed:@"Model"] prefix:nil];
-						object_setIvar(self, ivars[i], sub);
+						[prop setValue:sub forObject:self];
 					}
 					else if ([ivarClass isSubclassOfClass:[NSArray class]]) {				// NSArray
-						Class itemClass = [[self class] classForProperty:ivarName];
+						Class itemClass = prop.itemClass;
 						if (itemClass) {
 							NSArray *children = [[myNode childNamed:@"Models"] children];
 							if ([children count] > 0) {
@@ -225,7 +263,7 @@
 									[item setFromFlatParent:itemNode prefix:nil];
 									[arr addObjectIfNotNil:item];
 								}
-								object_setIvar(self, ivars[i], [arr copy]);
+								[prop setValue:[arr copy] forObject:self];
 							}
 						}
 						else {
@@ -233,11 +271,11 @@
 						}
 					}
 					else if ([ivarClass isSubclassOfClass:[NSString class]]) {				// NSString
-						object_setIvar(self, ivars[i], [myNode.text copy]);
+						[prop setValue:[myNode.text copy] forObject:self];
 					}
 					else if ([ivarClass isSubclassOfClass:[NSNumber class]]) {				// NSNumber
 						NSDecimalNumber *value = ([myNode.text length] > 0) ? [NSDecimalNumber decimalNumberWithString:myNode.text] : nil;
-						object_setIvar(self, ivars[i], value);
+						[prop setValue:value forObject:self];
 					}
 					else {
 						DLog(@"I don't know how to generate an object of class %@ as an attribute for %@", NSStringFromClass(ivarClass), ivarName);
@@ -248,7 +286,6 @@
 				}
 			}
 		}
-		free(ivars);
 	}
 }
 
@@ -261,16 +298,45 @@
  *	@return An XML document representation of the receiver including the xml version and encoding header
  */
 - (NSString *)documentXML
+{
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeDocumentXMLTo:writer];
+	return [writer string];
+}
+
+/**
+ *	Returns the same as "documentXML", but as UTF-8 data ready to be sent to the server.
+ *	The data is the writer's buffer, so there is no round trip through NSString.
+ */
+- (NSData *)documentXMLData
+{
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeDocumentXMLTo:writer];
+	return [writer data];
+}
+
+/**
+ *	Writes the complete document, including the XML header, in the format our class uses
+ */
+- (void)writeDocumentXMLTo:(INXMLWriter *)writer
 {
 	if ([[self class] useFlatXMLFormat]) {
-		return [self flatDocumentXML];
+		[self writeFlatDocumentXMLTo:writer];
+		return;
 	}
 	
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [NSString stringWithFormat:@"<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n<%@ xmlns=\"%@\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\">\n\t%@\n</%@>", [self tagString], self.nameSpace, [self innerXML], self.nodeName];
-#else
-	return [NSString stringWithFormat:@"<?xml version=\"1.0\" encoding=\"utf-8\" ?><%@ xmlns=\"%@\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\">%@</%@>", [self tagString], self.nameSpace, [self innerXML], self.nodeName];
-#endif
+	[writer appendString:@"<?xml version=\"1.0\" encoding=\"utf-8\" ?>"];
+	[writer indent];
+	[writer appendString:@"<"];
+	[writer appendString:[self tagString]];
+	[writer appendString:@" xmlns=\""];
+	[writer appendString:self.nameSpace];
+	[writer appendString:@"\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\">"];
+	writer.depth++;
+	[self writeInnerXMLTo:writer];
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:self.nodeName];
 }
 
 /**
@@ -279,27 +345,36 @@
  */
 - (NSString *)flatDocumentXML
 {
-	NSArray *xmlValues = [self flatXMLPartsWithPrefix:nil];
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	NSString *inner = [xmlValues componentsJoinedByString:@"\n\t\t"];
-	return [NSString stringWithFormat:@"<Models xmlns=\"http://indivo.org/vocab/xml/documents#\">\n\t<Model name=\"%@\" documentId=\"%@\">\n\t\t%@\n\t</Model>\n</Models>", self.nodeName, self.uuid ? self.uuid : @"", inner];
-#else
-	NSString *inner = [xmlValues componentsJoinedByString:@""];
-	return [NSString stringWithFormat:@"<Models xmlns=\"http://indivo.org/vocab/xml/documents#\"><Model name=\"%@\" documentId=\"%@\">%@</Model></Models>", self.nodeName, self.uuid ? self.uuid : @"", inner];
-#endif
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeFlatDocumentXMLTo:writer];
+	return [writer string];
+}
+
+/**
+ *	Writes the flat XML document, which wraps our <Model> node into a <Models> node
+ */
+- (void)writeFlatDocumentXMLTo:(INXMLWriter *)writer
+{
+	[writer appendString:@"<Models xmlns=\"http://indivo.org/vocab/xml/documents#\">"];
+	writer.depth++;
+	[writer indent];
+	[self writeFlatXMLTo:writer withDocumentId:YES];
+	writer.depth--;
+	[writer indent];
+	[writer appendString:@"</Models>"];
 }
 
 /**
- *	Returns an XML representation of the receiver, automatically collected from all instance variables responding to the "xml" selector.
- *	@return An XML representation of the receiver
+ *	Writes an XML representation of the receiver, automatically collected from all instance variables responding to the "xml" selector.
  */
-- (NSString *)xml
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [NSString stringWithFormat:@"<%@>\n\t%@\n</%@>", [self tagString], [self innerXML], self.nodeName];
-#else
-	return [NSString stringWithFormat:@"<%@>%@</%@>", [self tagString], [self innerXML], self.nodeName];
-#endif
+	[writer appendStartTag:[self tagString]];
+	writer.depth++;
+	[self writeInnerXMLTo:writer];
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:self.nodeName];
 }
 
 /**
@@ -308,27 +383,53 @@
  */
 - (NSString *)flatXML
 {
-	NSArray *xmlValues = [self flatXMLPartsWithPrefix:nil];
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	NSString *inner = [xmlValues componentsJoinedByString:@"\n\t"];
-	return [NSString stringWithFormat:@"<Model name=\"%@\">\n\t\t%@\n\t</Model>", self.nodeName, inner];
-#else
-	NSString *inner = [xmlValues componentsJoinedByString:@""];
-	return [NSString stringWithFormat:@"<Model name=\"%@\">%@</Model>", self.nodeName, inner];
-#endif
+	INXMLWriter *writer = [INXMLWriter new];
+	writer.depth = 1;
+	[self writeFlatXMLTo:writer withDocumentId:NO];
+	return [writer string];
+}
+
+/**
+ *	Writes the <Model> node of the flat XML format, with the "documentId" attribute if desired
+ */
+- (void)writeFlatXMLTo:(INXMLWriter *)writer withDocumentId:(BOOL)withId
+{
+	[writer appendString:@"<Model name=\""];
+	[writer appendEscapedString:self.nodeName];
+	if (withId) {
+		[writer appendString:@"\" documentId=\""];
+		[writer appendEscapedString:self.uuid];
+	}
+	[writer appendString:@"\">"];
+	writer.depth++;
+	for (NSString *part in [self flatXMLPartsWithPrefix:nil]) {
+		[writer indent];
+		[writer appendString:part];
+	}
+	writer.depth--;
+	[writer indent];
+	[writer appendString:@"</Model>"];
 }
 
 
 /**
- *	This is the main XML generating method, overridden from IndivoAbstractDocument.
- *	This method collects all class ivars from ourselves up until the superclass is "IndivoDocument". Most of our classes are direct IndivoDocument
- *	subclasses, but if not we need to walk the class hierarchy upwards until one below IndivoDocument in order to collect the inherited ivars.
+ *	Returns the XML of all our properties, see "writeInnerXMLTo:".
  *	@return An XML string or nil
  */
 - (NSString *)innerXML
 {
-	unsigned int num, i;
-	
+	INXMLWriter *writer = [INXMLWriter new];
+	[self writeInnerXMLTo:writer];
+	return [writer string];
+}
+
+/**
+ *	This is the main XML generating method, overridden from INObject.
+ *	This method collects all class ivars from ourselves up until the superclass is "IndivoDocument". Most of our classes are direct IndivoDocument
+ *	subclasses, but if not we need to walk the class hierarchy upwards until one below IndivoDocument in order to collect the inherited ivars.
+ */
+- (void)writeInnerXMLTo:(INXMLWriter *)writer
+{
 	// collect class hierarchy up to IndivoDocument
 	// we also need to break before IndivoAbstractDocument for those classes directly inheriting from it, like IndivoMetaDocument
 	Class currentClass = [self class];
@@ -338,74 +439,48 @@
 		currentClass = [currentClass superclass];
 	}
 	
-	// collect XML for all ivars of all classes in the hierarchy
-	NSArray *attrNames = [[self class] attributeNames];
-	NSMutableArray *xmlValues = [NSMutableArray array];
+	// write XML for all ivars of all classes in the hierarchy
 	for (Class currentClass in [hierarchy reverseObjectEnumerator]) {
-		Ivar *ivars = class_copyIvarList(currentClass, &num);
-		for (i = 0; i < num; ++i) {
-			id anObject = object_getIvar(self, ivars[i]);
-			NSString *propertyName = [NSString stringWithCString:ivar_getName(ivars[i]) encoding:NSUTF8StringEncoding];
+		for (INProperty *prop in [[INPropertyPlan planForClass:currentClass] properties]) {
+			id anObject = [prop valueForObject:self];
+			NSString *propertyName = prop.name;
 			
 			// array - loop objects
 			if ([anObject isKindOfClass:[NSArray class]]) {
-				NSMutableArray *xmlSubValues = [NSMutableArray array];
 				for (id object in anObject) {
-					[xmlSubValues addObjectIfNotNil:[self xmlForObject:object nodeName:propertyName]];
+					[self writeObject:object nodeName:propertyName to:writer];
 				}
-#ifdef INDIVO_XML_PRETTY_FORMAT
-				NSString *propertyXML = [xmlSubValues componentsJoinedByString:@"\n\t"];
-#else
-				NSString *propertyXML = [xmlSubValues componentsJoinedByString:@""];
-#endif
-				[xmlValues addObjectIfNotNil:propertyXML];
 			}
 			
 			// any other object if it's NOT an attribute. We assume that NSArray properties are never attributes, which is probably not far from the truth.
-			else {
-				if (![attrNames containsObject:propertyName]) {
-					NSString *propertyXML = [self xmlForObject:anObject nodeName:propertyName];
-					[xmlValues addObjectIfNotNil:propertyXML];
-				}
+			else if (!prop.isAttribute) {
+				[self writeObject:anObject nodeName:propertyName to:writer];
 			}
-
 		}
-		free(ivars);
 	}
-	
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [xmlValues componentsJoinedByString:@"\n\t"];
-#else
-	return [xmlValues componentsJoinedByString:@""];
-#endif
 }
 
 
 /**
- *	Takes any object and tries to return the result of its "xml" selector, if it responds to that. If the object is of INObject ancestry, sets
- *	its nodeName to the passed nodeName if it's not yet set.
- *	@return An XML string or nil
+ *	Takes any object and writes its XML on a new line, if it responds to the "xml" selector. If the object is of INObject ancestry, sets its nodeName
+ *	to the passed nodeName if it's not yet set and lets it write directly to the writer.
  */
-- (NSString *)xmlForObject:(id)anObject nodeName:(NSString *)nodeName
+- (void)writeObject:(id)anObject nodeName:(NSString *)nodeName to:(INXMLWriter *)writer
 {
-	if ([anObject respondsToSelector:@selector(xml)]) {
+	if ([anObject isKindOfClass:[INObject class]]) {
 		
 		// if the node does not have its own nodeName (ignoring the class nodeName), set the ivar name as nodeName
-		if ([anObject isKindOfClass:[INObject class]]) {
-			INObject *node = (INObject *)anObject;
-			if (!node->_nodeName) {
-				node.nodeName = nodeName;
-			}
+		INObject *node = (INObject *)anObject;
+		if (!node->_nodeName) {
+			node.nodeName = nodeName;
 		}
-		
-		// get object's XML
-		NSString *subXML = [anObject performSelector:@selector(xml)];
-#ifdef INDIVO_XML_PRETTY_FORMAT
-		subXML = [subXML stringByReplacingOccurrencesOfString:@"\n" withString:@"\n\t"];
-#endif
-		return subXML;
+		[writer indent];
+		[node writeXMLTo:writer];
+	}
+	else if ([anObject respondsToSelector:@selector(xml)]) {
+		[writer indent];
+		[writer appendString:[anObject performSelector:@selector(xml)]];
 	}
-	return nil;
 }
 
 
@@ -502,18 +577,13 @@
  */
 - (BOOL)isNull
 {
-	unsigned int num, i;
-	
 	// return NO as soon as one ivar responding to "xml" is not nil
-	Ivar *ivars = class_copyIvarList([self class], &num);
-	for (i = 0; i < num; ++i) {
-		id ivar = object_getIvar(self, ivars[i]);
+	for (INProperty *prop in [[INPropertyPlan planForClass:[self class]] properties]) {
+		id ivar = [prop valueForObject:self];
 		if ([ivar respondsToSelector:@selector(xml)]) {
-			free(ivars);
 			return NO;
 		}
 	}
-	free(ivars);
 	return YES;
 }
 
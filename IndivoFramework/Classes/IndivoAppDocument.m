@@ -22,6 +22,7 @@
 
 #import "IndivoAppDocument.h"
 #import "IndivoServer.h"
+#import "INXMLWriter.h"
 
 @implementation IndivoAppDocument
 
@@ -75,16 +76,24 @@
 	return [tree childXML];
 }
 
+/**
+ *	Writes the children of our "tree" node straight to the writer
+ */
+- (void)writeInnerXMLTo:(INXMLWriter *)writer
+{
+	[tree writeChildXMLTo:writer];
+}
+
 
 
 #pragma mark - Server Actions
 /**
  *	We override this method because we need a two-legged oauth call if this is a non-record specific document
  */
-- (void)performMethod:(NSString *)aMethod withBody:(NSString *)body orParameters:(NSArray *)parameters httpMethod:(NSString *)httpMethod callback:(INSuccessRetvalueBlock)callback
+- (void)performMethod:(NSString *)aMethod withBodyData:(NSData *)bodyData orParameters:(NSArray *)parameters httpMethod:(NSString *)httpMethod callback:(INSuccessRetvalueBlock)callback
 {
 	if (self.record) {
-		[super performMethod:aMethod withBody:body orParameters:parameters httpMethod:httpMethod callback:callback];
+		[super performMethod:aMethod withBodyData:bodyData orParameters:parameters httpMethod:httpMethod callback:callback];
 	}
 	
 	if (!self.server) {
@@ -96,7 +105,7 @@
 	// create the desired INServerCall instance
 	INServerCall *call = [INServerCall new];
 	call.method = aMethod;
-	call.body = body;
+	call.bodyData = bodyData;
 	call.parameters = parameters;
 	call.HTTPMethod = httpMethod;
 	call.myCallback = callback;
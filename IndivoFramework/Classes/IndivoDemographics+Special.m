@@ -54,11 +54,11 @@
 		return;
 	}
 	
-	NSString *xml = [self documentXML];
-	//DLog(@"Pushing XML:  %@", xml);
+	NSData *xml = [self documentXMLData];
+	//DLog(@"Pushing XML:  %@", [[NSString alloc] initWithData:xml encoding:NSUTF8StringEncoding]);
 	
 	[self put:path
-		 body:xml
+		 bodyData:xml
 	 callback:^(BOOL success, NSDictionary *userInfo) {
 		  if (success) {
 			  CANCEL_ERROR_CALLBACK_OR_LOG_USER_INFO(callback, NO, userInfo)
@@ -71,7 +71,7 @@
 			  }
 			  else {
 				  // we log the XML if push fails because most likely, it didn't validate, so here's your chance to take a look
-				  DLog(@"PUSH FAILED BECAUSE %@:\n%@", [[userInfo objectForKey:INErrorKey] localizedDescription], xml);
+				  DLog(@"PUSH FAILED BECAUSE %@:\n%@", [[userInfo objectForKey:INErrorKey] localizedDescription], [[NSString alloc] initWithData:xml encoding:NSUTF8StringEncoding]);
 			  }
 			  CANCEL_ERROR_CALLBACK_OR_LOG_USER_INFO(callback, didCancel, userInfo)
 		  }
@@ -41,6 +41,7 @@
 @property (nonatomic, readonly, copy) NSString *uuidLatest;							///< The udid of the latest document of the receiver
 @property (nonatomic, readonly, copy) NSString *uuidOriginal;						///< The udid of the original document, if the receiver replaced a document
 @property (nonatomic, readonly, copy) NSString *uuidReplaces;						///< The udid of the replaced document, if the receiver replaced a document
+@property (nonatomic, readonly, copy) NSString *digest;							///< The digest from our meta document, used to validate cached objects
 
 - (id)initFromNode:(INXMLNode *)aNode forRecord:(IndivoRecord *)aRecord withMeta:(IndivoMetaDocument *)aMetaDocument;
 
@@ -61,6 +62,7 @@
 
 // Document actions
 - (void)pull:(INCancelErrorBlock)callback;
+- (void)pullOrLoadCached:(INCancelErrorBlock)callback;
 - (void)push:(INCancelErrorBlock)callback;
 - (void)replace:(INCancelErrorBlock)callback;
 - (void)setLabel:(NSString *)aLabel callback:(INCancelErrorBlock)callback;
@@ -76,6 +78,8 @@
 - (id)cachedObjectOfType:(NSString *)aType;
 + (BOOL)cacheObject:(id)anObject asType:(NSString *)aType forId:(NSString *)aUdid error:(__autoreleasing NSError **)error;
 + (id)cachedObjectOfType:(NSString *)aType forId:(NSString *)aUdid;
++ (void)removeCachedObjectOfType:(NSString *)aType forId:(NSString *)aUdid;
+- (void)loadCachedObjectOfType:(NSString *)aType callback:(void (^)(id cachedObject))callback;
 
 
 @end
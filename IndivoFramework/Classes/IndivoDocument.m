@@ -24,6 +24,8 @@
 #import <objc/runtime.h>
 #import "IndivoMetaDocument.h"
 #import "IndivoRecord.h"
+#import "INDocumentCache.h"
+#import "INXMLParser.h"
 #import "NSArray+NilProtection.h"
 
 
@@ -37,9 +39,7 @@
 @property (nonatomic, readwrite, copy) NSString *uuidLatest;
 @property (nonatomic, readwrite, copy) NSString *uuidOriginal;
 @property (nonatomic, readwrite, copy) NSString *uuidReplaces;
-
-+ (NSMutableDictionary *)cacheDictionary;
-+ (dispatch_queue_t)cacheQueue;
+@property (nonatomic, readwrite, copy) NSString *digest;
 
 @end
 
@@ -47,7 +47,7 @@
 @implementation IndivoDocument
 
 @synthesize label, documentStatus, fetched;
-@synthesize creator, uuidLatest, uuidReplaces, uuidOriginal;
+@synthesize creator, uuidLatest, uuidReplaces, uuidOriginal, digest;
 
 
 /**
@@ -297,6 +297,40 @@
 	 }];
 }
 
+/**
+ *	Sets the document from the XML we cached the last time it was pulled with this method, if our digest still matches; pulls it from the server
+ *	otherwise and caches its XML. Used when syncing a record, where unchanged documents don't need to be downloaded again.
+ */
+- (void)pullOrLoadCached:(INCancelErrorBlock)callback
+{
+	[self loadCachedObjectOfType:INDocumentXMLCacheType callback:^(id cachedObject) {
+		INXMLNode *xmlNode = nil;
+		if ([cachedObject isKindOfClass:[NSData class]]) {
+			xmlNode = [INXMLParser parseXMLData:cachedObject error:nil];
+		}
+		
+		// got it locally
+		if (xmlNode) {
+			[self setFromNode:xmlNode];
+			[self markOnServer];
+			self.fetched = YES;
+			CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(callback, NO, nil)
+			return;
+		}
+		
+		// pull and remember
+		[self pull:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+			if (!userDidCancel && !errorMessage && self.digest) {
+				NSError *error = nil;
+				if (![self cacheObject:[self documentXMLData] asType:INDocumentXMLCacheType error:&error]) {
+					DLog(@"Failed to cache XML of %@: %@", self, [error localizedDescription]);
+				}
+			}
+			CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(callback, userDidCancel, errorMessage)
+		}];
+	}];
+}
+
 
 
 #pragma mark - Document Actions
@@ -314,11 +348,11 @@
 	}
 	
 	if (!self.onServer) {
-		NSString *xml = [self documentXML];
-		//DLog(@"Pushing XML:  %@", xml);
+		NSData *xml = [self documentXMLData];
+		//DLog(@"Pushing XML:  %@", [[NSString alloc] initWithData:xml encoding:NSUTF8StringEncoding]);
 		
 		[self post:path
-			  body:xml
+			  bodyData:xml
 		  callback:^(BOOL success, NSDictionary *userInfo) {
 			  if (success) {
 				  
@@ -340,7 +374,7 @@
 				  }
 				  else {
 					  // we log the XML if push fails because most likely, it didn't validate, so here's your chance to take a look
-					  DLog(@"PUSH FAILED BECAUSE %@:\n%@", [[userInfo objectForKey:INErrorKey] localizedDescription], xml);
+					  DLog(@"PUSH FAILED BECAUSE %@:\n%@", [[userInfo objectForKey:INErrorKey] localizedDescription], [[NSString alloc] initWithData:xml encoding:NSUTF8StringEncoding]);
 				  }
 				  CANCEL_ERROR_CALLBACK_OR_LOG_USER_INFO(callback, didCancel, userInfo)
 			  }
@@ -367,9 +401,9 @@
 			return;
 		}
 		
-		NSString *xml = [self documentXML];
+		NSData *xml = [self documentXMLData];
 		[self post:updatePath
-			  body:xml
+			  bodyData:xml
 		  callback:^(BOOL success, NSDictionary *userInfo) {
 			  if (success) {
 				  
@@ -389,7 +423,7 @@
 					  didCancel = YES;
 				  }
 				  else {
-					  DLog(@"FAILED: %@", xml);
+					  DLog(@"FAILED: %@", [[NSString alloc] initWithData:xml encoding:NSUTF8StringEncoding]);
 				  }
 				  CANCEL_ERROR_CALLBACK_OR_LOG_USER_INFO(callback, didCancel, userInfo)
 			  }
@@ -515,6 +549,9 @@
 	if (aMetaDoc.latest) {
 		self.uuidLatest = [aMetaDoc.latest attr:@"id"];
 	}
+	if (aMetaDoc.digest) {
+		self.digest = aMetaDoc.digest;
+	}
 }
 
 
@@ -528,11 +565,11 @@ static NSDictionary *registeredClassHash = nil;
  */
 + (Class)documentClassForType:(NSString *)aType
 {
-	// convert the array to a hash the first time we're called
-	if (!registeredClassHash) {
+	// convert the array to a hash the first time we're called; documents may be instantiated on several threads, so do this exactly once
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
 		if (!registeredClasses) {
-			DLog(@"WARNING: No classes have registered");
-			return self;
+			return;
 		}
 		NSMutableDictionary *tempDict = [NSMutableDictionary dictionaryWithCapacity:[registeredClasses count]];
 		for (Class aClass in registeredClasses) {
@@ -543,6 +580,10 @@ static NSDictionary *registeredClassHash = nil;
 		}
 		registeredClassHash = tempDict;
 		registeredClasses = nil;
+	});
+	if (!registeredClassHash) {
+		DLog(@"WARNING: No classes have registered");
+		return self;
 	}
 	
 	// search
@@ -574,107 +615,58 @@ static NSDictionary *registeredClassHash = nil;
 
 #pragma mark - Caching Facility
 /**
- *	Caches the object for a given type.
+ *	Caches the object for a given type, tied to our current digest.
  */
 - (BOOL)cacheObject:(id)anObject asType:(NSString *)aType error:(__autoreleasing NSError **)error
 {
-	return [[self class] cacheObject:anObject asType:aType forId:self.uuid error:error];
+	return [[INDocumentCache sharedCache] storeObject:anObject type:aType forId:self.uuid digest:self.digest error:error];
 }
 
 /**
- *	Retrieves the object for a given type from cache.
+ *	Retrieves the object for a given type from the memory cache. Objects cached for a different digest, i.e. a different version of the document, are
+ *	discarded.
+ *	If the object is not in memory, it is loaded from disk in the background and will be returned the next time.
  */
 - (id)cachedObjectOfType:(NSString *)aType
 {
-	return [[self class] cachedObjectOfType:aType forId:self.uuid];
+	return [[INDocumentCache sharedCache] objectOfType:aType forId:self.uuid digest:self.digest];
 }
 
-
 /**
- *	Stores an object of a given type for the document of the given udid.
+ *	Retrieves the object for a given type from memory or disk without blocking the calling thread.
+ *	@param callback Called on the main queue with the cached object, or nil if there is none
  */
-+ (BOOL)cacheObject:(id)anObject asType:(NSString *)aType forId:(NSString *)aUdid error:(__autoreleasing NSError **)error
+- (void)loadCachedObjectOfType:(NSString *)aType callback:(void (^)(id))callback
 {
-	if (!anObject) {
-		ERR(error, @"No object given", 21)
-		return NO;
-	}
-	if (!aUdid) {
-		ERR(error, @"No id given", 0)
-		return NO;
-	}
-	if (!aType) {
-		aType = @"generic";
-	}
-	
-	// get the queue
-	dispatch_queue_t cacheQueue = [self cacheQueue];
-	
-	// store the object in cache
-	dispatch_sync(cacheQueue, ^{
-		NSMutableDictionary *cacheDict = [self cacheDictionary];
-		NSMutableDictionary *typeDictionary = [cacheDict objectForKey:aType];
-		if (!typeDictionary) {
-			typeDictionary = [NSMutableDictionary dictionaryWithObject:anObject forKey:aUdid];
-			[cacheDict setObject:typeDictionary forKey:aType];
-		}
-		else {
-			[typeDictionary setObject:anObject forKey:aUdid];
-		}
-		
-		/// @todo cache to disk
-	});
-	return YES;
+	[[INDocumentCache sharedCache] loadObjectOfType:aType forId:self.uuid digest:self.digest callback:callback];
 }
 
 
 /**
- *	Retrieves the cached object of a given type for a given document udid.
+ *	Stores an object of a given type for the document of the given udid, in memory and on disk if the object conforms to NSCoding.
  */
-+ (id)cachedObjectOfType:(NSString *)aType forId:(NSString *)aUdid
++ (BOOL)cacheObject:(id)anObject asType:(NSString *)aType forId:(NSString *)aUdid error:(__autoreleasing NSError **)error
 {
-	if (!aUdid) {
-		return nil;
-	}
-	if (!aType) {
-		aType = @"generic";
-	}
-	
-	// get the queue
-	dispatch_queue_t cacheQueue = [self cacheQueue];
-	
-	// retrieve the object
-	__block id theObject = nil;
-	dispatch_sync(cacheQueue, ^{
-		NSMutableDictionary *cacheDict = [self cacheDictionary];
-		theObject = [[cacheDict objectForKey:aType] objectForKey:aUdid];
-		
-		// not loaded, try to load from disk
-		if (!theObject) {
-			/// @todo load from disk
-		}
-	});
-	return theObject;
+	return [[INDocumentCache sharedCache] storeObject:anObject type:aType forId:aUdid digest:nil error:error];
 }
 
 
-+ (NSMutableDictionary *)cacheDictionary
+/**
+ *	Retrieves the cached object of a given type for a given document udid from memory.
+ *	On a miss the object is loaded from disk in the background, without blocking the calling thread, and will be returned the next time.
+ */
++ (id)cachedObjectOfType:(NSString *)aType forId:(NSString *)aUdid
 {
-	static NSMutableDictionary *cacheDict = nil;
-	if (!cacheDict) {
-		cacheDict = [[NSMutableDictionary alloc] init];
-	}
-	return cacheDict;
+	return [[INDocumentCache sharedCache] objectOfType:aType forId:aUdid digest:nil];
 }
 
 
-+ (dispatch_queue_t)cacheQueue
+/**
+ *	Removes the cached object of a given type for a given document udid from memory and disk.
+ */
++ (void)removeCachedObjectOfType:(NSString *)aType forId:(NSString *)aUdid
 {
-	static dispatch_queue_t cacheQueue = NULL;
-	if (!cacheQueue) {
-		cacheQueue = dispatch_queue_create("org.chip.indivo.framework.cachequeue", NULL);
-	}
-	return cacheQueue;
+	[[INDocumentCache sharedCache] removeObjectOfType:aType forId:aUdid];
 }
 
 
@@ -57,5 +57,7 @@
 #import "IndivoPrincipal.h"
 #import "IndivoAggregateReport.h"
 #import "INQueryParameter.h"
+#import "INQueryEngine.h"
+#import "INTimeSeries.h"
 
 
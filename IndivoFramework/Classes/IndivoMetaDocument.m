@@ -23,6 +23,7 @@
 #import "IndivoMetaDocument.h"
 #import "IndivoDocument.h"
 #import "IndivoRecord.h"
+#import "INXMLWriter.h"
 
 @interface IndivoMetaDocument ()
 
@@ -87,13 +88,24 @@
 }
 
 
-- (NSString *)xml
+- (void)writeXMLTo:(INXMLWriter *)writer
 {
-#ifdef INDIVO_XML_PRETTY_FORMAT
-	return [NSString stringWithFormat:@"<%@ id=\"%@\" type=\"%@\" size=\"\" digest=\"%@\" record_id=\"%@\">\n\t%@\n</%@>", self.nodeName, self.uuid, self.nameSpace, self.digest, self.record.uuid, [self innerXML], self.nodeName];
-#else
-	return [NSString stringWithFormat:@"<%@ id=\"%@\" type=\"%@\" size=\"\" digest=\"%@\" record_id=\"%@\">%@</%@>", self.nodeName, self.udid, self.namespace, self.digest, self.record.udid, [self innerXML], self.nodeName];
-#endif
+	[writer appendString:@"<"];
+	[writer appendString:self.nodeName];
+	[writer appendString:@" id=\""];
+	[writer appendEscapedString:self.uuid];
+	[writer appendString:@"\" type=\""];
+	[writer appendEscapedString:self.nameSpace];
+	[writer appendString:@"\" size=\"\" digest=\""];
+	[writer appendEscapedString:self.digest];
+	[writer appendString:@"\" record_id=\""];
+	[writer appendEscapedString:self.record.uuid];
+	[writer appendString:@"\">"];
+	writer.depth++;
+	[self writeInnerXMLTo:writer];
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:self.nodeName];
 }
 
 
@@ -26,6 +26,7 @@
 @class IndivoDemographics;
 @class INQueryParameter;
 @class INXMLNode;
+@class INDocumentIndex;
 
 
 @interface IndivoRecord : INServerObject
@@ -37,6 +38,7 @@
 
 @property (nonatomic, copy) NSString *accessToken;									///< The last access token successfully used with this record
 @property (nonatomic, copy) NSString *accessTokenSecret;							///< The last access token secret successfully used with this record
+@property (nonatomic, readonly, strong) INDocumentIndex *documentIndex;			///< The persistent index of this record's documents, used by "syncDocumentsWithCallback:"
 
 - (id)initWithId:(NSString *)anId onServer:(IndivoServer *)aServer;
 
@@ -47,12 +49,18 @@
 // record documens
 - (void)fetchDocumentsWithCallback:(INSuccessRetvalueBlock)callback;
 - (void)fetchDocumentsOfClass:(Class)documentClass callback:(INSuccessRetvalueBlock)callback;
+- (void)syncDocumentsWithCallback:(INSuccessRetvalueBlock)callback;
 - (IndivoDocument *)addDocumentOfClass:(Class)documentClass error:(NSError * __autoreleasing *)error;
 - (void)fetchAppSpecificDocumentsWithCallback:(INSuccessRetvalueBlock)callback;
 
 // record reports
 - (void)fetchReportsOfClass:(Class)documentClass callback:(INSuccessRetvalueBlock)callback;
 - (void)fetchReportsOfClass:(Class)documentClass withQuery:(INQueryParameter *)aQuery callback:(INSuccessRetvalueBlock)callback;
+- (void)fetchReportsOfClass:(Class)documentClass
+				  withQuery:(INQueryParameter *)aQuery
+				   pageSize:(NSUInteger)pageSize
+				   progress:(INArrayPageBlock)progress
+				   callback:(INSuccessRetvalueBlock)callback;
 
 // messaging
 - (void)sendMessage:(NSString *)messageSubject
@@ -24,7 +24,7 @@
 #import "IndivoDocuments.h"
 #import "INXMLParser.h"
 #import "INXMLReport.h"
-#import "NSArray+NilProtection.h"
+#import "INDocumentIndex.h"
 
 
 @interface IndivoRecord ()
@@ -35,6 +35,137 @@
 
 @property (nonatomic, strong) NSMutableArray *metaDocuments;					///< Storage for this records fetched document metadata
 @property (nonatomic, strong) NSMutableArray *documents;						///< Storage for this records fetched documents: Does NOT automatically contain all documents
+@property (nonatomic, readwrite, strong) INDocumentIndex *documentIndex;
+
+@end
+
+
+/**
+ *	Walks the pages of a report fetch, keeping the request for the next page one page ahead of the one being parsed and delivered.
+ */
+@interface INReportPager : NSObject
+
+@property (nonatomic, strong) IndivoRecord *record;
+@property (nonatomic, assign) Class documentClass;
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, strong) INQueryParameter *query;
+@property (nonatomic, assign) NSUInteger pageSize;								///< 0 to not page at all
+@property (nonatomic, copy) INArrayPageBlock progress;
+@property (nonatomic, copy) INSuccessRetvalueBlock callback;
+
+@property (nonatomic, assign) NSUInteger nextOffset;							///< The offset of the next page to request
+@property (nonatomic, assign) BOOL delivering;									///< YES while a page is being parsed and handed to the progress block
+@property (nonatomic, assign) BOOL finished;									///< YES once the callback has been called, later responses are dropped
+@property (nonatomic, strong) NSDictionary *pendingResponse;					///< A response that arrived while the previous page was still being delivered
+@property (nonatomic, assign) BOOL pendingSuccess;
+
+- (void)start;
+
+@end
+
+
+@implementation INReportPager
+
+@synthesize record, documentClass, path, query, pageSize, progress, callback;
+@synthesize nextOffset, delivering, finished, pendingResponse, pendingSuccess;
+
+
+- (void)start
+{
+	self.nextOffset = query.offset;
+	[self requestNextPage];
+}
+
+/**
+ *	Issues the GET for the page at "nextOffset". A response arriving while the previous page is still being delivered (which happens if the server calls
+ *	back synchronously) is held back so pages always reach the progress block in order.
+ */
+- (void)requestNextPage
+{
+	NSUInteger originalOffset = query.offset;
+	NSUInteger originalLimit = query.limit;
+	if (pageSize > 0) {
+		query.offset = nextOffset;
+		query.limit = pageSize;
+		self.nextOffset = nextOffset + pageSize;
+	}
+	NSArray *parameters = [query queryParameters];
+	query.offset = originalOffset;
+	query.limit = originalLimit;
+	
+	[record get:path
+	 parameters:parameters
+	   callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		   if (delivering) {
+			   self.pendingResponse = userInfo ? userInfo : [NSDictionary dictionary];
+			   self.pendingSuccess = success;
+			   return;
+		   }
+		   [self handleResponse:userInfo success:success];
+	   }];
+}
+
+/**
+ *	Parses and delivers the page contained in the response, then continues with a page that arrived in the meantime, if any.
+ */
+- (void)handleResponse:(NSDictionary *)userInfo success:(BOOL)success
+{
+	while (!finished) {
+		if (!success) {
+			[self finishWithSuccess:NO userInfo:userInfo];
+			return;
+		}
+		
+		INXMLNode *docNode = [userInfo objectForKey:INResponseXMLKey];
+		NSArray *reports = [docNode childrenNamed:@"Model"];
+		
+		// is there another page? If so, request it before we start parsing this one
+		BOOL hasMore = (pageSize > 0 && [reports count] >= pageSize);
+		NSString *total = [[docNode childNamed:@"Summary"] attr:@"total_document_count"];
+		if (hasMore && total && nextOffset >= (NSUInteger)[total integerValue]) {
+			hasMore = NO;
+		}
+		
+		self.delivering = YES;
+		if (hasMore) {
+			[self requestNextPage];
+		}
+		
+		// create documents (on all cores for large pages) and deliver them on our thread
+		BOOL stop = NO;
+		if ([reports count] > 0) {
+			NSArray *page = [documentClass documentsFromNodes:reports forRecord:record];
+			if (progress) {
+				progress(page, &stop);
+			}
+		}
+		self.delivering = NO;
+		
+		if (stop || !hasMore) {
+			[self finishWithSuccess:YES userInfo:nil];
+			return;
+		}
+		
+		// the next page may have arrived while we were busy
+		if (!pendingResponse) {
+			return;
+		}
+		userInfo = pendingResponse;
+		success = pendingSuccess;
+		self.pendingResponse = nil;
+	}
+}
+
+- (void)finishWithSuccess:(BOOL)success userInfo:(NSDictionary *)userInfo
+{
+	self.finished = YES;
+	self.pendingResponse = nil;
+	
+	SUCCESS_RETVAL_CALLBACK_OR_LOG_USER_INFO(callback, success, userInfo);
+	self.progress = nil;
+	self.callback = nil;
+}
+
 
 @end
 
@@ -43,7 +174,7 @@
 
 @synthesize label, demographicsDocId, demographicsDoc, created;
 @synthesize accessToken, accessTokenSecret;
-@synthesize metaDocuments, documents;
+@synthesize metaDocuments, documents, documentIndex;
 
 
 /**
@@ -227,6 +358,97 @@
 }
 
 
+/**
+ *	Brings the record's documents up to date with as little traffic as possible.
+ *	Fetches the document listing and diffs it against our persistent document index: only new and changed documents are pulled from the server, unchanged
+ *	ones are restored from the XML cached during an earlier sync, and the cache of removed documents is cleared.
+ *	Upon callback, the "INResponseArrayKey" of the user-info dictionary will contain the record's current IndivoDocument instances and the
+ *	"INResponseIndexDiffKey" the INDocumentIndexDiff. If some documents failed to load, success is NO and the user-info also contains the last error.
+ *	@param callback The callback block to be executed after all documents are loaded
+ */
+- (void)syncDocumentsWithCallback:(INSuccessRetvalueBlock)callback
+{
+	[self get:[NSString stringWithFormat:@"/records/%@/documents/", self.uuid]
+	 callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		 if (!success) {
+			 SUCCESS_RETVAL_CALLBACK_OR_LOG_USER_INFO(callback, NO, userInfo);
+			 return;
+		 }
+		 
+		 // diff the listing against our index
+		 INXMLNode *documentsNode = [userInfo objectForKey:INResponseXMLKey];
+		 NSArray *docNodes = [documentsNode childrenNamed:@"Document"];
+		 NSMutableArray *listing = [NSMutableArray arrayWithCapacity:[docNodes count]];
+		 NSMutableDictionary *nodes = [NSMutableDictionary dictionaryWithCapacity:[docNodes count]];
+		 for (INXMLNode *docNode in docNodes) {
+			 INDocumentIndexEntry *entry = [INDocumentIndexEntry entryFromNode:docNode];
+			 if (entry) {
+				 [listing addObject:entry];
+				 [nodes setObject:docNode forKey:entry.uuid];
+			 }
+		 }
+		 
+		 INDocumentIndexDiff *diff = [self.documentIndex updateWithEntries:listing];
+		 NSError *error = nil;
+		 if (![self.documentIndex save:&error]) {
+			 DLog(@"Failed to save document index: %@", [error localizedDescription]);
+		 }
+		 for (INDocumentIndexEntry *removed in diff.removed) {
+			 [IndivoDocument removeCachedObjectOfType:INDocumentXMLCacheType forId:removed.uuid];
+		 }
+		 
+		 // instantiate current documents and load them from cache or server
+		 NSArray *current = [diff current];
+		 NSMutableArray *docs = [NSMutableArray arrayWithCapacity:[current count]];
+		 for (INDocumentIndexEntry *entry in current) {
+			 IndivoMetaDocument *meta = [[IndivoMetaDocument alloc] initFromNode:[nodes objectForKey:entry.uuid] forRecord:self];
+			 IndivoDocument *doc = meta.document;
+			 if (doc) {
+				 [docs addObject:doc];
+			 }
+		 }
+		 
+		 __block NSUInteger pending = [docs count];
+		 __block NSString *lastError = nil;
+		 void (^finish)(void) = ^{
+			 NSMutableDictionary *usrIfo = [NSMutableDictionary dictionaryWithObjectsAndKeys:docs, INResponseArrayKey, diff, INResponseIndexDiffKey, nil];
+			 if (lastError) {
+				 NSError *syncError = nil;
+				 ERR(&syncError, lastError, 0)
+				 [usrIfo setObject:syncError forKey:INErrorKey];
+			 }
+			 SUCCESS_RETVAL_CALLBACK_OR_LOG_USER_INFO(callback, (nil == lastError), usrIfo);
+		 };
+		 
+		 if (0 == pending) {
+			 finish();
+			 return;
+		 }
+		 for (IndivoDocument *doc in docs) {
+			 [doc pullOrLoadCached:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+				 if (errorMessage) {
+					 lastError = errorMessage;
+				 }
+				 if (0 == --pending) {
+					 finish();
+				 }
+			 }];
+		 }
+	 }];
+}
+
+/**
+ *	The document index is stored in the caches directory and loaded the first time it's needed
+ */
+- (INDocumentIndex *)documentIndex
+{
+	if (!documentIndex && self.uuid) {
+		self.documentIndex = [[INDocumentIndex alloc] initWithPath:[INDocumentIndex defaultPathForRecordId:self.uuid]];
+	}
+	return documentIndex;
+}
+
+
 /**
  *	Instantiates a document of given class and adds it to our documents cache.
  *	@param documentClass Must be a subclass of IndivoDocument
@@ -307,13 +529,50 @@
 
 
 /**
- *	Fetches reports limited by the query parameters given.
+ *	Fetches reports limited by the query parameters given, delivering all of them at once.
  *	@attention The "INResponseArrayKey" will contain either IndivoAggregateReport objects or IndivoDocument-subclass objects (of the class supplied to the method)
  *	@param documentClass The class representing the desired document type (e.g. IndivoMedication for medication reports)
  *	@param aQuery The query parameters restricting the query
  *	@param callback The block to execute upon success or failure
  */
 - (void)fetchReportsOfClass:(Class)documentClass withQuery:(INQueryParameter *)aQuery callback:(INSuccessRetvalueBlock)callback
+{
+	NSMutableArray *reportArr = [NSMutableArray array];
+	
+	[self fetchReportsOfClass:documentClass
+					withQuery:aQuery
+					 pageSize:0
+					 progress:^(NSArray *page, BOOL *stop) {
+						 [reportArr addObjectsFromArray:page];
+					 }
+					 callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+						 NSDictionary *usrIfo = userInfo;
+						 
+						 // return in user info dictionary (this strips the response string, should we put it back in?)
+						 if (success) {
+							 usrIfo = ([reportArr count] > 0) ? [NSDictionary dictionaryWithObject:reportArr forKey:INResponseArrayKey] : nil;
+						 }
+						 
+						 SUCCESS_RETVAL_CALLBACK_OR_LOG_USER_INFO(callback, success, usrIfo);
+					 }];
+}
+
+/**
+ *	Fetches reports page by page, handing each page of parsed objects to the progress block as soon as it is ready.
+ *	The request for the next page is issued before the current page is parsed, so the network stays busy while we parse, and no more than two pages are
+ *	held in memory at any time. Paging ends when a page contains less than "pageSize" objects, when the "total_document_count" of a returned Summary has
+ *	been reached or when the progress block sets "stop" to YES.
+ *	@param documentClass The class representing the desired document type (e.g. IndivoMedication for medication reports)
+ *	@param aQuery The query parameters restricting the query. Paging starts at its offset, its limit is ignored unless "pageSize" is 0
+ *	@param pageSize How many objects to request per page. If 0, only one request with the query's own offset and limit will be made
+ *	@param progress The block receiving every page of IndivoDocument-subclass objects, in order
+ *	@param callback The block to execute after the last page has been delivered or when a page fails to load
+ */
+- (void)fetchReportsOfClass:(Class)documentClass
+				  withQuery:(INQueryParameter *)aQuery
+				   pageSize:(NSUInteger)pageSize
+				   progress:(INArrayPageBlock)progress
+				   callback:(INSuccessRetvalueBlock)callback
 {
 	if (!documentClass || ![documentClass isSubclassOfClass:[IndivoDocument class]]) {
 		NSString *errStr = [NSString stringWithFormat:@"Invalid Class, must be a subclass of IndivoDocument. Class given: %@", NSStringFromClass(documentClass)];
@@ -335,62 +594,16 @@
 	}
 	[aQuery addParameter:@"response_format" withValue:@"application/xml"];
 	
-	// fetch
-	__unsafe_unretained IndivoRecord *this = self;
-	
-	[self get:path
-   parameters:[aQuery queryParameters]
-	 callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
-		 NSDictionary *usrIfo = nil;
-		 
-		 // fetched successfully...
-		 if (success) {
-			 //DLog(@"Incoming XML: %@", [userInfo objectForKey:INResponseStringKey]);
-			 INXMLNode *docNode = [userInfo objectForKey:INResponseXMLKey];
-			 NSArray *reports = [docNode childrenNamed:@"Model"];
-			 
-			 // create documents
-			 if ([reports count] > 0) {
-				 NSMutableArray *reportArr = [NSMutableArray arrayWithCapacity:[reports count]];
-				 
-				 /*	// Indivo 1.0
-				 for (INXMLReport *report in reports) {
-					 IndivoMetaDocument *meta = [[IndivoMetaDocument alloc] initFromNode:[report metaDocumentNode] forRecord:self];
-					 meta.documentClass = documentClass;
-					 
-					 // document?
-					 INXMLNode *docNode = [report documentNode];
-					 if (docNode) {
-						 IndivoDocument *doc = [[documentClass alloc] initFromNode:docNode forRecord:self withMeta:meta];
-						 if (doc) {
-							 [reportArr addObject:doc];
-						 }
-					 }
-					 
-					 // aggregate report?
-					 else {
-						 INXMLNode *aggNode = [report aggregateReportNode];
-						 if (aggNode) {
-							 IndivoAggregateReport *aggregate = [[IndivoAggregateReport alloc] initFromNode:aggNode forRecord:self withMeta:meta];
-							 if (aggregate) {
-								 [reportArr addObject:aggregate];
-							 } 
-						 }
-					 }
-				 }		//	*/
-				 
-				 for (INXMLNode *reportNode in reports) {
-					 IndivoDocument *report = [[documentClass alloc] initFromNode:reportNode forRecord:this];
-					 [reportArr addObjectIfNotNil:report];
-				 }
-				 
-				 // return in user info dictionary (this strips the response string, should we put it back in?)
-				 usrIfo = [NSDictionary dictionaryWithObject:reportArr forKey:INResponseArrayKey];
-			 }
-		 }
-		 
-		 SUCCESS_RETVAL_CALLBACK_OR_LOG_USER_INFO(callback, success, usrIfo);
-	 }];
+	// let the pager walk the pages
+	INReportPager *pager = [INReportPager new];
+	pager.record = self;
+	pager.documentClass = documentClass;
+	pager.path = path;
+	pager.query = aQuery;
+	pager.pageSize = pageSize;
+	pager.progress = progress;
+	pager.callback = callback;
+	[pager start];
 }
 
 
@@ -462,7 +675,7 @@
 				for (IndivoDocument *doc in attachments) {
 					i++;			// increment before as the attachment-number is 1-based
 					NSString *postPath = [NSString stringWithFormat:@"/records/%@/inbox/%@/attachments/%d", self.uuid, messageId, i];
-					[self post:postPath body:[doc documentXML] callback:NULL];
+					[self post:postPath bodyData:[doc documentXMLData] callback:NULL];
 				}
 				CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(callback, NO, nil)
 			}
@@ -47,6 +47,7 @@
 
 @class IndivoServer;
 @class IndivoRecord;
+@class INResponseCache;
 
 
 /**
@@ -96,6 +97,11 @@
 
 @property (nonatomic, assign) BOOL storeCredentials;							///< NO by default. If you set this to YES, a successful login will save credentials to the system keychain
 @property (nonatomic, readonly, copy) NSString *lastOAuthVerifier;				///< Storing our OAuth verifier here until MPOAuth asks for it
+@property (nonatomic, assign) NSUInteger maxConcurrentCalls;					///< How many calls may be in flight at the same time, 4 by default
+@property (nonatomic, readonly, assign) NSUInteger coalescedCallCount;			///< How many GET calls were answered by an identical call already pending instead of hitting the server
+@property (nonatomic, readonly, strong) INResponseCache *responseCache;			///< Previous GET responses, used to make conditional requests
+@property (nonatomic, assign) BOOL useCompression;								///< NO by default. If YES, calls ask for compressed responses and gzip large request bodies
+@property (nonatomic, assign) NSUInteger compressionThreshold;					///< Request bodies smaller than this are sent uncompressed, 1024 bytes by default
 
 
 + (id)serverWithDelegate:(id<IndivoServerDelegate>)aDelegate;
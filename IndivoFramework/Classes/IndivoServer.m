@@ -25,6 +25,7 @@
 #import "IndivoRecord.h"
 #import "IndivoDocuments.h"
 #import "INServerCall.h"
+#import "INResponseCache.h"
 #import "MPOAuthAPI.h"
 #import "MPOAuthAuthenticationMethodOAuth.h"			// to get ahold of dictionary key constants
 
@@ -37,16 +38,27 @@
 @property (nonatomic, readwrite, strong) NSMutableArray *knownRecords;
 
 @property (nonatomic, strong) MPOAuthAPI *oauth;								///< Handle to our MPOAuth instance with App credentials
-@property (nonatomic, strong) NSMutableArray *callQueue;						///< Calls are queued instead of performed in parallel to avoid getting inconsistent results
+@property (nonatomic, strong) NSMutableArray *callQueue;						///< Calls waiting for a free slot or for a conflicting call to finish, in the order they were performed
+@property (nonatomic, strong) NSMutableArray *activeCalls;						///< Calls currently in flight
+@property (nonatomic, strong) NSMutableDictionary *pendingGETCalls;			///< Pending GET calls by "coalescingKeyForCall:", identical GETs are attached to these
 @property (nonatomic, strong) NSMutableArray *suspendedCalls;					///< Calls that were dequeued, we need to hold on to them to not deallocate them
-@property (nonatomic, strong) INServerCall *currentCall;						///< Only one call at a time, this is the current one
+@property (nonatomic, strong) INServerCall *currentCall;						///< The authentication call; while it is in flight no other call is started
 
 @property (nonatomic, strong) IndivoLoginViewController *loginVC;				///< A handle to the currently shown login view controller
 @property (nonatomic, readwrite, copy) NSString *lastOAuthVerifier;
+@property (nonatomic, readwrite, assign) NSUInteger coalescedCallCount;
+@property (nonatomic, readwrite, strong) INResponseCache *responseCache;
 
 - (void)_presentLoginScreenAtURL:(NSURL *)loginURL;
 
 - (MPOAuthAPI *)getOAuthOutError:(NSError * __autoreleasing *)error;
+- (MPOAuthAPI *)copyOfOAuthOutError:(NSError * __autoreleasing *)error;
+- (BOOL)canCopyOAuthForCall:(INServerCall *)aCall;
+- (BOOL)canStartCall:(INServerCall *)aCall;
+- (NSString *)resourceKeyForCall:(INServerCall *)aCall;
+- (NSString *)coalescingKeyForCall:(INServerCall *)aCall;
+- (void)attachCall:(INServerCall *)follower toCall:(INServerCall *)leader;
+- (void)startQueuedCalls;
 
 @end
 
@@ -59,8 +71,10 @@ NSString *const INResponseStringKey = @"INServerCallResponseText";
 NSString *const INResponseXMLKey = @"INServerCallResponseXMLNode";
 NSString *const INResponseArrayKey = @"INResponseArray";
 NSString *const INResponseDocumentKey = @"INResponseDocument";
+NSString *const INResponseIndexDiffKey = @"INResponseIndexDiff";
 
 NSString *const INInternalScheme = @"indivo-framework";
+NSString *const INDocumentXMLCacheType = @"documentXML";
 
 NSString *const INRecordDocumentsDidChangeNotification = @"INRecordDocumentsDidChangeNotification";
 NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
@@ -68,7 +82,8 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 @synthesize delegate, activeRecord, knownRecords;
 @synthesize appId, callbackScheme, url, ui_url, startURL, authorizeURL;
 @dynamic activeRecordId;
-@synthesize oauth, callQueue, suspendedCalls, currentCall;
+@synthesize oauth, callQueue, activeCalls, pendingGETCalls, suspendedCalls, currentCall, maxConcurrentCalls, coalescedCallCount, responseCache;
+@synthesize useCompression, compressionThreshold;
 @synthesize loginVC, lastOAuthVerifier;
 @synthesize consumerKey, consumerSecret, storeCredentials;
 
@@ -110,7 +125,12 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 		}
 		
 		self.callQueue = [NSMutableArray arrayWithCapacity:2];
+		self.activeCalls = [NSMutableArray arrayWithCapacity:4];
+		self.pendingGETCalls = [NSMutableDictionary dictionaryWithCapacity:4];
 		self.suspendedCalls = [NSMutableArray arrayWithCapacity:2];
+		self.maxConcurrentCalls = 4;
+		self.responseCache = [INResponseCache new];
+		self.compressionThreshold = 1024;
 	}
 	return self;
 }
@@ -158,7 +178,7 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 
 #pragma mark - Server
 /**
- *	Sets the active record and resets the oauth instance upon logout
+ *	Sets the active record and resets the oauth instance and the response cache upon logout
  */
 - (void)setActiveRecord:(IndivoRecord *)aRecord
 {
@@ -167,6 +187,7 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 		
 		if (!activeRecord) {
 			self.oauth = nil;
+			[responseCache removeAllResponses];
 		}
 	}
 }
@@ -301,7 +322,10 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 
 /**
  *	Strips current credentials and then does the OAuth dance again. The authorize screen is automatically shown if necessary.
- *	@attention This call is only useful if a call is in progress (but has hit an invalid access token), so it will not do anything without a current call.
+ *	If an authentication is already in progress, e.g. because several concurrent calls hit an invalid access token, no new authentication is started but
+ *	the callback is called once the running one finishes.
+ *	@attention This call is only useful if a call is in progress (but has hit an invalid access token), so it will not do anything without such a call.
+ *	Calls wanting to be re-performed after authentication should suspend themselves before calling this method.
  *	@param callback An INCancelErrorBlock callback
  */
 - (void)authenticate:(INCancelErrorBlock)callback
@@ -315,22 +339,15 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 		return;
 	}
 	
-	// dequeue current call
-	if (!currentCall) {
-		NSString *errorStr = error ? [error localizedDescription] : @"No current call";
-		CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(callback, NO, errorStr)
+	// we need a call in progress
+	if ([activeCalls count] < 1 && [suspendedCalls count] < 1 && !currentCall) {
+		CANCEL_ERROR_CALLBACK_OR_LOG_ERR_STRING(callback, NO, @"No current call")
 		return;
 	}
-	[self suspendCall:currentCall];
-	
-	// construct the call
-	__unsafe_unretained IndivoServer *this = self;
-	self.currentCall = [INServerCall newForServer:self];
-	currentCall.HTTPMethod = @"POST";
-	currentCall.finishIfAuthenticated = YES;
 	
 	// here's the callback once authentication has finished
-	currentCall.myCallback = ^(BOOL success, NSDictionary *userInfo) {
+	__unsafe_unretained IndivoServer *this = self;
+	INSuccessRetvalueBlock authCallback = ^(BOOL success, NSDictionary *userInfo) {
 		BOOL didCancel = NO;
 		
 		// successfully authenticated
@@ -350,6 +367,27 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 		CANCEL_ERROR_CALLBACK_OR_LOG_USER_INFO(callback, didCancel, userInfo)
 	};
 	
+	// already authenticating, piggyback on that call
+	if ([currentCall isAuthenticationCall] && [currentCall hasBeenFired]) {
+		INSuccessRetvalueBlock previousCallback = currentCall.myCallback;
+		currentCall.myCallback = ^(BOOL success, NSDictionary *userInfo) {
+			if (previousCallback) {
+				previousCallback(success, userInfo);
+			}
+			authCallback(success, userInfo);
+		};
+		return;
+	}
+	
+	// suspend a pending authentication call and construct the new call
+	if (currentCall) {
+		[self suspendCall:currentCall];
+	}
+	self.currentCall = [INServerCall newForServer:self];
+	currentCall.HTTPMethod = @"POST";
+	currentCall.finishIfAuthenticated = YES;
+	currentCall.myCallback = authCallback;
+	
 	// force authentication by wiping current credentials
 	currentCall.oauth = [self getOAuthOutError:nil];
 	[currentCall.oauth discardCredentials];
@@ -563,7 +601,8 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 #pragma mark - Call Handling
 /**
  *	Perform a method on our server
- *	This method is usally called by INServerObject subclasses, but you can use it bare if you wish
+ *	This method is usally called by INServerObject subclasses, but you can use it bare if you wish. Up to "maxConcurrentCalls" calls are performed at
+ *	the same time, calls that can't be started right away are queued and started in order as soon as possible (see "canStartCall:").
  *	@param aCall The call to perform
  */
 - (void)performCall:(INServerCall *)aCall
@@ -582,9 +621,8 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 	// maybe this call was suspended, remove it from the store
 	[suspendedCalls removeObject:aCall];
 	
-	// there already is a call in progress
-	if (aCall != currentCall && [currentCall hasBeenFired]) {
-		[callQueue addObject:aCall];
+	// already in flight; only the authentication call gets re-fired while in flight, to continue after the user logged in
+	if (aCall != currentCall && [activeCalls containsObject:aCall]) {
 		return;
 	}
 	
@@ -594,40 +632,216 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 		aCall.oauth = [self getOAuthOutError:&error];
 	}
 	if (!aCall.oauth) {
+		[callQueue removeObject:aCall];
 		[aCall abortWithError:error];
 		return;
 	}
-	
-	// setup and fire
 	aCall.server = self;
-	self.currentCall = aCall;
+	
+	// an identical GET is already pending, let it answer this call as well
+	NSString *coalescingKey = [self coalescingKeyForCall:aCall];
+	if (coalescingKey) {
+		INServerCall *leader = [pendingGETCalls objectForKey:coalescingKey];
+		if (leader && leader != aCall) {
+			[self attachCall:aCall toCall:leader];
+			return;
+		}
+		[pendingGETCalls setObject:aCall forKey:coalescingKey];
+	}
+	
+	// can we start it now?
+	if (![self canStartCall:aCall]) {
+		if (![callQueue containsObject:aCall]) {
+			[callQueue addObject:aCall];
+		}
+		return;
+	}
+	
+	// MPOAuth can't run several requests on one instance, give the call its own copy of ours if ours is busy
+	if ([self canCopyOAuthForCall:aCall]) {
+		for (INServerCall *active in activeCalls) {
+			if (active.oauth == aCall.oauth) {
+				MPOAuthAPI *copy = [self copyOfOAuthOutError:&error];
+				if (!copy) {
+					[callQueue removeObject:aCall];
+					[aCall abortWithError:error];
+					return;
+				}
+				aCall.oauth = copy;
+				aCall.oauthIsCopy = YES;
+				break;
+			}
+		}
+	}
+	
+	// fire
+	[callQueue removeObject:aCall];
+	if (![activeCalls containsObject:aCall]) {
+		[activeCalls addObject:aCall];
+	}
 	
 	[aCall fire];
 }
 
+/**
+ *	Decides whether a call can be started right now. The authentication call (our "currentCall") always can, all others must wait if:
+ *	- an authentication call is in flight
+ *	- another call using the same OAuth instance is in flight and we can't give them a copy of it (see "canCopyOAuthForCall:"). MPOAuthAPI has
+ *	  only one auth and load delegate and posts its notifications for the instance, not the request, so calls sharing an instance can't tell
+ *	  their errors and token rejections apart
+ *	- "maxConcurrentCalls" calls are in flight
+ *	- they write to or read from a document that an earlier call, in flight or queued, writes to (or vice versa), so writes to the same
+ *	  document are performed in order, whichever path they use (see "resourceKeyForCall:")
+ */
+- (BOOL)canStartCall:(INServerCall *)aCall
+{
+	if (aCall == currentCall || [aCall isAuthenticationCall]) {
+		return YES;
+	}
+	if ([currentCall hasBeenFired]) {
+		return NO;
+	}
+	if ([activeCalls count] >= MAX(maxConcurrentCalls, 1U)) {
+		return NO;
+	}
+	
+	BOOL canCopyOAuth = [self canCopyOAuthForCall:aCall];
+	BOOL isWrite = ![@"GET" isEqualToString:aCall.HTTPMethod];
+	NSString *resource = [self resourceKeyForCall:aCall];
+	for (INServerCall *active in activeCalls) {
+		if (!canCopyOAuth && active.oauth == aCall.oauth) {
+			return NO;
+		}
+		if ((isWrite || ![@"GET" isEqualToString:active.HTTPMethod]) && [[self resourceKeyForCall:active] isEqualToString:resource]) {
+			return NO;
+		}
+	}
+	
+	// don't overtake calls queued before us that touch the same document
+	for (INServerCall *queued in callQueue) {
+		if (queued == aCall) {
+			break;
+		}
+		if ((isWrite || ![@"GET" isEqualToString:queued.HTTPMethod]) && [[self resourceKeyForCall:queued] isEqualToString:resource]) {
+			return NO;
+		}
+	}
+	return YES;
+}
+
+/**
+ *	Calls using our own OAuth instance can get a copy of it to run concurrently, once we have an access token to hand on. Until then MPOAuth would
+ *	do the OAuth dance for each copy, so these calls wait for each other.
+ */
+- (BOOL)canCopyOAuthForCall:(INServerCall *)aCall
+{
+	if (!oauth || aCall.oauth != oauth || [aCall isAuthenticationCall] || aCall.finishIfAuthenticated) {
+		return NO;
+	}
+	return ([[oauth credentialNamed:kMPOAuthCredentialAccessToken] length] > 0);
+}
+
+/**
+ *	The document a call reads or writes, so calls to the same document are ordered even if they use different paths, e.g. ".../documents/{id}/replace"
+ *	and ".../documents/{id}/label". Calls not addressing a single document use their path.
+ */
+- (NSString *)resourceKeyForCall:(INServerCall *)aCall
+{
+	NSMutableArray *parts = [NSMutableArray array];
+	for (NSString *part in [aCall.method componentsSeparatedByString:@"/"]) {
+		if ([part length] > 0) {
+			[parts addObject:part];
+		}
+	}
+	
+	NSUInteger docIndex = [parts indexOfObject:@"documents"];
+	if (NSNotFound == docIndex || docIndex + 1 >= [parts count]) {
+		return aCall.method;
+	}
+	
+	// special documents are addressed by type, external documents by app and external id
+	NSUInteger last = docIndex + 1;
+	if ([@"special" isEqualToString:[parts objectAtIndex:last]]) {
+		last += 1;
+	}
+	else if ([@"external" isEqualToString:[parts objectAtIndex:last]]) {
+		last += 2;
+	}
+	last = MIN(last, [parts count] - 1);
+	return [[parts subarrayWithRange:NSMakeRange(0, last + 1)] componentsJoinedByString:@"/"];
+}
+
+/**
+ *	Starts as many queued calls as possible, in order. If there's nothing to do we resume the first suspended call.
+ */
+- (void)startQueuedCalls
+{
+	for (INServerCall *queued in [callQueue copy]) {
+		if ([callQueue containsObject:queued] && [self canStartCall:queued]) {
+			[self performCall:queued];
+		}
+	}
+	
+	if ([activeCalls count] < 1 && [callQueue count] < 1 && [suspendedCalls count] > 0) {
+		[self performCall:[suspendedCalls objectAtIndex:0]];
+	}
+}
+
+/**
+ *	GET calls with the same OAuth instance, path and parameters (in any order) are identical and can share one request. Returns nil for calls that
+ *	must not be coalesced.
+ */
+- (NSString *)coalescingKeyForCall:(INServerCall *)aCall
+{
+	if (![@"GET" isEqualToString:aCall.HTTPMethod] || [aCall isAuthenticationCall] || aCall.finishIfAuthenticated || [aCall.body length] > 0 || [aCall.bodyData length] > 0) {
+		return nil;
+	}
+	
+	NSString *paramString = @"";
+	if ([aCall.parameters count] > 0) {
+		paramString = [[aCall.parameters sortedArrayUsingSelector:@selector(compare:)] componentsJoinedByString:@"&"];
+	}
+	return [NSString stringWithFormat:@"%p %@?%@", aCall.oauth, aCall.method, paramString];
+}
+
+/**
+ *	Makes the follower finish with the leader's result, right after the leader's own callback. The follower is never fired.
+ */
+- (void)attachCall:(INServerCall *)follower toCall:(INServerCall *)leader
+{
+	INSuccessRetvalueBlock leaderCallback = leader.myCallback;
+	leader.myCallback = ^(BOOL success, NSDictionary *userInfo) {
+		if (leaderCallback) {
+			leaderCallback(success, userInfo);
+		}
+		
+		if (success) {
+			[follower finishWith:userInfo];
+		}
+		else {
+			[follower abortWithError:[userInfo objectForKey:INErrorKey]];
+		}
+	};
+	self.coalescedCallCount = coalescedCallCount + 1;
+}
+
 /**
  *	Callback to let us know a call has finished.
- *	The call will have called the callback by now, no need for us to do any further handling
+ *	The call will call its callback right after this method returns, no need for us to do any further handling
  */
 - (void)callDidFinish:(INServerCall *)aCall
 {
+	[activeCalls removeObject:aCall];
 	[callQueue removeObject:aCall];
+	[suspendedCalls removeObject:aCall];
+	[pendingGETCalls removeObjectsForKeys:[pendingGETCalls allKeysForObject:aCall]];			// the call has already dropped its oauth instance, so we can't recreate its key
 	if (aCall == currentCall) {
 		self.currentCall = nil;
 	}
 	
-	// move on
-	INServerCall *nextCall = nil;
-	if ([callQueue count] > 0) {
-		nextCall = [callQueue objectAtIndex:0];
-	}
-	else if ([suspendedCalls count] > 0) {
-		nextCall = [suspendedCalls objectAtIndex:0];
-	}
-	
-	if (nextCall) {
-		[self performCall:nextCall];
-	}
+	// move on once the call has delivered its callback, which may re-perform calls waiting for this one (e.g. after authentication)
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(startQueuedCalls) object:nil];
+	[self performSelector:@selector(startQueuedCalls) withObject:nil afterDelay:0.0];
 }
 
 /**
@@ -638,12 +852,21 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
  */
 - (void)suspendCall:(INServerCall *)aCall
 {
-	[suspendedCalls addObject:aCall];
+	if (![suspendedCalls containsObject:aCall]) {
+		[suspendedCalls addObject:aCall];
+	}
+	[activeCalls removeObject:aCall];
 	[callQueue removeObject:aCall];
 	
 	if (aCall == currentCall) {
 		self.currentCall = nil;
 	}
+	
+	// a copy of our OAuth instance has an outdated token once the call is resumed, it gets a fresh one then
+	if (aCall.oauthIsCopy) {
+		aCall.oauth = nil;
+		aCall.oauthIsCopy = NO;
+	}
 }
 
 /**
@@ -673,6 +896,19 @@ NSString *const INRecordUserInfoKey = @"INRecordUserInfoKey";
 }
 
 
+/**
+ *	Creates a new MPOAuthAPI instance carrying the access token and secret of our standard instance, so a call can use it while another call uses ours
+ *	@param error An error pointer to be filled if OAuth creation fails
+ */
+- (MPOAuthAPI *)copyOfOAuthOutError:(NSError *__autoreleasing *)error
+{
+	MPOAuthAPI *copy = [self createOAuthWithAuthMethodClass:nil error:error];
+	[copy setCredential:[oauth credentialNamed:kMPOAuthCredentialAccessToken] withName:kMPOAuthCredentialAccessToken];
+	[copy setCredential:[oauth credentialNamed:kMPOAuthCredentialAccessTokenSecret] withName:kMPOAuthCredentialAccessTokenSecret];
+	return copy;
+}
+
+
 /**
  *	Creates a new MPOAuthAPI instance with our current settings.
  *	@param authClass An MPOAuthAuthenticationMethod class name. If nil picks three-legged oauth.
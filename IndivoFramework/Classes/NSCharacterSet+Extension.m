@@ -16,11 +16,12 @@
 + (NSCharacterSet *)numericCharacterSet
 {
 	static NSCharacterSet *NSCharacterSet_numericCharacterSet = nil;
-	if (!NSCharacterSet_numericCharacterSet) {
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
 		NSMutableCharacterSet *numSet = [[NSCharacterSet decimalDigitCharacterSet] mutableCopy];
 		[numSet addCharactersInString:@"."];
 		NSCharacterSet_numericCharacterSet = [numSet copy];
-	}
+	});
 	return NSCharacterSet_numericCharacterSet;
 }
 
@@ -0,0 +1,114 @@
+/*
+ NSData+Gzip.m
+ IndivoFramework
+ 
+ Copyright (c) 2012 Children's Hospital Boston
+ 
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+ 
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+ 
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#import "NSData+Gzip.h"
+#import <zlib.h>
+
+#define kINGzipChunkSize 32768
+
+
+@implementation NSData (Gzip)
+
+/**
+ *	YES if the data starts with the gzip magic bytes
+ */
+- (BOOL)isGzipped
+{
+	if ([self length] < 2) {
+		return NO;
+	}
+	const unsigned char *bytes = [self bytes];
+	return (0x1f == bytes[0] && 0x8b == bytes[1]);
+}
+
+
+/**
+ *	Returns the data compressed with gzip, nil if compression fails
+ */
+- (NSData *)gzippedData
+{
+	if ([self length] < 1 || [self length] > UINT_MAX) {
+		return nil;
+	}
+	
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	if (Z_OK != deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY)) {		// +16: gzip header
+		return nil;
+	}
+	
+	// the bound is what deflate needs at worst, so we can do it in one go
+	NSMutableData *compressed = [NSMutableData dataWithLength:deflateBound(&stream, [self length])];
+	stream.next_in = (Bytef *)[self bytes];
+	stream.avail_in = (uInt)[self length];
+	stream.next_out = [compressed mutableBytes];
+	stream.avail_out = (uInt)[compressed length];
+	
+	int res = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+	if (Z_STREAM_END != res) {
+		return nil;
+	}
+	
+	[compressed setLength:stream.total_out];
+	return compressed;
+}
+
+
+/**
+ *	Inflates gzip or zlib compressed data chunk by chunk, returns nil if the data is not compressed or is corrupt
+ */
+- (NSData *)gunzippedData
+{
+	if ([self length] < 1 || [self length] > UINT_MAX) {
+		return nil;
+	}
+	
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	if (Z_OK != inflateInit2(&stream, MAX_WBITS + 32)) {		// +32: detect gzip or zlib header
+		return nil;
+	}
+	
+	NSMutableData *inflated = [NSMutableData dataWithLength:MAX([self length] * 4, (NSUInteger)kINGzipChunkSize)];
+	stream.next_in = (Bytef *)[self bytes];
+	stream.avail_in = (uInt)[self length];
+	
+	int res = Z_OK;
+	while (Z_OK == res) {
+		if (stream.total_out >= [inflated length]) {
+			[inflated increaseLengthBy:MAX([inflated length] / 2, (NSUInteger)kINGzipChunkSize)];
+		}
+		stream.next_out = (Bytef *)[inflated mutableBytes] + stream.total_out;
+		stream.avail_out = (uInt)([inflated length] - stream.total_out);
+		res = inflate(&stream, Z_SYNC_FLUSH);
+	}
+	inflateEnd(&stream);
+	if (Z_STREAM_END != res) {
+		return nil;
+	}
+	
+	[inflated setLength:stream.total_out];
+	return inflated;
+}
+
+
+@end
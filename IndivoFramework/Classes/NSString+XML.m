@@ -9,11 +9,96 @@
 #import "NSString+XML.h"
 #import "NSCharacterSet+Extension.h"
 
+
+/**
+ *	The characters that need escaping in XML: & " ' < >
+ */
+static NSCharacterSet *INXMLSpecialCharacterSet(void)
+{
+	static NSCharacterSet *xmlSpecialChars = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		xmlSpecialChars = [NSCharacterSet characterSetWithCharactersInString:@"&\"'<>"];
+	});
+	return xmlSpecialChars;
+}
+
+/**
+ *	Escapes the string in a single pass, starting at the given index which must be the first special character.
+ *	Works on the UTF-16 buffer directly if CoreFoundation can hand it out, otherwise on a copy of the characters. The output buffer starts a bit larger
+ *	than the input and grows by doubling, so the string is only walked once.
+ */
+static NSString *INXMLEscapedString(NSString *string, NSUInteger firstSpecial)
+{
+	NSUInteger len = [string length];
+	const UniChar *chars = CFStringGetCharactersPtr((__bridge CFStringRef)string);
+	UniChar *copied = NULL;
+	if (!chars) {
+		copied = malloc(len * sizeof(UniChar));
+		if (!copied) {
+			[NSException raise:NSMallocException format:@"Failed to allocate %u characters to escape", len];
+		}
+		[string getCharacters:copied range:NSMakeRange(0, len)];
+		chars = copied;
+	}
+	
+	NSUInteger capacity = len + (len >> 3) + 16;
+	UniChar *out = malloc(capacity * sizeof(UniChar));
+	if (!out) {
+		free(copied);
+		[NSException raise:NSMallocException format:@"Failed to allocate %u characters to escape", capacity];
+	}
+	memcpy(out, chars, firstSpecial * sizeof(UniChar));
+	NSUInteger o = firstSpecial;
+	
+	NSUInteger i = firstSpecial;
+	for (; i < len; i++) {
+		UniChar c = chars[i];
+		const char *entity = NULL;
+		NSUInteger entityLength = 0;
+		switch (c) {
+			case '&':  entity = "&amp;";  entityLength = 5; break;
+			case '"':  entity = "&quot;"; entityLength = 6; break;
+			case '\'': entity = "&#x27;"; entityLength = 6; break;
+			case '<':  entity = "&lt;";   entityLength = 4; break;
+			case '>':  entity = "&gt;";   entityLength = 4; break;
+		}
+		
+		// make room for the longest entity
+		if (o + 6 > capacity) {
+			capacity *= 2;
+			UniChar *grown = realloc(out, capacity * sizeof(UniChar));
+			if (!grown) {
+				free(out);
+				free(copied);
+				[NSException raise:NSMallocException format:@"Failed to allocate %u characters to escape", capacity];
+			}
+			out = grown;
+		}
+		
+		if (entity) {
+			NSUInteger e = 0;
+			for (; e < entityLength; e++) {
+				out[o++] = entity[e];
+			}
+		}
+		else {
+			out[o++] = c;
+		}
+	}
+	free(copied);
+	
+	return [[NSString alloc] initWithCharactersNoCopy:out length:o freeWhenDone:YES];
+}
+
+
+
 @implementation NSString (XML)
 
 
 /**
- *	Escapes XML special chars (see "xmlEscape")
+ *	Escapes XML special chars (see "xmlEscape").
+ *	The receiver is scanned once for special characters, if there are none we return it without making a copy.
  */
 - (NSString *)xmlSafe
 {
@@ -21,10 +106,11 @@
 		return self;
 	}
 	
-	/// @todo Maybe it's performance-wise wise to only copy if we actually contain escapeable chars?
-	NSMutableString *mutable = [self mutableCopy];
-	[mutable xmlEscape];
-	return mutable;
+	NSUInteger first = [self rangeOfCharacterFromSet:INXMLSpecialCharacterSet() options:NSLiteralSearch].location;
+	if (NSNotFound == first) {
+		return [self copy];			// only copies if we are mutable
+	}
+	return INXMLEscapedString(self, first);
 }
 
 
@@ -65,15 +151,18 @@
 
 /**
  *	Escapes these XML special chars: & " ' < >
+ *	Does not touch the receiver if it doesn't contain any of them, otherwise replaces our content with the string escaped in a single pass.
  */
 - (void)xmlEscape
 {
-	/// @todo 5 iterations over the full string, it's probably possible to do this more effectively. NSScanner!
-    [self replaceOccurrencesOfString:@"&"  withString:@"&amp;"  options:NSLiteralSearch range:NSMakeRange(0, [self length])];
-    [self replaceOccurrencesOfString:@"\"" withString:@"&quot;" options:NSLiteralSearch range:NSMakeRange(0, [self length])];
-    [self replaceOccurrencesOfString:@"'"  withString:@"&#x27;" options:NSLiteralSearch range:NSMakeRange(0, [self length])];
-    [self replaceOccurrencesOfString:@">"  withString:@"&gt;"   options:NSLiteralSearch range:NSMakeRange(0, [self length])];
-    [self replaceOccurrencesOfString:@"<"  withString:@"&lt;"   options:NSLiteralSearch range:NSMakeRange(0, [self length])];
+	if ([self length] < 1) {
+		return;
+	}
+	
+	NSUInteger first = [self rangeOfCharacterFromSet:INXMLSpecialCharacterSet() options:NSLiteralSearch].location;
+	if (NSNotFound != first) {
+		[self setString:INXMLEscapedString(self, first)];
+	}
 }
 
 
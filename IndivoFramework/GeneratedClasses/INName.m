@@ -34,32 +34,12 @@
 - (void)setFromFlatParent:(INXMLNode *)parent prefix:(NSString *)nodePrefix
 {
 	if (parent) {
-		BOOL hasPrefix = ([nodePrefix length] > 0);
-		NSString *familyNameFull = hasPrefix ? [NSString stringWithFormat:@"%@_%@", nodePrefix, @"family"] : @"family";
-		NSString *givenNameFull = hasPrefix ? [NSString stringWithFormat:@"%@_%@", nodePrefix, @"given"] : @"given";
-		NSString *middleNameFull = hasPrefix ? [NSString stringWithFormat:@"%@_%@", nodePrefix, @"middle"] : @"middle";
-		NSString *prefixFull = hasPrefix ? [NSString stringWithFormat:@"%@_%@", nodePrefix, @"prefix"] : @"prefix";
-		NSString *suffixFull = hasPrefix ? [NSString stringWithFormat:@"%@_%@", nodePrefix, @"suffix"] : @"suffix";
-		
 		// look for these nodes
-		for (INXMLNode *child in [parent children]) {
-			NSString *childName = [child attr:@"name"];
-			if ([familyNameFull isEqualToString:childName]) {
-				self.familyName = child.text;
-			}
-			else if ([givenNameFull isEqualToString:childName]) {
-				self.givenName = child.text;
-			}
-			else if ([middleNameFull isEqualToString:childName]) {
-				self.middleName = child.text;
-			}
-			else if ([prefixFull isEqualToString:childName]) {
-				self.prefix = child.text;
-			}
-			else if ([suffixFull isEqualToString:childName]) {
-				self.suffix = child.text;
-			}
-		}
+		self.familyName = [[parent childWithNameAttribute:flatXMLName(nodePrefix, @"family")] text];
+		self.givenName = [[parent childWithNameAttribute:flatXMLName(nodePrefix, @"given")] text];
+		self.middleName = [[parent childWithNameAttribute:flatXMLName(nodePrefix, @"middle")] text];
+		self.prefix = [[parent childWithNameAttribute:flatXMLName(nodePrefix, @"prefix")] text];
+		self.suffix = [[parent childWithNameAttribute:flatXMLName(nodePrefix, @"suffix")] text];
 	}
 }
 
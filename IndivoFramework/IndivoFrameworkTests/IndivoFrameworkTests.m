@@ -10,8 +10,20 @@
 #import "IndivoMockServer.h"
 #import "IndivoDocuments.h"
 #import "INXMLParser.h"
+#import "INPropertyPlan.h"
+#import "INXMLWriter.h"
+#import "INISO8601.h"
+#import "INServerCall.h"
+#import "INDocumentCache.h"
+#import "INResponseCache.h"
+#import "INDocumentIndex.h"
+#import "INURLFetcher.h"
+#import "INURLLoader.h"
 #import "NSString+XML.h"
+#import "NSData+Gzip.h"
 #import <mach/mach_time.h>
+#import <malloc/malloc.h>
+#import <objc/runtime.h>
 
 
 /**
@@ -22,6 +34,78 @@
 	@throw [NSException exceptionWithName:@"Unexpected Response" reason:throwMessage userInfo:nil]
 
 
+/**
+ *	Bytes currently allocated in all malloc zones
+ */
+static size_t INBytesInUse(void)
+{
+	malloc_statistics_t stats;
+	malloc_zone_statistics(NULL, &stats);
+	return stats.size_in_use;
+}
+
+
+/**
+ *	A server call that never hits the network, used to test call scheduling
+ */
+@interface INTestServerCall : INServerCall
+
+@property (nonatomic, assign) BOOL didFire;
+
+@end
+
+@implementation INTestServerCall
+
+@synthesize didFire;
+
+- (void)fire
+{
+	self.didFire = YES;
+	
+	// take over the OAuth instance like the real call does before it hits the network
+	[self setValue:[NSNumber numberWithBool:YES] forKey:@"hasBeenFired"];
+	self.oauth.authDelegate = self;
+	self.oauth.loadDelegate = self;
+}
+
+@end
+
+
+/**
+ *	An HTTP response with a status code of our choosing, used to feed loaders without a server
+ */
+@interface INTestHTTPURLResponse : NSHTTPURLResponse
+
+@property (nonatomic, assign) NSInteger testStatusCode;
+@property (nonatomic, copy) NSDictionary *testHeaderFields;
+
+@end
+
+@implementation INTestHTTPURLResponse
+
+@synthesize testStatusCode, testHeaderFields;
+
+- (NSInteger)statusCode
+{
+	return testStatusCode;
+}
+
+- (NSDictionary *)allHeaderFields
+{
+	return testHeaderFields;
+}
+
+@end
+
+
+@interface IndivoFrameworkTests ()
+
+- (BOOL)waitForCondition:(BOOL (^)(void))condition timeout:(NSTimeInterval)timeout;
+- (double)secondsToRun:(void (^)(void))block;
+
+@end
+
+
 @implementation IndivoFrameworkTests
 
 @synthesize server;
@@ -40,6 +124,33 @@
     [super tearDown];
 }
 
+/**
+ *	Runs the run loop until the condition is met or the timeout passes
+ *	@return The condition's value when returning
+ */
+- (BOOL)waitForCondition:(BOOL (^)(void))condition timeout:(NSTimeInterval)timeout
+{
+	NSDate *until = [NSDate dateWithTimeIntervalSinceNow:timeout];
+	while (!condition() && [until timeIntervalSinceNow] > 0) {
+		[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+	}
+	return condition();
+}
+
+/**
+ *	Runs the block once
+ *	@return The seconds it took
+ */
+- (double)secondsToRun:(void (^)(void))block
+{
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	
+	uint64_t startTime = mach_absolute_time();
+	block();
+	return (mach_absolute_time() - startTime) * (double)timebase.numer / timebase.denom / 1000000000;
+}
+
 
 - (void)testStringExtensions
 {
@@ -52,6 +163,46 @@
 	STAssertEqualObjects(@"15", [nonNumString1 numericString], @"numeric string 2");
 	STAssertEqualObjects(@"", [nonNumString2 numericString], @"numeric string 3");
 	STAssertEqualObjects(@"6", [nonNumString3 numericString], @"numeric string 4");
+	
+	// XML escaping
+	NSString *plain = @"Patient reports mild headache, no fever";
+	STAssertTrue(plain == [plain xmlSafe], @"Strings without special chars must not be copied");
+	STAssertEqualObjects(@"&lt;b&gt;Tom &amp; Jerry&#x27;s &quot;show&quot;&lt;/b&gt;", [@"<b>Tom & Jerry's \"show\"</b>" xmlSafe], @"xmlSafe");
+	STAssertEqualObjects(@"\u00dcbelkeit &amp; Schwindel", [@"\u00dcbelkeit & Schwindel" xmlSafe], @"xmlSafe non-ASCII");
+	NSMutableString *mutable = [@"a<b" mutableCopy];
+	[mutable xmlEscape];
+	STAssertEqualObjects(@"a&lt;b", mutable, @"xmlEscape");
+}
+
+/**
+ *	Escapes a clinical note-sized text, once with and once without special characters, 10'000 times each.
+ */
+- (void)testXMLEscapingSpeed
+{
+	NSString *clean = @"Pt is a 7 yo male presenting with 3 days of cough and fever up to 39.2 C. Mother reports decreased appetite but good fluid intake. "
+					  @"Lungs: scattered crackles RLL, no wheezes. Assessment: community acquired pneumonia. Plan: amoxicillin 90 mg/kg/day divided BID x 10 days, "
+					  @"return if worsening respiratory distress or unable to tolerate PO. Follow up with PCP in 48-72 hours.";
+	NSString *dirty = @"Pt's temp was > 39 C & HR < 120 at triage. Mother states \"he hasn't been himself\". Sats 94% on RA; CXR w/ RLL infiltrate & small effusion. "
+					  @"Assessment: CAP, r/o empyema if effusion > 1 cm. Plan: amoxicillin 90 mg/kg/day & ibuprofen prn, return if RR > 50 or sats < 92%.";
+	
+	double cleanTime = [self secondsToRun:^{
+		for (NSUInteger i = 0; i < 10000; i++) {
+			@autoreleasepool {
+				[clean xmlSafe];
+			}
+		}
+	}];
+	double dirtyTime = [self secondsToRun:^{
+		for (NSUInteger i = 0; i < 10000; i++) {
+			@autoreleasepool {
+				[dirty xmlSafe];
+			}
+		}
+	}];
+	
+	STAssertEqualObjects(clean, [clean xmlSafe], @"Clean note");
+	STAssertTrue(NSNotFound != [[dirty xmlSafe] rangeOfString:@"Pt&#x27;s temp was &gt; 39 C &amp; HR &lt; 120"].location, @"Dirty note");
+	NSLog(@"10000 clinical notes escaped: %.4f sec without, %.4f sec with special chars", cleanTime, dirtyTime);
 }
 
 
@@ -430,20 +581,1329 @@
 	STAssertEqualObjects(@"2951-2", doc.test_name.identifier, @"LOINC code");
 	
 	// timing
-	mach_timebase_info_data_t timebase;
-	mach_timebase_info(&timebase);
-	double ticksToNanoseconds = (double)timebase.numer / timebase.denom;
-	uint64_t startTime = mach_absolute_time();
+	double elapsedTime = [self secondsToRun:^{
+		for (NSUInteger i = 0; i < 1000; i++) {
+			[doc documentXML];
+		}
+	}];
+	NSLog(@"1000 XML generation calls: %.4f sec", elapsedTime);				// 6/26/2012, iMac i7 2.8GHz 4Gig RAM: ~0.16 sec
+}
+
+/**
+ *	Speed comparison of the NSXMLParser and the libxml2 SAX parser on the lab reports fixture, scaled up 1000x.
+ */
+- (void)testXMLParsing
+{
+	NSError *error = nil;
+	NSString *fixture = [server readFixture:@"lab_reports"];
+	NSRange firstReport = [fixture rangeOfString:@"<Model name="];
+	NSRange closingTag = [fixture rangeOfString:@"</Models>" options:NSBackwardsSearch];
+	STAssertTrue(NSNotFound != firstReport.location && NSNotFound != closingTag.location, @"Report fixture");
 	
+	NSString *reports = [fixture substringWithRange:NSMakeRange(firstReport.location, closingTag.location - firstReport.location)];
+	NSMutableString *scaled = [NSMutableString stringWithString:[fixture substringToIndex:firstReport.location]];
 	NSUInteger i = 0;
 	for (; i < 1000; i++) {
-		[doc documentXML];
+		[scaled appendString:reports];
 	}
+	[scaled appendString:[fixture substringFromIndex:closingTag.location]];
+	NSData *scaledData = [scaled dataUsingEncoding:NSUTF8StringEncoding];
 	
-	uint64_t elapsedTime = mach_absolute_time() - startTime;
-	double elapsedTimeInNanoseconds = elapsedTime * ticksToNanoseconds;
-	NSLog(@"1000 XML generation calls: %.4f sec", elapsedTimeInNanoseconds / 1000000000);				// 6/26/2012, iMac i7 2.8GHz 4Gig RAM: ~0.16 sec
+	// timing
+	__block INXMLNode *stringRoot = nil;
+	double stringTime = [self secondsToRun:^{
+		NSError *parseError = nil;
+		stringRoot = [INXMLParser parseXML:scaled error:&parseError];
+		STAssertNotNil(stringRoot, @"NSXMLParser: %@", [parseError localizedDescription]);
+	}];
+	
+	__block INXMLNode *dataRoot = nil;
+	double dataTime = [self secondsToRun:^{
+		NSError *parseError = nil;
+		dataRoot = [INXMLParser parseXMLData:scaledData error:&parseError];
+		STAssertNotNil(dataRoot, @"SAX parser: %@", [parseError localizedDescription]);
+	}];
+	
+	NSLog(@"Parsing %d KB of reports: NSXMLParser %.4f sec, libxml2 SAX %.4f sec", [scaledData length] / 1024, stringTime, dataTime);
+	
+	// both parsers must produce the same tree
+	NSArray *stringReports = [stringRoot childrenNamed:@"Model"];
+	NSArray *dataReports = [dataRoot childrenNamed:@"Model"];
+	STAssertEquals((NSUInteger)5000, [dataReports count], @"Number of reports");
+	STAssertEquals([stringReports count], [dataReports count], @"Number of reports");
+	
+	INXMLNode *stringDoc = [stringReports lastObject];
+	INXMLNode *dataDoc = [dataReports lastObject];
+	STAssertEqualObjects(@"lab-report-5", [dataDoc attr:@"documentId"], @"Document id");
+	STAssertEqualObjects([stringDoc attr:@"documentId"], [dataDoc attr:@"documentId"], @"Document id");
+	STAssertEqualObjects([[stringDoc childWithNameAttribute:@"test_name_title"] text], [[dataDoc childWithNameAttribute:@"test_name_title"] text], @"Test name");
+	STAssertEqualObjects(@"Serum Creatinine", [[dataDoc childWithNameAttribute:@"test_name_title"] text], @"Test name");
+	
+	// push parsing in network-sized chunks must produce the same tree
+	INXMLParser *pushParser = [INXMLParser new];
+	NSUInteger offset = 0;
+	while (offset < [scaledData length]) {
+		NSUInteger chunkLength = MIN((NSUInteger)1500, [scaledData length] - offset);
+		STAssertTrue([pushParser parseChunk:[scaledData subdataWithRange:NSMakeRange(offset, chunkLength)] error:&error], @"Chunk at %d: %@", offset, [error localizedDescription]);
+		offset += chunkLength;
+	}
+	INXMLNode *pushRoot = [pushParser finishParsingChunks:&error];
+	STAssertNotNil(pushRoot, @"Push parser: %@", [error localizedDescription]);
+	STAssertEquals([dataReports count], [[pushRoot childrenNamed:@"Model"] count], @"Number of reports");
+	STAssertEqualObjects([dataDoc attr:@"documentId"], [[[pushRoot childrenNamed:@"Model"] lastObject] attr:@"documentId"], @"Document id");
+	
+	// malformed XML must fail
+	STAssertNil([INXMLParser parseXMLData:[@"<a><b></a>" dataUsingEncoding:NSUTF8StringEncoding] error:&error], @"Malformed XML");
+	STAssertNotNil(error, @"Malformed XML error");
+}
+
+
+- (void)testChildIndex
+{
+	NSError *error = nil;
+	
+	// a wide node: lookups must find the first match in document order, and adding a child must invalidate the index
+	INXMLNode *wide = [INXMLNode nodeWithName:@"Report"];
+	NSUInteger i = 0;
+	for (; i < 200; i++) {
+		INXMLNode *child = [INXMLNode nodeWithName:[NSString stringWithFormat:@"field_%d", i % 100]];
+		child.text = [NSString stringWithFormat:@"%d", i];
+		[wide addChild:child];
+	}
+	STAssertEqualObjects(@"42", [[wide childNamed:@"field_42"] text], @"First match");
+	STAssertEquals((NSUInteger)2, [[wide childrenNamed:@"field_42"] count], @"All matches");
+	STAssertEqualObjects(@"142", [[[wide childrenNamed:@"field_42"] lastObject] text], @"Document order");
+	STAssertNil([wide childNamed:@"missing"], @"Missing child");
+	STAssertEquals((NSUInteger)0, [[wide childrenNamed:@"missing"] count], @"Missing children");
+	
+	[wide addChild:[INXMLNode nodeWithName:@"added"]];
+	STAssertNotNil([wide childNamed:@"added"], @"Index invalidation");
+	[wide.children addObject:[INXMLNode nodeWithName:@"appended"]];
+	STAssertNotNil([wide childNamed:@"appended"], @"Index invalidation on direct mutation");
+	NSUInteger replaceAt = [wide.children indexOfObjectIdenticalTo:[wide childNamed:@"appended"]];
+	[wide.children replaceObjectAtIndex:replaceAt withObject:[INXMLNode nodeWithName:@"replaced"]];
+	STAssertNil([wide childNamed:@"appended"], @"Index invalidation on replacing a child in place");
+	STAssertNotNil([wide childNamed:@"replaced"], @"Replacement must be found");
+	NSArray *named = [wide childrenNamed:@"field_42"];
+	STAssertFalse([named isKindOfClass:[NSMutableArray class]], @"childrenNamed: must not hand out the index's arrays");
+	
+	// flat XML fields are found by their name attribute
+	INXMLNode *model = [INXMLNode nodeWithName:@"Model"];
+	for (i = 0; i < 100; i++) {
+		INXMLNode *field = [INXMLNode nodeWithName:@"Field" attributes:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"field_%d", i] forKey:@"name"]];
+		field.text = [NSString stringWithFormat:@"%d", i];
+		[model addChild:field];
+	}
+	STAssertEqualObjects(@"42", [[model childWithNameAttribute:@"field_42"] text], @"Flat field lookup");
+	STAssertEqualObjects(@"field_42", flatXMLName(@"field", @"42"), @"Flat field name");
+	STAssertEqualObjects(@"field", flatXMLName(nil, @"field"), @"Flat field name without prefix");
+	
+	// micro-benchmark: deserialize wide documents, compare to what the lookups would cost with linear scans
+	for (NSString *fixtureName in [NSArray arrayWithObjects:@"lab", @"medication", nil]) {
+		INXMLNode *node = [INXMLParser parseXML:[server readFixture:fixtureName] error:&error];
+		STAssertNotNil(node, @"Fixture %@: %@", fixtureName, [error localizedDescription]);
+		Class docClass = [@"lab" isEqualToString:fixtureName] ? [IndivoLabResult class] : [IndivoMedication class];
+		NSArray *names = [[node children] valueForKey:@"name"];
+		
+		__block NSUInteger found = 0;
+		double linearTime = [self secondsToRun:^{
+			for (NSUInteger j = 0; j < 2000; j++) {
+				for (NSString *childName in names) {
+					for (INXMLNode *child in [node children]) {
+						if ([child.name isEqualToString:childName]) {
+							found++;
+							break;
+						}
+					}
+				}
+			}
+		}];
+		
+		__block NSUInteger indexed = 0;
+		double indexTime = [self secondsToRun:^{
+			for (NSUInteger j = 0; j < 2000; j++) {
+				for (NSString *childName in names) {
+					if ([node childNamed:childName]) {
+						indexed++;
+					}
+				}
+			}
+		}];
+		STAssertEquals(found, indexed, @"Indexed lookups must find the same children");
+		
+		double docTime = [self secondsToRun:^{
+			for (NSUInteger j = 0; j < 2000; j++) {
+				INXMLNode *copy = [INXMLParser parseXML:[server readFixture:fixtureName] error:nil];
+				STAssertNotNil([[docClass alloc] initFromNode:copy forRecord:nil], @"Deserialization");
+			}
+		}];
+		
+		NSLog(@"%d children of %@: linear lookups %.4f sec, indexed lookups %.4f sec, deserializing 2000 documents %.4f sec", [names count], fixtureName, linearTime, indexTime, docTime);
+	}
+}
+
+
+- (void)testPropertyPlan
+{
+	INPropertyPlan *plan = [INPropertyPlan planForClass:[IndivoMedication class]];
+	STAssertNotNil(plan, @"Medication plan");
+	STAssertTrue(plan == [INPropertyPlan planForClass:[IndivoMedication class]], @"Plans must be cached");
+	
+	INProperty *fulfillments = nil;
+	for (INProperty *prop in plan.properties) {
+		if ([@"fulfillments" isEqualToString:prop.name]) {
+			fulfillments = prop;
+		}
+	}
+	STAssertNotNil(fulfillments, @"Fulfillments property");
+	STAssertTrue([fulfillments.ivarClass isSubclassOfClass:[NSArray class]], @"Fulfillments ivar class");
+	STAssertEquals([IndivoFill class], fulfillments.itemClass, @"Fulfillments item class");
+	STAssertFalse(fulfillments.isAttribute, @"Fulfillments is not an attribute");
+	
+	// attributes and ivar access
+	INPropertyPlan *principalPlan = [INPropertyPlan planForClass:[IndivoPrincipal class]];
+	IndivoPrincipal *principal = [IndivoPrincipal new];
+	for (INProperty *prop in principalPlan.properties) {
+		STAssertEquals([@"type" isEqualToString:prop.name], prop.isAttribute, @"Attribute flag of %@", prop.name);
+		if ([@"fullname" isEqualToString:prop.name]) {
+			INString *name = [INString newWithString:@"Test"];
+			[prop setValue:name forObject:principal];
+			STAssertEquals(name, [prop valueForObject:principal], @"Ivar access");
+		}
+	}
+	STAssertEqualObjects(@"Test", principal.fullname.string, @"Ivar was set");
+}
+
+
+- (void)testXMLWriter
+{
+	INXMLWriter *writer = [INXMLWriter writer];
+	writer.prettyFormat = YES;
+	[writer appendStartTag:@"Note"];
+	writer.depth++;
+	[writer indent];
+	[writer appendStartTag:@"author"];
+	[writer appendEscapedString:@"Dr. O'Neil & \"Partners\" <Ped\u00e4trie>"];
+	[writer appendEndTag:@"author"];
+	writer.depth--;
+	[writer indent];
+	[writer appendEndTag:@"Note"];
+	STAssertEqualObjects(@"<Note>\n\t<author>Dr. O&#x27;Neil &amp; &quot;Partners&quot; &lt;Ped\u00e4trie&gt;</author>\n</Note>", [writer string], @"Escaping and indentation");
+	STAssertEquals((NSUInteger)0, writer.length, @"Writer must be empty after handing over its buffer");
+	
+	// document data must match the string version byte for byte
+	NSError *error = nil;
+	NSString *fixture = [server readFixture:@"lab"];
+	INXMLNode *node = [INXMLParser parseXML:fixture error:&error];
+	IndivoLabResult *doc = [[IndivoLabResult alloc] initFromNode:node forRecord:nil];
+	NSData *xmlData = [doc documentXMLData];
+	STAssertTrue([xmlData length] > 0, @"Document XML data");
+	STAssertEqualObjects([[doc documentXML] dataUsingEncoding:NSUTF8StringEncoding], xmlData, @"Document XML data");
+	
+	// attribute values must be escaped exactly once
+	IndivoPrincipal *principal = [IndivoPrincipal new];
+	principal.type = [INString newWithString:@"A&B <C>"];
+	principal.fullname = [INString newWithString:@"Tom & Jerry"];
+	NSString *expectedAttribute = @" type=\"A&amp;B &lt;C&gt;\"";
+	STAssertTrue(NSNotFound != [[principal tagString] rangeOfString:expectedAttribute].location, @"Attribute escaping in %@", [principal tagString]);
+	NSString *principalXML = [principal xml];
+	STAssertTrue(NSNotFound != [principalXML rangeOfString:expectedAttribute].location, @"Attribute escaping in %@", principalXML);
+	STAssertTrue(NSNotFound != [principalXML rangeOfString:@"<fullname>Tom &amp; Jerry</fullname>"].location, @"Content escaping in %@", principalXML);
+	STAssertTrue(NSNotFound == [principalXML rangeOfString:@"&amp;amp;"].location, @"Double escaping in %@", principalXML);
+}
+
+
+/**
+ *	Date parsing and formatting, including a benchmark parsing one million timestamps.
+ */
+- (void)testISODates
+{
+	STAssertEqualObjects(@"2010-12-27T17:00:00Z", [INDateTime isoStringFrom:[INDateTime parseDateFromISOString:@"2010-12-27T17:00:00Z"]], @"Round trip");
+	STAssertEqualObjects(@"2010-12-27T17:00:00Z", [INDateTime isoStringFrom:[INDateTime parseDateFromISOString:@"2010-12-27T19:00:00.250+02:00"]], @"Offset and fraction");
+	STAssertEqualObjects(@"2010-12-27T17:00:00Z", [INDateTime isoStringFrom:[INDateTime parseDateFromISOString:@"2010-12-27T12:00:00-0500"]], @"Offset without colon");
+	STAssertEqualObjects(@"2007-03-14T00:00:00Z", [INDateTime isoStringFrom:[INDateTime parseDateFromISOString:@"2007-03-14"]], @"Date as date-time");
+	STAssertEqualsWithAccuracy(0.25, fmod([[INDateTime parseDateFromISOString:@"2012-01-31T10:40:41.25Z"] timeIntervalSince1970], 1.0), 0.0001, @"Fractional seconds");
+	STAssertEqualObjects(@"1939-11-15", [INDate isoStringFrom:[INDate parseDateFromISOString:@"1939-11-15"]], @"Date round trip");
+	STAssertEqualObjects(@"2012-02-29", [[INDate dateFromISOString:@"2012-02-29"] isoString], @"Leap day");
+	STAssertNil([INDate parseDateFromISOString:@"2011-02-29"], @"Not a leap year");
+	STAssertNil([INDateTime parseDateFromISOString:@"2012-01-31T25:00:00Z"], @"Invalid hour");
+	STAssertNil([INDateTime parseDateFromISOString:@"yesterday"], @"Garbage");
+	STAssertEqualObjects(@"0000-00-00T00:00:00Z", [INDateTime isoStringFrom:nil], @"Null date");
+	
+	// parse 1 million timestamps, on a background queue to make sure nothing relies on the main thread
+	NSMutableArray *stamps = [NSMutableArray arrayWithCapacity:1000];
+	NSUInteger i = 0;
+	for (; i < 1000; i++) {
+		[stamps addObject:INISO8601StringFromDate([NSDate dateWithTimeIntervalSince1970:1293469200 + i * 3607], YES)];
+	}
+	
+	__block NSUInteger failed = 0;
+	double elapsedTime = [self secondsToRun:^{
+		dispatch_sync(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			NSUInteger j = 0;
+			for (; j < 1000; j++) {
+				@autoreleasepool {
+					for (NSString *stamp in stamps) {
+						if (!INDateFromISO8601String(stamp, NO)) {
+							failed++;
+						}
+					}
+				}
+			}
+		});
+	}];
+	
+	STAssertEquals((NSUInteger)0, failed, @"All timestamps must parse");
+	NSLog(@"1000000 timestamps parsed: %.4f sec", elapsedTime);
 }
 
 
+/**
+ *	Calls are performed concurrently up to maxConcurrentCalls, each with its own copy of the server's OAuth instance. Writes to the same document are
+ *	serialized.
+ */
+- (void)testCallScheduling
+{
+	IndivoServer *realServer = [IndivoServer new];
+	realServer.url = [NSURL URLWithString:@"http://localhost:8000"];
+	realServer.consumerKey = @"key";
+	realServer.consumerSecret = @"secret";
+	realServer.maxConcurrentCalls = 2;
+	
+	// the standard OAuth instance as selecting a record leaves it, calls use it by default
+	MPOAuthAPI *standard = [realServer createOAuthWithAuthMethodClass:nil error:nil];
+	[standard setCredential:@"token" withName:kMPOAuthCredentialAccessToken];
+	[standard setCredential:@"token-secret" withName:kMPOAuthCredentialAccessTokenSecret];
+	[realServer setValue:standard forKey:@"oauth"];
+	
+	INTestServerCall *(^makeCall)(NSString *, NSString *) = ^(NSString *method, NSString *httpMethod) {
+		INTestServerCall *call = [INTestServerCall new];
+		call.method = method;
+		call.HTTPMethod = httpMethod;
+		return call;
+	};
+	
+	INTestServerCall *demographics = makeCall(@"/records/abc/documents/special/demographics", @"GET");
+	INTestServerCall *medications = makeCall(@"/records/abc/reports/minimal/medications/", @"GET");
+	INTestServerCall *labs = makeCall(@"/records/abc/reports/minimal/labs/", @"GET");
+	[realServer performCall:demographics];
+	[realServer performCall:medications];
+	[realServer performCall:labs];
+	STAssertTrue(demographics.didFire && medications.didFire, @"Independent record GETs must run in parallel");
+	STAssertFalse(labs.didFire, @"Must not exceed maxConcurrentCalls");
+	STAssertTrue(standard == demographics.oauth, @"First call must use the standard instance");
+	STAssertTrue(medications.oauthIsCopy && standard != medications.oauth, @"Concurrent call must get its own OAuth instance");
+	STAssertEqualObjects(@"token", [medications.oauth credentialNamed:kMPOAuthCredentialAccessToken], @"Copy must carry the access token");
+	STAssertEqualObjects(@"token-secret", [medications.oauth credentialNamed:kMPOAuthCredentialAccessTokenSecret], @"Copy must carry the token secret");
+	
+	[demographics finishWith:nil];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue(labs.didFire, @"Queued call must start once a slot is free");
+	
+	[medications finishWith:nil];
+	[labs finishWith:nil];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	
+	// writes to the same document, even through different paths
+	realServer.maxConcurrentCalls = 4;
+	INTestServerCall *firstWrite = makeCall(@"/records/abc/documents/123/replace", @"POST");
+	INTestServerCall *secondWrite = makeCall(@"/records/abc/documents/123/replace", @"POST");
+	INTestServerCall *labelWrite = makeCall(@"/records/abc/documents/123/label", @"PUT");
+	INTestServerCall *otherWrite = makeCall(@"/records/abc/documents/456/replace", @"POST");
+	[realServer performCall:firstWrite];
+	[realServer performCall:secondWrite];
+	[realServer performCall:labelWrite];
+	[realServer performCall:otherWrite];
+	STAssertTrue(firstWrite.didFire && otherWrite.didFire, @"Writes to different documents must run in parallel");
+	STAssertFalse(secondWrite.didFire, @"Writes to the same document must be serialized");
+	STAssertFalse(labelWrite.didFire, @"Writes to the same document through another path must be serialized");
+	
+	[firstWrite finishWith:nil];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue(secondWrite.didFire, @"Second write must start after the first finished");
+	STAssertFalse(labelWrite.didFire, @"Writes must not overtake earlier writes to the same document");
+	[secondWrite finishWith:nil];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue(labelWrite.didFire, @"Label write must start after the replacements finished");
+	[labelWrite finishWith:nil];
+	[otherWrite finishWith:nil];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	
+	// calls sharing an instance that isn't ours to copy, e.g. an app's own instance, must not overlap
+	MPOAuthAPI *shared = [realServer createOAuthWithAuthMethodClass:nil error:nil];
+	INTestServerCall *firstShared = makeCall(@"/records/abc/reports/minimal/allergies/", @"GET");
+	INTestServerCall *secondShared = makeCall(@"/records/abc/reports/minimal/problems/", @"GET");
+	firstShared.oauth = shared;
+	secondShared.oauth = shared;
+	__block BOOL secondGotError = NO;
+	secondShared.myCallback = ^(BOOL success, NSDictionary *userInfo) {
+		secondGotError = (nil != [userInfo objectForKey:INErrorKey]);
+	};
+	[realServer performCall:firstShared];
+	[realServer performCall:secondShared];
+	STAssertTrue(firstShared.didFire, @"First call on the shared instance must fire");
+	STAssertFalse(secondShared.didFire, @"Calls sharing an OAuth instance must be serialized");
+	
+	// an error on the instance while the first call runs must not end up in the queued call
+	[[NSNotificationCenter defaultCenter] postNotificationName:MPOAuthNotificationErrorHasOccurred object:shared userInfo:nil];
+	STAssertNotNil([[firstShared valueForKey:@"responseObject"] objectForKey:INErrorKey], @"Running call must receive the error");
+	STAssertNil([secondShared valueForKey:@"responseObject"], @"Queued call must ignore notifications of the running call");
+	
+	[firstShared finishWith:nil];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	STAssertTrue(secondShared.didFire, @"Second call on the shared instance must start after the first finished");
+	STAssertTrue(shared == secondShared.oauth, @"Second call must own the shared instance once it runs");
+	[secondShared finishWith:[NSDictionary dictionaryWithObject:@"<Reports />" forKey:INResponseStringKey]];
+	STAssertFalse(secondGotError, @"Second call must not inherit the first call's state");
+}
+
+
+/**
+ *	Identical GETs must share one request and all receive its result.
+ */
+- (void)testCallCoalescing
+{
+	IndivoServer *realServer = [IndivoServer new];
+	realServer.url = [NSURL URLWithString:@"http://localhost:8000"];
+	realServer.consumerKey = @"key";
+	realServer.consumerSecret = @"secret";
+	MPOAuthAPI *oauth = [realServer createOAuthWithAuthMethodClass:nil error:nil];
+	
+	__block NSUInteger numCallbacks = 0;
+	NSDictionary *response = [NSDictionary dictionaryWithObject:@"<Reports />" forKey:INResponseStringKey];
+	NSMutableArray *calls = [NSMutableArray arrayWithCapacity:3];
+	NSUInteger i = 0;
+	for (; i < 3; i++) {
+		INTestServerCall *call = [INTestServerCall new];
+		call.method = @"/records/abc/reports/minimal/medications/";
+		call.HTTPMethod = @"GET";
+		call.parameters = (0 == i % 2) ? [NSArray arrayWithObjects:@"limit=50", @"offset=0", nil] : [NSArray arrayWithObjects:@"offset=0", @"limit=50", nil];
+		call.oauth = oauth;
+		call.myCallback = ^(BOOL success, NSDictionary *userInfo) {
+			STAssertTrue(success, @"Coalesced call must succeed");
+			STAssertEqualObjects(@"<Reports />", [userInfo objectForKey:INResponseStringKey], @"Coalesced call must get the response");
+			numCallbacks++;
+		};
+		[calls addObject:call];
+		[realServer performCall:call];
+	}
+	
+	INTestServerCall *leader = [calls objectAtIndex:0];
+	STAssertTrue(leader.didFire, @"First call must fire");
+	STAssertFalse([[calls objectAtIndex:1] didFire] || [[calls objectAtIndex:2] didFire], @"Identical calls must not fire");
+	STAssertEquals((NSUInteger)2, realServer.coalescedCallCount, @"Saved requests");
+	
+	[leader finishWith:response];
+	STAssertEquals((NSUInteger)3, numCallbacks, @"All callbacks must be called");
+	
+	// once finished, the same GET goes to the server again
+	INTestServerCall *later = [INTestServerCall new];
+	later.method = @"/records/abc/reports/minimal/medications/";
+	later.HTTPMethod = @"GET";
+	later.oauth = oauth;
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+	[realServer performCall:later];
+	STAssertTrue(later.didFire, @"Calls after the leader finished must fire");
+	STAssertEquals((NSUInteger)2, realServer.coalescedCallCount, @"Saved requests");
+	[later finishWith:nil];
+}
+
+
+/**
+ *	Objects must survive in the disk tier and be invalidated by a changed digest.
+ */
+- (void)testDocumentCache
+{
+	NSString *dir = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INDocumentCacheTest"];
+	[[NSFileManager defaultManager] removeItemAtPath:dir error:nil];
+	
+	INDocumentCache *cache = [[INDocumentCache alloc] initWithDirectory:dir];
+	cache.memoryCountLimit = 2;
+	NSError *error = nil;
+	STAssertTrue([cache storeObject:@"pill-1" type:@"pillImage" forId:@"doc-1" digest:@"abc" error:&error], @"Store: %@", [error localizedDescription]);
+	STAssertTrue([cache storeObject:@"pill-2" type:@"pillImage" forId:@"doc-2" digest:nil error:&error], @"Store: %@", [error localizedDescription]);
+	STAssertEqualObjects(@"pill-1", [cache objectOfType:@"pillImage" forId:@"doc-1" digest:@"abc"], @"Memory hit");
+	STAssertNil([cache objectOfType:@"otherType" forId:@"doc-1" digest:nil], @"Types are separate");
+	
+	// LRU eviction, doc-2 is least recently used
+	[cache storeObject:@"pill-3" type:@"pillImage" forId:@"doc-3" digest:nil error:nil];
+	STAssertNotNil([cache objectOfType:@"pillImage" forId:@"doc-1" digest:nil], @"Recently used must stay in memory");
+	
+	// a new cache on the same directory must find the objects on disk
+	__block id loaded = nil;
+	__block BOOL done = NO;
+	INDocumentCache *coldCache = [[INDocumentCache alloc] initWithDirectory:dir];
+	[cache loadObjectOfType:@"pillImage" forId:@"doc-3" digest:nil callback:^(id cachedObject) {			// queues behind the background writes
+		[coldCache loadObjectOfType:@"pillImage" forId:@"doc-1" digest:@"abc" callback:^(id cachedObject) {
+			loaded = cachedObject;
+			done = YES;
+		}];
+	}];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertEqualObjects(@"pill-1", loaded, @"Disk hit");
+	STAssertEqualObjects(@"pill-1", [coldCache objectOfType:@"pillImage" forId:@"doc-1" digest:@"abc"], @"Disk hits must be promoted to memory");
+	
+	// changed digest
+	STAssertNil([coldCache objectOfType:@"pillImage" forId:@"doc-1" digest:@"def"], @"Outdated object must be discarded");
+	
+	// a load still waiting for the disk must not put back an object removed in the meantime
+	done = NO;
+	[cache purgeMemory];
+	[cache storeObject:[NSMutableData dataWithLength:4 * 1024 * 1024] type:@"blob" forId:@"doc-1" digest:nil error:nil];		// keeps the disk queue busy
+	[cache loadObjectOfType:@"pillImage" forId:@"doc-3" digest:nil callback:^(id cachedObject) {
+		done = YES;
+	}];
+	[cache removeObjectOfType:@"pillImage" forId:@"doc-3"];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertEquals((NSUInteger)1, cache.memoryCount, @"Removed object must not be resurrected by a pending load");
+	
+	// same for a purge
+	done = NO;
+	[coldCache loadObjectOfType:@"pillImage" forId:@"doc-2" digest:nil callback:^(id cachedObject) {
+		done = YES;
+	}];
+	[coldCache purgeMemory];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertEquals((NSUInteger)0, coldCache.memoryCount, @"Purged memory must not be refilled by a pending load");
+	
+	[cache removeAllObjects];
+	[coldCache removeAllObjects];
+}
+
+
+- (void)testDocumentCacheBudgets
+{
+	NSString *dir = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INDocumentCacheBudgetTest"];
+	[[NSFileManager defaultManager] removeItemAtPath:dir error:nil];
+	
+	INDocumentCache *cache = [[INDocumentCache alloc] initWithDirectory:dir];
+	cache.memoryByteLimit = 1000;
+	[cache setCountLimit:0 byteLimit:300 forType:@"pillImage"];
+	
+	// per-type byte budget
+	[cache storeObject:@"a" type:@"pillImage" forId:@"doc-1" digest:nil cost:200 error:nil];
+	[cache storeObject:@"b" type:@"pillImage" forId:@"doc-2" digest:nil cost:200 error:nil];
+	[cache storeObject:@"c" type:@"note" forId:@"doc-1" digest:nil cost:200 error:nil];
+	STAssertEquals((NSUInteger)2, cache.memoryCount, @"One pill image must have been evicted");
+	STAssertEquals((NSUInteger)400, cache.memoryBytes, @"Cost bookkeeping");
+	STAssertEquals((NSUInteger)1, cache.evictions, @"Eviction count");
+	STAssertNotNil([cache objectOfType:@"pillImage" forId:@"doc-2" digest:nil], @"Newest pill image must stay");
+	STAssertNotNil([cache objectOfType:@"note" forId:@"doc-1" digest:nil], @"Other types are not affected by the type budget");
+	
+	// overall budget, LFU keeps the frequently used object even if it was used longest ago
+	[cache purgeMemory];
+	[cache resetStatistics];
+	STAssertEquals((NSUInteger)0, cache.memoryCount, @"Purged");
+	STAssertEquals((NSUInteger)0, cache.memoryBytes, @"Purged");
+	cache.evictionPolicy = INDocumentCacheEvictLeastFrequentlyUsed;
+	[cache storeObject:@"x" type:@"a" forId:@"doc-1" digest:nil cost:400 error:nil];
+	[cache storeObject:@"y" type:@"b" forId:@"doc-1" digest:nil cost:400 error:nil];
+	[cache objectOfType:@"a" forId:@"doc-1" digest:nil];
+	[cache objectOfType:@"a" forId:@"doc-1" digest:nil];
+	[cache objectOfType:@"b" forId:@"doc-1" digest:nil];
+	[cache storeObject:@"z" type:@"c" forId:@"doc-1" digest:nil cost:400 error:nil];
+	STAssertEquals((NSUInteger)3, cache.memoryHits, @"Memory hit count");
+	STAssertNotNil([cache objectOfType:@"a" forId:@"doc-1" digest:nil], @"LFU must keep the most used object");
+	STAssertNil([cache objectOfType:@"b" forId:@"doc-1" digest:nil], @"LFU must evict the least used object");
+	
+	// same sequence with LRU evicts the object used longest ago
+	[cache purgeMemory];
+	cache.evictionPolicy = INDocumentCacheEvictLeastRecentlyUsed;
+	[cache storeObject:@"x" type:@"a" forId:@"doc-1" digest:nil cost:400 error:nil];
+	[cache storeObject:@"y" type:@"b" forId:@"doc-1" digest:nil cost:400 error:nil];
+	[cache objectOfType:@"a" forId:@"doc-1" digest:nil];
+	[cache objectOfType:@"a" forId:@"doc-1" digest:nil];
+	[cache objectOfType:@"b" forId:@"doc-1" digest:nil];
+	[cache storeObject:@"z" type:@"c" forId:@"doc-1" digest:nil cost:400 error:nil];
+	STAssertNil([cache objectOfType:@"a" forId:@"doc-1" digest:nil], @"LRU must evict the object used longest ago");
+	
+	// estimated cost
+	NSData *data = [NSMutableData dataWithLength:123];
+	STAssertEquals((NSUInteger)123, [INDocumentCache estimatedCostOfObject:data], @"Data cost");
+	STAssertEquals((NSUInteger)8, [INDocumentCache estimatedCostOfObject:@"four"], @"String cost");
+	
+	// a memory warning empties the memory tier
+	[[NSNotificationCenter defaultCenter] postNotificationName:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	STAssertEquals((NSUInteger)0, cache.memoryCount, @"Memory warning must purge memory");
+	
+	[cache removeAllObjects];
+}
+
+- (void)testDocumentCacheConcurrency
+{
+	NSString *dir = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INDocumentCacheConcurrencyTest"];
+	[[NSFileManager defaultManager] removeItemAtPath:dir error:nil];
+	
+	INDocumentCache *cache = [[INDocumentCache alloc] initWithDirectory:dir];
+	NSMutableArray *ids = [NSMutableArray arrayWithCapacity:100];
+	for (NSUInteger i = 0; i < 100; i++) {
+		NSString *docId = [NSString stringWithFormat:@"doc-%d", i];
+		[ids addObject:docId];
+		[cache storeObject:[NSObject new] type:@"generic" forId:docId digest:nil error:nil];
+	}
+	[cache resetStatistics];
+	
+	// 8 threads with a 95/5 read/write mix; stored objects don't conform to NSCoding so we measure the memory tier, not the disk
+	double elapsedTime = [self secondsToRun:^{
+		dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+			for (NSUInteger i = 0; i < 20000; i++) {
+				NSString *docId = [ids objectAtIndex:(i * 7 + thread * 13) % 100];
+				if (0 == i % 20) {
+					[cache storeObject:[NSObject new] type:@"generic" forId:docId digest:nil error:nil];
+				}
+				else {
+					[cache objectOfType:@"generic" forId:docId digest:nil];
+				}
+			}
+		});
+	}];
+	NSLog(@"160000 cache operations on 8 threads, 95%% reads: %.4f sec", elapsedTime);
+	
+	STAssertEquals((NSUInteger)152000, cache.memoryHits, @"Every read must have hit memory");
+	STAssertEquals((NSUInteger)100, cache.memoryCount, @"Writes replace objects");
+	STAssertEquals((NSUInteger)0, cache.evictions, @"Nothing to evict");
+	
+	[cache removeAllObjects];
+}
+
+- (void)testConditionalGET
+{
+	IndivoMockServer *mockServer = (IndivoMockServer *)self.server;
+	NSUInteger notModifiedBefore = mockServer.notModifiedCount;
+	
+	__block INXMLNode *firstNode = nil;
+	__block INXMLNode *secondNode = nil;
+	INServerCall *first = [INServerCall newForServer:mockServer];
+	first.method = @"/records/abc";
+	first.myCallback = ^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		firstNode = [userInfo objectForKey:INResponseXMLKey];
+	};
+	STAssertNil([first conditionalRequestHeaders], @"Nothing to validate yet");
+	[mockServer performCall:first];
+	STAssertNotNil(firstNode, @"Full response must be parsed");
+	STAssertNotNil([mockServer.responseCache responseForURLString:[first canonicalURLString]], @"Response with ETag must be remembered");
+	
+	// the same GET again must send the ETag and get the very same node back
+	INServerCall *second = [INServerCall newForServer:mockServer];
+	second.method = @"/records/abc";
+	second.myCallback = ^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		secondNode = [userInfo objectForKey:INResponseXMLKey];
+	};
+	STAssertNotNil([[second conditionalRequestHeaders] objectForKey:@"If-None-Match"], @"Must send the ETag");
+	[mockServer performCall:second];
+	STAssertEquals(notModifiedBefore + 1, mockServer.notModifiedCount, @"Second GET must be answered with a 304");
+	STAssertTrue(firstNode == secondNode, @"A 304 must hand out the previously parsed node");
+	
+	// canonical URLs ignore parameter order, POSTs have none
+	second.parameters = [NSArray arrayWithObjects:@"b=2", @"a=1", nil];
+	first.parameters = [NSArray arrayWithObjects:@"a=1", @"b=2", nil];
+	STAssertEqualObjects([first canonicalURLString], [second canonicalURLString], @"Parameter order");
+	second.HTTPMethod = @"POST";
+	STAssertNil([second canonicalURLString], @"Only GETs are cached");
+	
+	// parameters are escaped when we build the conditional request ourselves
+	IndivoServer *realServer = [IndivoServer new];
+	realServer.url = [NSURL URLWithString:@"http://localhost:8000"];
+	realServer.consumerKey = @"key";
+	realServer.consumerSecret = @"secret";
+	INServerCall *escaping = [INServerCall newForServer:realServer];
+	escaping.method = @"/records/abc/reports/minimal/labs/";
+	escaping.parameters = [NSArray arrayWithObjects:@"status=on hold", @"name=A&B", @"date=2012%2D10", nil];
+	escaping.oauth = [realServer createOAuthWithAuthMethodClass:nil error:nil];
+	NSURL *escapedURL = [escaping requestURL];
+	STAssertNotNil(escapedURL, @"Parameters with spaces must still give a URL");
+	STAssertEqualObjects(@"status=on%20hold&name=A%26B&date=2012-10", [escapedURL query], @"Names and values must be escaped exactly once");
+	escaping.oauth = nil;
+	
+	// a 304 without a cached response fails
+	__block BOOL succeeded = YES;
+	INServerCall *third = [INServerCall newForServer:mockServer];
+	third.method = @"/records/abc/documents/";
+	third.myCallback = ^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		succeeded = success;
+	};
+	[third finishWith:nil statusCode:304 responseHeaders:nil];
+	STAssertFalse(succeeded, @"304 without previous response");
+	
+	// pulling a document twice gets the second response from the cache
+	IndivoLabResult *lab = (IndivoLabResult *)[mockServer.activeRecord addDocumentOfClass:[IndivoLabResult class] error:nil];
+	lab.uuid = @"mock-doc-id";
+	notModifiedBefore = mockServer.notModifiedCount;
+	[lab pull:NULL];
+	[lab pull:NULL];
+	STAssertEquals(notModifiedBefore + 1, mockServer.notModifiedCount, @"Second pull must be answered with a 304");
+}
+
+- (void)testCompression
+{
+	NSData *xmlData = [[self.server readFixture:@"lab_reports"] dataUsingEncoding:NSUTF8StringEncoding];
+	NSData *gzipped = [xmlData gzippedData];
+	STAssertTrue([gzipped isGzipped], @"Must have gzip header");
+	STAssertFalse([xmlData isGzipped], @"Plain XML is not gzipped");
+	STAssertTrue([gzipped length] < [xmlData length], @"XML must compress");
+	STAssertEqualObjects(xmlData, [gzipped gunzippedData], @"Round trip");
+	STAssertNil([xmlData gunzippedData], @"Uncompressed data can't be inflated");
+	NSLog(@"Lab reports fixture compresses from %d to %d bytes", [xmlData length], [gzipped length]);
+	
+	// request bodies are only compressed if the server wants it
+	INServerCall *call = [INServerCall newForServer:self.server];
+	call.method = @"/records/abc/documents/";
+	call.HTTPMethod = @"POST";
+	NSMutableURLRequest *request = [call requestWithBodyData:xmlData];
+	STAssertNil([request valueForHTTPHeaderField:@"Content-Encoding"], @"Compression is opt-in");
+	STAssertEqualObjects(xmlData, [request HTTPBody], @"Uncompressed body");
+	
+	self.server.useCompression = YES;
+	request = [call requestWithBodyData:xmlData];
+	STAssertEqualObjects(@"gzip", [request valueForHTTPHeaderField:@"Content-Encoding"], @"Compressed body");
+	STAssertNotNil([request valueForHTTPHeaderField:@"Accept-Encoding"], @"Must ask for compressed responses");
+	STAssertEqualObjects(xmlData, [[request HTTPBody] gunzippedData], @"Compressed body round trip");
+	STAssertEquals([xmlData length], call.uncompressedBytesSent, @"Bytes before compression");
+	STAssertEquals([[request HTTPBody] length], call.bytesSent, @"Bytes after compression");
+	
+	NSData *small = [@"<Note/>" dataUsingEncoding:NSUTF8StringEncoding];
+	request = [call requestWithBodyData:small];
+	STAssertNil([request valueForHTTPHeaderField:@"Content-Encoding"], @"Small bodies are not worth compressing");
+	
+	// GETs ask for compressed responses, too
+	INServerCall *getCall = [INServerCall newForServer:self.server];
+	getCall.method = @"/records/abc/reports/LabResult/";
+	getCall.HTTPMethod = @"GET";
+	request = [getCall requestWithValidators:nil];
+	STAssertEqualObjects(@"GET", [request HTTPMethod], @"GET request");
+	STAssertNotNil([request valueForHTTPHeaderField:@"Accept-Encoding"], @"GETs must ask for compressed responses");
+	
+	// a response the server compressed and that arrives still gzipped is inflated
+	__block NSString *responseString = nil;
+	getCall.myCallback = ^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		responseString = [userInfo objectForKey:INResponseStringKey];
+	};
+	NSDictionary *headers = [NSDictionary dictionaryWithObject:@"gzip" forKey:@"Content-Encoding"];
+	NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://localhost/"] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+	[getCall connectionFinishedWithResponse:response data:gzipped];
+	STAssertEqualObjects([self.server readFixture:@"lab_reports"], responseString, @"Inflated response");
+	STAssertEquals([gzipped length], getCall.bytesReceived, @"Bytes before decompression");
+	STAssertEquals([xmlData length], getCall.uncompressedBytesReceived, @"Bytes after decompression");
+	
+	// a gzipped document is handed out as stored, we didn't compress it
+	INServerCall *documentCall = [INServerCall newForServer:self.server];
+	documentCall.method = @"/records/abc/documents/123";
+	headers = [NSDictionary dictionaryWithObject:@"application/x-gzip" forKey:@"Content-Type"];
+	response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://localhost/"] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+	[documentCall connectionFinishedWithResponse:response data:gzipped];
+	STAssertEquals([gzipped length], documentCall.uncompressedBytesReceived, @"Gzipped document without Content-Encoding must not be inflated");
+	
+	self.server.useCompression = NO;
+	documentCall = [INServerCall newForServer:self.server];
+	documentCall.method = @"/records/abc/documents/123";
+	response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://localhost/"] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:[NSDictionary dictionaryWithObject:@"gzip" forKey:@"Content-Encoding"]];
+	[documentCall connectionFinishedWithResponse:response data:gzipped];
+	STAssertEquals([gzipped length], documentCall.uncompressedBytesReceived, @"Responses must not be inflated if we didn't ask for compression");
+	STAssertNil([[getCall requestWithValidators:nil] valueForHTTPHeaderField:@"Accept-Encoding"], @"Compression is opt-in for GETs");
+}
+
+- (void)testDocumentIndex
+{
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INDocumentIndexTest/abc.plist"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	INDocumentIndex *index = [[INDocumentIndex alloc] initWithPath:path];
+	
+	INDocumentIndexEntry *a = [INDocumentIndexEntry new];
+	a.uuid = @"a";
+	a.digest = @"1";
+	a.status = @"active";
+	INDocumentIndexEntry *b = [INDocumentIndexEntry new];
+	b.uuid = @"b";
+	b.digest = @"2";
+	b.status = @"active";
+	INDocumentIndexDiff *diff = [index updateWithEntries:[NSArray arrayWithObjects:a, b, nil]];
+	STAssertEquals((NSUInteger)2, [diff.added count], @"All new");
+	
+	NSError *error = nil;
+	STAssertTrue([index save:&error], @"Save: %@", [error localizedDescription]);
+	INDocumentIndex *reloaded = [[INDocumentIndex alloc] initWithPath:path];
+	STAssertEquals((NSUInteger)2, [reloaded count], @"Reloaded entries");
+	STAssertEqualObjects(@"2", [reloaded entryForId:@"b"].digest, @"Reloaded digest");
+	
+	// "a" is replaced by "c", "b" gets voided, "d" is new
+	INDocumentIndexEntry *a2 = [INDocumentIndexEntry new];
+	a2.uuid = @"a";
+	a2.digest = @"1";
+	a2.status = @"active";
+	a2.latest = @"c";
+	INDocumentIndexEntry *b2 = [INDocumentIndexEntry new];
+	b2.uuid = @"b";
+	b2.digest = @"2";
+	b2.status = @"void";
+	INDocumentIndexEntry *c = [INDocumentIndexEntry new];
+	c.uuid = @"c";
+	c.digest = @"3";
+	c.status = @"active";
+	c.replaces = @"a";
+	INDocumentIndexEntry *d = [INDocumentIndexEntry new];
+	d.uuid = @"d";
+	d.digest = @"4";
+	d.status = @"active";
+	diff = [reloaded updateWithEntries:[NSArray arrayWithObjects:a2, b2, c, d, nil]];
+	STAssertEqualObjects([NSArray arrayWithObject:d], diff.added, @"New document");
+	STAssertEqualObjects([NSArray arrayWithObject:c], diff.changed, @"New version of a known document");
+	STAssertEquals((NSUInteger)2, [diff.removed count], @"Replaced and voided documents");
+	STAssertEquals((NSUInteger)0, [diff.unchanged count], @"Nothing unchanged");
+	
+	diff = [reloaded updateWithEntries:[NSArray arrayWithObjects:a2, b2, c, d, nil]];
+	STAssertTrue([diff isEmpty], @"Same listing, no changes");
+	STAssertEquals((NSUInteger)2, [diff.unchanged count], @"Current documents are unchanged");
+	
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testDocumentSync
+{
+	IndivoRecord *record = self.server.activeRecord;
+	[record.documentIndex removeAllEntries];
+	[IndivoDocument removeCachedObjectOfType:INDocumentXMLCacheType forId:@"mock-doc-id"];
+	
+	__block INDocumentIndexDiff *diff = nil;
+	__block NSArray *docs = nil;
+	__block BOOL done = NO;
+	INSuccessRetvalueBlock callback = ^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		STAssertTrue(success, @"Sync failed: %@", userInfo);
+		diff = [userInfo objectForKey:INResponseIndexDiffKey];
+		docs = [userInfo objectForKey:INResponseArrayKey];
+		done = YES;
+	};
+	
+	[record syncDocumentsWithCallback:callback];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertEquals((NSUInteger)1, [diff.added count], @"First sync adds all documents");
+	STAssertEquals((NSUInteger)1, [docs count], @"Document instances");
+	STAssertTrue([[docs lastObject] fetched], @"Document must have been pulled");
+	
+	// second sync only transfers the listing, the document comes from the cache
+	NSUInteger notModifiedBefore = self.server.notModifiedCount;
+	done = NO;
+	[record syncDocumentsWithCallback:callback];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertEquals((NSUInteger)1, [diff.unchanged count], @"Second sync finds no changes");
+	STAssertTrue([[docs lastObject] fetched], @"Document must have been loaded from cache");
+	STAssertEquals(notModifiedBefore + 1, self.server.notModifiedCount, @"Only the listing may be requested again");
+	
+	[record.documentIndex removeAllEntries];
+	[IndivoDocument removeCachedObjectOfType:INDocumentXMLCacheType forId:@"mock-doc-id"];
+}
+
+- (void)testPagedReports
+{
+	IndivoRecord *record = self.server.activeRecord;
+	NSMutableArray *pageSizes = [NSMutableArray array];
+	NSMutableArray *requestsAhead = [NSMutableArray array];
+	__block NSString *firstId = nil;
+	__block BOOL done = NO;
+	NSUInteger callsBefore = self.server.pagedCallCount;
+	
+	// walk all pages, the next page must already be requested when a page is delivered
+	[record fetchReportsOfClass:[IndivoLabResult class]
+					  withQuery:nil
+					   pageSize:2
+					   progress:^(NSArray *page, BOOL *stop) {
+						   if (!firstId) {
+							   firstId = [[page objectAtIndex:0] uuid];
+						   }
+						   [pageSizes addObject:[NSNumber numberWithUnsignedInteger:[page count]]];
+						   [requestsAhead addObject:[NSNumber numberWithUnsignedInteger:self.server.pagedCallCount - callsBefore - [pageSizes count]]];
+					   }
+					   callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+						   STAssertTrue(success, @"Paged fetch failed: %@", userInfo);
+						   done = YES;
+					   }];
+	STAssertTrue(done, @"Callback must have been called");
+	STAssertEquals((NSUInteger)3, [pageSizes count], @"5 reports in pages of 2");
+	STAssertEquals((NSUInteger)1, [[pageSizes lastObject] unsignedIntegerValue], @"Last page");
+	STAssertEqualObjects(@"lab-report-1", firstId, @"Pages must arrive in order");
+	STAssertEquals((NSUInteger)1, [[requestsAhead objectAtIndex:0] unsignedIntegerValue], @"Second page must be requested before the first is delivered");
+	STAssertEquals((NSUInteger)0, [[requestsAhead lastObject] unsignedIntegerValue], @"No request after the last page");
+	
+	// stop after the first page
+	__block NSUInteger numPages = 0;
+	done = NO;
+	callsBefore = self.server.pagedCallCount;
+	[record fetchReportsOfClass:[IndivoLabResult class]
+					  withQuery:nil
+					   pageSize:2
+					   progress:^(NSArray *page, BOOL *stop) {
+						   numPages++;
+						   *stop = YES;
+					   }
+					   callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+						   STAssertTrue(success, @"Stopped fetch failed: %@", userInfo);
+						   done = YES;
+					   }];
+	STAssertTrue(done, @"Callback must be called when stopping");
+	STAssertEquals((NSUInteger)1, numPages, @"Must stop after the first page");
+	STAssertEquals((NSUInteger)2, self.server.pagedCallCount - callsBefore, @"Only the prefetched page may have been requested");
+	
+	// all at once
+	__block NSArray *reports = nil;
+	[record fetchReportsOfClass:[IndivoLabResult class] callback:^(BOOL success, NSDictionary *__autoreleasing userInfo) {
+		reports = [userInfo objectForKey:INResponseArrayKey];
+	}];
+	STAssertEquals((NSUInteger)5, [reports count], @"All reports in one array");
+}
+
+- (void)testQueryEngine
+{
+	INXMLNode *models = [INXMLParser parseXML:[server readFixture:@"lab_reports"] error:nil];
+	NSMutableArray *labs = [NSMutableArray array];
+	for (INXMLNode *node in [models childrenNamed:@"Model"]) {
+		IndivoLabResult *lab = [[IndivoLabResult alloc] initFromNode:node forRecord:nil];
+		if (lab) {
+			[labs addObject:lab];
+		}
+	}
+	STAssertEquals((NSUInteger)5, [labs count], @"Lab results");
+	INQueryEngine *engine = [[INQueryEngine alloc] initWithReports:labs];
+	
+	// filter
+	INQueryParameter *query = [INQueryParameter new];
+	[query addFilter:@"test_name_identifier" withValue:@"2823-3"];
+	NSArray *results = [engine resultsForQuery:query];
+	STAssertEquals((NSUInteger)1, [results count], @"Filtered results");
+	STAssertEqualObjects(@"Serum Potassium", ((IndivoLabResult *)[results lastObject]).test_name.title, @"Filtered result");
+	
+	// order and limit
+	query = [INQueryParameter new];
+	query.orderBy = @"quantitative_result_value_value";
+	query.descending = YES;
+	query.limit = 2;
+	results = [engine resultsForQuery:query];
+	STAssertEquals((NSUInteger)2, [results count], @"Limited results");
+	STAssertEqualObjects(@"lab-report-1", [[results objectAtIndex:0] uuid], @"Highest value first");
+	STAssertEqualObjects(@"lab-report-3", [[results objectAtIndex:1] uuid], @"Second highest value");
+	
+	// date range
+	query = [INQueryParameter new];
+	query.dateRangeField = @"collected_at";
+	query.dateRangeStart = [INDateTime parseDateFromISOString:@"2011-01-01T00:00:00Z"];
+	STAssertEquals((NSUInteger)3, [[engine resultsForQuery:query] count], @"Results in date range");
+	
+	// date groups, re-sliced from months to weeks
+	query = [INQueryParameter new];
+	query.dateGroupField = @"collected_at";
+	query.dateGroupIncrement = INDateGroupMonth;
+	results = [engine resultsForQuery:query];
+	STAssertEquals((NSUInteger)3, [results count], @"Month groups");
+	IndivoAggregateReport *aggregate = [results objectAtIndex:0];
+	STAssertEqualObjects(@"2010-12", aggregate.group.string, @"First month");
+	STAssertEqualObjects(@"2", aggregate.value.string, @"Count in first month");
+	
+	query.dateGroupIncrement = INDateGroupWeek;
+	results = [engine resultsForQuery:query];
+	STAssertEquals((NSUInteger)4, [results count], @"Week groups");
+	STAssertEqualObjects(@"2010-W52", ((IndivoAggregateReport *)[results objectAtIndex:0]).group.string, @"Last ISO week of 2010");
+	STAssertEqualObjects(@"2011-W01", ((IndivoAggregateReport *)[results objectAtIndex:1]).group.string, @"First ISO week of 2011");
+	
+	// aggregation
+	query = [INQueryParameter new];
+	query.groupBy = @"quantitative_result_value_unit";
+	query.aggregateBy = @"quantitative_result_value_value";
+	query.aggregateOperator = INAggregationOperatorSum;
+	results = [engine resultsForQuery:query];
+	STAssertEquals((NSUInteger)2, [results count], @"Unit groups");
+	STAssertEqualObjects(@"mEq/L", ((IndivoAggregateReport *)[results objectAtIndex:0]).group.string, @"First unit");
+	STAssertEqualObjects(@"245.1", ((IndivoAggregateReport *)[results objectAtIndex:0]).value.string, @"Sum of first unit");
+	STAssertEqualObjects(@"92.9", ((IndivoAggregateReport *)[results objectAtIndex:1]).value.string, @"Sum of second unit");
+	
+	query = [INQueryParameter new];
+	query.aggregateBy = @"quantitative_result_value_value";
+	query.aggregateOperator = INAggregationOperatorAverage;
+	results = [engine resultsForQuery:query];
+	STAssertEquals((NSUInteger)1, [results count], @"Ungrouped aggregate");
+	STAssertEqualObjects(@"67.6", ((IndivoAggregateReport *)[results lastObject]).value.string, @"Average");
+	STAssertNil(((IndivoAggregateReport *)[results lastObject]).group, @"Ungrouped aggregate has no group");
+}
+
+- (void)testTimeSeries
+{
+	INTimeSeriesStore *store = [INTimeSeriesStore new];
+	NSError *error = nil;
+	
+	// vital signs: one value per vital sign
+	STAssertEquals((NSUInteger)9, [store addReportsFromXML:[server readFixture:@"vitals"] error:&error], @"Vital signs: %@", [error localizedDescription]);
+	INTimeSeries *weight = [store seriesForCode:@"3141-9" unit:@"kg"];
+	STAssertNotNil(weight, @"Weight series");
+	STAssertEqualsWithAccuracy(70.8, [weight values][0], 0.0001, @"Weight");
+	STAssertEqualObjects(@"Body weight", weight.title, @"Weight title");
+	
+	// lab results, in reverse date order
+	[store removeAllSeries];
+	NSTimeInterval base = 1262304000.0;			// 2010-01-01
+	NSMutableString *xml = [NSMutableString stringWithString:@"<Models>"];
+	for (NSInteger day = 999; day >= 0; day--) {
+		NSString *date = [INDateTime isoStringFrom:[NSDate dateWithTimeIntervalSince1970:base + day * 86400]];
+		[xml appendFormat:@"<Model name=\"LabResult\"><Field name=\"collected_at\">%@</Field><Field name=\"test_name_identifier\">2951-2</Field>"
+		 @"<Field name=\"quantitative_result_value_value\">%d</Field><Field name=\"quantitative_result_value_unit\">mEq/L</Field></Model>", date, (int)(day % 50 + 100)];
+	}
+	[xml appendString:@"</Models>"];
+	
+	INXMLNode *models = [INXMLParser parseXML:xml error:&error];
+	
+	double columnTime = [self secondsToRun:^{
+		STAssertEquals((NSUInteger)1000, [store addReportsFromNode:models], @"Lab values");
+	}];
+	double objectTime = [self secondsToRun:^{
+		for (INXMLNode *model in [models childrenNamed:@"Model"]) {
+			@autoreleasepool {
+				[[IndivoLabResult alloc] initFromNode:model forRecord:nil];
+			}
+		}
+	}];
+	NSLog(@"1000 lab results: %.4f sec into columns, %.4f sec into objects", columnTime, objectTime);
+	
+	INTimeSeries *sodium = [store seriesForCode:@"2951-2" unit:@"mEq/L"];
+	STAssertEquals((NSUInteger)1000, [sodium count], @"Sodium values");
+	STAssertEqualsWithAccuracy(base, [sodium timestamps][0], 0.001, @"Samples must be sorted by date");
+	STAssertEqualsWithAccuracy(149.0, [sodium values][49], 0.0001, @"Values must move with their timestamps");
+	
+	// kernels
+	NSRange all = NSMakeRange(0, [sodium count]);
+	STAssertEqualsWithAccuracy(100.0, [sodium minimumInRange:all], 0.0001, @"Minimum");
+	STAssertEqualsWithAccuracy(149.0, [sodium maximumInRange:all], 0.0001, @"Maximum");
+	STAssertEqualsWithAccuracy(124.5, [sodium meanInRange:all], 0.0001, @"Mean");
+	
+	NSRange tenDays = [sodium rangeFromDate:[NSDate dateWithTimeIntervalSince1970:base + 100 * 86400] toDate:[NSDate dateWithTimeIntervalSince1970:base + 109 * 86400]];
+	STAssertEquals((NSUInteger)100, tenDays.location, @"Range start");
+	STAssertEquals((NSUInteger)10, tenDays.length, @"Range length");
+	STAssertEqualsWithAccuracy(109.0, [sodium maximumInRange:tenDays], 0.0001, @"Maximum in range");
+	
+	double minimums[10], maximums[10], means[10];
+	STAssertEquals((NSUInteger)10, [sodium downsampleRange:all toBuckets:10 timestamps:NULL minimums:minimums maximums:maximums means:means], @"Buckets");
+	STAssertEqualsWithAccuracy(100.0, minimums[9], 0.0001, @"Bucket minimum");
+	STAssertEqualsWithAccuracy(149.0, maximums[9], 0.0001, @"Bucket maximum");
+	STAssertEqualsWithAccuracy(124.5, means[9], 0.0001, @"Bucket mean");
+}
+
+- (void)testParallelMaterialization
+{
+	NSMutableString *xml = [NSMutableString stringWithString:@"<Models>"];
+	for (NSUInteger i = 0; i < 2000; i++) {
+		[xml appendFormat:@"<Model name=\"LabResult\" documentId=\"lab-%d\"><Field name=\"collected_at\">2011-05-02T17:48:13Z</Field>"
+		 @"<Field name=\"test_name_title\">Serum Sodium</Field><Field name=\"test_name_identifier\">2951-2</Field>"
+		 @"<Field name=\"quantitative_result_value_value\">%d</Field><Field name=\"quantitative_result_value_unit\">mEq/L</Field></Model>", i, i];
+	}
+	[xml appendString:@"</Models>"];
+	NSArray *nodes = [[INXMLParser parseXML:xml error:nil] childrenNamed:@"Model"];
+	
+	NSMutableArray *serial = [NSMutableArray arrayWithCapacity:[nodes count]];
+	double serialTime = [self secondsToRun:^{
+		for (INXMLNode *node in nodes) {
+			[serial addObject:[[IndivoLabResult alloc] initFromNode:node forRecord:nil]];
+		}
+	}];
+	
+	__block NSArray *parallel = nil;
+	double parallelTime = [self secondsToRun:^{
+		parallel = [IndivoLabResult documentsFromNodes:nodes forRecord:nil];
+	}];
+	NSLog(@"2000 lab results materialized: %.4f sec serially, %.4f sec in parallel", serialTime, parallelTime);
+	
+	STAssertEquals([serial count], [parallel count], @"Document count");
+	for (NSUInteger i = 0; i < [parallel count]; i++) {
+		IndivoLabResult *lab = [parallel objectAtIndex:i];
+		STAssertEqualObjects(([NSString stringWithFormat:@"lab-%d", i]), lab.uuid, @"Order must be kept");
+		STAssertEqualObjects(((IndivoLabResult *)[serial objectAtIndex:i]).quantitative_result.value.value, lab.quantitative_result.value.value, @"Values must match");
+	}
+}
+
+- (void)testURLFetcher
+{
+	NSBundle *bundle = [NSBundle bundleForClass:[IndivoMockServer class]];
+	NSMutableArray *urls = [NSMutableArray array];
+	for (NSString *fixture in [NSArray arrayWithObjects:@"demographics", @"medication", @"allergy", @"lab_reports", nil]) {
+		[urls addObject:[NSURL fileURLWithPath:[bundle pathForResource:fixture ofType:@"xml"]]];
+	}
+	[urls insertObject:[NSURL fileURLWithPath:@"/nonexistent/fixture.xml"] atIndex:2];
+	
+	INURLFetcher *fetcher = [INURLFetcher new];
+	fetcher.maxConcurrentLoaders = 2;
+	fetcher.maxConcurrentLoadersPerHost = 2;
+	
+	__block NSMutableIndexSet *reported = [NSMutableIndexSet indexSet];
+	__block BOOL done = NO;
+	__block NSString *batchError = nil;
+	[fetcher getURLs:urls
+			progress:^(INURLLoader *loader, NSUInteger index, NSString *__autoreleasing errorMessage) {
+				STAssertEqualObjects([urls objectAtIndex:index], loader.url, @"Progress must report the URL's index");
+				STAssertFalse([reported containsIndex:index], @"Every URL must be reported once");
+				[reported addIndex:index];
+			}
+			callback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+				STAssertFalse(userDidCancel, @"Nobody cancelled");
+				batchError = errorMessage;
+				done = YES;
+			}];
+	STAssertFalse([fetcher isIdle], @"Fetcher must be busy");
+	
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertTrue(done, @"Fetcher did not finish");
+	STAssertTrue([fetcher isIdle], @"Fetcher must be idle again");
+	STAssertNotNil(batchError, @"The missing file must be reported");
+	STAssertEquals([urls count], [reported count], @"Progress for every URL");
+	STAssertEquals([urls count], [fetcher.loaders count], @"Loader for every URL");
+	for (NSUInteger i = 0; i < [urls count]; i++) {
+		STAssertEqualObjects([urls objectAtIndex:i], [[fetcher.loaders objectAtIndex:i] url], @"Loaders must be in URL order");
+	}
+	STAssertEquals((NSUInteger)4, [fetcher.successfulLoads count], @"Successful loads");
+	STAssertEquals((NSUInteger)1, [fetcher.failedLoads count], @"Failed loads");
+	STAssertEqualObjects([urls objectAtIndex:2], [[fetcher.failedLoads lastObject] url], @"The missing file must fail");
+	STAssertEqualObjects([urls objectAtIndex:3], [[fetcher.successfulLoads objectAtIndex:2] url], @"Successful loads in URL order");
+	
+	// cancelling from the progress block must be reported as a cancel, exactly once
+	__block NSUInteger numCallbacks = 0;
+	__block BOOL didCancel = NO;
+	done = NO;
+	[fetcher getURLs:urls
+			progress:^(INURLLoader *loader, NSUInteger index, NSString *__autoreleasing errorMessage) {
+				[fetcher cancel];
+			}
+			callback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+				didCancel = userDidCancel;
+				numCallbacks++;
+				done = YES;
+			}];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	[[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+	STAssertTrue(didCancel, @"Cancelling in the progress block must call back with userDidCancel");
+	STAssertEquals((NSUInteger)1, numCallbacks, @"The callback must be called once");
+	STAssertTrue([fetcher isIdle], @"Fetcher must be idle after cancelling");
+}
+
+- (void)testDownloadToFile
+{
+	NSString *fixturePath = [[NSBundle bundleForClass:[IndivoMockServer class]] pathForResource:@"lab_reports" ofType:@"xml"];
+	NSString *target = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INURLLoaderTestDownload.xml"];
+	[[NSFileManager defaultManager] removeItemAtPath:target error:nil];
+	
+	INURLLoader *loader = [INURLLoader loaderWithURL:[NSURL fileURLWithPath:fixturePath]];
+	loader.downloadToFile = YES;
+	loader.downloadPath = target;
+	
+	__block BOOL done = NO;
+	[loader getWithCallback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+		STAssertNil(errorMessage, @"Download failed: %@", errorMessage);
+		done = YES;
+	}];
+	[self waitForCondition:^{ return done; } timeout:5.0];
+	STAssertTrue(done, @"Download did not finish");
+	STAssertEqualObjects([NSData dataWithContentsOfFile:fixturePath], loader.responseData, @"Downloaded data must match the fixture");
+	STAssertEqualObjects([NSData dataWithContentsOfFile:target], loader.responseData, @"Data must have been written to the download path");
+	STAssertNil(loader.responseString, @"No string must be decoded when downloading to file");
+	
+	[[NSFileManager defaultManager] removeItemAtPath:target error:nil];
+}
+
+/**
+ *	Parsing while loading must build the tree, an empty body is a success without XML
+ */
+- (void)testParseWhileLoading
+{
+	NSString *fixturePath = [[NSBundle bundleForClass:[IndivoMockServer class]] pathForResource:@"lab_reports" ofType:@"xml"];
+	NSString *emptyPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INURLLoaderTestEmpty.xml"];
+	[[NSData data] writeToFile:emptyPath atomically:NO];
+	
+	for (NSString *path in [NSArray arrayWithObjects:fixturePath, emptyPath, nil]) {
+		INURLLoader *loader = [INURLLoader loaderWithURL:[NSURL fileURLWithPath:path]];
+		loader.parseXMLWhileLoading = YES;
+		
+		__block BOOL done = NO;
+		__block NSString *error = nil;
+		[loader getWithCallback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+			error = errorMessage;
+			done = YES;
+		}];
+		[self waitForCondition:^{ return done; } timeout:5.0];
+		STAssertTrue(done, @"Loading did not finish");
+		STAssertNil(error, @"Loading %@ failed: %@", [path lastPathComponent], error);
+		if (path == fixturePath) {
+			STAssertEquals((NSUInteger)5, [[loader.responseXML childrenNamed:@"Model"] count], @"Parsed while loading");
+		}
+		else {
+			STAssertNil(loader.responseXML, @"An empty body has no XML");
+		}
+	}
+	
+	[[NSFileManager defaultManager] removeItemAtPath:emptyPath error:nil];
+}
+
+/**
+ *	Resuming a partial download with the server answering 206, 200, 416 or an error. We cancel the real connection and play the server's part by
+ *	calling the connection delegate methods ourselves.
+ */
+- (void)testResumeDownload
+{
+	NSString *fixturePath = [[NSBundle bundleForClass:[IndivoMockServer class]] pathForResource:@"lab_reports" ofType:@"xml"];
+	NSData *full = [NSData dataWithContentsOfFile:fixturePath];
+	NSUInteger half = [full length] / 2;
+	NSData *partial = [full subdataWithRange:NSMakeRange(0, half)];
+	NSString *target = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INURLLoaderTestResume.xml"];
+	NSString *validatorPath = [target stringByAppendingString:@".validator"];
+	NSURL *remote = [NSURL URLWithString:@"http://localhost:9/lab_reports.xml"];
+	
+	__block NSString *error = nil;
+	__block BOOL done = NO;
+	INCancelErrorBlock callback = ^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+		error = errorMessage;
+		done = YES;
+	};
+	INURLLoader *(^startLoader)(NSData *, NSString *) = ^(NSData *existing, NSString *validator) {
+		[existing writeToFile:target atomically:NO];
+		[[NSFileManager defaultManager] removeItemAtPath:validatorPath error:nil];
+		[validator writeToFile:validatorPath atomically:NO encoding:NSUTF8StringEncoding error:nil];
+		INURLLoader *loader = [INURLLoader loaderWithURL:remote];
+		loader.downloadToFile = YES;
+		loader.downloadPath = target;
+		loader.resumeDownload = YES;
+		error = nil;
+		done = NO;
+		[loader getWithCallback:callback];
+		[[loader valueForKey:@"currentConnection"] cancel];
+		return loader;
+	};
+	INTestHTTPURLResponse *(^response)(NSInteger, NSDictionary *) = ^(NSInteger status, NSDictionary *headers) {
+		INTestHTTPURLResponse *fake = [[INTestHTTPURLResponse alloc] initWithURL:remote MIMEType:@"application/xml" expectedContentLength:-1 textEncodingName:nil];
+		fake.testStatusCode = status;
+		fake.testHeaderFields = headers;
+		return fake;
+	};
+	NSDictionary *rangeHeaders = [NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"bytes %d-%d/%d", half, [full length] - 1, [full length]] forKey:@"Content-Range"];
+	
+	// 206: only the missing bytes of the version we have are requested and appended
+	INURLLoader *loader = startLoader(partial, @"\"v1\"");
+	NSURLConnection *connection = [loader valueForKey:@"currentConnection"];
+	NSURLRequest *request = [loader valueForKey:@"currentRequest"];
+	STAssertEquals((unsigned long long)half, [[loader valueForKey:@"resumeOffset"] unsignedLongLongValue], @"Must ask for the missing bytes only");
+	STAssertEqualObjects(([NSString stringWithFormat:@"bytes=%d-", half]), [request valueForHTTPHeaderField:@"Range"], @"Range header");
+	STAssertEqualObjects(@"\"v1\"", [request valueForHTTPHeaderField:@"If-Range"], @"Must only resume the version we have");
+	[(id)loader connection:connection didReceiveResponse:response(206, rangeHeaders)];
+	[(id)loader connection:connection didReceiveData:[full subdataWithRange:NSMakeRange(half, [full length] - half)]];
+	[(id)loader connectionDidFinishLoading:connection];
+	STAssertTrue(done, @"206 must finish");
+	STAssertNil(error, @"206 must succeed: %@", error);
+	STAssertEqualObjects(full, loader.responseData, @"Resumed data must be complete");
+	
+	// 206 with bytes that don't start where our file ends: discard what we have and request everything
+	loader = startLoader(partial, @"\"v1\"");
+	connection = [loader valueForKey:@"currentConnection"];
+	NSDictionary *wrongRange = [NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"bytes 0-%d/%d", [full length] - 1, [full length]] forKey:@"Content-Range"];
+	[(id)loader connection:connection didReceiveResponse:response(206, wrongRange)];
+	[[loader valueForKey:@"currentConnection"] cancel];
+	request = [loader valueForKey:@"currentRequest"];
+	STAssertFalse(done, @"A mismatching range must restart, not finish");
+	STAssertNil([request valueForHTTPHeaderField:@"Range"], @"Restart must request everything");
+	STAssertEquals(0ULL, [[loader valueForKey:@"resumeOffset"] unsignedLongLongValue], @"Restart must start at zero");
+	STAssertEquals(0ULL, [[[NSFileManager defaultManager] attributesOfItemAtPath:target error:nil] fileSize], @"Restart must discard the partial file");
+	connection = [loader valueForKey:@"currentConnection"];
+	[(id)loader connection:connection didReceiveResponse:response(200, [NSDictionary dictionaryWithObject:@"\"v2\"" forKey:@"Etag"])];
+	[(id)loader connection:connection didReceiveData:full];
+	[(id)loader connectionDidFinishLoading:connection];
+	STAssertNil(error, @"Restarted download must succeed: %@", error);
+	STAssertEqualObjects(full, loader.responseData, @"Restarted download must not be spliced");
+	STAssertEqualObjects(@"\"v2\"", [NSString stringWithContentsOfFile:validatorPath encoding:NSUTF8StringEncoding error:nil], @"Must remember the new version");
+	
+	// without a validator we can't know whether our bytes are still current, so we don't resume
+	loader = startLoader(partial, nil);
+	STAssertEquals(0ULL, [[loader valueForKey:@"resumeOffset"] unsignedLongLongValue], @"Must not resume without a validator");
+	STAssertNil([[loader valueForKey:@"currentRequest"] valueForHTTPHeaderField:@"Range"], @"Must not send a range without a validator");
+	[loader cancel];
+	
+	// 200: the resource changed or the server ignored the range and sends everything, we must start over
+	loader = startLoader([@"garbage" dataUsingEncoding:NSUTF8StringEncoding], @"\"v1\"");
+	connection = [loader valueForKey:@"currentConnection"];
+	[(id)loader connection:connection didReceiveResponse:response(200, nil)];
+	[(id)loader connection:connection didReceiveData:full];
+	[(id)loader connectionDidFinishLoading:connection];
+	STAssertNil(error, @"200 must succeed: %@", error);
+	STAssertEqualObjects(full, loader.responseData, @"Restarted download must not contain the old bytes");
+	
+	// 416: nothing left to load, the file is complete
+	loader = startLoader(full, @"\"v1\"");
+	connection = [loader valueForKey:@"currentConnection"];
+	[(id)loader connection:connection didReceiveResponse:response(416, nil)];
+	STAssertTrue(done, @"416 must finish right away");
+	STAssertNil(error, @"416 on resume must succeed: %@", error);
+	STAssertEquals((NSUInteger)200, loader.responseStatus, @"Complete file must be reported like a full download");
+	STAssertEqualObjects(full, loader.responseData, @"Complete file must be handed out");
+	
+	// other errors fail and keep the partial file
+	loader = startLoader(partial, @"\"v1\"");
+	connection = [loader valueForKey:@"currentConnection"];
+	[(id)loader connection:connection didReceiveResponse:response(503, nil)];
+	STAssertTrue(done, @"503 must finish right away");
+	STAssertNotNil(error, @"503 on resume must fail");
+	STAssertEqualObjects(partial, [NSData dataWithContentsOfFile:target], @"Partial file must be kept for the next attempt");
+	
+	// default download paths must differ for long URLs that only differ in the middle
+	NSString *longPath = [@"" stringByPaddingToLength:200 withString:@"a" startingAtIndex:0];
+	INURLLoader *first = [INURLLoader loaderWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"http://localhost/%@/records/1/%@", longPath, longPath]]];
+	INURLLoader *second = [INURLLoader loaderWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"http://localhost/%@/records/2/%@", longPath, longPath]]];
+	STAssertFalse([first.downloadPath isEqualToString:second.downloadPath], @"Different URLs must not share a download file");
+	
+	[[NSFileManager defaultManager] removeItemAtPath:target error:nil];
+	[[NSFileManager defaultManager] removeItemAtPath:validatorPath error:nil];
+}
+
+- (void)testLazyResponseString
+{
+	// write a 20 MB response
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"INURLLoaderTestResponse.xml"];
+	NSMutableData *big = [NSMutableData dataWithCapacity:20 * 1024 * 1024];
+	NSData *line = [@"<Field name=\"value\">0123456789 abcdefghijklmnopqrstuvwxyz</Field>\n" dataUsingEncoding:NSUTF8StringEncoding];
+	while ([big length] < 20 * 1024 * 1024) {
+		[big appendData:line];
+	}
+	[big writeToFile:path atomically:NO];
+	NSUInteger bigLength = [big length];
+	big = nil;
+	
+	size_t baseline = INBytesInUse();
+	__block size_t atCompletion = 0;
+	__block BOOL done = NO;
+	INURLLoader *loader = [INURLLoader loaderWithURL:[NSURL fileURLWithPath:path]];
+	[loader getWithCallback:^(BOOL userDidCancel, NSString *__autoreleasing errorMessage) {
+		STAssertNil(errorMessage, @"Loading failed: %@", errorMessage);
+		atCompletion = INBytesInUse();
+		done = YES;
+	}];
+	[self waitForCondition:^{ return done; } timeout:10.0];
+	STAssertTrue(done, @"Loading did not finish");
+	STAssertEquals(bigLength, [loader.responseData length], @"Response length");
+	STAssertNil(object_getIvar(loader, class_getInstanceVariable([INURLLoader class], "responseString")), @"The string must not be decoded at completion");
+	size_t buffer = malloc_size([loader.responseData bytes]);
+	STAssertTrue((double)atCompletion - (double)baseline < (double)(buffer + bigLength / 2), @"Completion must only hold the loading buffer, no copy or string");
+	
+	// what the loader used to hold at completion: a copy of the buffer plus the decoded string
+	size_t beforeEager = INBytesInUse();
+	NSData *eagerCopy = [loader.responseData copy];
+	NSString *eagerString = [[NSString alloc] initWithData:eagerCopy encoding:NSUTF8StringEncoding];
+	size_t eager = INBytesInUse() - beforeEager;
+	STAssertEquals(bigLength, [eagerString length], @"Eager string length");
+	eagerString = nil;
+	eagerCopy = nil;
+	
+	// the string is only decoded now
+	size_t beforeString = INBytesInUse();
+	STAssertEquals(bigLength, [loader.responseString length], @"Lazy string length");
+	size_t lazyString = INBytesInUse() - beforeString;
+	STAssertTrue(lazyString > bigLength / 2, @"Decoding must happen on first access, only %lu bytes allocated", (unsigned long)lazyString);
+	
+	// later accesses hand out the decoded string
+	size_t beforeSecond = INBytesInUse();
+	STAssertTrue(loader.responseString == loader.responseString, @"The string must be decoded once");
+	STAssertTrue((double)INBytesInUse() - (double)beforeSecond < (double)(bigLength / 2), @"Later accesses must not decode again");
+	
+	NSLog(@"20 MB response: %.1f MB held at completion, eager copy and string would add %.1f MB, decoding the string on demand adds %.1f MB",
+		  ((double)atCompletion - (double)baseline) / 1048576.0, eager / 1048576.0, lazyString / 1048576.0);
+	
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
 @end
@@ -13,11 +13,14 @@
  *	Mock Server to replace IndivoServer for unit testing.
  *	When performing a call it parses the request URL and immediately calls the "didFinishSuccessfully:returnObject:" method, supplying data of the respective
  *	call if the request URL was understood by the mock server.
+ *	GET responses carry an ETag derived from the fixture, a GET sending that ETag in "If-None-Match" gets a 304 response.
  */
 @interface IndivoMockServer : IndivoServer
 
 @property (nonatomic, strong) IndivoRecord *mockRecord;
 @property (nonatomic, copy) NSDictionary *mockMappings;				///< Two dimensional, first level is the method (GET, POST, ...), second a mapping path -> fixture.xml
+@property (nonatomic, readonly, assign) NSUInteger notModifiedCount;	///< How many GET calls we answered with a 304
+@property (nonatomic, readonly, assign) NSUInteger pagedCallCount;		///< How many calls asked for a page by supplying a "limit" parameter
 
 - (NSString *)readFixture:(NSString *)fileName;
 
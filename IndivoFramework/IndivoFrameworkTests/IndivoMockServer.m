@@ -11,9 +11,17 @@
 #import "INXMLParser.h"
 
 
+@interface IndivoMockServer ()
+
+@property (nonatomic, readwrite, assign) NSUInteger notModifiedCount;
+@property (nonatomic, readwrite, assign) NSUInteger pagedCallCount;
+
+@end
+
+
 @implementation IndivoMockServer
 
-@synthesize mockRecord, mockMappings;
+@synthesize mockRecord, mockMappings, notModifiedCount, pagedCallCount;
 
 
 - (id)init
@@ -64,10 +72,21 @@
 		@throw e;
 	}
 	
-	/// @todo Also take arguments into consideration
+	/// @todo Also take the remaining arguments into consideration
 	
-	// ok, we know about this path, read the fixture...
+	// ok, we know about this path, read the fixture and cut out the requested page
 	NSString *mockResponse = [self readFixture:fixturePath];
+	mockResponse = [self pageOfFixture:mockResponse withParameters:aCall.parameters];
+	
+	// ...answer GETs with a 304 if the call already has this version...
+	BOOL isGET = [@"GET" isEqualToString:aCall.HTTPMethod];
+	NSString *etag = [NSString stringWithFormat:@"\"%x\"", [mockResponse hash]];
+	if (isGET && [etag isEqualToString:[[aCall conditionalRequestHeaders] objectForKey:@"If-None-Match"]]) {
+		self.notModifiedCount = notModifiedCount + 1;
+		[aCall finishWith:nil statusCode:304 responseHeaders:[NSDictionary dictionaryWithObject:etag forKey:@"ETag"]];
+		return;
+	}
+	
 	NSMutableDictionary *response = [NSMutableDictionary dictionaryWithObject:mockResponse forKey:INResponseStringKey];
 	
 	// ...parse it...
@@ -78,7 +97,12 @@
 	}
 	
 	// ...and hand it to the call
-	[aCall finishWith:response];
+	if (isGET) {
+		[aCall finishWith:response statusCode:200 responseHeaders:[NSDictionary dictionaryWithObject:etag forKey:@"ETag"]];
+	}
+	else {
+		[aCall finishWith:response];
+	}
 }
 
 
@@ -95,5 +119,42 @@
 	return [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:nil];
 }
 
+/**
+ *	If the parameters contain a "limit", returns the XML of the fixture's root node with only those children that fall into the offset/limit window.
+ *	Returns the fixture untouched if there is no limit.
+ */
+- (NSString *)pageOfFixture:(NSString *)fixture withParameters:(NSArray *)parameters
+{
+	NSUInteger offset = 0;
+	NSUInteger limit = 0;
+	for (NSString *param in parameters) {
+		if ([param hasPrefix:@"offset="]) {
+			offset = [[param substringFromIndex:7] integerValue];
+		}
+		else if ([param hasPrefix:@"limit="]) {
+			limit = [[param substringFromIndex:6] integerValue];
+		}
+	}
+	if (limit < 1) {
+		return fixture;
+	}
+	
+	INXMLNode *root = [INXMLParser parseXML:fixture error:nil];
+	if (!root) {
+		return fixture;
+	}
+	self.pagedCallCount = pagedCallCount + 1;
+	
+	INXMLNode *page = [INXMLNode nodeWithName:root.name attributes:root.attributes];
+	NSUInteger i = 0;
+	for (INXMLNode *child in root.children) {
+		if (i >= offset && i < offset + limit) {
+			[page addChild:child];
+		}
+		i++;
+	}
+	return [page xml];
+}
+
 
 @end